@@ -1,50 +1,14 @@
 #include "bf16.h"
-#include <math.h>
+#include "cpu.h"
+#include <immintrin.h>
 #include <stdint.h>
 #include <string.h>
 
 float
 bf16_to_float(bf16_t b)
 {
-    // Extraction of bfloat16 components
-    bf16_t sign = (b >> 15) & 0x1;      // 1 bit for the sign      0000 0001
-    bf16_t exponent = (b >> 7) & 0xFF;  // 8 bits for the exponent 1111 1111
-    bf16_t mantissa = b & 0x7F;         // 7 bits for the mantissa 0111 1111
-
-    // If the exponent is zero, we have a zero or a denormalized number
-    if (exponent == 0)
-    {
-        if (mantissa == 0)
-        {
-            // Zero number (positive or negative)
-            return sign ? -0.0f : 0.0f;
-        }
-        else
-        {
-            // Denormalized number (not handled here for simplicity)
-            return 0.0f;
-        }
-    }
-    else if (exponent == 0x1F)
-    {
-        // Maximal exponent case: infinity or NaN
-        if (mantissa == 0)
-        {
-            return sign ? -INFINITY : INFINITY;
-        }
-        else
-        {
-            return NAN;  // NaN
-        }
-    }
-
-    // Calculate the new exponent for float32
-    uint32_t new_sign = sign << 31;          // Sign on bit 31
-    uint32_t new_exponent = exponent << 23;  // Shifted exponent
-    uint32_t new_mantissa = mantissa << 16;  // Extended mantissa
-
-    // Construct the integer representing the float32
-    uint32_t float_bits = new_sign | new_exponent | new_mantissa;
+    // The bf16 bits are the upper half of the float32 bits
+    uint32_t float_bits = (uint32_t) b << 16;
 
     // Interpret the number as a float
     float result;
@@ -52,3 +16,149 @@ bf16_to_float(bf16_t b)
 
     return result;
 }
+
+bf16_t
+float_to_bf16(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    if ((bits & 0x7FFFFFFF) > 0x7F800000)
+    {
+        // NaN: truncating could clear every mantissa bit left (giving infinity), force it quiet instead
+        return (bf16_t) ((bits >> 16) | 0x0040);
+    }
+
+    // Round to nearest, ties to even: add just under half an ulp, plus one when the kept lsb is odd
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (bf16_t) (bits >> 16);
+}
+
+static void
+bf16_to_f32_scalar(float *dst, const bf16_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        dst[i] = bf16_to_float(src[i]);
+    }
+}
+
+static void
+f32_to_bf16_scalar(bf16_t *dst, const float *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        dst[i] = float_to_bf16(src[i]);
+    }
+}
+
+/* Zero extend 8 bf16 to 32 bits (vpmovzxwd) and shift them into the upper half */
+__attribute__((target("avx2"))) static void
+bf16_to_f32_avx2(float *dst, const bf16_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i lo = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (src + i)));
+        __m256i hi = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (src + i + 8)));
+        _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(lo, 16)));
+        _mm256_storeu_ps(dst + i + 8, _mm256_castsi256_ps(_mm256_slli_epi32(hi, 16)));
+    }
+    bf16_to_f32_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+round_to_bf16_avx2(__m256 v)
+{
+    __m256i bits = _mm256_castps_si256(v);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+    __m256i bias = _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7FFF));
+    __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, bias), 16);
+    __m256i quiet_nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x0040));
+    __m256i is_nan = _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+    return _mm256_blendv_epi8(rounded, quiet_nan, is_nan);
+}
+
+__attribute__((target("avx2"))) static void
+f32_to_bf16_avx2(bf16_t *dst, const float *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i lo = round_to_bf16_avx2(_mm256_loadu_ps(src + i));
+        __m256i hi = round_to_bf16_avx2(_mm256_loadu_ps(src + i + 8));
+        // packus works per 128 bits lane: restore the element order afterwards
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *) (dst + i), packed);
+    }
+    f32_to_bf16_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx512f"))) static void
+bf16_to_f32_avx512(float *dst, const bf16_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) (src + i)));
+        _mm512_storeu_ps(dst + i, _mm512_castsi512_ps(_mm512_slli_epi32(wide, 16)));
+    }
+    bf16_to_f32_scalar(dst + i, src + i, n - i);
+}
+
+/*
+ * Integer rounding rather than AVX512_BF16's vcvtneps2bf16, which flushes denormal inputs to zero and so wouldn't be
+ * bit-exact with float_to_bf16.
+ */
+__attribute__((target("avx512f"))) static void
+f32_to_bf16_avx512(bf16_t *dst, const float *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 v = _mm512_loadu_ps(src + i);
+        __m512i bits = _mm512_castps_si512(v);
+        __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+        __m512i bias = _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7FFF));
+        __m512i rounded = _mm512_srli_epi32(_mm512_add_epi32(bits, bias), 16);
+        __m512i quiet_nan = _mm512_or_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(0x0040));
+        __mmask16 is_nan = _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q);
+        __m512i result = _mm512_mask_blend_epi32(is_nan, rounded, quiet_nan);
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm512_cvtepi32_epi16(result));
+    }
+    f32_to_bf16_scalar(dst + i, src + i, n - i);
+}
+
+void
+bf16_to_f32_n(float *dst, const bf16_t *src, size_t n)
+{
+    switch (cpu_best_isa())
+    {
+    case CPU_ISA_AVX512:
+        bf16_to_f32_avx512(dst, src, n);
+        break;
+    case CPU_ISA_AVX2:
+        bf16_to_f32_avx2(dst, src, n);
+        break;
+    default:
+        bf16_to_f32_scalar(dst, src, n);
+        break;
+    }
+}
+
+void
+f32_to_bf16_n(bf16_t *dst, const float *src, size_t n)
+{
+    switch (cpu_best_isa())
+    {
+    case CPU_ISA_AVX512:
+        f32_to_bf16_avx512(dst, src, n);
+        break;
+    case CPU_ISA_AVX2:
+        f32_to_bf16_avx2(dst, src, n);
+        break;
+    default:
+        f32_to_bf16_scalar(dst, src, n);
+        break;
+    }
+}
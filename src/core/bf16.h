@@ -1,6 +1,7 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef uint16_t bf16_t;
@@ -11,20 +12,23 @@ typedef uint16_t bf16_t;
  * @param b The bfloat16 number to be converted.
  * @return The corresponding float32 number.
  *
- * This function performs the following steps:
- * 1. Extracts the sign, exponent, and mantissa from the bfloat16 number.
- * 2. Handles special cases:
- *    - If the exponent is zero and the mantissa is zero, the result is zero
- * (positive or negative).
- *    - If the exponent is zero and the mantissa is non-zero, the result is
- * treated as zero (denormalized numbers are not handled).
- *    - If the exponent is maximal (0x1F), the result is either infinity (if
- * mantissa is zero) or NaN (if mantissa is non-zero).
- * 3. Adjusts the exponent and mantissa to fit the float32 format.
- * 4. Constructs the float32 number from the adjusted sign, exponent, and
- * mantissa.
- * 5. Returns the resulting float32 number.
+ * bf16 is the upper half of a float32 (same sign bit, same 8 bits exponent, 7 bits mantissa), so the conversion is
+ * exact: the 16 bits are shifted into the upper half of the float. Zeros, denormals, infinities and NaN (payload
+ * included) are all preserved.
  */
 float bf16_to_float(bf16_t b);
 
+/**
+ * Converts a float32 number to bfloat16, rounding to the nearest (ties to even) like PyTorch/safetensors do.
+ * Values too large for bf16 round to infinity, NaN stays a (quiet) NaN.
+ */
+bf16_t float_to_bf16(float f);
+
+/**
+ * Bulk versions of bf16_to_float / float_to_bf16, converting n elements (bit-exact with the single element functions).
+ * They use the widest instruction set allowed by cpu_best_isa(). src and dst must not overlap.
+ */
+void bf16_to_f32_n(float *dst, const bf16_t *src, size_t n);
+void f32_to_bf16_n(bf16_t *dst, const float *src, size_t n);
+
 #endif
@@ -32,6 +32,15 @@
         return NULL;                                                                                                   \
     }
 
+#define HANDLE_NOT_BOOLEAN(value, key)                                                                                 \
+    if (!json_is_boolean(value))                                                                                       \
+    {                                                                                                                  \
+        LOGF_ERROR("%s is not a boolean", key);                                                                        \
+        json_decref(root);                                                                                             \
+        free(config);                                                                                                  \
+        return NULL;                                                                                                   \
+    }
+
 #define HANDLE_NOT_STRING(value, key)                                                                                  \
     if (!json_is_string(value))                                                                                        \
     {                                                                                                                  \
@@ -41,18 +50,45 @@
         return NULL;                                                                                                   \
     }
 
+static Config *Config_from_json(json_t *root);
+
 Config *
 Config_new(const char *file_path)
 {
-    Config *config = (Config *) malloc(sizeof(Config));
-    CHECK_MALLOC_RET_NULL(config, "config");
-
     json_error_t error;
     json_t *root = json_load_file(file_path, 0, &error);
     if (!root)
     {
         LOGF_ERROR("Error while parsing config file: %s", error.text);
-        free(config);
+        return NULL;
+    }
+    return Config_from_json(root);
+}
+
+Config *
+Config_new_from_buffer(const char *buffer, size_t size)
+{
+    json_error_t error;
+    json_t *root = json_loadb(buffer, size, 0, &error);
+    if (!root)
+    {
+        LOGF_ERROR("Error while parsing config: %s", error.text);
+        return NULL;
+    }
+    return Config_from_json(root);
+}
+
+/*
+ * Reads the config from its JSON document, released in any case
+ */
+static Config *
+Config_from_json(json_t *root)
+{
+    Config *config = (Config *) malloc(sizeof(Config));
+    if (config == NULL)
+    {
+        LOG_ERROR("Failed to allocate config");
+        json_decref(root);
         return NULL;
     }
 
@@ -121,6 +157,69 @@ Config_new(const char *file_path)
     config->rope_theta = json_real_value(rope_theta);
     json_decref(rope_theta);
 
+    // Quantization (optional, everything keeps its stored precision by default)
+    config->quantization_dtype = WEIGHTS_F32;
+    config->quantization_group_size = WEIGHTS_Q4_DEFAULT_GROUP_SIZE;
+    config->quantize_attention = 0;
+    config->quantize_mlp = 0;
+    config->quantize_lm_head = 0;
+    json_t *quantization = json_object_get(root, "quantization");
+    if (quantization != NULL)
+    {
+        HANDLE_NOT_OBJECT(quantization, "quantization");
+
+        json_t *quantization_dtype = json_object_get(quantization, "dtype");
+        HANDLE_NOT_STRING(quantization_dtype, "quantization.dtype");
+        const char *dtype = json_string_value(quantization_dtype);
+        if (strcmp(dtype, "q8") == 0)
+        {
+            config->quantization_dtype = WEIGHTS_Q8;
+        }
+        else if (strcmp(dtype, "q4") == 0)
+        {
+            config->quantization_dtype = WEIGHTS_Q4;
+        }
+        else if (strcmp(dtype, "q4_min") == 0)
+        {
+            config->quantization_dtype = WEIGHTS_Q4_MIN;
+        }
+        else
+        {
+            LOGF_ERROR("Unknown quantization dtype: %s", dtype);
+            json_decref(root);
+            free(config);
+            return NULL;
+        }
+
+        json_t *group_size = json_object_get(quantization, "group_size");
+        if (group_size != NULL)
+        {
+            HANDLE_NOT_INT(group_size, "quantization.group_size");
+            config->quantization_group_size = json_integer_value(group_size);
+            if (config->quantization_group_size != 32 && config->quantization_group_size != 64
+                && config->quantization_group_size != 128)
+            {
+                LOGF_ERROR("Unsupported quantization group size: %d (32, 64 or 128)", config->quantization_group_size);
+                json_decref(root);
+                free(config);
+                return NULL;
+            }
+        }
+
+        const char *layers[] = { "attention", "mlp", "lm_head" };
+        int *flags[] = { &config->quantize_attention, &config->quantize_mlp, &config->quantize_lm_head };
+        for (int i = 0; i < 3; i++)
+        {
+            json_t *flag = json_object_get(quantization, layers[i]);
+            if (flag != NULL)
+            {
+                HANDLE_NOT_BOOLEAN(flag, layers[i]);
+                *flags[i] = json_is_true(flag);
+            }
+        }
+    }
+    // End of quantization
+
     json_decref(root);
 
     return config;
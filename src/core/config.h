@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #include "../shared/errors.h"
+#include "weights.h"
 #include <stddef.h>
 
 typedef enum RopeScalingType
@@ -20,10 +21,23 @@ typedef struct config_t
     RopeScalingType rope_scaling_type;
     float rope_theta;
     int head_dim;
+
+    // Optional "quantization" section: weights of the selected layers are converted to quantization_dtype at load
+    // time, the others keep their stored precision
+    WeightsDtype quantization_dtype;
+    int quantization_group_size;  // Q4 only
+    int quantize_attention;
+    int quantize_mlp;
+    int quantize_lm_head;  // The output head is tied to the embeddings table
 } Config;
 
 Config *Config_new(const char *file_path);
 
+/*
+ * Same as Config_new with the JSON content of a config file (e.g. embedded in a packed model)
+ */
+Config *Config_new_from_buffer(const char *buffer, size_t size);
+
 CallmStatusCode Config_free(Config *config);
 
 #endif  // !#ifndef CONFIG_H
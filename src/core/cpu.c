@@ -0,0 +1,163 @@
+#include "cpu.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define CPU_X86 1
+#endif
+
+static CpuFeatures features;
+static pthread_once_t features_once = PTHREAD_ONCE_INIT;
+static int isa_limit = -1;  // accessed atomically, kernels read it from every worker
+
+#ifdef CPU_X86
+static unsigned long long
+read_xcr0(void)
+{
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long) edx << 32) | eax;
+}
+
+static void
+detect_features(CpuFeatures *f)
+{
+    unsigned int eax, ebx, ecx, edx;
+    memset(f, 0, sizeof(CpuFeatures));
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return;
+    }
+    int osxsave = (ecx >> 27) & 1;
+    int avx = (ecx >> 28) & 1;
+    f->fma = (ecx >> 12) & 1;
+    f->f16c = (ecx >> 29) & 1;
+
+    if (!osxsave || !avx)
+    {
+        f->fma = 0;
+        f->f16c = 0;
+        return;
+    }
+
+    unsigned long long xcr0 = read_xcr0();
+    int ymm_state = (xcr0 & 0x6) == 0x6;     // SSE + AVX state
+    int zmm_state = (xcr0 & 0xe6) == 0xe6;  // + opmask, ZMM_Hi256, Hi16_ZMM state
+    if (!ymm_state)
+    {
+        f->fma = 0;
+        f->f16c = 0;
+        return;
+    }
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    {
+        return;
+    }
+    f->avx2 = (ebx >> 5) & 1;
+    if (zmm_state)
+    {
+        f->avx512f = (ebx >> 16) & 1;
+        f->avx512dq = (ebx >> 17) & 1;
+        f->avx512bw = (ebx >> 30) & 1;
+        f->avx512vl = (ebx >> 31) & 1;
+        f->avx512_vnni = (ecx >> 11) & 1;
+    }
+
+    if (__get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx))
+    {
+        f->avx_vnni = (eax >> 4) & 1;
+        f->avx512_bf16 = zmm_state ? (eax >> 5) & 1 : 0;
+    }
+}
+#else
+static void
+detect_features(CpuFeatures *f)
+{
+    memset(f, 0, sizeof(CpuFeatures));
+}
+#endif
+
+static int
+parse_isa_env(void)
+{
+    const char *env = getenv("CALLM_ISA");
+    if (env == NULL)
+    {
+        return -1;
+    }
+    if (strcmp(env, "scalar") == 0)
+    {
+        return CPU_ISA_SCALAR;
+    }
+    if (strcmp(env, "avx2") == 0)
+    {
+        return CPU_ISA_AVX2;
+    }
+    if (strcmp(env, "avx512") == 0)
+    {
+        return CPU_ISA_AVX512;
+    }
+    return -1;
+}
+
+static void
+init_features(void)
+{
+    detect_features(&features);
+    __atomic_store_n(&isa_limit, parse_isa_env(), __ATOMIC_RELEASE);
+}
+
+const CpuFeatures *
+cpu_features(void)
+{
+    // The first call may come from several workers at once
+    pthread_once(&features_once, init_features);
+    return &features;
+}
+
+CpuIsa
+cpu_best_isa(void)
+{
+    const CpuFeatures *f = cpu_features();
+    CpuIsa isa = CPU_ISA_SCALAR;
+    if (f->avx2 && f->fma)
+    {
+        isa = CPU_ISA_AVX2;
+        if (f->avx512f && f->avx512bw && f->avx512dq && f->avx512vl)
+        {
+            isa = CPU_ISA_AVX512;
+        }
+    }
+    int limit = __atomic_load_n(&isa_limit, __ATOMIC_ACQUIRE);
+    if (limit >= 0 && (int) isa > limit)
+    {
+        isa = (CpuIsa) limit;
+    }
+    return isa;
+}
+
+void
+cpu_limit_isa(CpuIsa isa)
+{
+    // After the detection, so that the environment can't override the limit later
+    cpu_features();
+    __atomic_store_n(&isa_limit, (int) isa, __ATOMIC_RELEASE);
+}
+
+const char *
+cpu_isa_name(CpuIsa isa)
+{
+    switch (isa)
+    {
+    case CPU_ISA_AVX512:
+        return "avx512";
+    case CPU_ISA_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef CALLM_CPU_H
+#define CALLM_CPU_H
+
+/*
+ * Instruction set levels the numerical kernels are specialised for, ordered from the most portable to the widest.
+ * Each level implies the previous ones.
+ */
+typedef enum
+{
+    CPU_ISA_SCALAR = 0,
+    CPU_ISA_AVX2 = 1,   // AVX2 + FMA
+    CPU_ISA_AVX512 = 2  // AVX-512 F/BW/DQ/VL
+} CpuIsa;
+
+typedef struct
+{
+    int avx2;
+    int fma;
+    int f16c;
+    int avx512f;
+    int avx512bw;
+    int avx512dq;
+    int avx512vl;
+    int avx512_vnni;
+    int avx512_bf16;
+    int avx_vnni;
+} CpuFeatures;
+
+/*
+ * Returns the features of the running CPU, detected once with CPUID/XGETBV (so features the OS doesn't save on
+ * context switch are reported as missing).
+ */
+const CpuFeatures *cpu_features(void);
+
+/*
+ * Returns the widest instruction set level the kernels may use: the best level supported by the CPU, capped by
+ * cpu_limit_isa() or by the CALLM_ISA environment variable ("scalar", "avx2" or "avx512").
+ */
+CpuIsa cpu_best_isa(void);
+
+/*
+ * Caps the instruction set level returned by cpu_best_isa(). Mainly useful to exercise every kernel in tests.
+ */
+void cpu_limit_isa(CpuIsa isa);
+
+const char *cpu_isa_name(CpuIsa isa);
+
+#endif  // CALLM_CPU_H
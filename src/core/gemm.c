@@ -0,0 +1,539 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "gemm.h"
+#include "../shared/logging.h"
+#include "bf16.h"
+#include "cpu.h"
+#include "memory/arena.h"
+#include "threadpool.h"
+#include <immintrin.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Cache blocking parameters, shared by all the micro-kernels:
+ * - a KC x NR panel of B plus a MR x KC panel of A stay in L1,
+ * - a MC x KC block of A stays in L2,
+ * - a KC x NC block of B stays in L3.
+ * MC and NC are multiples of every MR and NR below.
+ */
+#define GEMM_KC 256
+#define GEMM_MC 192
+#define GEMM_NC 4096
+
+/* Products smaller than this (in multiply-adds) are computed on the calling thread only */
+#define GEMM_MIN_PARALLEL_WORK (1 << 20)
+/* Number of packed panels per task when packing in parallel */
+#define GEMM_PACK_GRAIN 4
+
+#define GEMM_MAX_MR 8
+#define GEMM_MAX_NR 32
+
+typedef void (*gemm_kernel_t)(int kc, const float *a, const float *b, float *c, int ldc, int accumulate);
+
+typedef struct
+{
+    int mr;
+    int nr;
+    gemm_kernel_t kernel;
+} GemmKernel;
+
+/*
+ * Packs rows [0, mc) x columns [0, kc) of A into panels of mr rows. Inside a panel, the mr values of a given column
+ * are contiguous. Missing rows of the last panel are zero-padded.
+ */
+static void
+pack_a(int mc, int kc, const float *A, int lda, int mr, float *Ap)
+{
+    for (int i0 = 0; i0 < mc; i0 += mr)
+    {
+        int rows = mc - i0 < mr ? mc - i0 : mr;
+        for (int p = 0; p < kc; p++)
+        {
+            int i = 0;
+            for (; i < rows; i++)
+            {
+                Ap[i] = A[(i0 + i) * lda + p];
+            }
+            for (; i < mr; i++)
+            {
+                Ap[i] = 0.0f;
+            }
+            Ap += mr;
+        }
+    }
+}
+
+/* B is a float matrix, or a bf16_t one for the mixed precision products */
+typedef void (*gemm_pack_b_t)(const void *B, int ldb, int pc, int jc, int kc, int nc, int nr, float *Bp);
+
+/*
+ * Packs rows [pc, pc + kc) x columns [jc, jc + nc) of a k x n matrix B into panels of nr columns. Inside a panel, the
+ * nr values of a given row are contiguous. Missing columns of the last panel are zero-padded.
+ */
+static void
+pack_b_n(const void *B_ptr, int ldb, int pc, int jc, int kc, int nc, int nr, float *Bp)
+{
+    const float *B = (const float *) B_ptr;
+    for (int j0 = 0; j0 < nc; j0 += nr)
+    {
+        int cols = nc - j0 < nr ? nc - j0 : nr;
+        for (int p = 0; p < kc; p++)
+        {
+            const float *src = B + (size_t) (pc + p) * ldb + jc + j0;
+            memcpy(Bp, src, cols * sizeof(float));
+            if (cols < nr)
+            {
+                memset(Bp + cols, 0, (nr - cols) * sizeof(float));
+            }
+            Bp += nr;
+        }
+    }
+}
+
+/*
+ * Same panel layout as pack_b_n, but reads B from its n x k transposed storage (the [out, in] layout of linear layer
+ * weights): the transposition happens while packing, so the micro-kernels are unchanged.
+ */
+static void
+pack_b_t(const void *B_ptr, int ldb, int pc, int jc, int kc, int nc, int nr, float *Bp)
+{
+    const float *B = (const float *) B_ptr;
+    for (int j0 = 0; j0 < nc; j0 += nr)
+    {
+        int cols = nc - j0 < nr ? nc - j0 : nr;
+        const float *src = B + (size_t) (jc + j0) * ldb + pc;
+        for (int p = 0; p < kc; p++)
+        {
+            int j = 0;
+            for (; j < cols; j++)
+            {
+                Bp[j] = src[(size_t) j * ldb + p];
+            }
+            for (; j < nr; j++)
+            {
+                Bp[j] = 0.0f;
+            }
+            Bp += nr;
+        }
+    }
+}
+
+/*
+ * pack_b_t for bf16 weights: each value is widened to f32 while being packed. The conversion is paid once per KC x NC
+ * block and amortised over all the rows of A, the micro-kernels keep running on f32 panels with f32 accumulation.
+ */
+static void
+pack_b_t_bf16(const void *B_ptr, int ldb, int pc, int jc, int kc, int nc, int nr, float *Bp)
+{
+    const bf16_t *B = (const bf16_t *) B_ptr;
+    for (int j0 = 0; j0 < nc; j0 += nr)
+    {
+        int cols = nc - j0 < nr ? nc - j0 : nr;
+        const bf16_t *src = B + (size_t) (jc + j0) * ldb + pc;
+        for (int p = 0; p < kc; p++)
+        {
+            int j = 0;
+            for (; j < cols; j++)
+            {
+                Bp[j] = bf16_to_float(src[(size_t) j * ldb + p]);
+            }
+            for (; j < nr; j++)
+            {
+                Bp[j] = 0.0f;
+            }
+            Bp += nr;
+        }
+    }
+}
+
+/* B of gemm_nt_widen: rows in a custom format, widened by a callback */
+typedef struct
+{
+    const void *B;
+    gemm_widen_row_t widen;
+} GemmWidenB;
+
+/*
+ * pack_b_t for weights in any other format (e.g. quantised): each row strip [pc, pc + kc) is widened to f32 in a small
+ * buffer, then scattered into the panel. Like the bf16 packing, the cost is amortised over all the rows of A.
+ */
+static void
+pack_b_t_widen(const void *B_ptr, int ldb, int pc, int jc, int kc, int nc, int nr, float *Bp)
+{
+    (void) ldb;
+    const GemmWidenB *B = (const GemmWidenB *) B_ptr;
+    float strip[GEMM_KC];
+    for (int j0 = 0; j0 < nc; j0 += nr)
+    {
+        int cols = nc - j0 < nr ? nc - j0 : nr;
+        for (int j = 0; j < nr; j++)
+        {
+            if (j < cols)
+            {
+                B->widen(B->B, jc + j0 + j, pc, kc, strip);
+            }
+            for (int p = 0; p < kc; p++)
+            {
+                Bp[(size_t) p * nr + j] = j < cols ? strip[p] : 0.0f;
+            }
+        }
+        Bp += (size_t) kc * nr;
+    }
+}
+
+static void
+kernel_4x8_scalar(int kc, const float *a, const float *b, float *c, int ldc, int accumulate)
+{
+    float acc[4][8] = { { 0 } };
+    for (int p = 0; p < kc; p++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 8; j++)
+            {
+                acc[i][j] += a[i] * b[j];
+            }
+        }
+        a += 4;
+        b += 8;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            c[i * ldc + j] = accumulate ? c[i * ldc + j] + acc[i][j] : acc[i][j];
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define AVX2_ROW_FMA(i)                                                                                                \
+    a_i = _mm256_broadcast_ss(a + i);                                                                                  \
+    c##i##0 = _mm256_fmadd_ps(a_i, b0, c##i##0);                                                                       \
+    c##i##1 = _mm256_fmadd_ps(a_i, b1, c##i##1);
+
+#define AVX2_ROW_STORE(i)                                                                                              \
+    if (accumulate)                                                                                                    \
+    {                                                                                                                  \
+        c##i##0 = _mm256_add_ps(c##i##0, _mm256_loadu_ps(c + i * ldc));                                                \
+        c##i##1 = _mm256_add_ps(c##i##1, _mm256_loadu_ps(c + i * ldc + 8));                                            \
+    }                                                                                                                  \
+    _mm256_storeu_ps(c + i * ldc, c##i##0);                                                                            \
+    _mm256_storeu_ps(c + i * ldc + 8, c##i##1);
+
+__attribute__((target("avx2,fma"))) static void
+kernel_6x16_avx2(int kc, const float *a, const float *b, float *c, int ldc, int accumulate)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    __m256 a_i;
+
+    for (int p = 0; p < kc; p++)
+    {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        AVX2_ROW_FMA(0)
+        AVX2_ROW_FMA(1)
+        AVX2_ROW_FMA(2)
+        AVX2_ROW_FMA(3)
+        AVX2_ROW_FMA(4)
+        AVX2_ROW_FMA(5)
+        a += 6;
+        b += 16;
+    }
+
+    AVX2_ROW_STORE(0)
+    AVX2_ROW_STORE(1)
+    AVX2_ROW_STORE(2)
+    AVX2_ROW_STORE(3)
+    AVX2_ROW_STORE(4)
+    AVX2_ROW_STORE(5)
+}
+
+#define AVX512_ROW_FMA(i)                                                                                              \
+    a_i = _mm512_set1_ps(a[i]);                                                                                        \
+    c##i##0 = _mm512_fmadd_ps(a_i, b0, c##i##0);                                                                       \
+    c##i##1 = _mm512_fmadd_ps(a_i, b1, c##i##1);
+
+#define AVX512_ROW_STORE(i)                                                                                            \
+    if (accumulate)                                                                                                    \
+    {                                                                                                                  \
+        c##i##0 = _mm512_add_ps(c##i##0, _mm512_loadu_ps(c + i * ldc));                                                \
+        c##i##1 = _mm512_add_ps(c##i##1, _mm512_loadu_ps(c + i * ldc + 16));                                           \
+    }                                                                                                                  \
+    _mm512_storeu_ps(c + i * ldc, c##i##0);                                                                            \
+    _mm512_storeu_ps(c + i * ldc + 16, c##i##1);
+
+__attribute__((target("avx512f"))) static void
+kernel_8x32_avx512(int kc, const float *a, const float *b, float *c, int ldc, int accumulate)
+{
+    __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps();
+    __m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+    __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps();
+    __m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+    __m512 c40 = _mm512_setzero_ps(), c41 = _mm512_setzero_ps();
+    __m512 c50 = _mm512_setzero_ps(), c51 = _mm512_setzero_ps();
+    __m512 c60 = _mm512_setzero_ps(), c61 = _mm512_setzero_ps();
+    __m512 c70 = _mm512_setzero_ps(), c71 = _mm512_setzero_ps();
+    __m512 a_i;
+
+    for (int p = 0; p < kc; p++)
+    {
+        __m512 b0 = _mm512_load_ps(b);
+        __m512 b1 = _mm512_load_ps(b + 16);
+        AVX512_ROW_FMA(0)
+        AVX512_ROW_FMA(1)
+        AVX512_ROW_FMA(2)
+        AVX512_ROW_FMA(3)
+        AVX512_ROW_FMA(4)
+        AVX512_ROW_FMA(5)
+        AVX512_ROW_FMA(6)
+        AVX512_ROW_FMA(7)
+        a += 8;
+        b += 32;
+    }
+
+    AVX512_ROW_STORE(0)
+    AVX512_ROW_STORE(1)
+    AVX512_ROW_STORE(2)
+    AVX512_ROW_STORE(3)
+    AVX512_ROW_STORE(4)
+    AVX512_ROW_STORE(5)
+    AVX512_ROW_STORE(6)
+    AVX512_ROW_STORE(7)
+}
+
+#endif
+
+static const GemmKernel *
+select_kernel(void)
+{
+    static const GemmKernel scalar = { 4, 8, kernel_4x8_scalar };
+#if defined(__x86_64__) || defined(__i386__)
+    static const GemmKernel avx2 = { 6, 16, kernel_6x16_avx2 };
+    static const GemmKernel avx512 = { 8, 32, kernel_8x32_avx512 };
+
+    switch (cpu_best_isa())
+    {
+    case CPU_ISA_AVX512:
+        return &avx512;
+    case CPU_ISA_AVX2:
+        return &avx2;
+    default:
+        break;
+    }
+#endif
+    return &scalar;
+}
+
+/*
+ * Runs the micro-kernel on a (possibly partial) mr_eff x nr_eff tile. Partial tiles are computed into a full size
+ * scratch tile (the packed panels are zero-padded) and only the valid part is written back.
+ */
+static void
+run_tile(const GemmKernel *kr, int kc, const float *ap, const float *bp, float *c, int ldc, int mr_eff, int nr_eff,
+         int accumulate)
+{
+    if (mr_eff == kr->mr && nr_eff == kr->nr)
+    {
+        kr->kernel(kc, ap, bp, c, ldc, accumulate);
+        return;
+    }
+
+    float tile[GEMM_MAX_MR * GEMM_MAX_NR];
+    kr->kernel(kc, ap, bp, tile, kr->nr, 0);
+    for (int i = 0; i < mr_eff; i++)
+    {
+        for (int j = 0; j < nr_eff; j++)
+        {
+            c[i * ldc + j] = accumulate ? c[i * ldc + j] + tile[i * kr->nr + j] : tile[i * kr->nr + j];
+        }
+    }
+}
+
+/*
+ * State shared by the threads working on one KC x NC block of B (one iteration of the jc/pc loops)
+ */
+typedef struct
+{
+    const GemmKernel *kr;
+    int m;
+    int kc;
+    int nc;
+    int pc;
+    int jc;
+    int accumulate;
+    int nb_panels;  // panels of nr columns in the block of B
+    const float *A;
+    int lda;
+    const void *B;
+    int ldb;
+    gemm_pack_b_t pack_b;
+    float *C;
+    int ldc;
+    float *Ap;
+    float *Bp;
+} GemmBlock;
+
+/* Packs the panels [start, end) of the current block of B */
+static void
+pack_b_range(void *arg, int start, int end)
+{
+    GemmBlock *blk = (GemmBlock *) arg;
+    int nr = blk->kr->nr;
+    int j0 = start * nr;
+    int j1 = end * nr < blk->nc ? end * nr : blk->nc;
+    blk->pack_b(blk->B, blk->ldb, blk->pc, blk->jc + j0, blk->kc, j1 - j0, nr, blk->Bp + (size_t) j0 * blk->kc);
+}
+
+/* Packs the panels of mr rows [start, end) of the current KC columns of A */
+static void
+pack_a_range(void *arg, int start, int end)
+{
+    GemmBlock *blk = (GemmBlock *) arg;
+    int mr = blk->kr->mr;
+    int i0 = start * mr;
+    int i1 = end * mr < blk->m ? end * mr : blk->m;
+    pack_a(i1 - i0, blk->kc, blk->A + (size_t) i0 * blk->lda + blk->pc, blk->lda, mr, blk->Ap + (size_t) i0 * blk->kc);
+}
+
+/*
+ * Computes the (MC block of rows, panel of B) pairs [start, end), numbered row block major: consecutive pairs reuse
+ * the same MC x KC block of A from L2, as in the serial ic/jr loop order.
+ */
+static void
+compute_range(void *arg, int start, int end)
+{
+    GemmBlock *blk = (GemmBlock *) arg;
+    const GemmKernel *kr = blk->kr;
+    for (int idx = start; idx < end; idx++)
+    {
+        int ic = (idx / blk->nb_panels) * GEMM_MC;
+        int jr = (idx % blk->nb_panels) * kr->nr;
+        int mc = blk->m - ic < GEMM_MC ? blk->m - ic : GEMM_MC;
+        int nr_eff = blk->nc - jr < kr->nr ? blk->nc - jr : kr->nr;
+        for (int ir = 0; ir < mc; ir += kr->mr)
+        {
+            int mr_eff = mc - ir < kr->mr ? mc - ir : kr->mr;
+            float *c = blk->C + (size_t) (ic + ir) * blk->ldc + blk->jc + jr;
+            run_tile(kr, blk->kc, blk->Ap + (size_t) (ic + ir) * blk->kc, blk->Bp + (size_t) jr * blk->kc, c, blk->ldc,
+                     mr_eff, nr_eff, blk->accumulate);
+        }
+    }
+}
+
+static void
+gemm_for(int parallel, int n, int grain, parallel_for_fn_t fn, void *arg)
+{
+    if (parallel)
+    {
+        parallel_for(n, grain, fn, arg);
+    }
+    else
+    {
+        fn(arg, 0, n);
+    }
+}
+
+static void
+gemm_driver(int m, int n, int k, const float *A, int lda, const void *B, int ldb, gemm_pack_b_t pack_b, float *C,
+            int ldc, int accumulate)
+{
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+    if (k <= 0)
+    {
+        if (!accumulate)
+        {
+            for (int i = 0; i < m; i++)
+            {
+                memset(C + (size_t) i * ldc, 0, n * sizeof(float));
+            }
+        }
+        return;
+    }
+
+    const GemmKernel *kr = select_kernel();
+    int mr = kr->mr;
+    int nr = kr->nr;
+
+    // A is packed as a whole for each KC slice so that all the threads share it: the MC blocking only drives the order
+    // in which tiles are computed
+    int kc_max = k < GEMM_KC ? k : GEMM_KC;
+    int m_padded = ((m + mr - 1) / mr) * mr;
+    int nc_max = n < GEMM_NC ? ((n + nr - 1) / nr) * nr : GEMM_NC;
+    int parallel = (size_t) m * n * k >= GEMM_MIN_PARALLEL_WORK;
+
+    // Packing buffers come from the arena of the calling thread, released on return: once it has grown to the
+    // largest product, GEMMs no longer touch the heap
+    Arena *arena = Arena_thread_local();
+    ArenaMark mark = arena != NULL ? Arena_mark(arena) : (ArenaMark) { 0, 0, 0 };
+    float *Ap = arena != NULL ? Arena_alloc(arena, (size_t) m_padded * kc_max * sizeof(float)) : NULL;
+    float *Bp = arena != NULL ? Arena_alloc(arena, (size_t) kc_max * nc_max * sizeof(float)) : NULL;
+    if (Ap == NULL || Bp == NULL)
+    {
+        LOG_ERROR("Failed to allocate GEMM packing buffers");
+        if (arena != NULL)
+        {
+            Arena_release(arena, mark);
+        }
+        return;
+    }
+
+    GemmBlock blk = { .kr = kr, .m = m, .A = A, .lda = lda, .B = B, .ldb = ldb, .pack_b = pack_b, .C = C, .ldc = ldc,
+                      .Ap = Ap, .Bp = Bp };
+    int nb_row_blocks = (m + GEMM_MC - 1) / GEMM_MC;
+
+    for (int jc = 0; jc < n; jc += GEMM_NC)
+    {
+        blk.jc = jc;
+        blk.nc = n - jc < GEMM_NC ? n - jc : GEMM_NC;
+        blk.nb_panels = (blk.nc + nr - 1) / nr;
+        for (int pc = 0; pc < k; pc += GEMM_KC)
+        {
+            blk.pc = pc;
+            blk.kc = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+            blk.accumulate = accumulate || pc > 0;
+
+            gemm_for(parallel, blk.nb_panels, GEMM_PACK_GRAIN, pack_b_range, &blk);
+            gemm_for(parallel, m_padded / mr, GEMM_PACK_GRAIN, pack_a_range, &blk);
+            gemm_for(parallel, nb_row_blocks * blk.nb_panels, 1, compute_range, &blk);
+        }
+    }
+
+    Arena_release(arena, mark);
+}
+
+void
+gemm_f32(int m, int n, int k, const float *A, int lda, const float *B, int ldb, float *C, int ldc, int accumulate)
+{
+    gemm_driver(m, n, k, A, lda, B, ldb, pack_b_n, C, ldc, accumulate);
+}
+
+void
+gemm_f32_nt(int m, int n, int k, const float *A, int lda, const float *B, int ldb, float *C, int ldc, int accumulate)
+{
+    gemm_driver(m, n, k, A, lda, B, ldb, pack_b_t, C, ldc, accumulate);
+}
+
+void
+gemm_bf16_nt(int m, int n, int k, const float *A, int lda, const bf16_t *B, int ldb, float *C, int ldc, int accumulate)
+{
+    gemm_driver(m, n, k, A, lda, B, ldb, pack_b_t_bf16, C, ldc, accumulate);
+}
+
+void
+gemm_nt_widen(int m, int n, int k, const float *A, int lda, const void *B, gemm_widen_row_t widen, float *C, int ldc,
+              int accumulate)
+{
+    GemmWidenB widen_b = { B, widen };
+    gemm_driver(m, n, k, A, lda, &widen_b, 0, pack_b_t_widen, C, ldc, accumulate);
+}
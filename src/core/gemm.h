@@ -0,0 +1,51 @@
+#ifndef CALLM_GEMM_H
+#define CALLM_GEMM_H
+
+#include "bf16.h"
+
+/*
+ * Single precision general matrix multiplication on row-major buffers.
+ *
+ * The implementation follows the usual Goto/BLIS scheme: B is packed by blocks of KC x NC (L3) into panels of NR
+ * columns, A by blocks of MC x KC (L2) into panels of MR rows, and a register-tiled MR x NR micro-kernel streams both
+ * panels from L1. The micro-kernel (AVX-512, AVX2/FMA or scalar) is picked at runtime from cpu_best_isa().
+ * Packing and the (MC block, NR panel) tiles of large products are spread over the default thread pool.
+ *
+ * lda, ldb and ldc are the row strides (in elements) of the respective buffers.
+ */
+
+/*
+ * C = A . B (or C += A . B when accumulate is non zero)
+ * A is m x k, B is k x n and C is m x n.
+ */
+void gemm_f32(int m, int n, int k, const float *A, int lda, const float *B, int ldb, float *C, int ldc,
+              int accumulate);
+
+/*
+ * C = A . B^T (or C += A . B^T when accumulate is non zero)
+ * A is m x k, B is n x k (e.g. a [out, in] weight matrix as stored in safetensors) and C is m x n.
+ * B is transposed on the fly while being packed, it's never copied as a whole.
+ */
+void gemm_f32_nt(int m, int n, int k, const float *A, int lda, const float *B, int ldb, float *C, int ldc,
+                 int accumulate);
+
+/*
+ * Same as gemm_f32_nt with bf16 weights B (ldb in bf16 elements): B is widened to f32 while being packed and the
+ * products are accumulated in f32.
+ */
+void gemm_bf16_nt(int m, int n, int k, const float *A, int lda, const bf16_t *B, int ldb, float *C, int ldc,
+                  int accumulate);
+
+/*
+ * Widens the values [pc, pc + kc) of row j of a matrix stored in a custom format (kc <= 256) into dst
+ */
+typedef void (*gemm_widen_row_t)(const void *B, int j, int pc, int kc, float *dst);
+
+/*
+ * Same as gemm_f32_nt with B n x k in any format widen understands (e.g. quantised weights): strips of B rows are
+ * widened to f32 while being packed.
+ */
+void gemm_nt_widen(int m, int n, int k, const float *A, int lda, const void *B, gemm_widen_row_t widen, float *C, int ldc,
+                   int accumulate);
+
+#endif  // CALLM_GEMM_H
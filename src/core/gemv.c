@@ -0,0 +1,493 @@
+#include "gemv.h"
+#include "bf16.h"
+#include "cpu.h"
+#include "threadpool.h"
+#include <immintrin.h>
+#include <stddef.h>
+
+/*
+ * Minimal number of multiply-adds a thread must get before a product is split: below this, waking a worker costs
+ * more than it saves.
+ */
+#define GEMV_MIN_WORK_PER_THREAD (256 * 1024)
+/* Output ranges handed to threads are multiples of this, so no two threads write the same cache line of y */
+#define GEMV_RANGE_ALIGNMENT 16
+
+typedef struct gemv_args_t GemvArgs;
+
+typedef void (*gemv_range_t)(const GemvArgs *args, int start, int end);
+
+struct gemv_args_t
+{
+    int n;
+    int k;
+    const void *M;  // float, or bf16_t for the bf16 kernels
+    int ld;
+    const float *x;
+    float *y;
+    int accumulate;
+    gemv_range_t range_fn;
+};
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* y = W . x kernels, computing the output rows [start, end)                                                        */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+static void
+gemv_t_scalar(const GemvArgs *args, int start, int end)
+{
+    int k = args->k;
+    for (int i = start; i < end; i++)
+    {
+        const float *w = (const float *) args->M + (size_t) i * args->ld;
+        const float *x = args->x;
+        float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        int p = 0;
+        for (; p + 4 <= k; p += 4)
+        {
+            s0 += w[p] * x[p];
+            s1 += w[p + 1] * x[p + 1];
+            s2 += w[p + 2] * x[p + 2];
+            s3 += w[p + 3] * x[p + 3];
+        }
+        for (; p < k; p++)
+        {
+            s0 += w[p] * x[p];
+        }
+        float sum = (s0 + s1) + (s2 + s3);
+        args->y[i] = args->accumulate ? args->y[i] + sum : sum;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2,fma"))) static inline float
+hsum_avx2(__m256 v)
+{
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+    return _mm_cvtss_f32(lo);
+}
+
+/*
+ * Four rows are processed together (four independent dot products, each with two accumulators to hide the FMA
+ * latency) while the same columns of the next four rows are prefetched, so the next group starts with warm lines.
+ */
+__attribute__((target("avx2,fma"))) static void
+gemv_t_avx2(const GemvArgs *args, int start, int end)
+{
+    int k = args->k;
+    size_t ld = args->ld;
+    const float *x = args->x;
+    int i = start;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        const float *w0 = (const float *) args->M + i * ld;
+        const float *w1 = w0 + ld;
+        const float *w2 = w1 + ld;
+        const float *w3 = w2 + ld;
+        const float *next = i + 8 <= end ? w0 + 4 * ld : w0;
+
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        __m256 b0 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps(), b2 = _mm256_setzero_ps(), b3 = _mm256_setzero_ps();
+        int p = 0;
+        for (; p + 16 <= k; p += 16)
+        {
+            _mm_prefetch((const char *) (next + p), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + ld + p), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + 2 * ld + p), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + 3 * ld + p), _MM_HINT_T0);
+
+            __m256 x0 = _mm256_loadu_ps(x + p);
+            __m256 x1 = _mm256_loadu_ps(x + p + 8);
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(w0 + p), x0, a0);
+            a1 = _mm256_fmadd_ps(_mm256_loadu_ps(w1 + p), x0, a1);
+            a2 = _mm256_fmadd_ps(_mm256_loadu_ps(w2 + p), x0, a2);
+            a3 = _mm256_fmadd_ps(_mm256_loadu_ps(w3 + p), x0, a3);
+            b0 = _mm256_fmadd_ps(_mm256_loadu_ps(w0 + p + 8), x1, b0);
+            b1 = _mm256_fmadd_ps(_mm256_loadu_ps(w1 + p + 8), x1, b1);
+            b2 = _mm256_fmadd_ps(_mm256_loadu_ps(w2 + p + 8), x1, b2);
+            b3 = _mm256_fmadd_ps(_mm256_loadu_ps(w3 + p + 8), x1, b3);
+        }
+        float s[4] = { hsum_avx2(_mm256_add_ps(a0, b0)), hsum_avx2(_mm256_add_ps(a1, b1)),
+                       hsum_avx2(_mm256_add_ps(a2, b2)), hsum_avx2(_mm256_add_ps(a3, b3)) };
+        for (; p < k; p++)
+        {
+            s[0] += w0[p] * x[p];
+            s[1] += w1[p] * x[p];
+            s[2] += w2[p] * x[p];
+            s[3] += w3[p] * x[p];
+        }
+        for (int r = 0; r < 4; r++)
+        {
+            args->y[i + r] = args->accumulate ? args->y[i + r] + s[r] : s[r];
+        }
+    }
+
+    if (i < end)
+    {
+        gemv_t_scalar(args, i, end);
+    }
+}
+
+__attribute__((target("avx512f"))) static void
+gemv_t_avx512(const GemvArgs *args, int start, int end)
+{
+    int k = args->k;
+    size_t ld = args->ld;
+    const float *x = args->x;
+    int i = start;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        const float *w0 = (const float *) args->M + i * ld;
+        const float *w1 = w0 + ld;
+        const float *w2 = w1 + ld;
+        const float *w3 = w2 + ld;
+        const float *next = i + 8 <= end ? w0 + 4 * ld : w0;
+
+        __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps(), a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+        __m512 b0 = _mm512_setzero_ps(), b1 = _mm512_setzero_ps(), b2 = _mm512_setzero_ps(), b3 = _mm512_setzero_ps();
+        int p = 0;
+        for (; p + 32 <= k; p += 32)
+        {
+            _mm_prefetch((const char *) (next + p), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + p + 16), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + ld + p), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + ld + p + 16), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + 2 * ld + p), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + 2 * ld + p + 16), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + 3 * ld + p), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + 3 * ld + p + 16), _MM_HINT_T0);
+
+            __m512 x0 = _mm512_loadu_ps(x + p);
+            __m512 x1 = _mm512_loadu_ps(x + p + 16);
+            a0 = _mm512_fmadd_ps(_mm512_loadu_ps(w0 + p), x0, a0);
+            a1 = _mm512_fmadd_ps(_mm512_loadu_ps(w1 + p), x0, a1);
+            a2 = _mm512_fmadd_ps(_mm512_loadu_ps(w2 + p), x0, a2);
+            a3 = _mm512_fmadd_ps(_mm512_loadu_ps(w3 + p), x0, a3);
+            b0 = _mm512_fmadd_ps(_mm512_loadu_ps(w0 + p + 16), x1, b0);
+            b1 = _mm512_fmadd_ps(_mm512_loadu_ps(w1 + p + 16), x1, b1);
+            b2 = _mm512_fmadd_ps(_mm512_loadu_ps(w2 + p + 16), x1, b2);
+            b3 = _mm512_fmadd_ps(_mm512_loadu_ps(w3 + p + 16), x1, b3);
+        }
+        if (p < k)
+        {
+            // At most two masked steps for the remaining (< 32) columns
+            for (; p < k; p += 16)
+            {
+                __mmask16 mask = k - p >= 16 ? (__mmask16) 0xFFFF : (__mmask16) ((1u << (k - p)) - 1);
+                __m512 x0 = _mm512_maskz_loadu_ps(mask, x + p);
+                a0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, w0 + p), x0, a0);
+                a1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, w1 + p), x0, a1);
+                a2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, w2 + p), x0, a2);
+                a3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, w3 + p), x0, a3);
+            }
+        }
+        float s[4] = { _mm512_reduce_add_ps(_mm512_add_ps(a0, b0)), _mm512_reduce_add_ps(_mm512_add_ps(a1, b1)),
+                       _mm512_reduce_add_ps(_mm512_add_ps(a2, b2)), _mm512_reduce_add_ps(_mm512_add_ps(a3, b3)) };
+        for (int r = 0; r < 4; r++)
+        {
+            args->y[i + r] = args->accumulate ? args->y[i + r] + s[r] : s[r];
+        }
+    }
+
+    if (i < end)
+    {
+        gemv_t_scalar(args, i, end);
+    }
+}
+
+#endif
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* y = W . x kernels with bf16 weights: same structure, the weights are widened to f32 in registers                 */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+static void
+gemv_t_bf16_scalar(const GemvArgs *args, int start, int end)
+{
+    int k = args->k;
+    for (int i = start; i < end; i++)
+    {
+        const bf16_t *w = (const bf16_t *) args->M + (size_t) i * args->ld;
+        const float *x = args->x;
+        float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        int p = 0;
+        for (; p + 4 <= k; p += 4)
+        {
+            s0 += bf16_to_float(w[p]) * x[p];
+            s1 += bf16_to_float(w[p + 1]) * x[p + 1];
+            s2 += bf16_to_float(w[p + 2]) * x[p + 2];
+            s3 += bf16_to_float(w[p + 3]) * x[p + 3];
+        }
+        for (; p < k; p++)
+        {
+            s0 += bf16_to_float(w[p]) * x[p];
+        }
+        float sum = (s0 + s1) + (s2 + s3);
+        args->y[i] = args->accumulate ? args->y[i] + sum : sum;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* 8 bf16 widened to f32: zero extend to 32 bits and shift into the upper half */
+__attribute__((target("avx2,fma"))) static inline __m256
+load_bf16_avx2(const bf16_t *p)
+{
+    __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+}
+
+__attribute__((target("avx2,fma"))) static void
+gemv_t_bf16_avx2(const GemvArgs *args, int start, int end)
+{
+    int k = args->k;
+    size_t ld = args->ld;
+    const float *x = args->x;
+    int i = start;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        const bf16_t *w0 = (const bf16_t *) args->M + i * ld;
+        const bf16_t *w1 = w0 + ld;
+        const bf16_t *w2 = w1 + ld;
+        const bf16_t *w3 = w2 + ld;
+        const bf16_t *next = i + 8 <= end ? w0 + 4 * ld : w0;
+
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        __m256 b0 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps(), b2 = _mm256_setzero_ps(), b3 = _mm256_setzero_ps();
+        int p = 0;
+        for (; p + 16 <= k; p += 16)
+        {
+            // 16 bf16 = half a cache line per row
+            if (p % 32 == 0)
+            {
+                _mm_prefetch((const char *) (next + p), _MM_HINT_T0);
+                _mm_prefetch((const char *) (next + ld + p), _MM_HINT_T0);
+                _mm_prefetch((const char *) (next + 2 * ld + p), _MM_HINT_T0);
+                _mm_prefetch((const char *) (next + 3 * ld + p), _MM_HINT_T0);
+            }
+
+            __m256 x0 = _mm256_loadu_ps(x + p);
+            __m256 x1 = _mm256_loadu_ps(x + p + 8);
+            a0 = _mm256_fmadd_ps(load_bf16_avx2(w0 + p), x0, a0);
+            a1 = _mm256_fmadd_ps(load_bf16_avx2(w1 + p), x0, a1);
+            a2 = _mm256_fmadd_ps(load_bf16_avx2(w2 + p), x0, a2);
+            a3 = _mm256_fmadd_ps(load_bf16_avx2(w3 + p), x0, a3);
+            b0 = _mm256_fmadd_ps(load_bf16_avx2(w0 + p + 8), x1, b0);
+            b1 = _mm256_fmadd_ps(load_bf16_avx2(w1 + p + 8), x1, b1);
+            b2 = _mm256_fmadd_ps(load_bf16_avx2(w2 + p + 8), x1, b2);
+            b3 = _mm256_fmadd_ps(load_bf16_avx2(w3 + p + 8), x1, b3);
+        }
+        float s[4] = { hsum_avx2(_mm256_add_ps(a0, b0)), hsum_avx2(_mm256_add_ps(a1, b1)),
+                       hsum_avx2(_mm256_add_ps(a2, b2)), hsum_avx2(_mm256_add_ps(a3, b3)) };
+        for (; p < k; p++)
+        {
+            s[0] += bf16_to_float(w0[p]) * x[p];
+            s[1] += bf16_to_float(w1[p]) * x[p];
+            s[2] += bf16_to_float(w2[p]) * x[p];
+            s[3] += bf16_to_float(w3[p]) * x[p];
+        }
+        for (int r = 0; r < 4; r++)
+        {
+            args->y[i + r] = args->accumulate ? args->y[i + r] + s[r] : s[r];
+        }
+    }
+
+    if (i < end)
+    {
+        gemv_t_bf16_scalar(args, i, end);
+    }
+}
+
+__attribute__((target("avx512f"))) static inline __m512
+load_bf16_avx512(const bf16_t *p)
+{
+    __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) p));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(wide, 16));
+}
+
+__attribute__((target("avx512f"))) static void
+gemv_t_bf16_avx512(const GemvArgs *args, int start, int end)
+{
+    int k = args->k;
+    size_t ld = args->ld;
+    const float *x = args->x;
+    int i = start;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        const bf16_t *w0 = (const bf16_t *) args->M + i * ld;
+        const bf16_t *w1 = w0 + ld;
+        const bf16_t *w2 = w1 + ld;
+        const bf16_t *w3 = w2 + ld;
+        const bf16_t *next = i + 8 <= end ? w0 + 4 * ld : w0;
+
+        __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps(), a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+        __m512 b0 = _mm512_setzero_ps(), b1 = _mm512_setzero_ps(), b2 = _mm512_setzero_ps(), b3 = _mm512_setzero_ps();
+        int p = 0;
+        for (; p + 32 <= k; p += 32)
+        {
+            // 32 bf16 = one cache line per row
+            _mm_prefetch((const char *) (next + p), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + ld + p), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + 2 * ld + p), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + 3 * ld + p), _MM_HINT_T0);
+
+            __m512 x0 = _mm512_loadu_ps(x + p);
+            __m512 x1 = _mm512_loadu_ps(x + p + 16);
+            a0 = _mm512_fmadd_ps(load_bf16_avx512(w0 + p), x0, a0);
+            a1 = _mm512_fmadd_ps(load_bf16_avx512(w1 + p), x0, a1);
+            a2 = _mm512_fmadd_ps(load_bf16_avx512(w2 + p), x0, a2);
+            a3 = _mm512_fmadd_ps(load_bf16_avx512(w3 + p), x0, a3);
+            b0 = _mm512_fmadd_ps(load_bf16_avx512(w0 + p + 16), x1, b0);
+            b1 = _mm512_fmadd_ps(load_bf16_avx512(w1 + p + 16), x1, b1);
+            b2 = _mm512_fmadd_ps(load_bf16_avx512(w2 + p + 16), x1, b2);
+            b3 = _mm512_fmadd_ps(load_bf16_avx512(w3 + p + 16), x1, b3);
+        }
+        float s[4] = { _mm512_reduce_add_ps(_mm512_add_ps(a0, b0)), _mm512_reduce_add_ps(_mm512_add_ps(a1, b1)),
+                       _mm512_reduce_add_ps(_mm512_add_ps(a2, b2)), _mm512_reduce_add_ps(_mm512_add_ps(a3, b3)) };
+        for (; p < k; p++)
+        {
+            s[0] += bf16_to_float(w0[p]) * x[p];
+            s[1] += bf16_to_float(w1[p]) * x[p];
+            s[2] += bf16_to_float(w2[p]) * x[p];
+            s[3] += bf16_to_float(w3[p]) * x[p];
+        }
+        for (int r = 0; r < 4; r++)
+        {
+            args->y[i + r] = args->accumulate ? args->y[i + r] + s[r] : s[r];
+        }
+    }
+
+    if (i < end)
+    {
+        gemv_t_bf16_scalar(args, i, end);
+    }
+}
+
+#endif
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* y = x . B kernel, computing the output columns [start, end)                                                      */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+/*
+ * Row by row axpy over the output range: the loops are trivially vectorised by the compiler and y[start, end) stays in
+ * L1 while B rows are streamed.
+ */
+static void
+gemv_n_range(const GemvArgs *args, int start, int end)
+{
+    float *y = args->y;
+    if (!args->accumulate)
+    {
+        for (int j = start; j < end; j++)
+        {
+            y[j] = 0.0f;
+        }
+    }
+    for (int p = 0; p < args->k; p++)
+    {
+        const float *b = (const float *) args->M + (size_t) p * args->ld;
+        float xp = args->x[p];
+        for (int j = start; j < end; j++)
+        {
+            y[j] += xp * b[j];
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* Work splitting                                                                                                   */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+static void
+gemv_range(void *arg, int start, int end)
+{
+    const GemvArgs *args = (const GemvArgs *) arg;
+    args->range_fn(args, start, end);
+}
+
+static void
+gemv_run(const GemvArgs *args)
+{
+    // Smallest block of outputs worth a thread, rounded to whole cache lines of y
+    int k = args->k > 0 ? args->k : 1;
+    int grain = (GEMV_MIN_WORK_PER_THREAD + k - 1) / k;
+    grain = (grain + GEMV_RANGE_ALIGNMENT - 1) / GEMV_RANGE_ALIGNMENT * GEMV_RANGE_ALIGNMENT;
+    parallel_for(args->n, grain, gemv_range, (void *) args);
+}
+
+static gemv_range_t
+select_gemv_t(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    switch (cpu_best_isa())
+    {
+    case CPU_ISA_AVX512:
+        return gemv_t_avx512;
+    case CPU_ISA_AVX2:
+        return gemv_t_avx2;
+    default:
+        break;
+    }
+#endif
+    return gemv_t_scalar;
+}
+
+static gemv_range_t
+select_gemv_t_bf16(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    switch (cpu_best_isa())
+    {
+    case CPU_ISA_AVX512:
+        return gemv_t_bf16_avx512;
+    case CPU_ISA_AVX2:
+        return gemv_t_bf16_avx2;
+    default:
+        break;
+    }
+#endif
+    return gemv_t_bf16_scalar;
+}
+
+void
+gemv_f32_t(int n, int k, const float *W, int ldw, const float *x, float *y, int accumulate)
+{
+    if (n <= 0)
+    {
+        return;
+    }
+    GemvArgs args = { n, k, W, ldw, x, y, accumulate, select_gemv_t() };
+    gemv_run(&args);
+}
+
+void
+gemv_f32_n(int n, int k, const float *B, int ldb, const float *x, float *y, int accumulate)
+{
+    if (n <= 0)
+    {
+        return;
+    }
+    GemvArgs args = { n, k, B, ldb, x, y, accumulate, gemv_n_range };
+    gemv_run(&args);
+}
+
+void
+gemv_bf16_t(int n, int k, const bf16_t *W, int ldw, const float *x, float *y, int accumulate)
+{
+    if (n <= 0)
+    {
+        return;
+    }
+    GemvArgs args = { n, k, W, ldw, x, y, accumulate, select_gemv_t_bf16() };
+    gemv_run(&args);
+}
@@ -0,0 +1,30 @@
+#ifndef CALLM_GEMV_H
+#define CALLM_GEMV_H
+
+#include "bf16.h"
+
+/*
+ * Single precision matrix-vector products, used instead of the blocked GEMM when the left operand has a single row
+ * (one token while decoding). They are bound by the weight bandwidth: each weight is read exactly once, streamed row by
+ * row, and large products are split by blocks of output elements across the thread pool.
+ */
+
+/*
+ * y = W . x (or y += W . x when accumulate is non zero)
+ * W is n x k with a row stride of ldw elements (the [out, in] weight layout), x has k elements and y has n elements.
+ */
+void gemv_f32_t(int n, int k, const float *W, int ldw, const float *x, float *y, int accumulate);
+
+/*
+ * Same as gemv_f32_t with bf16 weights (ldw in bf16 elements): the weights are widened to f32 in registers and the
+ * products accumulated in f32, so only half the bytes are streamed.
+ */
+void gemv_bf16_t(int n, int k, const bf16_t *W, int ldw, const float *x, float *y, int accumulate);
+
+/*
+ * y = x . B (or y += x . B when accumulate is non zero)
+ * B is k x n with a row stride of ldb elements, x has k elements and y has n elements.
+ */
+void gemv_f32_n(int n, int k, const float *B, int ldb, const float *x, float *y, int accumulate);
+
+#endif  // CALLM_GEMV_H
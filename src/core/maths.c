@@ -1,4 +1,5 @@
 #include "maths.h"
+#include "vecops.h"
 #include <math.h>
 
 float
@@ -10,34 +11,33 @@ square(float x)
 float
 mean(const float *x, int n)
 {
-    float sum = 0;
-    for (int i = 0; i < n; i++)
-    {
-        sum += x[i];
-    }
-    return sum / n;
+    return vec_sum(x, n) / n;
 }
 
 void
 softmax(float *x, int n)
 {
-    float max = 0;
-    for (int i = 0; i < n; i++)
+    softmax_masked(x, n, n, 1.0f);
+}
+
+void
+softmax_masked(float *x, int n, int nb_valid, float scale)
+{
+    // Subtracting the max keeps every exponent <= 0: no overflow, and at least one term equal to 1 in the sum
+    float max = vec_max(x, nb_valid);
+    if (max == -INFINITY)
     {
-        if (x[i] > max)
-        {
-            max = x[i];
-        }
+        // Nothing to attend to (only masked entries): all weights are 0
+        nb_valid = 0;
     }
-    float sum = 0;
-    for (int i = 0; i < n; i++)
+    else
     {
-        x[i] = exp(x[i] - max);
-        sum += x[i];
+        float sum = vec_exp_sum(x, x, scale, -scale * max, nb_valid);
+        vec_scale(x, x, 1.0f / sum, nb_valid);
     }
-    for (int i = 0; i < n; i++)
+    for (int i = nb_valid; i < n; i++)
     {
-        x[i] /= sum;
+        x[i] = 0.0f;
     }
 }
 
@@ -47,6 +47,12 @@ relu(float x)
     return x > 0 ? x : 0;
 }
 
+float
+silu(float x)
+{
+    return x / (1.0f + expf(-x));
+}
+
 float
 Q_rsqrt(float number)
 {
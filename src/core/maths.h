@@ -5,10 +5,23 @@ float square(float x);
 
 float mean(const float *x, int n);
 
+/*
+ * In place softmax of x. A row without any finite entry (e.g. fully masked with -INFINITY) gives 0 everywhere
+ * instead of NaN.
+ */
 void softmax(float *x, int n);
 
+/*
+ * In place softmax of scale * x[0, nb_valid), the masked entries x[nb_valid, n) being set to 0 without being read
+ * (e.g. a causal attention row: token i attends to the nb_valid = i + 1 first tokens, scale = 1 / sqrt(head_dim)).
+ * scale must be positive.
+ */
+void softmax_masked(float *x, int n, int nb_valid, float scale);
+
 float relu(float x);
 
+float silu(float x);
+
 float Q_rsqrt(float number);
 
 #endif  // !#ifndef MATHS_H
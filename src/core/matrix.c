@@ -1,31 +1,140 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include "matrix.h"
 #include "../shared/logging.h"
-#include <immintrin.h>
+#include "gemm.h"
+#include "gemv.h"
+#include "threadpool.h"
+#include "vecops.h"
 #include <jansson.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define BLOCK_SIZE 16
+static Matrix *
+matrix_alloc(int r, int c, int stride)
+{
+    Matrix *M = malloc(sizeof(Matrix));
+    RETURN_WHEN_NULL(M, "Failed to allocate matrix");
+    M->r = r;
+    M->c = c;
+    M->size = (size_t) r * c;
+    M->stride = stride;
+    M->owns_data = 1;
+    M->in_arena = 0;
+
+    // At least one line so that empty matrices still get a valid buffer
+    size_t nb_bytes = (size_t) (r > 0 ? r : 1) * (stride > 0 ? stride : 1) * sizeof(float);
+    void *data = NULL;
+    if (posix_memalign(&data, MATRIX_ALIGNMENT, nb_bytes) != 0)
+    {
+        LOGF_ERROR("Failed to allocate %zu bytes of matrix data", nb_bytes);
+        free(M);
+        return NULL;
+    }
+    M->data = (float *) data;
+    return M;
+}
 
 Matrix *
 Matrix_new(int r, int c)
+{
+    return matrix_alloc(r, c, c);
+}
+
+Matrix *
+Matrix_new_in(Arena *arena, int r, int c)
+{
+    if (arena == NULL)
+    {
+        return Matrix_new(r, c);
+    }
+    Matrix *M = Arena_alloc(arena, sizeof(Matrix));
+    float *data = Arena_alloc(arena, (size_t) (r > 0 ? r : 1) * (c > 0 ? c : 1) * sizeof(float));
+    if (M == NULL || data == NULL)
+    {
+        LOGF_ERROR("Failed to allocate a (%d, %d) matrix from the arena", r, c);
+        return NULL;
+    }
+    M->r = r;
+    M->c = c;
+    M->size = (size_t) r * c;
+    M->stride = c;
+    M->data = data;
+    M->owns_data = 0;
+    M->in_arena = 1;
+    return M;
+}
+
+Matrix *
+Matrix_new_padded(int r, int c)
+{
+    int stride = (c + MATRIX_PADDING - 1) / MATRIX_PADDING * MATRIX_PADDING;
+    Matrix *M = matrix_alloc(r, c, stride);
+    RETURN_WHEN_NULL(M, "Failed to allocate padded matrix");
+    memset(M->data, 0, (size_t) r * stride * sizeof(float));
+    return M;
+}
+
+Matrix *
+Matrix_wrap(int r, int c, float *data)
 {
     Matrix *M = malloc(sizeof(Matrix));
+    RETURN_WHEN_NULL(M, "Failed to allocate matrix");
     M->r = r;
     M->c = c;
-    M->size = r * c;
-    M->data = (float *) malloc(r * c * sizeof(float));
+    M->size = (size_t) r * c;
+    M->stride = c;
+    M->data = data;
+    M->owns_data = 0;
+    M->in_arena = 0;
     return M;
 }
 
+Matrix *
+Matrix_submatrix(const Matrix *M, int row, int col, int r, int c)
+{
+    if (row < 0 || col < 0 || r < 0 || c < 0 || row + r > M->r || col + c > M->c)
+    {
+        LOGF_ERROR("Sub-matrix (%d, %d) of shape (%d, %d) out of bounds of a (%d, %d) matrix", row, col, r, c, M->r,
+                   M->c);
+        return NULL;
+    }
+    Matrix *sub = malloc(sizeof(Matrix));
+    RETURN_WHEN_NULL(sub, "Failed to allocate sub-matrix");
+    sub->r = r;
+    sub->c = c;
+    sub->size = (size_t) r * c;
+    sub->stride = M->stride;
+    sub->data = Matrix_row(M, row) + col;
+    sub->owns_data = 0;
+    sub->in_arena = 0;
+    return sub;
+}
+
+int
+Matrix_overlaps(const Matrix *A, const Matrix *B)
+{
+    if (A->r == 0 || A->c == 0 || B->r == 0 || B->c == 0)
+    {
+        return 0;
+    }
+    const float *a_end = Matrix_row(A, A->r - 1) + A->c;
+    const float *b_end = Matrix_row(B, B->r - 1) + B->c;
+    return A->data < b_end && B->data < a_end;
+}
+
 CallmStatusCode
 Matrix_free(Matrix *M)
 {
-    if (M == NULL)
+    if (M == NULL || M->in_arena)
     {
         return OK;
     }
-    free(M->data);
+    if (M->owns_data)
+    {
+        free(M->data);
+    }
     free(M);
     return OK;
 }
@@ -37,7 +146,7 @@ Matrix_set(Matrix *M, int row, int col, float value)
     {
         return ERROR;
     }
-    M->data[row * M->c + col] = value;
+    Matrix_row(M, row)[col] = value;
     return OK;
 }
 
@@ -53,7 +162,7 @@ Matrix_get(const Matrix *M, int row, int col, CallmStatusCode *status)
     {
         *status = OK;
     }
-    return M->data[row * M->c + col];
+    return Matrix_row(M, row)[col];
 }
 
 CallmStatusCode
@@ -61,10 +170,7 @@ Matrix_fill(Matrix *M, float *data)
 {
     for (int i = 0; i < M->r; i++)
     {
-        for (int j = 0; j < M->c; j++)
-        {
-            M->data[i * M->c + j] = data[i * M->c + j];
-        }
+        memcpy(Matrix_row(M, i), data + (size_t) i * M->c, M->c * sizeof(float));
     }
     return OK;
 }
@@ -90,33 +196,319 @@ Matrix_arange(int start, int end, int step, int axis)
 
     for (int i = 0; i < nb; i++)
     {
-        M->data[i] = start + i * step;
+        if (axis == MAT_APPLY_ROW)
+        {
+            M->data[i] = start + i * step;
+        }
+        else
+        {
+            Matrix_row(M, i)[0] = start + i * step;
+        }
     }
     return M;
 }
 
+/*
+ * Checks the destination of an *_into operation has the expected shape
+ */
+static CallmStatusCode
+check_dst_shape(const Matrix *dst, int r, int c, const char *op_name)
+{
+    if (dst == NULL || dst->data == NULL)
+    {
+        LOGF_ERROR("%s: destination matrix is NULL", op_name);
+        return ERROR;
+    }
+    if (dst->r != r || dst->c != c)
+    {
+        LOGF_ERROR("%s: invalid destination shape: expected (%d, %d), got (%d, %d)", op_name, r, c, dst->r, dst->c);
+        return ERROR;
+    }
+    return OK;
+}
+
+/*
+ * Allocates the result of an operation, runs the *_into implementation and releases the result on failure
+ */
+#define NEW_RESULT_FROM_INTO(r, c, into_call)                                                                          \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        Matrix *dst = Matrix_new(r, c);                                                                                \
+        RETURN_WHEN_NULL(dst, "Failed to allocate result matrix");                                                     \
+        if (into_call != OK)                                                                                           \
+        {                                                                                                              \
+            Matrix_free(dst);                                                                                          \
+            return NULL;                                                                                               \
+        }                                                                                                              \
+        return dst;                                                                                                    \
+    } while (0)
+
+/*
+ * Element-wise and per-row operations are split over the thread pool in ranges of at least this many elements
+ */
+#define MATRIX_PARALLEL_GRAIN (16 * 1024)
+
+typedef struct matrix_op_args_t MatrixOpArgs;
+
+/*
+ * Element-wise kernel over len consecutive elements of a row. a and b point to the same elements of the operands
+ * (NULL for missing operands).
+ */
+typedef void (*elementwise_segment_t)(const MatrixOpArgs *op, float *dst, const float *a, const float *b, int len);
+
+struct matrix_op_args_t
+{
+    Matrix *dst;
+    const Matrix *A;
+    const Matrix *B;
+    float scalar;
+    mat_apply_t apply;
+    mat_apply_arg_t apply_arg;
+    void *arg;
+    mat_apply_along_t apply_along;
+    mat_reduce_along_t reduce_along;
+    elementwise_segment_t segment;
+};
+
+/*
+ * Number of rows of M making up MATRIX_PARALLEL_GRAIN elements
+ */
+static int
+row_grain(const Matrix *M)
+{
+    int grain = MATRIX_PARALLEL_GRAIN / (M->c > 0 ? M->c : 1);
+    return grain > 0 ? grain : 1;
+}
+
+/*
+ * Runs op->segment on the elements [start, end) of dst, in row-major order, cut at row boundaries so that every
+ * operand's stride is honored.
+ */
+static void
+elementwise_range(void *arg, int start, int end)
+{
+    MatrixOpArgs *op = (MatrixOpArgs *) arg;
+    int c = op->dst->c;
+    for (int i = start; i < end;)
+    {
+        int row = i / c;
+        int col = i % c;
+        int len = c - col < end - i ? c - col : end - i;
+        const float *a = op->A != NULL ? Matrix_row(op->A, row) + col : NULL;
+        const float *b = op->B != NULL ? Matrix_row(op->B, row) + col : NULL;
+        op->segment(op, Matrix_row(op->dst, row) + col, a, b, len);
+        i += len;
+    }
+}
+
+static void
+run_elementwise(MatrixOpArgs *op, elementwise_segment_t segment)
+{
+    op->segment = segment;
+    parallel_for(op->dst->r * op->dst->c, MATRIX_PARALLEL_GRAIN, elementwise_range, op);
+}
+
+static void
+multiply_segment(const MatrixOpArgs *op, float *dst, const float *a, const float *b, int len)
+{
+    vec_mul(dst, a, b, len);
+}
+
+static void
+add_segment(const MatrixOpArgs *op, float *dst, const float *a, const float *b, int len)
+{
+    vec_add(dst, a, b, len);
+}
+
+static void
+multiply_scalar_segment(const MatrixOpArgs *op, float *dst, const float *a, const float *b, int len)
+{
+    vec_scale(dst, a, op->scalar, len);
+}
+
+static void
+add_scalar_segment(const MatrixOpArgs *op, float *dst, const float *a, const float *b, int len)
+{
+    vec_add_scalar(dst, a, op->scalar, len);
+}
+
+static void
+silu_segment(const MatrixOpArgs *op, float *dst, const float *a, const float *b, int len)
+{
+    vec_silu(dst, a, len);
+}
+
+static void
+exp_segment(const MatrixOpArgs *op, float *dst, const float *a, const float *b, int len)
+{
+    vec_exp(dst, a, len);
+}
+
+static void
+silu_multiply_segment(const MatrixOpArgs *op, float *dst, const float *a, const float *b, int len)
+{
+    vec_silu_mul(dst, a, b, len);
+}
+
+static void
+apply_each_segment(const MatrixOpArgs *op, float *dst, const float *a, const float *b, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        dst[i] = op->apply(dst[i]);
+    }
+}
+
+static void
+apply_each_arg_segment(const MatrixOpArgs *op, float *dst, const float *a, const float *b, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        dst[i] = op->apply_arg(dst[i], op->arg);
+    }
+}
+
+/* Rows [start, end) of B scaled column-wise by the row vector A */
+static void
+broadcast_col_range(void *arg, int start, int end)
+{
+    MatrixOpArgs *op = (MatrixOpArgs *) arg;
+    int c = op->B->c;
+    for (int i = start; i < end; i++)
+    {
+        vec_mul(Matrix_row(op->dst, i), op->A->data, Matrix_row(op->B, i), c);
+    }
+}
+
+/* Rows [start, end) of B scaled row-wise by the column vector A */
+static void
+broadcast_row_range(void *arg, int start, int end)
+{
+    MatrixOpArgs *op = (MatrixOpArgs *) arg;
+    int c = op->B->c;
+    for (int i = start; i < end; i++)
+    {
+        vec_scale(Matrix_row(op->dst, i), Matrix_row(op->B, i), Matrix_row(op->A, i)[0], c);
+    }
+}
+
+static void
+apply_along_rows_range(void *arg, int start, int end)
+{
+    MatrixOpArgs *op = (MatrixOpArgs *) arg;
+    for (int i = start; i < end; i++)
+    {
+        op->apply_along(Matrix_row(op->dst, i), op->dst->c);
+    }
+}
+
+static void
+reduce_along_rows_range(void *arg, int start, int end)
+{
+    MatrixOpArgs *op = (MatrixOpArgs *) arg;
+    for (int i = start; i < end; i++)
+    {
+        Matrix_row(op->dst, i)[0] = op->reduce_along(Matrix_row(op->A, i), op->A->c);
+    }
+}
+
+CallmStatusCode
+Matrix_dot_into(Matrix *dst, const Matrix *A, const Matrix *B)
+{
+    if (A->c != B->r)
+    {
+        LOG_ERROR("Matrix dimensions do not match");
+        return ERROR;
+    }
+    if (check_dst_shape(dst, A->r, B->c, "Matrix_dot_into") != OK)
+    {
+        return ERROR;
+    }
+    if (Matrix_overlaps(dst, A) || Matrix_overlaps(dst, B))
+    {
+        LOG_ERROR("Matrix_dot_into: destination must not overlap an operand");
+        return ERROR;
+    }
+
+    if (A->r == 1)
+    {
+        gemv_f32_n(B->c, A->c, B->data, B->stride, A->data, dst->data, 0);
+    }
+    else
+    {
+        gemm_f32(A->r, B->c, A->c, A->data, A->stride, B->data, B->stride, dst->data, dst->stride, 0);
+    }
+    return OK;
+}
+
 Matrix *
 Matrix_dot(const Matrix *A, const Matrix *B)
 {
-    Matrix *C = Matrix_new(A->r, B->c);
     if (A->c != B->r)
     {
         LOG_ERROR("Matrix dimensions do not match");
         return NULL;
     }
+    NEW_RESULT_FROM_INTO(A->r, B->c, Matrix_dot_into(dst, A, B));
+}
 
-    for (int a_row = 0; a_row < A->r; a_row++)
+CallmStatusCode
+Matrix_dot_transposed_into(Matrix *dst, const Matrix *A, const Matrix *B)
+{
+    if (A->c != B->c)
     {
-        for (int b_col = 0; b_col < B->c; b_col++)
-        {
-            C->data[a_row * C->c + b_col] = 0;
-            for (int k = 0; k < A->c; k++)
-            {
-                C->data[a_row * C->c + b_col] += A->data[a_row * A->c + k] * B->data[k * B->c + b_col];
-            }
-        }
+        LOG_ERROR("Matrix dimensions do not match");
+        return ERROR;
+    }
+    if (check_dst_shape(dst, A->r, B->r, "Matrix_dot_transposed_into") != OK)
+    {
+        return ERROR;
+    }
+    if (Matrix_overlaps(dst, A) || Matrix_overlaps(dst, B))
+    {
+        LOG_ERROR("Matrix_dot_transposed_into: destination must not overlap an operand");
+        return ERROR;
+    }
+
+    if (A->r == 1)
+    {
+        // Single token (decoding): the product is bound by the weights bandwidth, not by the FLOPs
+        gemv_f32_t(B->r, A->c, B->data, B->stride, A->data, dst->data, 0);
+    }
+    else
+    {
+        gemm_f32_nt(A->r, B->r, A->c, A->data, A->stride, B->data, B->stride, dst->data, dst->stride, 0);
+    }
+    return OK;
+}
+
+Matrix *
+Matrix_dot_transposed(const Matrix *A, const Matrix *B)
+{
+    if (A->c != B->c)
+    {
+        LOG_ERROR("Matrix dimensions do not match");
+        return NULL;
+    }
+    NEW_RESULT_FROM_INTO(A->r, B->r, Matrix_dot_transposed_into(dst, A, B));
+}
+
+CallmStatusCode
+Matrix_multiply_into(Matrix *dst, const Matrix *A, const Matrix *B)
+{
+    if ((A->r != B->r) || (A->c != B->c))
+    {
+        LOG_ERROR("Matrix dimensions do not match");
+        return ERROR;
+    }
+    if (check_dst_shape(dst, A->r, A->c, "Matrix_multiply_into") != OK)
+    {
+        return ERROR;
     }
-    return C;
+
+    MatrixOpArgs op = { .dst = dst, .A = A, .B = B };
+    run_elementwise(&op, multiply_segment);
+    return OK;
 }
 
 Matrix *
@@ -127,111 +519,192 @@ Matrix_multiply(const Matrix *A, const Matrix *B)
         LOG_ERROR("Matrix dimensions do not match");
         return NULL;
     }
+    NEW_RESULT_FROM_INTO(A->r, A->c, Matrix_multiply_into(dst, A, B));
+}
 
-    Matrix *C = Matrix_new(A->r, A->c);
-    for (int i = 0; i < C->r; i++)
+CallmStatusCode
+Matrix_add_into(Matrix *dst, const Matrix *A, const Matrix *B)
+{
+    if ((A->r != B->r) || (A->c != B->c))
     {
-        for (int j = 0; j < C->c; j++)
-        {
-            C->data[i * C->c + j] = A->data[i * A->c + j] * B->data[i * B->c + j];
-        }
+        LOG_ERROR("Matrix dimensions do not match");
+        return ERROR;
     }
-    return C;
+    if (check_dst_shape(dst, A->r, A->c, "Matrix_add_into") != OK)
+    {
+        return ERROR;
+    }
+
+    MatrixOpArgs op = { .dst = dst, .A = A, .B = B };
+    run_elementwise(&op, add_segment);
+    return OK;
 }
 
 Matrix *
-Matrix_multiply_broadcast(const Matrix *A_small, const Matrix *B_large, int broadcast_direction)
+Matrix_add(const Matrix *A, const Matrix *B)
+{
+    if ((A->r != B->r) || (A->c != B->c))
+    {
+        LOG_ERROR("Matrix dimensions do not match");
+        return NULL;
+    }
+    NEW_RESULT_FROM_INTO(A->r, A->c, Matrix_add_into(dst, A, B));
+}
+
+CallmStatusCode
+Matrix_multiply_broadcast_into(Matrix *dst, const Matrix *A_small, const Matrix *B_large, int broadcast_direction)
 {
     if (broadcast_direction == MAT_APPLY_COL)
     {
         if (A_small->c != B_large->c)
         {
             LOGF_ERROR("Large matrix nb of columns do not match: expected %d, got %d", A_small->c, B_large->c);
-            return NULL;
+            return ERROR;
         }
-        Matrix *C = Matrix_new(B_large->r, B_large->c);
-        for (int i = 0; i < C->c; i++)
+        if (check_dst_shape(dst, B_large->r, B_large->c, "Matrix_multiply_broadcast_into") != OK)
         {
-            for (int j = 0; j < C->r; j++)
-            {
-                C->data[j * C->c + i] = A_small->data[i] * B_large->data[j * B_large->c + i];
-            }
+            return ERROR;
         }
-        return C;
+        MatrixOpArgs op = { .dst = dst, .A = A_small, .B = B_large };
+        parallel_for(dst->r, row_grain(dst), broadcast_col_range, &op);
+        return OK;
     }
     else if (broadcast_direction == MAT_APPLY_ROW)
     {
         if (A_small->r != B_large->r)
         {
             LOGF_ERROR("Large matrix nb of rows do not match: expected %d, got %d", A_small->r, B_large->r);
-            return NULL;
+            return ERROR;
         }
-        Matrix *C = Matrix_new(B_large->r, B_large->c);
-        for (int i = 0; i < C->r; i++)
+        if (check_dst_shape(dst, B_large->r, B_large->c, "Matrix_multiply_broadcast_into") != OK)
         {
-            for (int j = 0; j < C->c; j++)
-            {
-                C->data[i * C->c + j] = A_small->data[i] * B_large->data[i * B_large->c + j];
-            }
+            return ERROR;
         }
-        return C;
+        MatrixOpArgs op = { .dst = dst, .A = A_small, .B = B_large };
+        parallel_for(dst->r, row_grain(dst), broadcast_row_range, &op);
+        return OK;
     }
     else
     {
         LOG_ERROR("Invalid broadcast direction");
-        return NULL;
+        return ERROR;
+    }
+}
+
+Matrix *
+Matrix_multiply_broadcast(const Matrix *A_small, const Matrix *B_large, int broadcast_direction)
+{
+    NEW_RESULT_FROM_INTO(B_large->r, B_large->c, Matrix_multiply_broadcast_into(dst, A_small, B_large,
+                                                                                 broadcast_direction));
+}
+
+CallmStatusCode
+Matrix_multiply_scalar_into(Matrix *dst, const Matrix *A, float scalar)
+{
+    if (check_dst_shape(dst, A->r, A->c, "Matrix_multiply_scalar_into") != OK)
+    {
+        return ERROR;
     }
+    MatrixOpArgs op = { .dst = dst, .A = A, .scalar = scalar };
+    run_elementwise(&op, multiply_scalar_segment);
+    return OK;
 }
 
 Matrix *
 Matrix_multiply_scalar(const Matrix *A, float scalar)
 {
-    Matrix *C = Matrix_new(A->r, A->c);
-    for (int i = 0; i < C->r; i++)
+    NEW_RESULT_FROM_INTO(A->r, A->c, Matrix_multiply_scalar_into(dst, A, scalar));
+}
+
+CallmStatusCode
+Matrix_add_scalar_into(Matrix *dst, const Matrix *A, float scalar)
+{
+    if (check_dst_shape(dst, A->r, A->c, "Matrix_add_scalar_into") != OK)
     {
-        for (int j = 0; j < C->c; j++)
-        {
-            C->data[i * C->c + j] = A->data[i * A->c + j] * scalar;
-        }
+        return ERROR;
     }
-    return C;
+    MatrixOpArgs op = { .dst = dst, .A = A, .scalar = scalar };
+    run_elementwise(&op, add_scalar_segment);
+    return OK;
 }
 
 Matrix *
 Matrix_add_scalar(const Matrix *A, float scalar)
 {
-    Matrix *C = Matrix_new(A->r, A->c);
-    for (int i = 0; i < C->r; i++)
+    NEW_RESULT_FROM_INTO(A->r, A->c, Matrix_add_scalar_into(dst, A, scalar));
+}
+
+CallmStatusCode
+Matrix_silu_into(Matrix *dst, const Matrix *A)
+{
+    if (check_dst_shape(dst, A->r, A->c, "Matrix_silu_into") != OK)
     {
-        for (int j = 0; j < C->c; j++)
-        {
-            C->data[i * C->c + j] = A->data[i * A->c + j] + scalar;
-        }
+        return ERROR;
     }
-    return C;
+    MatrixOpArgs op = { .dst = dst, .A = A };
+    run_elementwise(&op, silu_segment);
+    return OK;
 }
 
-void
-Matrix_apply_each(Matrix *M, mat_apply_t f)
+CallmStatusCode
+Matrix_exp_into(Matrix *dst, const Matrix *A)
 {
-    for (int i = 0; i < M->r; i++)
+    if (check_dst_shape(dst, A->r, A->c, "Matrix_exp_into") != OK)
     {
-        for (int j = 0; j < M->c; j++)
-        {
-            M->data[i * M->c + j] = f(M->data[i * M->c + j]);
-        }
+        return ERROR;
+    }
+    MatrixOpArgs op = { .dst = dst, .A = A };
+    run_elementwise(&op, exp_segment);
+    return OK;
+}
+
+CallmStatusCode
+Matrix_silu_multiply_into(Matrix *dst, const Matrix *gate, const Matrix *up)
+{
+    if (gate->r != up->r || gate->c != up->c)
+    {
+        LOG_ERROR("Matrix dimensions do not match");
+        return ERROR;
+    }
+    if (check_dst_shape(dst, gate->r, gate->c, "Matrix_silu_multiply_into") != OK)
+    {
+        return ERROR;
     }
+    MatrixOpArgs op = { .dst = dst, .A = gate, .B = up };
+    run_elementwise(&op, silu_multiply_segment);
+    return OK;
+}
+
+void
+Matrix_apply_each(Matrix *M, mat_apply_t f)
+{
+    MatrixOpArgs op = { .dst = M, .apply = f };
+    run_elementwise(&op, apply_each_segment);
 }
 
 void
 Matrix_apply_each_arg(Matrix *M, mat_apply_arg_t f, void *arg)
 {
-    for (int i = 0; i < M->r; i++)
+    MatrixOpArgs op = { .dst = M, .apply_arg = f, .arg = arg };
+    run_elementwise(&op, apply_each_arg_segment);
+}
+
+/*
+ * Columns are gathered into a contiguous scratch buffer of the thread arena for the callbacks: a VLA would put a tall
+ * matrix's column on the stack
+ */
+static float *
+column_scratch(Arena *arena, int r)
+{
+    return arena != NULL ? Arena_alloc(arena, (size_t) (r > 0 ? r : 1) * sizeof(float)) : NULL;
+}
+
+static void
+release_scratch(Arena *arena, ArenaMark mark)
+{
+    if (arena != NULL)
     {
-        for (int j = 0; j < M->c; j++)
-        {
-            M->data[i * M->c + j] = f(M->data[i * M->c + j], arg);
-        }
+        Arena_release(arena, mark);
     }
 }
 
@@ -240,27 +713,33 @@ Matrix_apply_along(Matrix *M, int axis, mat_apply_along_t f)
 {
     if (axis == MAT_APPLY_COL)
     {
+        Arena *arena = Arena_thread_local();
+        ArenaMark mark = arena != NULL ? Arena_mark(arena) : (ArenaMark) { 0, 0, 0 };
+        float *col = column_scratch(arena, M->r);
+        if (col == NULL)
+        {
+            LOG_ERROR("Failed to allocate the column buffer");
+            release_scratch(arena, mark);
+            return;
+        }
         for (int j = 0; j < M->c; j++)
         {
-            float col[M->r];
             for (int i = 0; i < M->r; i++)
             {
-                col[i] = M->data[i * M->c + j];
+                col[i] = Matrix_row(M, i)[j];
             }
             f(col, M->r);
             for (int i = 0; i < M->r; i++)
             {
-                M->data[i * M->c + j] = col[i];
+                Matrix_row(M, i)[j] = col[i];
             }
         }
+        release_scratch(arena, mark);
     }
     else if (axis == MAT_APPLY_ROW)
     {
-
-        for (int i = 0; i < M->r; i++)
-        {
-            f(&M->data[i * M->c], M->c);
-        }
+        MatrixOpArgs op = { .dst = M, .apply_along = f };
+        parallel_for(M->r, row_grain(M), apply_along_rows_range, &op);
     }
     else
     {
@@ -268,131 +747,236 @@ Matrix_apply_along(Matrix *M, int axis, mat_apply_along_t f)
     }
 }
 
-Matrix *
-Matrix_reduce_along(const Matrix *M, int axis, mat_reduce_along_t f)
+CallmStatusCode
+Matrix_reduce_along_into(Matrix *dst, const Matrix *M, int axis, mat_reduce_along_t f)
 {
-    Matrix *result;
     if (axis == MAT_APPLY_COL)
     {
-        result = Matrix_new(1, M->c);
+        if (check_dst_shape(dst, 1, M->c, "Matrix_reduce_along_into") != OK)
+        {
+            return ERROR;
+        }
+        Arena *arena = Arena_thread_local();
+        ArenaMark mark = arena != NULL ? Arena_mark(arena) : (ArenaMark) { 0, 0, 0 };
+        float *col = column_scratch(arena, M->r);
+        if (col == NULL)
+        {
+            LOG_ERROR("Failed to allocate the column buffer");
+            release_scratch(arena, mark);
+            return ERROR;
+        }
         for (int j = 0; j < M->c; j++)
         {
-            float col[M->r];
             for (int i = 0; i < M->r; i++)
             {
-                col[i] = M->data[i * M->c + j];
+                col[i] = Matrix_row(M, i)[j];
             }
-            result->data[j] = f(col, M->r);
+            dst->data[j] = f(col, M->r);
         }
-        ENSURE_SHAPE(result, 1, M->c);
+        release_scratch(arena, mark);
     }
     else if (axis == MAT_APPLY_ROW)
     {
-        result = Matrix_new(M->r, 1);
-        for (int i = 0; i < M->r; i++)
+        if (check_dst_shape(dst, M->r, 1, "Matrix_reduce_along_into") != OK)
         {
-            result->data[i] = f(&M->data[i * M->c], M->c);
+            return ERROR;
         }
-
-        ENSURE_SHAPE(result, M->r, 1);
+        MatrixOpArgs op = { .dst = dst, .A = M, .reduce_along = f };
+        parallel_for(M->r, row_grain(M), reduce_along_rows_range, &op);
     }
     else
     {
         LOG_ERROR("Invalid axis");
-        return NULL;
+        return ERROR;
     }
-    return result;
+    return OK;
 }
 
 Matrix *
-Matrix_transpose(const Matrix *M)
+Matrix_reduce_along(const Matrix *M, int axis, mat_reduce_along_t f)
+{
+    if (axis == MAT_APPLY_COL)
+    {
+        NEW_RESULT_FROM_INTO(1, M->c, Matrix_reduce_along_into(dst, M, axis, f));
+    }
+    else if (axis == MAT_APPLY_ROW)
+    {
+        NEW_RESULT_FROM_INTO(M->r, 1, Matrix_reduce_along_into(dst, M, axis, f));
+    }
+    LOG_ERROR("Invalid axis");
+    return NULL;
+}
+
+CallmStatusCode
+Matrix_reshape(Matrix *M, int r, int c)
+{
+    if (M == NULL || r * c != M->r * M->c)
+    {
+        LOG_ERROR("Invalid reshape: the number of elements must be unchanged");
+        return ERROR;
+    }
+    if (!Matrix_is_contiguous(M))
+    {
+        LOG_ERROR("Invalid reshape: the matrix must be contiguous");
+        return ERROR;
+    }
+    M->r = r;
+    M->c = c;
+    M->stride = c;
+    return OK;
+}
+
+CallmStatusCode
+Matrix_transpose_into(Matrix *dst, const Matrix *M)
 {
     if (M == NULL || M->data == NULL)
     {
-        return NULL;
+        return ERROR;
+    }
+    if (check_dst_shape(dst, M->c, M->r, "Matrix_transpose_into") != OK)
+    {
+        return ERROR;
+    }
+    if (Matrix_overlaps(dst, M))
+    {
+        LOG_ERROR("Matrix_transpose_into: transposition can't be done in place");
+        return ERROR;
     }
 
-    Matrix *result = Matrix_new(M->c, M->r);
     for (int i = 0; i < M->r; i++)
     {
+        const float *row = Matrix_row(M, i);
         for (int j = 0; j < M->c; j++)
         {
-            result->data[j * M->r + i] = M->data[i * M->c + j];
+            Matrix_row(dst, j)[i] = row[j];
         }
     }
-    return result;
+    return OK;
 }
 
 Matrix *
-Matrix_slice_line(const Matrix *M, int from, int nb)
+Matrix_transpose(const Matrix *M)
 {
-    if (from + nb > M->r)
+    if (M == NULL || M->data == NULL)
     {
-        LOG_ERROR("Error: slice out of bounds");
         return NULL;
     }
-    Matrix *M_slice = Matrix_new(nb, M->c);
+    NEW_RESULT_FROM_INTO(M->c, M->r, Matrix_transpose_into(dst, M));
+}
+
+CallmStatusCode
+Matrix_slice_line_into(Matrix *dst, const Matrix *M, int from, int nb)
+{
+    if (from < 0 || from + nb > M->r)
+    {
+        LOG_ERROR("Error: slice out of bounds");
+        return ERROR;
+    }
+    if (check_dst_shape(dst, nb, M->c, "Matrix_slice_line_into") != OK)
+    {
+        return ERROR;
+    }
+    // memmove: the destination may overlap the source (e.g. shifting rows in place)
     for (int i = 0; i < nb; i++)
     {
-        for (int j = 0; j < M->c; j++)
-        {
-            M_slice->data[i * M->c + j] = M->data[(from + i) * M->c + j];
-        }
+        memmove(Matrix_row(dst, i), Matrix_row(M, from + i), M->c * sizeof(float));
     }
-    return M_slice;
+    return OK;
 }
 
 Matrix *
-Matrix_slice_column(const Matrix *M, int from, int nb)
+Matrix_slice_line(const Matrix *M, int from, int nb)
 {
-    if (from + nb > M->c)
+    if (from < 0 || from + nb > M->r)
     {
         LOG_ERROR("Error: slice out of bounds");
         return NULL;
     }
-    Matrix *M_slice = Matrix_new(M->r, nb);
+    NEW_RESULT_FROM_INTO(nb, M->c, Matrix_slice_line_into(dst, M, from, nb));
+}
+
+CallmStatusCode
+Matrix_slice_column_into(Matrix *dst, const Matrix *M, int from, int nb)
+{
+    if (from < 0 || from + nb > M->c)
+    {
+        LOG_ERROR("Error: slice out of bounds");
+        return ERROR;
+    }
+    if (check_dst_shape(dst, M->r, nb, "Matrix_slice_column_into") != OK)
+    {
+        return ERROR;
+    }
     for (int i = 0; i < M->r; i++)
     {
-        for (int j = 0; j < nb; j++)
-        {
-            M_slice->data[i * nb + j] = M->data[i * M->c + from + j];
-        }
+        memmove(Matrix_row(dst, i), Matrix_row(M, i) + from, nb * sizeof(float));
     }
-    return M_slice;
+    return OK;
 }
 
 Matrix *
-Matrix_select_columns(const Matrix *M, int *idx, int nb)
+Matrix_slice_column(const Matrix *M, int from, int nb)
 {
-    Matrix *M_slice = Matrix_new(M->r, nb);
-    int i;
-    int curr_idx;
-    for (i = 0; i < nb; i++)
+    if (from < 0 || from + nb > M->c)
     {
-        curr_idx = idx[i];
+        LOG_ERROR("Error: slice out of bounds");
+        return NULL;
+    }
+    NEW_RESULT_FROM_INTO(M->r, nb, Matrix_slice_column_into(dst, M, from, nb));
+}
+
+CallmStatusCode
+Matrix_select_columns_into(Matrix *dst, const Matrix *M, int *idx, int nb)
+{
+    if (check_dst_shape(dst, M->r, nb, "Matrix_select_columns_into") != OK)
+    {
+        return ERROR;
+    }
+    if (Matrix_overlaps(dst, M))
+    {
+        LOG_ERROR("Matrix_select_columns_into: selection can't be done in place");
+        return ERROR;
+    }
+    for (int i = 0; i < nb; i++)
+    {
+        int curr_idx = idx[i];
         for (int j = 0; j < M->r; j++)
         {
-            M_slice->data[j * nb + i] = M->data[j * M->c + curr_idx];
+            Matrix_row(dst, j)[i] = Matrix_row(M, j)[curr_idx];
         }
     }
-    return M_slice;
+    return OK;
 }
 
 Matrix *
-Matrix_select_rows(const Matrix *M, int *idx, int nb)
+Matrix_select_columns(const Matrix *M, int *idx, int nb)
 {
-    Matrix *M_slice = Matrix_new(nb, M->c);
-    int i;
-    int curr_idx;
-    for (i = 0; i < nb; i++)
+    NEW_RESULT_FROM_INTO(M->r, nb, Matrix_select_columns_into(dst, M, idx, nb));
+}
+
+CallmStatusCode
+Matrix_select_rows_into(Matrix *dst, const Matrix *M, int *idx, int nb)
+{
+    if (check_dst_shape(dst, nb, M->c, "Matrix_select_rows_into") != OK)
     {
-        curr_idx = idx[i];
-        for (int j = 0; j < M->c; j++)
-        {
-            M_slice->data[i * M->c + j] = M->data[curr_idx * M->c + j];
-        }
+        return ERROR;
+    }
+    if (Matrix_overlaps(dst, M))
+    {
+        LOG_ERROR("Matrix_select_rows_into: selection can't be done in place");
+        return ERROR;
+    }
+    for (int i = 0; i < nb; i++)
+    {
+        memcpy(Matrix_row(dst, i), Matrix_row(M, idx[i]), M->c * sizeof(float));
     }
-    return M_slice;
+    return OK;
+}
+
+Matrix *
+Matrix_select_rows(const Matrix *M, int *idx, int nb)
+{
+    NEW_RESULT_FROM_INTO(nb, M->c, Matrix_select_rows_into(dst, M, idx, nb));
 }
 
 void
@@ -422,7 +1006,7 @@ Matrix_print(const Matrix *M, int display_len)
     {
         for (int j = 0; j < nb_cols; j++)
         {
-            printf("%f ", M->data[i * M->c + j]);
+            printf("%f ", Matrix_row(M, i)[j]);
         }
         if (nb_cols < M->c)
         {
@@ -462,7 +1046,7 @@ Matrix_to_json(const Matrix *M)
 
         for (int j = 0; j < M->c; j++)
         {
-            json_t *json_value = json_real(M->data[i * M->c + j]);
+            json_t *json_value = json_real(Matrix_row(M, i)[j]);
             if (!json_value)
             {
                 json_decref(json_row);
@@ -489,39 +1073,51 @@ Matrix_equals(const Matrix *A, Matrix *B)
         return 0;
     }
 
-    for (int i = 0; i < A->r * A->c; i++)
+    for (int i = 0; i < A->r; i++)
     {
-        if (A->data[i] != B->data[i])
+        const float *a = Matrix_row(A, i);
+        const float *b = Matrix_row(B, i);
+        for (int j = 0; j < A->c; j++)
         {
-            return 0;
+            if (a[j] != b[j])
+            {
+                return 0;
+            }
         }
     }
 
     return 1;
 }
 
-Matrix *
-Matrix_concat(const Matrix *A, const Matrix *B, int axis)
+CallmStatusCode
+Matrix_concat_into(Matrix *dst, const Matrix *A, const Matrix *B, int axis)
 {
-    Matrix *C;
+    if (dst == NULL || dst->data == NULL)
+    {
+        LOG_ERROR("Matrix_concat_into: destination matrix is NULL");
+        return ERROR;
+    }
+    if (Matrix_overlaps(dst, A) || Matrix_overlaps(dst, B))
+    {
+        LOG_ERROR("Matrix_concat_into: destination must not overlap an operand");
+        return ERROR;
+    }
+
     if (axis == MAT_APPLY_COL)
     {
         if (A->r != B->r)
         {
             LOG_ERROR("Matrix_concat: matrices dimensions do not match for axis col");
-            return NULL;
+            return ERROR;
         }
-        C = Matrix_new(A->r, A->c + B->c);
-        for (int i = 0; i < C->r; i++)
+        if (check_dst_shape(dst, A->r, A->c + B->c, "Matrix_concat_into") != OK)
         {
-            for (int j = 0; j < A->c; j++)
-            {
-                C->data[i * C->c + j] = A->data[i * A->c + j];
-            }
-            for (int j = 0; j < B->c; j++)
-            {
-                C->data[i * C->c + A->c + j] = B->data[i * B->c + j];
-            }
+            return ERROR;
+        }
+        for (int i = 0; i < dst->r; i++)
+        {
+            memcpy(Matrix_row(dst, i), Matrix_row(A, i), A->c * sizeof(float));
+            memcpy(Matrix_row(dst, i) + A->c, Matrix_row(B, i), B->c * sizeof(float));
         }
     }
     else if (axis == MAT_APPLY_ROW)
@@ -529,118 +1125,50 @@ Matrix_concat(const Matrix *A, const Matrix *B, int axis)
         if (A->c != B->c)
         {
             LOG_ERROR("Matrix_concat: matrices dimensions do not match for axis row");
-            return NULL;
+            return ERROR;
+        }
+        if (check_dst_shape(dst, A->r + B->r, A->c, "Matrix_concat_into") != OK)
+        {
+            return ERROR;
         }
-        C = Matrix_new(A->r + B->r, A->c);
         for (int i = 0; i < A->r; i++)
         {
-            for (int j = 0; j < C->c; j++)
-            {
-                C->data[i * C->c + j] = A->data[i * A->c + j];
-            }
+            memcpy(Matrix_row(dst, i), Matrix_row(A, i), A->c * sizeof(float));
         }
         for (int i = 0; i < B->r; i++)
         {
-            for (int j = 0; j < C->c; j++)
-            {
-                C->data[(A->r + i) * C->c + j] = B->data[i * B->c + j];
-            }
+            memcpy(Matrix_row(dst, A->r + i), Matrix_row(B, i), B->c * sizeof(float));
         }
     }
     else
     {
         LOG_ERROR("Matrix_concat : invalid axis");
-        return NULL;
+        return ERROR;
     }
-    return C;
-}
-
-// void multiply_matrices_blocked(int **A, int **B, int **C, int m, int n, int
-// p)
-// {
-//     for (int i = 0; i < m; i += BLOCK_SIZE)
-//     {
-//         for (int j = 0; j < p; j += BLOCK_SIZE)
-//         {
-//             for (int k = 0; k < n; k += BLOCK_SIZE)
-//             {
-//                 // Multiplication des blocs
-//                 for (int ii = i; ii < i + BLOCK_SIZE && ii < m; ii++)
-//                 {
-//                     for (int jj = j; jj < j + BLOCK_SIZE && jj < p; jj++)
-//                     {
-//                         int sum = 0;
-//                         for (int kk = k; kk < k + BLOCK_SIZE && kk < n;
-//                         kk++)
-//                         {
-//                             sum += A[ii][kk] * B[kk][jj];
-//                         }
-//                         C[ii][jj] += sum;
-//                     }
-//                 }
-//             }
-//         }
-//     }
-// }
-//
-// void multiply_matrices_SIMD(float **A, float **B, float **C, int m, int n,
-// int p)
-// {
-//     for (int i = 0; i < m; i++)
-//     {
-//         for (int j = 0; j < p; j++)
-//         {
-//             __m256 sum = _mm256_setzero_ps(); // vecteur de somme initialisé
-//             à zéro for (int k = 0; k < n; k += 8)
-//             {
-//                 __m256 a = _mm256_loadu_ps(&A[i][k]); // charge 8 éléments
-//                 de A
-//                 __m256 b = _mm256_loadu_ps(&B[k][j]); // charge 8 éléments
-//                 de B sum = _mm256_fmadd_ps(a, b, sum);     // multiplication
-//                 et addition
-//             }
-//             // Ajout des éléments du vecteur pour obtenir un scalaire
-//             C[i][j] = _mm256_reduce_add_ph(sum);
-//         }
-//     }
-// }
-//
-// void multiply_matrices_asm(matrix *A, matrix *B, matrix *C)
-// {
-//     __asm__ volatile("mov %3, %%rsi\n\t"  // Charger n dans rsi (taille de
-//     la matrice)
-//                      "xor %%r8, %%r8\n\t" // r8 sera notre index pour les
-//                      lignes "loop_i:\n\t"
-//
-//                      "xor %%r9, %%r9\n\t" // r9 sera notre index pour les
-//                      colonnes "loop_j:\n\t"
-//
-//                      "vxorps %%ymm0, %%ymm0, %%ymm0\n\t" // Initialiser le
-//                      registre YMM0 à 0 (accumulateur pour C[i][j]) "xor
-//                      %%r10, %%r10\n\t"              // r10 sera notre index
-//                      pour la boucle k
-//
-//                      "loop_k:\n\t"
-//                      "vmovups (%0, %%r8, 4), %%ymm1\n\t"      // Charger
-//                      A[i, k] dans ymm1 "vmovups (%1, %%r9, 4), %%ymm2\n\t"
-//                      // Charger B[k, j] dans ymm2 "vfmadd231ps %%ymm1,
-//                      %%ymm2, %%ymm0\n\t" // C[i, j] += A[i, k] * B[k, j]
-//
-//                      "add $8, %%r10\n\t"    // k += 8
-//                      "cmp %%rsi, %%r10\n\t" // Comparer k avec n
-//                      "jl loop_k\n\t"        // Répéter pour chaque élément k
-//
-//                      "vmovups %%ymm0, (%2, %%r8, 4)\n\t" // Stocker le
-//                      résultat C[i, j] "add $8, %%r9\n\t"                  //
-//                      j += 8 "cmp %%rsi, %%r9\n\t"               // Comparer
-//                      j avec n "jl loop_j\n\t"                     // Répéter
-//                      pour chaque colonne j
-//
-//                      "add $8, %%r8\n\t"    // i += 8
-//                      "cmp %%rsi, %%r8\n\t" // Comparer i avec n
-//                      "jl loop_i\n\t"       // Répéter pour chaque ligne i
-//                      :
-//                      : "r"(A->data), "r"(B->data), "r"(C->data), "r"(C->c)
-//                      : "rsi", "r8", "r9", "r10", "ymm0", "ymm1", "ymm2",
-//                      "memory");
-// }
+    return OK;
+}
+
+Matrix *
+Matrix_concat(const Matrix *A, const Matrix *B, int axis)
+{
+    if (axis == MAT_APPLY_COL)
+    {
+        if (A->r != B->r)
+        {
+            LOG_ERROR("Matrix_concat: matrices dimensions do not match for axis col");
+            return NULL;
+        }
+        NEW_RESULT_FROM_INTO(A->r, A->c + B->c, Matrix_concat_into(dst, A, B, axis));
+    }
+    else if (axis == MAT_APPLY_ROW)
+    {
+        if (A->c != B->c)
+        {
+            LOG_ERROR("Matrix_concat: matrices dimensions do not match for axis row");
+            return NULL;
+        }
+        NEW_RESULT_FROM_INTO(A->r + B->r, A->c, Matrix_concat_into(dst, A, B, axis));
+    }
+    LOG_ERROR("Matrix_concat : invalid axis");
+    return NULL;
+}
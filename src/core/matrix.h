@@ -2,10 +2,17 @@
 #define MATRIX_H
 
 #include "../shared/errors.h"
+#include "memory/arena.h"
+#include <stdlib.h>
 
 #define MAT_APPLY_ROW 0
 #define MAT_APPLY_COL 1
 
+/* Matrix buffers are aligned on a cache line, which is also the width of an AVX-512 register */
+#define MATRIX_ALIGNMENT 64
+/* Rows of padded matrices have a multiple of this number of floats (one AVX-512 register) */
+#define MATRIX_PADDING 16
+
 #if RELEASE_TYPE == DEV
 #define ENSURE_SHAPE(M, rows, cols)                                                                                    \
     if (M == NULL || M->data == NULL || M->r != rows || M->c != cols)                                                  \
@@ -17,12 +24,20 @@
 #define ENSURE_SHAPE(M, rows, cols)
 #endif
 
+/*
+ * Row-major matrix of floats. Element (i, j) is data[i * stride + j]: stride (the leading dimension) is c for a
+ * contiguous matrix, more for padded matrices and for sub-matrices sharing the storage of a larger one.
+ * Only matrices owning their data release it in Matrix_free, and matrices allocated from an arena are released with it.
+ */
 typedef struct
 {
     int r;
     int c;
-    size_t size;
+    size_t size;  // r * c, the number of elements (excluding any padding)
     float *data;
+    int stride;
+    int owns_data;
+    int in_arena;  // the matrix and its data were allocated from an arena, Matrix_free leaves them
 } Matrix;
 
 typedef float (*mat_apply_t)(float);
@@ -30,10 +45,74 @@ typedef float (*mat_apply_arg_t)(float, void *);
 typedef void (*mat_apply_along_t)(float *, int);
 typedef float (*mat_reduce_along_t)(float *, int);
 
+/*
+ * Most operations come in two flavours:
+ * - Matrix_xxx(...) allocates and returns a new result matrix (NULL on error), to be released with Matrix_free
+ * - Matrix_xxx_into(dst, ...) writes the result into a caller provided matrix, which must already have the output
+ *   shape. Nothing is allocated, so layers can reuse preallocated scratch buffers on the hot path.
+ *   Returns ERROR (and leaves dst untouched) if a shape does not match.
+ *   Unless stated otherwise, dst may be one of the operands (in-place operation).
+ */
+
+/*
+ * Create a new r x c contiguous matrix (stride == c), with a 64 bytes aligned, uninitialised buffer
+ */
 Matrix *Matrix_new(int r, int c);
 
+/*
+ * Same as Matrix_new, allocating the matrix and its data from arena (from the heap when arena is NULL). Matrix_free
+ * is a no-op on it: it lives until the arena is reset or released.
+ */
+Matrix *Matrix_new_in(Arena *arena, int r, int c);
+
+/*
+ * Create a new r x c matrix whose rows are padded to a multiple of MATRIX_PADDING floats, so every row starts on a
+ * 64 bytes boundary. The buffer (padding included) is zero initialised.
+ */
+Matrix *Matrix_new_padded(int r, int c);
+
+/*
+ * Create a r x c contiguous matrix on an existing buffer (e.g. a tensor of a mapped safetensors file), without copying
+ * it. The matrix doesn't own the data: the buffer must outlive it. The buffer may be read-only (a PROT_READ mapping):
+ * such a matrix must then only be read, as an operand or through views, since writing to it (as the destination of an
+ * operation, in place included) faults.
+ */
+Matrix *Matrix_wrap(int r, int c, float *data);
+
+/*
+ * Create a r x c matrix on the block of M starting at (row, col), sharing M's storage (and stride): writes through
+ * one are visible in the other. The sub-matrix doesn't own the data and must be released before M.
+ */
+Matrix *Matrix_submatrix(const Matrix *M, int row, int col, int r, int c);
+
+/*
+ * Returns a pointer to the first element of row i
+ */
+static inline float *
+Matrix_row(const Matrix *M, int i)
+{
+    return M->data + (size_t) i * M->stride;
+}
+
+/*
+ * Returns 1 if the rows of M follow each other without any gap, 0 otherwise
+ */
+static inline int
+Matrix_is_contiguous(const Matrix *M)
+{
+    return M->stride == M->c || M->r <= 1;
+}
+
+/*
+ * Returns 1 if the memory spanned by the rows of A and B intersects (e.g. two views of the same buffer), 0 otherwise
+ */
+int Matrix_overlaps(const Matrix *A, const Matrix *B);
+
 CallmStatusCode Matrix_free(Matrix *M);
 
+/*
+ * Copy a dense r x c buffer (rows following each other) into the matrix
+ */
 CallmStatusCode Matrix_fill(Matrix *M, float *data);
 
 CallmStatusCode Matrix_set(Matrix *M, int row, int col, float value);
@@ -56,9 +135,21 @@ Matrix *Matrix_arange(int start, int end, int step, int axis);
 
 /*
  * Given a N x M matrix A and a M x P matrix B, returns the dot product of the two matrices.
+ * When N == 1, a matrix-vector kernel is used instead of the blocked GEMM.
  * Output shape is N x P
  */
 Matrix *Matrix_dot(const Matrix *A, const Matrix *B);
+CallmStatusCode Matrix_dot_into(Matrix *dst, const Matrix *A, const Matrix *B);  // dst must not overlap A or B
+
+/*
+ * Given a N x M matrix A and a P x M matrix B, returns the dot product of A with the transpose of B.
+ * This is the natural product with linear layer weights stored as [out, in]: B is never transposed nor copied.
+ * When N == 1 (a single token, e.g. while decoding), a multithreaded matrix-vector kernel is used instead of the
+ * blocked GEMM.
+ * Output shape is N x P, the dst of the _into variant must not overlap A or B
+ */
+Matrix *Matrix_dot_transposed(const Matrix *A, const Matrix *B);
+CallmStatusCode Matrix_dot_transposed_into(Matrix *dst, const Matrix *A, const Matrix *B);
 
 /*
  * Given an input N x M matrix, applies the given function to matrix's individual elements.
@@ -66,6 +157,15 @@ Matrix *Matrix_dot(const Matrix *A, const Matrix *B);
  * Returns NULL if both input matrices are not of the same shape
  */
 Matrix *Matrix_multiply(const Matrix *A, const Matrix *B);
+CallmStatusCode Matrix_multiply_into(Matrix *dst, const Matrix *A, const Matrix *B);
+
+/*
+ * Given two N x M matrices, returns their element-wise sum (e.g. a residual connection).
+ * Output shape is N x M
+ * Returns NULL if both input matrices are not of the same shape
+ */
+Matrix *Matrix_add(const Matrix *A, const Matrix *B);
+CallmStatusCode Matrix_add_into(Matrix *dst, const Matrix *A, const Matrix *B);
 
 /*
  * Multiply each rows or columns of a large matrix by the corresponding element of a small matrix.
@@ -88,27 +188,54 @@ Matrix *Matrix_multiply(const Matrix *A, const Matrix *B);
  * Output shape is N x M
  */
 Matrix *Matrix_multiply_broadcast(const Matrix *A_small, const Matrix *B_large, int broadcast_direction);
+CallmStatusCode Matrix_multiply_broadcast_into(Matrix *dst, const Matrix *A_small, const Matrix *B_large,
+                                               int broadcast_direction);
 
 /*
  * Given an input N x M matrix, multiplies each element by a scalar.
  * Output shape is N x M
  */
 Matrix *Matrix_multiply_scalar(const Matrix *A, float scalar);
+CallmStatusCode Matrix_multiply_scalar_into(Matrix *dst, const Matrix *A, float scalar);
 
 /*
  * Given an input N x M matrix, add each element by a scalar.
  * Output shape is N x M
  */
 Matrix *Matrix_add_scalar(const Matrix *A, float scalar);
+CallmStatusCode Matrix_add_scalar_into(Matrix *dst, const Matrix *A, float scalar);
+
+/*
+ * Change the shape of the matrix in place, without moving any data. The number of elements must be unchanged and the
+ * matrix must be contiguous.
+ * Example: a 2048 x 1 column vector loaded from a 1D tensor can be reshaped into a 1 x 2048 row vector.
+ */
+CallmStatusCode Matrix_reshape(Matrix *M, int r, int c);
 
 /*
  * Given an input N x M matrix, returns the transpose of the matrix.
  * Output shape is M x N
  */
 Matrix *Matrix_transpose(const Matrix *M);
+CallmStatusCode Matrix_transpose_into(Matrix *dst, const Matrix *M);  // can't be done in place
+
+/*
+ * Element-wise silu / exp of an N x M matrix (dst may be A).
+ * Same result as Matrix_apply_each with silu / expf, but the operation is compiled into a vectorised loop (vecops.h)
+ * instead of being called through a pointer for each element: prefer them to the generic apply functions.
+ */
+CallmStatusCode Matrix_silu_into(Matrix *dst, const Matrix *A);
+CallmStatusCode Matrix_exp_into(Matrix *dst, const Matrix *A);
+
+/*
+ * Gated activation of the MLP, in a single pass: dst = silu(gate) * up, element-wise.
+ * Output shape is N x M
+ */
+CallmStatusCode Matrix_silu_multiply_into(Matrix *dst, const Matrix *gate, const Matrix *up);
 
 /*
  * Given an input N x M matrix, applies the given function to matrix's individual elements.
+ * Large matrices are processed by several threads: f must be thread-safe.
  * Output shape is N x M
  */
 void Matrix_apply_each(Matrix *M, mat_apply_t f);
@@ -116,6 +243,7 @@ void Matrix_apply_each(Matrix *M, mat_apply_t f);
 /*
  * Given an input N x M matrix, applies the given function to matrix's individual element-wise
  * with an additional argument.
+ * Large matrices are processed by several threads: f must be thread-safe and must not modify arg.
  * Output shape is N x M
  */
 void Matrix_apply_each_arg(Matrix *M, mat_apply_arg_t f, void *arg);
@@ -144,6 +272,8 @@ void Matrix_apply_each_arg(Matrix *M, mat_apply_arg_t f, void *arg);
  *   => apply_along(M, MAT_APPLY_ROW, add_the_max)
  *   => M=[[4, 5, 6],
  *         [10, 11, 12]]
+ *
+ * Rows are processed in parallel when the matrix is large (f must then be thread-safe).
  */
 void Matrix_apply_along(Matrix *M, int axis, mat_apply_along_t f);
 
@@ -151,8 +281,10 @@ void Matrix_apply_along(Matrix *M, int axis, mat_apply_along_t f);
  * Given an input N x M matrix, applies a function to reduce the matrix along it's:
  * - rows if axis == MAT_APPLY_ROW => output shape is N x 1
  * - columns if axis == MAT_APPLY_COL => output shape is 1 x M
+ * Rows are reduced in parallel when the matrix is large (f must then be thread-safe).
  */
 Matrix *Matrix_reduce_along(const Matrix *M, int axis, mat_reduce_along_t f);
+CallmStatusCode Matrix_reduce_along_into(Matrix *dst, const Matrix *M, int axis, mat_reduce_along_t f);
 
 /*
  * Simply prints the matrix shape and first elements to the console
@@ -179,6 +311,7 @@ char *Matrix_to_json(const Matrix *M);
  * Output shape is nb x M
  */
 Matrix *Matrix_slice_line(const Matrix *M, int from, int nb);
+CallmStatusCode Matrix_slice_line_into(Matrix *dst, const Matrix *M, int from, int nb);
 
 /*
  * Given an input N x M matrix, returns a slice of the matrix from the given index to the given number of columns.
@@ -192,6 +325,7 @@ Matrix *Matrix_slice_line(const Matrix *M, int from, int nb);
  * Output shape is N x nb
  */
 Matrix *Matrix_slice_column(const Matrix *M, int from, int nb);
+CallmStatusCode Matrix_slice_column_into(Matrix *dst, const Matrix *M, int from, int nb);
 
 /*
  * Compare two matrices element-wise (and compare their shape) and return 1 if they are equal, 0 otherwise
@@ -209,6 +343,7 @@ int Matrix_equals(const Matrix *A, Matrix *B);
  *  Output shape is N x nb
  */
 Matrix *Matrix_select_columns(const Matrix *M, int *idx, int nb);
+CallmStatusCode Matrix_select_columns_into(Matrix *dst, const Matrix *M, int *idx, int nb);  // can't be done in place
 
 /*
  * Given an input N x M matrix, returns a slice of the matrix with the rows specified by their index.
@@ -223,6 +358,7 @@ Matrix *Matrix_select_columns(const Matrix *M, int *idx, int nb);
  *    Output shape is nb x M
  */
 Matrix *Matrix_select_rows(const Matrix *M, int *idx, int nb);
+CallmStatusCode Matrix_select_rows_into(Matrix *dst, const Matrix *M, int *idx, int nb);  // can't be done in place
 
 /*
  * Concatenate two matrices along a given axis.
@@ -241,7 +377,9 @@ Matrix *Matrix_select_rows(const Matrix *M, int *idx, int nb);
  *    => [[1, 2, 5, 6],
  *        [3, 4, 7, 8]]
  *    Output shape is 2 x 4
+ * The destination of Matrix_concat_into must not overlap A or B (e.g. a view of the same buffer).
  */
 Matrix *Matrix_concat(const Matrix *A, const Matrix *B, int axis);
+CallmStatusCode Matrix_concat_into(Matrix *dst, const Matrix *A, const Matrix *B, int axis);
 
 #endif  // !#ifndef MATRIX_H
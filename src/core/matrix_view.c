@@ -1,44 +1,334 @@
 #include "matrix_view.h"
 #include "../shared/errors.h"
+#include "../shared/logging.h"
 #include "matrix.h"
+#include <stdlib.h>
+#include <string.h>
 
 struct matrix_view
 {
     Matrix *M;
+    size_t offset;
+    int r;
+    int c;
+    int row_stride;
+    int col_stride;
+    int *rows_idx;  // NULL when rows follow each other
+    int *cols_idx;  // NULL when columns follow each other
 };
 
+static inline size_t
+element_offset(const MatrixView *V, int row, int col)
+{
+    size_t i = V->rows_idx != NULL ? (size_t) V->rows_idx[row] : (size_t) row;
+    size_t j = V->cols_idx != NULL ? (size_t) V->cols_idx[col] : (size_t) col;
+    return V->offset + i * V->row_stride + j * V->col_stride;
+}
+
+static int *
+copy_indexes(const int *idx, int nb)
+{
+    int *copy = malloc((nb > 0 ? nb : 1) * sizeof(int));
+    if (copy != NULL && nb > 0)
+    {
+        memcpy(copy, idx, nb * sizeof(int));
+    }
+    return copy;
+}
+
 MatrixView *
 MatrixView_new(Matrix *M)
 {
-    return NULL;
+    RETURN_WHEN_NULL(M, "MatrixView_new: matrix is NULL");
+    MatrixView *V = malloc(sizeof(MatrixView));
+    RETURN_WHEN_NULL(V, "Failed to allocate matrix view");
+    V->M = M;
+    V->offset = 0;
+    V->r = M->r;
+    V->c = M->c;
+    V->row_stride = M->stride;
+    V->col_stride = 1;
+    V->rows_idx = NULL;
+    V->cols_idx = NULL;
+    return V;
+}
+
+MatrixView *
+MatrixView_clone(const MatrixView *V)
+{
+    MatrixView *clone = malloc(sizeof(MatrixView));
+    RETURN_WHEN_NULL(clone, "Failed to allocate matrix view");
+    *clone = *V;
+    clone->rows_idx = V->rows_idx != NULL ? copy_indexes(V->rows_idx, V->r) : NULL;
+    clone->cols_idx = V->cols_idx != NULL ? copy_indexes(V->cols_idx, V->c) : NULL;
+    if ((V->rows_idx != NULL && clone->rows_idx == NULL) || (V->cols_idx != NULL && clone->cols_idx == NULL))
+    {
+        MatrixView_free(clone);
+        LOG_ERROR("Failed to allocate matrix view indexes");
+        return NULL;
+    }
+    return clone;
+}
+
+CallmStatusCode
+MatrixView_free(MatrixView *V)
+{
+    if (V == NULL)
+    {
+        return OK;
+    }
+    free(V->rows_idx);
+    free(V->cols_idx);
+    free(V);
+    return OK;
+}
+
+int
+MatrixView_rows(const MatrixView *V)
+{
+    return V->r;
+}
+
+int
+MatrixView_cols(const MatrixView *V)
+{
+    return V->c;
 }
 
 CallmStatusCode
-MatrixView_select_rows_by_nb(MatrixView *M, int from_row, int nb_rows)
+MatrixView_select_rows_by_nb(MatrixView *V, int from_row, int nb_rows)
 {
-    return NOT_IMPLEMENTED;
+    if (from_row < 0 || nb_rows < 0 || from_row + nb_rows > V->r)
+    {
+        LOGF_ERROR("MatrixView_select_rows_by_nb: rows [%d, %d) out of bounds (%d rows)", from_row, from_row + nb_rows,
+                   V->r);
+        return ERROR;
+    }
+    if (V->rows_idx != NULL)
+    {
+        memmove(V->rows_idx, V->rows_idx + from_row, nb_rows * sizeof(int));
+    }
+    else
+    {
+        V->offset += (size_t) from_row * V->row_stride;
+    }
+    V->r = nb_rows;
+    return OK;
 }
 
 CallmStatusCode
-MatrixView_select_columns_by_nb(MatrixView *M, int from_col, int nb_cols)
+MatrixView_select_columns_by_nb(MatrixView *V, int from_col, int nb_cols)
 {
-    return NOT_IMPLEMENTED;
+    if (from_col < 0 || nb_cols < 0 || from_col + nb_cols > V->c)
+    {
+        LOGF_ERROR("MatrixView_select_columns_by_nb: columns [%d, %d) out of bounds (%d columns)", from_col,
+                   from_col + nb_cols, V->c);
+        return ERROR;
+    }
+    if (V->cols_idx != NULL)
+    {
+        memmove(V->cols_idx, V->cols_idx + from_col, nb_cols * sizeof(int));
+    }
+    else
+    {
+        V->offset += (size_t) from_col * V->col_stride;
+    }
+    V->c = nb_cols;
+    return OK;
+}
+
+/*
+ * Composes an index selection with the current one: the new indexes are positions in the current view
+ */
+static CallmStatusCode
+select_indexes(int **current_idx, int *current_nb, const int *idx, int nb, const char *label)
+{
+    for (int i = 0; i < nb; i++)
+    {
+        if (idx[i] < 0 || idx[i] >= *current_nb)
+        {
+            LOGF_ERROR("MatrixView_select_%s_by_indexes: index %d out of bounds (%d %s)", label, idx[i], *current_nb,
+                       label);
+            return ERROR;
+        }
+    }
+    int *new_idx = copy_indexes(idx, nb);
+    if (new_idx == NULL)
+    {
+        LOG_ERROR("Failed to allocate matrix view indexes");
+        return ERROR;
+    }
+    if (*current_idx != NULL)
+    {
+        for (int i = 0; i < nb; i++)
+        {
+            new_idx[i] = (*current_idx)[idx[i]];
+        }
+        free(*current_idx);
+    }
+    *current_idx = new_idx;
+    *current_nb = nb;
+    return OK;
 }
 
 CallmStatusCode
-MatrixView_select_rows_by_indexes(MatrixView *M, int *rows_idx)
+MatrixView_select_rows_by_indexes(MatrixView *V, const int *rows_idx, int nb_rows)
 {
-    return NOT_IMPLEMENTED;
+    return select_indexes(&V->rows_idx, &V->r, rows_idx, nb_rows, "rows");
 }
 
 CallmStatusCode
-MatrixView_select_columns_by_indexes(MatrixView *M, int *cols_idx)
+MatrixView_select_columns_by_indexes(MatrixView *V, const int *cols_idx, int nb_cols)
 {
-    return NOT_IMPLEMENTED;
+    return select_indexes(&V->cols_idx, &V->c, cols_idx, nb_cols, "columns");
 }
 
 CallmStatusCode
-MatrixView_free(MatrixView *M)
+MatrixView_transpose(MatrixView *V)
+{
+    int tmp = V->r;
+    V->r = V->c;
+    V->c = tmp;
+
+    tmp = V->row_stride;
+    V->row_stride = V->col_stride;
+    V->col_stride = tmp;
+
+    int *tmp_idx = V->rows_idx;
+    V->rows_idx = V->cols_idx;
+    V->cols_idx = tmp_idx;
+    return OK;
+}
+
+float
+MatrixView_get(const MatrixView *V, int row, int col)
+{
+    return V->M->data[element_offset(V, row, col)];
+}
+
+void
+MatrixView_set(MatrixView *V, int row, int col, float value)
+{
+    V->M->data[element_offset(V, row, col)] = value;
+}
+
+float *
+MatrixView_row(const MatrixView *V, int i)
+{
+    if (V->cols_idx != NULL || (V->col_stride != 1 && V->c > 1))
+    {
+        return NULL;
+    }
+    return V->M->data + element_offset(V, i, 0);
+}
+
+CallmStatusCode
+MatrixView_as_matrix(const MatrixView *V, Matrix *out)
+{
+    if (V->rows_idx != NULL || V->cols_idx != NULL || (V->col_stride != 1 && V->c > 1))
+    {
+        return ERROR;
+    }
+    out->r = V->r;
+    out->c = V->c;
+    out->size = (size_t) V->r * V->c;
+    out->data = V->M->data + V->offset;
+    out->stride = V->row_stride;
+    out->owns_data = 0;
+    out->in_arena = 0;
+    return OK;
+}
+
+Matrix *
+MatrixView_to_matrix(const MatrixView *V)
+{
+    Matrix *M = Matrix_new(V->r, V->c);
+    RETURN_WHEN_NULL(M, "Failed to allocate matrix from view");
+    for (int i = 0; i < V->r; i++)
+    {
+        float *dst = Matrix_row(M, i);
+        const float *src = MatrixView_row(V, i);
+        if (src != NULL)
+        {
+            memcpy(dst, src, V->c * sizeof(float));
+            continue;
+        }
+        for (int j = 0; j < V->c; j++)
+        {
+            dst[j] = MatrixView_get(V, i, j);
+        }
+    }
+    return M;
+}
+
+CallmStatusCode
+MatrixView_dot_into(Matrix *dst, const MatrixView *A, const MatrixView *B)
+{
+    if (A->c != B->r)
+    {
+        LOG_ERROR("Matrix dimensions do not match");
+        return ERROR;
+    }
+
+    Matrix a_mat, b_mat;
+    Matrix *a_tmp = NULL;
+    Matrix *b_tmp = NULL;
+    const Matrix *a = &a_mat;
+    if (MatrixView_as_matrix(A, &a_mat) != OK)
+    {
+        a = a_tmp = MatrixView_to_matrix(A);
+    }
+
+    CallmStatusCode status;
+    MatrixView Bt = *B;
+    MatrixView_transpose(&Bt);
+    if (a == NULL)
+    {
+        status = ERROR;
+    }
+    else if (MatrixView_as_matrix(B, &b_mat) == OK)
+    {
+        status = Matrix_dot_into(dst, a, &b_mat);
+    }
+    else if (MatrixView_as_matrix(&Bt, &b_mat) == OK)
+    {
+        // B is the transpose of a plain block, e.g. keys of an attention head: use the B^T product directly
+        status = Matrix_dot_transposed_into(dst, a, &b_mat);
+    }
+    else if ((b_tmp = MatrixView_to_matrix(B)) != NULL)
+    {
+        status = Matrix_dot_into(dst, a, b_tmp);
+    }
+    else
+    {
+        status = ERROR;
+    }
+
+    Matrix_free(a_tmp);
+    Matrix_free(b_tmp);
+    return status;
+}
+
+void
+MatrixView_apply_along_rows(MatrixView *V, mat_apply_along_t f)
 {
-    return NOT_IMPLEMENTED;
+    float tmp[V->c > 0 ? V->c : 1];
+    for (int i = 0; i < V->r; i++)
+    {
+        float *row = MatrixView_row(V, i);
+        if (row != NULL)
+        {
+            f(row, V->c);
+            continue;
+        }
+        for (int j = 0; j < V->c; j++)
+        {
+            tmp[j] = MatrixView_get(V, i, j);
+        }
+        f(tmp, V->c);
+        for (int j = 0; j < V->c; j++)
+        {
+            MatrixView_set(V, i, j, tmp[j]);
+        }
+    }
 }
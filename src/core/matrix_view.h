@@ -4,18 +4,91 @@
 #include "../shared/errors.h"
 #include "matrix.h"
 
+/*
+ * Zero-copy window on a Matrix: an offset, a shape and a stride per dimension, plus optional row/column index lists.
+ * Element (i, j) of the view is
+ *   data[offset + row(i) * row_stride + col(j) * col_stride]
+ * where row(i) is rows_idx[i] when rows were selected by indexes, i otherwise (same for columns).
+ *
+ * Selections narrow the view in place and never copy the matrix data: a view is only valid as long as the viewed
+ * matrix is alive, and writes through the view are visible in the matrix.
+ */
 typedef struct matrix_view MatrixView;
 
+/*
+ * Create a view on the whole matrix
+ */
 MatrixView *MatrixView_new(Matrix *M);
 
-CallmStatusCode MatrixView_select_rows_by_nb(MatrixView *M, int from_row, int nb_rows);
+/*
+ * Create an independent copy of a view (on the same matrix)
+ */
+MatrixView *MatrixView_clone(const MatrixView *V);
 
-CallmStatusCode MatrixView_select_columns_by_nb(MatrixView *M, int from_col, int nb_cols);
+CallmStatusCode MatrixView_free(MatrixView *V);
 
-CallmStatusCode MatrixView_select_rows_by_indexes(MatrixView *M, int *rows_idx);
+int MatrixView_rows(const MatrixView *V);
 
-CallmStatusCode MatrixView_select_columns_by_indexes(MatrixView *M, int *cols_idx);
+int MatrixView_cols(const MatrixView *V);
 
-CallmStatusCode MatrixView_free(MatrixView *M);
+/*
+ * Keep the rows [from_row, from_row + nb_rows) of the view
+ */
+CallmStatusCode MatrixView_select_rows_by_nb(MatrixView *V, int from_row, int nb_rows);
+
+/*
+ * Keep the columns [from_col, from_col + nb_cols) of the view
+ */
+CallmStatusCode MatrixView_select_columns_by_nb(MatrixView *V, int from_col, int nb_cols);
+
+/*
+ * Keep the nb_rows rows of the view given by their index (indexes may repeat). rows_idx is copied.
+ */
+CallmStatusCode MatrixView_select_rows_by_indexes(MatrixView *V, const int *rows_idx, int nb_rows);
+
+/*
+ * Keep the nb_cols columns of the view given by their index (indexes may repeat). cols_idx is copied.
+ */
+CallmStatusCode MatrixView_select_columns_by_indexes(MatrixView *V, const int *cols_idx, int nb_cols);
+
+/*
+ * Transpose the view by swapping its dimensions (no data is moved)
+ */
+CallmStatusCode MatrixView_transpose(MatrixView *V);
+
+float MatrixView_get(const MatrixView *V, int row, int col);
+
+void MatrixView_set(MatrixView *V, int row, int col, float value);
+
+/*
+ * Returns a pointer to the first element of row i when the elements of a row are contiguous in memory (unit column
+ * stride, no column index list), NULL otherwise
+ */
+float *MatrixView_row(const MatrixView *V, int i);
+
+/*
+ * When the view is a plain strided block of its matrix (unit column stride, no index list), fills out with a non-owning
+ * Matrix on the same data and returns OK. Returns ERROR otherwise.
+ */
+CallmStatusCode MatrixView_as_matrix(const MatrixView *V, Matrix *out);
+
+/*
+ * Copy the elements of the view into a new (contiguous) matrix
+ */
+Matrix *MatrixView_to_matrix(const MatrixView *V);
+
+/*
+ * dst = A . B, with dst of shape rows(A) x cols(B).
+ * Plain strided views are handed to the GEMM/GEMV kernels as they are, and so are transposed plain views for B (they
+ * match the [out, in] layout of gemm_f32_nt): per-head or per-token slices don't cost any copy. Other views (index
+ * lists, transposed A) are gathered into a temporary matrix first.
+ */
+CallmStatusCode MatrixView_dot_into(Matrix *dst, const MatrixView *A, const MatrixView *B);
+
+/*
+ * Applies f (e.g. softmax) in place on each row of the view. Rows that aren't contiguous are gathered into a
+ * temporary buffer and written back.
+ */
+void MatrixView_apply_along_rows(MatrixView *V, mat_apply_along_t f);
 
 #endif  // !MATRIX_VIEW_H
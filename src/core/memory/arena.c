@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "arena.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+/* Blocks of the thread local arenas, grown on demand */
+#define ARENA_THREAD_BLOCK_SIZE (1024 * 1024)
+
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+struct arena
+{
+    ArenaBlock *blocks;
+    size_t nb_blocks;
+    size_t blocks_size;  // allocated length of blocks
+    size_t current;      // block serving the allocations
+    size_t block_size;
+    size_t used;
+    size_t high_water;
+    size_t nb_allocs;
+    size_t nb_block_allocs;
+};
+
+Arena *
+Arena_new(size_t block_size)
+{
+    Arena *a = calloc(1, sizeof(Arena));
+    if (a == NULL)
+        return NULL;
+    a->block_size = block_size > 0 ? block_size : ARENA_THREAD_BLOCK_SIZE;
+    return a;
+}
+
+static void
+free_blocks(Arena *a)
+{
+    for (size_t i = 0; i < a->nb_blocks; i++)
+        free(a->blocks[i].data);
+    a->nb_blocks = 0;
+    a->current = 0;
+}
+
+void
+Arena_free(Arena *a)
+{
+    if (a == NULL)
+        return;
+    free_blocks(a);
+    free(a->blocks);
+    free(a);
+}
+
+static size_t
+align_up(size_t n)
+{
+    return (n + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+/* Fills block with a heap buffer of at least size bytes */
+static int
+block_init(Arena *a, ArenaBlock *block, size_t size)
+{
+    void *data = NULL;
+    size = align_up(size > a->block_size ? size : a->block_size);
+    if (posix_memalign(&data, ARENA_ALIGNMENT, size) != 0)
+        return 0;
+    block->data = (char *) data;
+    block->size = size;
+    block->used = 0;
+    a->nb_block_allocs++;
+    return 1;
+}
+
+/* Makes the block after the current one able to serve size bytes, returns 0 when out of memory */
+static int
+next_block(Arena *a, size_t size)
+{
+    size_t next = a->nb_blocks == 0 ? 0 : a->current + 1;
+    if (next < a->nb_blocks)
+    {
+        // Released blocks are reused, unless too small: they are all empty from here on
+        if (a->blocks[next].size >= size)
+        {
+            a->current = next;
+            return 1;
+        }
+        free(a->blocks[next].data);
+        a->blocks[next].data = NULL;
+        if (!block_init(a, &a->blocks[next], size))
+            return 0;
+        a->current = next;
+        return 1;
+    }
+
+    if (a->nb_blocks == a->blocks_size)
+    {
+        size_t blocks_size = a->blocks_size > 0 ? 2 * a->blocks_size : 4;
+        ArenaBlock *blocks = realloc(a->blocks, blocks_size * sizeof(ArenaBlock));
+        if (blocks == NULL)
+            return 0;
+        a->blocks = blocks;
+        a->blocks_size = blocks_size;
+    }
+    if (!block_init(a, &a->blocks[a->nb_blocks], size))
+        return 0;
+    a->current = a->nb_blocks++;
+    return 1;
+}
+
+void *
+Arena_alloc(Arena *a, size_t size)
+{
+    size = align_up(size > 0 ? size : 1);
+    if (a->nb_blocks == 0 || a->blocks[a->current].size - a->blocks[a->current].used < size)
+    {
+        if (!next_block(a, size))
+            return NULL;
+    }
+
+    ArenaBlock *block = &a->blocks[a->current];
+    void *ptr = block->data + block->used;
+    block->used += size;
+    a->used += size;
+    if (a->used > a->high_water)
+        a->high_water = a->used;
+    a->nb_allocs++;
+    return ptr;
+}
+
+ArenaMark
+Arena_mark(const Arena *a)
+{
+    ArenaMark mark = { a->current, a->nb_blocks > 0 ? a->blocks[a->current].used : 0, a->used };
+    return mark;
+}
+
+void
+Arena_release(Arena *a, ArenaMark mark)
+{
+    if (mark.used == 0)
+    {
+        Arena_reset(a);
+        return;
+    }
+    for (size_t i = mark.block + 1; i < a->nb_blocks; i++)
+        a->blocks[i].used = 0;
+    a->current = mark.block;
+    a->blocks[mark.block].used = mark.offset;
+    a->used = mark.used;
+}
+
+void
+Arena_reset(Arena *a)
+{
+    if (a->nb_blocks > 1)
+    {
+        // One block large enough for the whole of the previous passes (or none when out of memory, the next
+        // allocation tries again)
+        free_blocks(a);
+        next_block(a, a->high_water);
+    }
+    if (a->nb_blocks > 0)
+        a->blocks[0].used = 0;
+    a->current = 0;
+    a->used = 0;
+}
+
+void
+Arena_stats(const Arena *a, ArenaStats *stats)
+{
+    stats->used = a->used;
+    stats->high_water = a->high_water;
+    stats->capacity = 0;
+    for (size_t i = 0; i < a->nb_blocks; i++)
+        stats->capacity += a->blocks[i].size;
+    stats->nb_blocks = a->nb_blocks;
+    stats->nb_allocs = a->nb_allocs;
+    stats->nb_block_allocs = a->nb_block_allocs;
+}
+
+static pthread_key_t thread_arena_key;
+static pthread_once_t thread_arena_once = PTHREAD_ONCE_INIT;
+
+static void
+free_thread_arena(void *arena)
+{
+    Arena_free((Arena *) arena);
+}
+
+static void
+create_thread_arena_key(void)
+{
+    pthread_key_create(&thread_arena_key, free_thread_arena);
+}
+
+Arena *
+Arena_thread_local(void)
+{
+    pthread_once(&thread_arena_once, create_thread_arena_key);
+    Arena *a = pthread_getspecific(thread_arena_key);
+    if (a == NULL)
+    {
+        a = Arena_new(ARENA_THREAD_BLOCK_SIZE);
+        if (a != NULL && pthread_setspecific(thread_arena_key, a) != 0)
+        {
+            Arena_free(a);
+            a = NULL;
+        }
+    }
+    return a;
+}
@@ -0,0 +1,106 @@
+#ifndef CALLM_ARENA_H
+#define CALLM_ARENA_H
+
+#include <stddef.h>
+
+/* Alignment of every allocation: a cache line, which is also the width of an AVX-512 register */
+#define ARENA_ALIGNMENT 64
+
+/*
+ * Bump allocator for short-lived buffers, e.g. the intermediates of a forward pass. Allocations are carved out of
+ * large blocks, and all released at once by going back to a mark. An arena is not thread safe: each thread uses its
+ * own (see Arena_thread_local).
+ */
+typedef struct arena Arena;
+
+/* Position in an arena, to release everything allocated after it */
+typedef struct
+{
+    size_t block;
+    size_t offset;
+    size_t used;
+} ArenaMark;
+
+typedef struct
+{
+    size_t used;        // bytes handed out since the last reset, alignment included
+    size_t high_water;  // largest value of used so far
+    size_t capacity;    // bytes held in blocks
+    size_t nb_blocks;
+    size_t nb_allocs;        // allocations served since the arena was created
+    size_t nb_block_allocs;  // blocks allocated from the heap since the arena was created
+} ArenaStats;
+
+/**
+ * Init a new empty arena. No memory is held until the first allocation.
+ *
+ * @param block_size minimal size of the blocks allocated from the heap
+ * @return new arena, or NULL when it could not be allocated
+ */
+Arena *
+Arena_new(size_t block_size);
+
+/**
+ * Free the arena and every buffer allocated from it.
+ *
+ * @param a
+ */
+void
+Arena_free(Arena *a);
+
+/**
+ * Allocate size bytes, ARENA_ALIGNMENT aligned. A new block is only taken from the heap when the current ones are full.
+ *
+ * @param a
+ * @param size
+ * @return the buffer, valid until the arena is reset or released before it, or NULL when out of memory
+ */
+void *
+Arena_alloc(Arena *a, size_t size);
+
+/**
+ * Returns the current position of the arena.
+ *
+ * @param a
+ * @return
+ */
+ArenaMark
+Arena_mark(const Arena *a);
+
+/**
+ * Release every buffer allocated after mark. Blocks are kept for the next allocations.
+ *
+ * @param a
+ * @param mark
+ */
+void
+Arena_release(Arena *a, ArenaMark mark);
+
+/**
+ * Release every buffer. When the arena had to grow over several blocks, they are merged into a single block of the
+ * high-water mark size, so that the next passes of a steady workload are served without touching the heap.
+ *
+ * @param a
+ */
+void
+Arena_reset(Arena *a);
+
+/**
+ * Fill stats with the usage of the arena.
+ *
+ * @param a
+ * @param stats
+ */
+void
+Arena_stats(const Arena *a, ArenaStats *stats);
+
+/**
+ * Returns the arena of the calling thread, created on first use and freed when the thread exits. Buffers of a
+ * function are released before it returns (Arena_mark / Arena_release), so that callers can use it for theirs.
+ *
+ * @return the arena, or NULL when it could not be allocated
+ */
+Arena *
+Arena_thread_local(void);
+
+#endif  // CALLM_ARENA_H
@@ -4,92 +4,180 @@
 
 #include <string.h>
 
-static unsigned int
+static size_t
 get_index_from_coordinates(MemBlock *b, size_t *coords, Error **err);
 
-struct memblock_iterator
-{
-    size_t current_iteration;
-    size_t max_iterations;
-    size_t *current_coords;
-
-    MemBlock *block;
-    size_t *mask;
-};
-
 struct memblock
 {
     float *data;
     size_t size;
     size_t *shape;
     size_t ndim;
-    size_t *index_scale;
+    size_t *strides;  // in elements, row-major
 
     unsigned int iterator_ref_cnt;
     MemBlockIterator **iterators;
     unsigned int iterators_size;
 };
 
-int
-MemBlockIterator_next(MemBlockIterator *i)
+void
+MemBlockIterator_init(MemBlockIterator *i, float *data, size_t ndim, const size_t *shape, const size_t *strides,
+                      const size_t *mask, Error **err)
 {
-    if (i->current_iteration >= i->max_iterations)
-        return -1;
-
-    for (size_t d = i->block->ndim; d != 0; d--)
+    memset(i, 0, sizeof(MemBlockIterator));
+    if (ndim > MEMBLOCK_MAX_DIMS)
     {
-        if (i->mask[d-1] == 0)
+        Error_with_message(err, "Too many dimensions to iterate over");
+        return;
+    }
+    for (size_t d = 0; mask != NULL && d < ndim; d++)
+    {
+        if (mask[d] != 0 && mask[d] != 1)
+        {
+            Error_with_message(err, "Shape mask must be 0 or 1");
+            return;
+        }
+    }
+    i->data = data;
+
+    // From the innermost dimension: iterated dimensions continuing the run of the previous ones are merged into the
+    // spans (a dimension of size 1 never breaks it), the others are walked by the iterator
+    size_t nb_outer = 0;
+    size_t outer_shape[MEMBLOCK_MAX_DIMS], outer_strides[MEMBLOCK_MAX_DIMS];
+    int merging = 1;
+    i->span_length = 1;
+    i->nb_spans = 1;
+    for (size_t d = ndim; d != 0; d--)
+    {
+        if (mask != NULL && mask[d - 1] == 0)
+        {
+            i->fixed_shape[i->nb_fixed] = shape[d - 1];
+            i->fixed_strides[i->nb_fixed] = strides[d - 1];
+            i->nb_fixed++;
             continue;
-        i->current_coords[d-1]++;
-        if (i->current_coords[d-1] < i->block->shape[d-1])
+        }
+        if (merging && (shape[d - 1] == 1 || strides[d - 1] == i->span_length))
         {
-            i->current_iteration++;
-            return 0;
+            i->span_length *= shape[d - 1];
+            continue;
         }
-        i->current_coords[d-1] = 0;
+        merging = 0;
+        outer_shape[nb_outer] = shape[d - 1];
+        outer_strides[nb_outer] = strides[d - 1];
+        nb_outer++;
+        i->nb_spans *= shape[d - 1];
     }
+    if (i->span_length == 0)
+        i->nb_spans = 0;
 
-    return -1;
+    // Both were filled innermost first
+    i->nb_outer = nb_outer;
+    for (size_t d = 0; d < nb_outer; d++)
+    {
+        i->outer_shape[d] = outer_shape[nb_outer - 1 - d];
+        i->outer_strides[d] = outer_strides[nb_outer - 1 - d];
+    }
+    for (size_t d = 0; d < i->nb_fixed / 2; d++)
+    {
+        size_t tmp = i->fixed_shape[d];
+        i->fixed_shape[d] = i->fixed_shape[i->nb_fixed - 1 - d];
+        i->fixed_shape[i->nb_fixed - 1 - d] = tmp;
+        tmp = i->fixed_strides[d];
+        i->fixed_strides[d] = i->fixed_strides[i->nb_fixed - 1 - d];
+        i->fixed_strides[i->nb_fixed - 1 - d] = tmp;
+    }
+
+    i->end = i->nb_spans;
 }
 
 void
-MemBlockIterator_set_val(MemBlockIterator *i, float val, size_t* coords, Error **err)
+MemBlockIterator_range(MemBlockIterator *i, size_t start, size_t end)
 {
-    size_t coord_idx = 0;
-    for (size_t d = i->block->ndim; d != 0; d--)
+    i->end = end < i->nb_spans ? end : i->nb_spans;
+    i->index = start;
+    i->offset = 0;
+
+    // Coordinates of span start, in the mixed radix of the outer shape
+    for (size_t d = i->nb_outer; d != 0; d--)
+    {
+        i->coords[d - 1] = start % i->outer_shape[d - 1];
+        start /= i->outer_shape[d - 1];
+        i->offset += i->coords[d - 1] * i->outer_strides[d - 1];
+    }
+}
+
+int
+MemBlockIterator_next(MemBlockIterator *i)
+{
+    if (i->index >= i->end)
+        return -1;
+    i->index++;
+    if (i->index >= i->end)
+        return -1;
+
+    // Odometer over the outer dimensions, only adding and subtracting strides
+    for (size_t d = i->nb_outer; d != 0; d--)
+    {
+        i->offset += i->outer_strides[d - 1];
+        if (++i->coords[d - 1] < i->outer_shape[d - 1])
+            break;
+        i->offset -= i->outer_shape[d - 1] * i->outer_strides[d - 1];
+        i->coords[d - 1] = 0;
+    }
+    return 0;
+}
+
+int
+MemBlockIterator_next_span(MemBlockIterator *i, MemBlockSpan *span)
+{
+    if (i->index >= i->end)
+        return -1;
+    span->data = i->data + i->offset;
+    span->length = i->span_length;
+    MemBlockIterator_next(i);
+    return 0;
+}
+
+/* Index of the element at coords along the dimensions outside of the mask, from the current span */
+static size_t
+get_fixed_index(MemBlockIterator *i, size_t *coords, Error **err)
+{
+    if (i->index >= i->end)
+    {
+        Error_with_message(err, "Iteration has ended");
+        return 0;
+    }
+    size_t index = i->offset;
+    for (size_t d = 0; d < i->nb_fixed; d++)
     {
-        if (i->mask[d] == 0)
+        if (coords[d] >= i->fixed_shape[d])
         {
-            i->current_coords[d] = coords[coord_idx];
-            coord_idx++;
+            Error_with_message(err, "Index out of bounds");
+            return 0;
         }
+        index += coords[d] * i->fixed_strides[d];
     }
+    return index;
+}
 
-    unsigned int index = get_index_from_coordinates(i->block, i->current_coords, err);
+void
+MemBlockIterator_set_val(MemBlockIterator *i, float val, size_t* coords, Error **err)
+{
+    size_t index = get_fixed_index(i, coords, err);
     if (*err != NULL)
         return;
 
-    i->block->data[index] = val;
+    i->data[index] = val;
 }
 
 float
 MemBlockIterator_get_val(MemBlockIterator *i, size_t* coords, Error **err)
 {
-    size_t coord_idx = 0;
-    for (size_t d = i->block->ndim; d != 0; d--)
-    {
-        if (i->mask[d] == 0)
-        {
-            i->current_coords[d] = coords[coord_idx];
-            coord_idx++;
-        }
-    }
-
-    unsigned int index = get_index_from_coordinates(i->block, i->current_coords, err);
+    size_t index = get_fixed_index(i, coords, err);
     if (*err != NULL)
         return 0;
 
-    return i->block->data[index];
+    return i->data[index];
 }
 
 MemBlock *
@@ -111,14 +199,15 @@ MemBlock_new(size_t ndim, size_t *shape, Error **err)
     if (ndim > 0)
     {
         b->shape = (size_t *) malloc(ndim * sizeof(size_t));
-        memcpy(b->shape, shape, ndim);
+        memcpy(b->shape, shape, ndim * sizeof(size_t));
     }
 
     b->size = 1;
     for (size_t i = 0; i < ndim; i++)
         b->size *= shape[i];
 
-    b->data = (float *) malloc(b->size * sizeof(float));
+    b->strides = NULL;
+    b->data = (float *) calloc(b->size, sizeof(float));
     if (b->data == NULL)
     {
         Error_with_message(err, "Could not allocate memory for tensor data");
@@ -126,13 +215,14 @@ MemBlock_new(size_t ndim, size_t *shape, Error **err)
         return NULL;
     }
 
-    b->index_scale = (size_t *) malloc(ndim * sizeof(size_t));
-    for (size_t i = 0; i < ndim; i++)
+    if (ndim > 0)
     {
-        b->index_scale[i] = 1;
-        for (size_t j = i + 1; j < ndim; j++)
+        b->strides = (size_t *) malloc(ndim * sizeof(size_t));
+        size_t stride = 1;
+        for (size_t i = ndim; i != 0; i--)
         {
-            b->index_scale[i] *= shape[j];
+            b->strides[i - 1] = stride;
+            stride *= shape[i - 1];
         }
     }
 
@@ -148,11 +238,11 @@ MemBlock_free(MemBlock *b)
         free(b->shape);
     if (b->data != NULL)
         free(b->data);
-    if (b->index_scale != NULL)
-        free(b->index_scale);
-    if (b->iterators != NULL && b->iterator_ref_cnt > 0)
-        for (size_t i = 0; i < b->iterator_ref_cnt; i++)
-            MemBlock_iterator_free(b, b->iterators[i]);
+    if (b->strides != NULL)
+        free(b->strides);
+    for (unsigned int i = 0; i < b->iterator_ref_cnt; i++)
+        free(b->iterators[i]);
+    free(b->iterators);
     free(b);
 }
 
@@ -174,11 +264,23 @@ MemBlock_ndim(MemBlock *b)
     return b->ndim;
 }
 
-static unsigned int
+size_t*
+MemBlock_strides(MemBlock *b)
+{
+    return b->strides;
+}
+
+float*
+MemBlock_data(MemBlock *b)
+{
+    return b->data;
+}
+
+static size_t
 get_index_from_coordinates(MemBlock *b, size_t *coords, Error **err)
 {
-    unsigned int index = 0;
-    for (int i = 0; i < b->ndim; i++)
+    size_t index = 0;
+    for (size_t i = 0; i < b->ndim; i++)
     {
         size_t c = coords[i];
         if (c >= b->shape[i])
@@ -186,7 +288,7 @@ get_index_from_coordinates(MemBlock *b, size_t *coords, Error **err)
             Error_with_message(err, "Index out of bounds");
             return 0;
         }
-        index += b->index_scale[i] * c;
+        index += b->strides[i] * c;
     }
     return index;
 }
@@ -194,7 +296,7 @@ get_index_from_coordinates(MemBlock *b, size_t *coords, Error **err)
 void
 MemBlock_set_val(MemBlock *b, float val, size_t* coords, Error **err)
 {
-    unsigned int index = get_index_from_coordinates(b, coords, err);
+    size_t index = get_index_from_coordinates(b, coords, err);
     if (*err != NULL)
         return;
 
@@ -204,7 +306,7 @@ MemBlock_set_val(MemBlock *b, float val, size_t* coords, Error **err)
 float
 MemBlock_get_val(MemBlock *b, size_t* coords, Error **err)
 {
-    unsigned int index = get_index_from_coordinates(b, coords, err);
+    size_t index = get_index_from_coordinates(b, coords, err);
     if (*err != NULL)
         return 0;
 
@@ -214,76 +316,33 @@ MemBlock_get_val(MemBlock *b, size_t* coords, Error **err)
 MemBlockIterator *
 MemBlock_iterate(MemBlock *b, size_t *shape_mask, Error **err)
 {
-    for (size_t i = 0; i < b->ndim; i++)
-    {
-        if (shape_mask[i] != 0 || shape_mask[i] != 1)
-        {
-            Error_with_message(err, "Shape mask must be 0 or 1");
-            return NULL;
-        }
-    }
-
-    // TODO: remove this when the behavior will be generalized
-    if (b->ndim <= 2)
+    MemBlockIterator *i = malloc(sizeof(MemBlockIterator));
+    if (i == NULL)
     {
-        Error_with_message(err, "For now, iterator doesn't supported blocks with ndim <= 3");
+        Error_with_message(err, "Could not allocate memory for an iterator");
         return NULL;
     }
-    for (size_t i = 0; i < b->ndim - 2; i++)
-    {
-        if (shape_mask[i] != 1)
-        {
-            Error_with_message(err, "For now, the only supported mask is {1, 1, ..., 1, 0, 0}");
-            return NULL;
-        }
-    }
-    if (shape_mask[b->ndim - 2] != 1 || shape_mask[b->ndim - 1] != 0)
+    MemBlockIterator_init(i, b->data, b->ndim, b->shape, b->strides, shape_mask, err);
+    if (*err != NULL)
     {
-        Error_with_message(err, "For now, the only supported mask is {1, 1, ..., 1, 0, 0}");
+        free(i);
         return NULL;
     }
 
-    MemBlockIterator *i = malloc(sizeof(MemBlockIterator));
-    b->iterator_ref_cnt++;
-    if (b->iterators == NULL)
+    if (b->iterator_ref_cnt == b->iterators_size)
     {
-        b->iterators = malloc(sizeof(MemBlockIterator *));
-        if (b->iterators == NULL)
+        unsigned int iterators_size = b->iterators_size > 0 ? 2 * b->iterators_size : 1;
+        MemBlockIterator **iterators = realloc(b->iterators, sizeof(MemBlockIterator *) * iterators_size);
+        if (iterators == NULL)
         {
-            b->iterator_ref_cnt--;
+            free(i);
             Error_with_message(err, "Could not allocate memory for iterators");
             return NULL;
         }
-        b->iterators_size = 1;
-    }
-    else if (b->iterator_ref_cnt > b->iterators_size)
-    {
-        b->iterators = realloc(b->iterators, sizeof(MemBlockIterator *) * b->iterator_ref_cnt);
-        if (b->iterators == NULL)
-        {
-            b->iterator_ref_cnt--;
-            Error_with_message(err, "Could not reallocate memory for iterators");
-            return NULL;
-        }
+        b->iterators = iterators;
+        b->iterators_size = iterators_size;
     }
-
-    i->block = b;
-
-    i->mask = (size_t *) malloc(b->ndim * sizeof(size_t));
-    memcpy(i->mask, shape_mask, b->ndim);
-
-    i->current_coords = (size_t *) malloc(b->ndim * sizeof(size_t));
-    for (size_t j = 0; j < b->ndim; j++)
-        i->current_coords[j] = 0;
-
-    i->max_iterations = 1;
-    for (size_t j = 0; j < b->ndim; j++)
-    {
-        if (shape_mask[j] == 1)
-            i->max_iterations *= b->shape[j];
-    }
-
-    b->iterators[b->iterator_ref_cnt - 1] = i;
+    b->iterators[b->iterator_ref_cnt++] = i;
 
     return i;
 }
@@ -294,23 +353,14 @@ MemBlock_iterator_free(MemBlock *b, MemBlockIterator *i)
     if (b == NULL || i == NULL)
         return;
 
-    if (b->iterator_ref_cnt > 0 && b->iterators != NULL)
+    for (unsigned int j = 0; j < b->iterator_ref_cnt; j++)
     {
-        MemBlockIterator *it;
-        for (unsigned int j = 0; j < b->iterator_ref_cnt; j++)
+        if (b->iterators[j] == i)
         {
-            it = b->iterators[j];
-            if (it == i)
-            {
-                if (it->mask != NULL)
-                    free(it->mask);
-                if (it->current_coords != NULL)
-                    free(it->current_coords);
-                free(it);
-
-                b->iterators[j] = b->iterators[b->iterator_ref_cnt - 1];
-                b->iterator_ref_cnt--;
-            }
+            b->iterators[j] = b->iterators[b->iterator_ref_cnt - 1];
+            b->iterator_ref_cnt--;
+            free(i);
+            break;
         }
     }
 
@@ -320,6 +370,4 @@ MemBlock_iterator_free(MemBlock *b, MemBlockIterator *i)
         b->iterators = NULL;
         b->iterators_size = 0;
     }
-
-    free(i);
 }
@@ -17,9 +17,90 @@
             varname[j] = tmp[j]; \
     } while (0);
 
-typedef struct memblock_iterator MemBlockIterator;
+/* Maximal number of dimensions of an iterated block */
+#define MEMBLOCK_MAX_DIMS 8
+
+/*
+ * Walks a strided N-d buffer (a memory block, or any view over one) over the dimensions selected by a mask, by
+ * contiguous spans: the innermost iterated dimensions that are contiguous in memory are merged into a single run of
+ * floats, so a kernel gets a pointer and a length it can vectorise instead of one element at a time. Everything is
+ * precomputed when the iterator is created, a step only adds strides.
+ *
+ * Spans are numbered from 0 to nb_spans - 1 in row-major order of the iterated dimensions, an iterator can be
+ * restricted to a range of them (MemBlockIterator_range): it is a plain value, each worker of a parallel loop copies
+ * it and walks its own range.
+ *
+ * Fields are read-only.
+ */
+typedef struct memblock_iterator
+{
+    float *data;
+    size_t nb_spans;
+    size_t span_length;  // floats per span (1 when the innermost iterated dimension is strided)
+
+    // Iterated dimensions left after merging the contiguous ones into the spans, outermost first
+    size_t nb_outer;
+    size_t outer_shape[MEMBLOCK_MAX_DIMS];
+    size_t outer_strides[MEMBLOCK_MAX_DIMS];
+
+    // Dimensions outside of the mask, addressed by MemBlockIterator_get_val / MemBlockIterator_set_val
+    size_t nb_fixed;
+    size_t fixed_shape[MEMBLOCK_MAX_DIMS];
+    size_t fixed_strides[MEMBLOCK_MAX_DIMS];
+
+    size_t coords[MEMBLOCK_MAX_DIMS];  // of the current span on the outer dimensions
+    size_t offset;                     // of the current span from data, in elements
+    size_t index;                      // of the current span
+    size_t end;                        // last span of the range + 1
+} MemBlockIterator;
+
+/*
+ * Contiguous run of floats
+ */
+typedef struct
+{
+    float *data;
+    size_t length;
+} MemBlockSpan;
+
+/**
+ * Init an iterator over a strided buffer, e.g. a tensor view.
+ *
+ * @param i iterator to fill
+ * @param data first element
+ * @param ndim number of dimensions (at most MEMBLOCK_MAX_DIMS)
+ * @param shape size of each dimension
+ * @param strides number of elements between two consecutive indices of each dimension
+ * @param mask array of 0 or 1: iterations are only performed along the dimensions marked as 1. NULL to iterate over
+ *             every dimension.
+ * @param err
+ */
+void
+MemBlockIterator_init(MemBlockIterator *i, float *data, size_t ndim, const size_t *shape, const size_t *strides,
+                      const size_t *mask, Error **err);
 
 /**
+ * Restrict the iterator to the spans [start, end) and move it to start, e.g. the range of a parallel worker.
+ *
+ * @param i
+ * @param start
+ * @param end clamped to nb_spans
+ */
+void
+MemBlockIterator_range(MemBlockIterator *i, size_t start, size_t end);
+
+/**
+ * Get the current span and move to the next one.
+ *
+ * @param i
+ * @param span filled with the current span
+ * @return -1 when iteration ends (span is left untouched), or 0 else.
+ */
+int
+MemBlockIterator_next_span(MemBlockIterator *i, MemBlockSpan *span);
+
+/**
+ * Move to the next span.
  *
  * @param i
  * @return -1 when iteration ends, or 0 else.
@@ -28,21 +109,21 @@ int
 MemBlockIterator_next(MemBlockIterator *i);
 
 /**
- * Set or update a value at a given memory block location.
+ * Set or update a value at a given location relative to the first element of the current span.
  *
  * @param i
  * @param val value to set
- * @param coords array of coordinates (must exist)
+ * @param coords array of coordinates along the dimensions outside of the mask, outermost first (must exist)
  * @param err
  */
 void
 MemBlockIterator_set_val(MemBlockIterator *i, float val, size_t* coords, Error **err);
 
 /**
- * Get the value corresponding to the specified memory location.
+ * Get the value at a given location relative to the first element of the current span.
  *
  * @param i
- * @param coords array of coordinates (must exist)
+ * @param coords array of coordinates along the dimensions outside of the mask, outermost first (must exist)
  * @param err
  * @return
  */
@@ -53,7 +134,7 @@ MemBlockIterator_get_val(MemBlockIterator *i, size_t* coords, Error **err);
 typedef struct memblock MemBlock;
 
 /**
- * Init a new memory block manager for floats.
+ * Init a new memory block manager for floats: a single zeroed, contiguous row-major buffer.
  *
  * @param ndim
  * @param shape Not owned by the block
@@ -80,6 +161,25 @@ MemBlock_shape(MemBlock *b);
 size_t
 MemBlock_ndim(MemBlock *b);
 
+/**
+ * Returns the number of elements between two consecutive indices of each dimension (row-major: the last one is 1).
+ * NULL for a scalar block.
+ *
+ * @param b
+ * @return
+ */
+size_t*
+MemBlock_strides(MemBlock *b);
+
+/**
+ * Returns the contiguous buffer of the block, owned by the block.
+ *
+ * @param b
+ * @return
+ */
+float*
+MemBlock_data(MemBlock *b);
+
 /**
  * Set or update a value at a given memory block location.
  *
@@ -103,7 +203,8 @@ float
 MemBlock_get_val(MemBlock *b, size_t* coords, Error **err);
 
 /**
- * Create an iterator.
+ * Create an iterator over the block, freed with it unless MemBlock_iterator_free is called before.
+ * For a stack iterator, MemBlockIterator_init with the data, shape and strides of the block.
  *
  * @param b
  * @param shape_mask array of 0 or 1. Iterations will only be performed to dimensions marked as 1.
@@ -0,0 +1,239 @@
+#include "pack.h"
+#include "../shared/logging.h"
+#include "quant.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A tensor to write, either straight from the source file or converted */
+typedef struct
+{
+    const char *name;
+    enum Dtype dtype;
+    int group_size;
+    int shape[SAFETENSORS_MAX_DIMS];
+    int shape_size;
+    const void *data;
+    size_t nb_bytes;
+    Weights *converted;  // owns data when the tensor was quantised
+    char *file_content;  // owns data for embedded files
+} PackItem;
+
+/*
+ * Precision the model asks for when loading a tensor, as selected by the quantization section of the config: mirrors
+ * the loaders of the attention, MLP and embeddings layers
+ */
+static WeightsDtype
+packed_dtype(const Config *config, const char *name, WeightsDtype stored)
+{
+    if (config == NULL)
+    {
+        return stored;
+    }
+    int quantized = (config->quantize_attention && strstr(name, ".self_attn.") != NULL)
+                    || (config->quantize_mlp && strstr(name, ".mlp.") != NULL)
+                    || (config->quantize_lm_head
+                        && (strstr(name, "embed_tokens") != NULL || strstr(name, "lm_head") != NULL));
+    return quantized ? config->quantization_dtype : stored;
+}
+
+static enum Dtype
+file_dtype(WeightsDtype dtype)
+{
+    switch (dtype)
+    {
+    case WEIGHTS_BF16:
+        return BF16;
+    case WEIGHTS_Q8:
+        return Q8;
+    case WEIGHTS_Q4:
+        return Q4;
+    case WEIGHTS_Q4_MIN:
+        return Q4_MIN;
+    default:
+        return F32;
+    }
+}
+
+static CallmStatusCode
+read_file(const char *path, char **content, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        LOGF_ERROR("Failed to open %s", path);
+        return ERROR;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    *content = malloc(file_size > 0 ? file_size : 1);
+    CHECK_MALLOC_PANIC(*content, "packed file content");
+    *size = fread(*content, 1, file_size, file);
+    fclose(file);
+    if (*size != (size_t) file_size)
+    {
+        LOGF_ERROR("Failed to read %s", path);
+        free(*content);
+        return ERROR;
+    }
+    return OK;
+}
+
+/*
+ * Fills the item of a tensor of st, converting it when the config quantises it
+ */
+static CallmStatusCode
+PackItem_from_tensor(PackItem *item, const Safetensors *st, const Config *config, const char *name)
+{
+    item->name = name;
+    if (Safetensors_tensor_info(st, name, &item->dtype, &item->group_size, item->shape, &item->shape_size) != OK)
+    {
+        return ERROR;
+    }
+    item->data = Safetensors_tensor_data(st, name, &item->nb_bytes);
+
+    // Only the matrices of the selected layers, if their rows split in groups
+    int group_size = config != NULL ? config->quantization_group_size : 0;
+    if (item->shape_size != 2 || (item->dtype != F32 && item->dtype != BF16))
+    {
+        return OK;
+    }
+    WeightsDtype stored = item->dtype == BF16 ? WEIGHTS_BF16 : WEIGHTS_F32;
+    WeightsDtype dtype = packed_dtype(config, name, stored);
+    int group = dtype == WEIGHTS_Q8 ? QK8 : group_size;
+    if (dtype == stored || item->shape[1] % group != 0)
+    {
+        return OK;
+    }
+
+    item->converted = Safetensors_load_weights_as(name, st, dtype, group_size);
+    item->dtype = file_dtype(dtype);
+    item->group_size = item->converted->group_size;
+    item->data = item->converted->data;
+    item->nb_bytes = Weights_nbytes(item->converted);
+    return OK;
+}
+
+static CallmStatusCode
+PackItem_from_file(PackItem *item, const char *name, const char *path)
+{
+    item->name = name;
+    item->dtype = U8;
+    if (read_file(path, &item->file_content, &item->nb_bytes) != OK)
+    {
+        return ERROR;
+    }
+    item->data = item->file_content;
+    item->shape_size = 1;
+    item->shape[0] = (int) item->nb_bytes;
+    return OK;
+}
+
+static size_t
+align_up(size_t offset, size_t alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+static CallmStatusCode
+write_items(const char *out_path, const PackItem *items, int nb_items)
+{
+    PackHeader header;
+    memset(&header, 0, sizeof(PackHeader));
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.nb_entries = nb_items;
+    header.names_offset = sizeof(PackHeader) + (size_t) nb_items * sizeof(PackEntry);
+
+    PackEntry *entries = calloc(nb_items > 0 ? nb_items : 1, sizeof(PackEntry));
+    CHECK_MALLOC_PANIC(entries, "packed entries");
+    for (int i = 0; i < nb_items; i++)
+    {
+        entries[i].name_offset = header.names_size;
+        header.names_size += strlen(items[i].name) + 1;
+    }
+    size_t offset = header.names_offset + header.names_size;
+    for (int i = 0; i < nb_items; i++)
+    {
+        offset = align_up(offset, items[i].nb_bytes >= PACK_HUGE_ALIGNMENT ? PACK_HUGE_ALIGNMENT : PACK_ALIGNMENT);
+        entries[i].offset = offset;
+        entries[i].nb_bytes = items[i].nb_bytes;
+        entries[i].dtype = items[i].dtype;
+        entries[i].group_size = items[i].group_size;
+        entries[i].shape_size = items[i].shape_size;
+        memcpy(entries[i].shape, items[i].shape, items[i].shape_size * sizeof(int));
+        offset += items[i].nb_bytes;
+    }
+    header.file_size = offset;
+
+    FILE *file = fopen(out_path, "wb");
+    if (file == NULL)
+    {
+        LOGF_ERROR("Failed to create %s", out_path);
+        free(entries);
+        return ERROR;
+    }
+    int written = fwrite(&header, sizeof(PackHeader), 1, file) == 1
+                  && fwrite(entries, sizeof(PackEntry), nb_items, file) == (size_t) nb_items;
+    for (int i = 0; written && i < nb_items; i++)
+    {
+        written = fwrite(items[i].name, 1, strlen(items[i].name) + 1, file) == strlen(items[i].name) + 1;
+    }
+    for (int i = 0; written && i < nb_items; i++)
+    {
+        // Seeking over the padding leaves holes
+        written = fseek(file, (long) entries[i].offset, SEEK_SET) == 0
+                  && fwrite(items[i].data, 1, items[i].nb_bytes, file) == items[i].nb_bytes;
+    }
+    written = fclose(file) == 0 && written;
+    free(entries);
+    if (!written)
+    {
+        LOGF_ERROR("Failed to write %s", out_path);
+        return ERROR;
+    }
+    LOGF_INFO("Packed %d tensors into %s (%zu bytes)", nb_items, out_path, (size_t) header.file_size);
+    return OK;
+}
+
+CallmStatusCode
+Pack_write(const char *out_path, const Safetensors *st, const Config *config, const char *config_path,
+           const char *tokenizer_path)
+{
+    int nb_tensors = Safetensors_nb_tensors(st);
+    PackItem *items = calloc(nb_tensors + 2, sizeof(PackItem));
+    CHECK_MALLOC_PANIC(items, "packed items");
+
+    CallmStatusCode status = OK;
+    int nb_items = 0;
+    for (int i = 0; status == OK && i < nb_tensors; i++)
+    {
+        const char *name = Safetensors_tensor_name(st, i);
+        if (strcmp(name, PACK_CONFIG_TENSOR) == 0 || strcmp(name, PACK_TOKENIZER_TENSOR) == 0)
+        {
+            continue;  // repacking a packed model: the files given replace them
+        }
+        status = PackItem_from_tensor(&items[nb_items++], st, config, name);
+    }
+    if (status == OK && config_path != NULL)
+    {
+        status = PackItem_from_file(&items[nb_items++], PACK_CONFIG_TENSOR, config_path);
+    }
+    if (status == OK && tokenizer_path != NULL)
+    {
+        status = PackItem_from_file(&items[nb_items++], PACK_TOKENIZER_TENSOR, tokenizer_path);
+    }
+    if (status == OK)
+    {
+        status = write_items(out_path, items, nb_items);
+    }
+
+    for (int i = 0; i < nb_items; i++)
+    {
+        Weights_free(items[i].converted);
+        free(items[i].file_content);
+    }
+    free(items);
+    return status;
+}
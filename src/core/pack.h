@@ -0,0 +1,61 @@
+#ifndef CALLM_PACK_H
+#define CALLM_PACK_H
+
+#include "../shared/errors.h"
+#include "config.h"
+#include "safetensors.h"
+#include <stdint.h>
+
+/*
+ * Packed model: a single file holding the weights in the layout the kernels run on, so that loading it is mapping it.
+ * Tensors selected by the quantization section of the config are stored quantised (rows laid out as in quant.h), the
+ * others as they were read. The config and the tokenizer model files are embedded as byte tensors.
+ *
+ * Layout (little endian):
+ *   - PackHeader
+ *   - nb_entries PackEntry, one per tensor
+ *   - the names of the tensors, null terminated, back to back
+ *   - the tensors data: each tensor starts on a PACK_ALIGNMENT boundary, and tensors of at least PACK_HUGE_ALIGNMENT
+ *     bytes on a PACK_HUGE_ALIGNMENT one (huge pages). Padding is left as holes in the file.
+ *
+ * Safetensors_new recognises packed files by their magic, their tensors are then loaded like any other.
+ */
+#define PACK_MAGIC "CALLMPAK"
+#define PACK_VERSION 1
+#define PACK_ALIGNMENT 4096
+#define PACK_HUGE_ALIGNMENT (2 * 1024 * 1024)
+
+/* Names of the embedded files */
+#define PACK_CONFIG_TENSOR "__callm_config__"
+#define PACK_TOKENIZER_TENSOR "__callm_tokenizer__"
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_entries;
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t file_size;
+} PackHeader;
+
+typedef struct
+{
+    uint64_t name_offset;  // in the names
+    uint64_t offset;       // absolute
+    uint64_t nb_bytes;
+    int32_t dtype;  // enum Dtype
+    int32_t group_size;
+    int32_t shape_size;
+    int32_t shape[SAFETENSORS_MAX_DIMS];
+    int32_t reserved;
+} PackEntry;
+
+/*
+ * Writes every tensor of st into a packed model at out_path, quantising the weights config selects (NULL: none).
+ * config_path and tokenizer_path are the files to embed, each may be NULL.
+ */
+CallmStatusCode Pack_write(const char *out_path, const Safetensors *st, const Config *config, const char *config_path,
+                           const char *tokenizer_path);
+
+#endif  // CALLM_PACK_H
@@ -0,0 +1,529 @@
+#include "quant.h"
+#include "../shared/logging.h"
+#include "cpu.h"
+#include "gemm.h"
+#include "memory/arena.h"
+#include "threadpool.h"
+#include <immintrin.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* Minimal number of multiply-adds a thread must get before a product is split (see gemv.c) */
+#define QUANT_MIN_WORK_PER_THREAD (256 * 1024)
+/* Output ranges handed to threads are multiples of this, so no two threads write the same cache line of C */
+#define QUANT_RANGE_ALIGNMENT 16
+
+void
+quantize_row_q8(BlockQ8 *dst, const float *src, int k)
+{
+    for (int b = 0; b < k / QK8; b++)
+    {
+        const float *x = src + b * QK8;
+        float amax = 0.0f;
+        for (int j = 0; j < QK8; j++)
+        {
+            amax = fmaxf(amax, fabsf(x[j]));
+        }
+
+        float d = amax / 127.0f;
+        float id = d != 0.0f ? 1.0f / d : 0.0f;
+        dst[b].d = d;
+        for (int j = 0; j < QK8; j++)
+        {
+            dst[b].qs[j] = (int8_t) lrintf(x[j] * id);
+        }
+    }
+}
+
+void
+dequantize_row_q8(float *dst, const BlockQ8 *src, int k)
+{
+    for (int b = 0; b < k / QK8; b++)
+    {
+        for (int j = 0; j < QK8; j++)
+        {
+            dst[b * QK8 + j] = src[b].d * src[b].qs[j];
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* Dot products of nb Q8 blocks                                                                                     */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+typedef float (*dot_q8_t)(int nb, const BlockQ8 *w, const BlockQ8 *x);
+
+static float
+dot_q8_scalar(int nb, const BlockQ8 *w, const BlockQ8 *x)
+{
+    float sum = 0.0f;
+    for (int b = 0; b < nb; b++)
+    {
+        int32_t isum = 0;
+        for (int j = 0; j < QK8; j++)
+        {
+            isum += (int32_t) w[b].qs[j] * x[b].qs[j];
+        }
+        sum += w[b].d * x[b].d * (float) isum;
+    }
+    return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2,fma"))) static inline float
+hsum_avx2(__m256 v)
+{
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+    return _mm_cvtss_f32(lo);
+}
+
+/*
+ * maddubs multiplies unsigned by signed bytes: the sign of x is moved onto w so that |x| can be the unsigned operand.
+ * With |q| <= 127 the pairwise int16 sums (at most 2 * 127 * 127) never saturate.
+ */
+__attribute__((target("avx2,fma"))) static inline __m256i
+block_dot_avx2(const BlockQ8 *w, const BlockQ8 *x)
+{
+    __m256i qw = _mm256_loadu_si256((const __m256i *) w->qs);
+    __m256i qx = _mm256_loadu_si256((const __m256i *) x->qs);
+    __m256i pairs = _mm256_maddubs_epi16(_mm256_sign_epi8(qx, qx), _mm256_sign_epi8(qw, qx));
+    return _mm256_madd_epi16(pairs, _mm256_set1_epi16(1));
+}
+
+__attribute__((target("avx2,fma"))) static float
+dot_q8_avx2(int nb, const BlockQ8 *w, const BlockQ8 *x)
+{
+    // Two accumulators to hide the FMA latency
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int b = 0;
+    for (; b + 2 <= nb; b += 2)
+    {
+        __m256 d0 = _mm256_set1_ps(w[b].d * x[b].d);
+        __m256 d1 = _mm256_set1_ps(w[b + 1].d * x[b + 1].d);
+        acc0 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(block_dot_avx2(w + b, x + b)), d0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(block_dot_avx2(w + b + 1, x + b + 1)), d1, acc1);
+    }
+    for (; b < nb; b++)
+    {
+        __m256 d = _mm256_set1_ps(w[b].d * x[b].d);
+        acc0 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(block_dot_avx2(w + b, x + b)), d, acc0);
+    }
+    return hsum_avx2(_mm256_add_ps(acc0, acc1));
+}
+
+/* vpdpbusd does the byte products and their sums into int32 in one instruction (no int16 intermediate) */
+__attribute__((target("avx2,fma,avx512f,avx512vl,avx512vnni"))) static inline __m256i
+block_dot_vnni(const BlockQ8 *w, const BlockQ8 *x)
+{
+    __m256i qw = _mm256_loadu_si256((const __m256i *) w->qs);
+    __m256i qx = _mm256_loadu_si256((const __m256i *) x->qs);
+    return _mm256_dpbusd_epi32(_mm256_setzero_si256(), _mm256_sign_epi8(qx, qx), _mm256_sign_epi8(qw, qx));
+}
+
+__attribute__((target("avx2,fma,avx512f,avx512vl,avx512vnni"))) static float
+dot_q8_vnni(int nb, const BlockQ8 *w, const BlockQ8 *x)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int b = 0;
+    for (; b + 2 <= nb; b += 2)
+    {
+        __m256 d0 = _mm256_set1_ps(w[b].d * x[b].d);
+        __m256 d1 = _mm256_set1_ps(w[b + 1].d * x[b + 1].d);
+        acc0 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(block_dot_vnni(w + b, x + b)), d0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(block_dot_vnni(w + b + 1, x + b + 1)), d1, acc1);
+    }
+    for (; b < nb; b++)
+    {
+        __m256 d = _mm256_set1_ps(w[b].d * x[b].d);
+        acc0 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(block_dot_vnni(w + b, x + b)), d, acc0);
+    }
+    return hsum_avx2(_mm256_add_ps(acc0, acc1));
+}
+
+#endif
+
+static dot_q8_t
+select_dot_q8(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    switch (cpu_best_isa())
+    {
+    case CPU_ISA_AVX512:
+        if (cpu_features()->avx512_vnni && cpu_features()->avx512vl)
+        {
+            return dot_q8_vnni;
+        }
+        return dot_q8_avx2;
+    case CPU_ISA_AVX2:
+        return dot_q8_avx2;
+    default:
+        break;
+    }
+#endif
+    return dot_q8_scalar;
+}
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* Products                                                                                                         */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+typedef struct
+{
+    int m;
+    int nb;  // blocks per row
+    const BlockQ8 *Aq;  // m rows of nb blocks
+    const BlockQ8 *W;
+    int ldw;
+    float *C;
+    int ldc;
+    dot_q8_t dot;
+} GemmQ8Args;
+
+/* Output columns [start, end): each weight row is read once from memory and stays in L1 for the m rows of A */
+static void
+gemm_q8_range(void *arg, int start, int end)
+{
+    const GemmQ8Args *args = (const GemmQ8Args *) arg;
+    for (int i = start; i < end; i++)
+    {
+        const BlockQ8 *w = args->W + (size_t) i * args->ldw;
+        for (int r = 0; r < args->m; r++)
+        {
+            args->C[(size_t) r * args->ldc + i] = args->dot(args->nb, w, args->Aq + (size_t) r * args->nb);
+        }
+    }
+}
+
+void
+gemm_q8_nt(int m, int n, int k, const float *A, int lda, const BlockQ8 *W, int ldw, float *C, int ldc)
+{
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+    int nb = k / QK8;
+    // The quantised activations live in the arena of the calling thread, as the GEMM packing panels
+    Arena *arena = Arena_thread_local();
+    ArenaMark mark = arena != NULL ? Arena_mark(arena) : (ArenaMark) { 0, 0, 0 };
+    BlockQ8 *Aq = arena != NULL ? Arena_alloc(arena, (size_t) m * (nb > 0 ? nb : 1) * sizeof(BlockQ8)) : NULL;
+    if (Aq == NULL)
+    {
+        LOG_ERROR("Failed to allocate the quantised activations");
+        if (arena != NULL)
+        {
+            Arena_release(arena, mark);
+        }
+        return;
+    }
+    for (int r = 0; r < m; r++)
+    {
+        quantize_row_q8(Aq + (size_t) r * nb, A + (size_t) r * lda, k);
+    }
+
+    GemmQ8Args args = { m, nb, Aq, W, ldw, C, ldc, select_dot_q8() };
+    size_t work = (size_t) m * (k > 0 ? k : 1);
+    int grain = (int) ((QUANT_MIN_WORK_PER_THREAD + work - 1) / work);
+    grain = (grain + QUANT_RANGE_ALIGNMENT - 1) / QUANT_RANGE_ALIGNMENT * QUANT_RANGE_ALIGNMENT;
+    parallel_for(n, grain, gemm_q8_range, &args);
+
+    Arena_release(arena, mark);
+}
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* Q4                                                                                                               */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+/* A Q4 row: scales, minimums (only when has_min) and nibbles */
+typedef struct
+{
+    const float *d;
+    const float *m;
+    const uint8_t *qs;
+} Q4Row;
+
+static Q4Row
+q4_row(const void *src, int k, int group_size, int has_min)
+{
+    int nb_groups = k / group_size;
+    Q4Row row;
+    row.d = (const float *) src;
+    row.m = has_min ? row.d + nb_groups : NULL;
+    row.qs = (const uint8_t *) (row.d + (has_min ? 2 : 1) * nb_groups);
+    return row;
+}
+
+size_t
+q4_row_nbytes(int k, int group_size, int has_min)
+{
+    return (size_t) (k / group_size) * (has_min ? 2 : 1) * sizeof(float) + (size_t) k / 2;
+}
+
+void
+quantize_row_q4(void *dst, const float *src, int k, int group_size, int has_min)
+{
+    int nb_groups = k / group_size;
+    float *d = (float *) dst;
+    float *m = d + nb_groups;
+    uint8_t *qs = (uint8_t *) (d + (has_min ? 2 : 1) * nb_groups);
+
+    for (int g = 0; g < nb_groups; g++)
+    {
+        const float *x = src + g * group_size;
+        float lo = x[0], hi = x[0], amax = 0.0f, max = 0.0f;
+        for (int j = 0; j < group_size; j++)
+        {
+            lo = fminf(lo, x[j]);
+            hi = fmaxf(hi, x[j]);
+            if (fabsf(x[j]) > amax)
+            {
+                amax = fabsf(x[j]);
+                max = x[j];
+            }
+        }
+
+        // Symmetric: the value of largest magnitude maps to -8, the end of the range with the most room
+        float scale = has_min ? (hi - lo) / 15.0f : max / -8.0f;
+        float offset = has_min ? lo : -8.0f * scale;
+        float inv_scale = scale != 0.0f ? 1.0f / scale : 0.0f;
+        d[g] = scale;
+        if (has_min)
+        {
+            m[g] = lo;
+        }
+
+        for (int c = 0; c < group_size; c += Q4_CHUNK)
+        {
+            uint8_t *q = qs + (g * group_size + c) / 2;
+            for (int j = 0; j < Q4_CHUNK / 2; j++)
+            {
+                long q_lo = lrintf((x[c + j] - offset) * inv_scale);
+                long q_hi = lrintf((x[c + j + Q4_CHUNK / 2] - offset) * inv_scale);
+                q_lo = q_lo < 0 ? 0 : (q_lo > 15 ? 15 : q_lo);
+                q_hi = q_hi < 0 ? 0 : (q_hi > 15 ? 15 : q_hi);
+                q[j] = (uint8_t) (q_lo | (q_hi << 4));
+            }
+        }
+    }
+}
+
+/* Dequantises the values [start, start + n) of a row */
+static void
+dequantize_q4_range(float *dst, const void *src, int k, int group_size, int has_min, int start, int n)
+{
+    Q4Row row = q4_row(src, k, group_size, has_min);
+    for (int i = 0; i < n; i++)
+    {
+        int j = start + i;
+        int g = j / group_size;
+        int pos = j % Q4_CHUNK;
+        uint8_t byte = row.qs[(j - pos) / 2 + pos % (Q4_CHUNK / 2)];
+        int q = pos < Q4_CHUNK / 2 ? byte & 0x0F : byte >> 4;
+        float offset = has_min ? row.m[g] : -8.0f * row.d[g];
+        dst[i] = row.d[g] * q + offset;
+    }
+}
+
+void
+dequantize_row_q4(float *dst, const void *src, int k, int group_size, int has_min)
+{
+    dequantize_q4_range(dst, src, k, group_size, has_min, 0, k);
+}
+
+/*
+ * Matrix-vector kernels: sum_j (d * q_j + m) x_j is computed per group as d * sum_j q_j x_j + m * sum_j x_j, the sums
+ * of x per group being computed once for all the rows.
+ */
+typedef float (*dot_q4_t)(const Q4Row *row, const float *x, const float *x_sums, int k, int group_size);
+
+static float
+dot_q4_scalar(const Q4Row *row, const float *x, const float *x_sums, int k, int group_size)
+{
+    float sum = 0.0f;
+    for (int g = 0; g < k / group_size; g++)
+    {
+        float group_sum = 0.0f;
+        for (int c = g * group_size; c < (g + 1) * group_size; c += Q4_CHUNK)
+        {
+            const uint8_t *q = row->qs + c / 2;
+            for (int j = 0; j < Q4_CHUNK / 2; j++)
+            {
+                group_sum += (float) (q[j] & 0x0F) * x[c + j] + (float) (q[j] >> 4) * x[c + j + Q4_CHUNK / 2];
+            }
+        }
+        float offset = row->m != NULL ? row->m[g] : -8.0f * row->d[g];
+        sum += row->d[g] * group_sum + offset * x_sums[g];
+    }
+    return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2,fma"))) static float
+dot_q4_avx2(const Q4Row *row, const float *x, const float *x_sums, int k, int group_size)
+{
+    const __m128i low_mask = _mm_set1_epi8(0x0F);
+    __m256 acc = _mm256_setzero_ps();
+    float offsets = 0.0f;
+    for (int g = 0; g < k / group_size; g++)
+    {
+        __m256 group_acc0 = _mm256_setzero_ps();
+        __m256 group_acc1 = _mm256_setzero_ps();
+        for (int c = g * group_size; c < (g + 1) * group_size; c += Q4_CHUNK)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *) (row->qs + c / 2));
+            __m128i lo = _mm_and_si128(bytes, low_mask);
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask);
+            __m256 q0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(lo));
+            __m256 q1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+            __m256 q2 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(hi));
+            __m256 q3 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+            group_acc0 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(x + c), group_acc0);
+            group_acc1 = _mm256_fmadd_ps(q1, _mm256_loadu_ps(x + c + 8), group_acc1);
+            group_acc0 = _mm256_fmadd_ps(q2, _mm256_loadu_ps(x + c + 16), group_acc0);
+            group_acc1 = _mm256_fmadd_ps(q3, _mm256_loadu_ps(x + c + 24), group_acc1);
+        }
+        acc = _mm256_fmadd_ps(_mm256_add_ps(group_acc0, group_acc1), _mm256_set1_ps(row->d[g]), acc);
+        offsets += (row->m != NULL ? row->m[g] : -8.0f * row->d[g]) * x_sums[g];
+    }
+    return hsum_avx2(acc) + offsets;
+}
+
+__attribute__((target("avx512f"))) static float
+dot_q4_avx512(const Q4Row *row, const float *x, const float *x_sums, int k, int group_size)
+{
+    const __m128i low_mask = _mm_set1_epi8(0x0F);
+    __m512 acc = _mm512_setzero_ps();
+    float offsets = 0.0f;
+    for (int g = 0; g < k / group_size; g++)
+    {
+        __m512 group_acc0 = _mm512_setzero_ps();
+        __m512 group_acc1 = _mm512_setzero_ps();
+        for (int c = g * group_size; c < (g + 1) * group_size; c += Q4_CHUNK)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *) (row->qs + c / 2));
+            __m128i lo = _mm_and_si128(bytes, low_mask);
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask);
+            __m512 q0 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(lo));
+            __m512 q1 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(hi));
+            group_acc0 = _mm512_fmadd_ps(q0, _mm512_loadu_ps(x + c), group_acc0);
+            group_acc1 = _mm512_fmadd_ps(q1, _mm512_loadu_ps(x + c + 16), group_acc1);
+        }
+        acc = _mm512_fmadd_ps(_mm512_add_ps(group_acc0, group_acc1), _mm512_set1_ps(row->d[g]), acc);
+        offsets += (row->m != NULL ? row->m[g] : -8.0f * row->d[g]) * x_sums[g];
+    }
+    return _mm512_reduce_add_ps(acc) + offsets;
+}
+
+#endif
+
+static dot_q4_t
+select_dot_q4(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    switch (cpu_best_isa())
+    {
+    case CPU_ISA_AVX512:
+        return dot_q4_avx512;
+    case CPU_ISA_AVX2:
+        return dot_q4_avx2;
+    default:
+        break;
+    }
+#endif
+    return dot_q4_scalar;
+}
+
+typedef struct
+{
+    int k;
+    int group_size;
+    int has_min;
+    size_t row_bytes;
+    const uint8_t *W;
+    const float *x;
+    const float *x_sums;
+    float *y;
+    dot_q4_t dot;
+} GemvQ4Args;
+
+static void
+gemv_q4_range(void *arg, int start, int end)
+{
+    const GemvQ4Args *args = (const GemvQ4Args *) arg;
+    for (int i = start; i < end; i++)
+    {
+        Q4Row row = q4_row(args->W + (size_t) i * args->row_bytes, args->k, args->group_size, args->has_min);
+        args->y[i] = args->dot(&row, args->x, args->x_sums, args->k, args->group_size);
+    }
+}
+
+/* Q4 weights as seen by the GEMM packing */
+typedef struct
+{
+    const uint8_t *W;
+    size_t row_bytes;
+    int k;
+    int group_size;
+    int has_min;
+} Q4Matrix;
+
+static void
+widen_q4_row(const void *B, int j, int pc, int kc, float *dst)
+{
+    const Q4Matrix *W = (const Q4Matrix *) B;
+    dequantize_q4_range(dst, W->W + (size_t) j * W->row_bytes, W->k, W->group_size, W->has_min, pc, kc);
+}
+
+void
+gemm_q4_nt(int m, int n, int k, const float *A, int lda, const void *W, int group_size, int has_min, float *C,
+           int ldc)
+{
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+    size_t row_bytes = q4_row_nbytes(k, group_size, has_min);
+
+    if (m > 1)
+    {
+        Q4Matrix q4 = { (const uint8_t *) W, row_bytes, k, group_size, has_min };
+        gemm_nt_widen(m, n, k, A, lda, &q4, widen_q4_row, C, ldc, 0);
+        return;
+    }
+
+    int nb_groups = k / group_size;
+    Arena *arena = Arena_thread_local();
+    ArenaMark mark = arena != NULL ? Arena_mark(arena) : (ArenaMark) { 0, 0, 0 };
+    float *x_sums = arena != NULL ? Arena_alloc(arena, (nb_groups > 0 ? nb_groups : 1) * sizeof(float)) : NULL;
+    if (x_sums == NULL)
+    {
+        LOG_ERROR("Failed to allocate the activation sums");
+        if (arena != NULL)
+        {
+            Arena_release(arena, mark);
+        }
+        return;
+    }
+    for (int g = 0; g < nb_groups; g++)
+    {
+        float sum = 0.0f;
+        for (int j = g * group_size; j < (g + 1) * group_size; j++)
+        {
+            sum += A[j];
+        }
+        x_sums[g] = sum;
+    }
+
+    GemvQ4Args args = { k, group_size, has_min, row_bytes, (const uint8_t *) W, A, x_sums, C, select_dot_q4() };
+    int grain = (QUANT_MIN_WORK_PER_THREAD + k - 1) / (k > 0 ? k : 1);
+    grain = (grain + QUANT_RANGE_ALIGNMENT - 1) / QUANT_RANGE_ALIGNMENT * QUANT_RANGE_ALIGNMENT;
+    parallel_for(n, grain, gemv_q4_range, &args);
+
+    Arena_release(arena, mark);
+}
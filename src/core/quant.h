@@ -0,0 +1,56 @@
+#ifndef CALLM_QUANT_H
+#define CALLM_QUANT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Block quantised weights. A row of k values is cut in blocks of QK8 consecutive values, each block stores one f32
+ * scale d and QK8 signed bytes q, with x ~= d * q and q in [-127, 127] (symmetric, the largest magnitude of the block
+ * maps to 127). k must be a multiple of QK8.
+ */
+#define QK8 32
+
+typedef struct
+{
+    float d;
+    int8_t qs[QK8];
+} BlockQ8;
+
+void quantize_row_q8(BlockQ8 *dst, const float *src, int k);
+void dequantize_row_q8(float *dst, const BlockQ8 *src, int k);
+
+/*
+ * C = A . W^T with f32 activations and Q8 weights: A is m x k (row stride lda), W is n rows of k / QK8 blocks (ldw
+ * blocks between rows), C is m x n (row stride ldc).
+ * The rows of A are quantised to Q8 on the fly, so every block product is an integer dot product (maddubs on AVX2,
+ * VNNI on AVX-512 CPUs having it) scaled once per block. Output columns are split across the thread pool.
+ */
+void gemm_q8_nt(int m, int n, int k, const float *A, int lda, const BlockQ8 *W, int ldw, float *C, int ldc);
+
+/*
+ * 4 bits grouped quantisation. A row of k values is cut in groups of group_size values (a multiple of Q4_CHUNK: 32, 64
+ * or 128), each group has an f32 scale d and, with minimums, an f32 minimum m:
+ *   - without minimum (symmetric): x ~= d * (q - 8), q in [0, 15]
+ *   - with minimum (asymmetric):    x ~= d * q + m,   q in [0, 15]
+ * A row is stored as its group scales, then its group minimums (if any), then its nibbles. Every Q4_CHUNK values take
+ * Q4_CHUNK / 2 bytes: byte j holds value j in its low nibble and value j + Q4_CHUNK / 2 in its high nibble, so a SIMD
+ * register of bytes unpacks into two runs of consecutive values.
+ */
+#define Q4_CHUNK 32
+
+size_t q4_row_nbytes(int k, int group_size, int has_min);
+void quantize_row_q4(void *dst, const float *src, int k, int group_size, int has_min);
+void dequantize_row_q4(float *dst, const void *src, int k, int group_size, int has_min);
+
+/*
+ * C = A . W^T with f32 activations and Q4 weights: A is m x k (row stride lda), W is n rows of q4_row_nbytes bytes,
+ * C is m x n (row stride ldc).
+ * A single row goes through matrix-vector kernels unpacking the nibbles to f32 in registers (the weights are read once,
+ * at 4.25 to 6 bits each depending on the group size and minimums). Larger products run the blocked GEMM, which
+ * dequantises strips of W while packing them.
+ */
+void gemm_q4_nt(int m, int n, int k, const float *A, int lda, const void *W, int group_size, int has_min, float *C,
+                int ldc);
+
+#endif  // CALLM_QUANT_H
@@ -0,0 +1,131 @@
+#define _GNU_SOURCE  // posix_memalign, madvise
+
+#include "residency.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define RESIDENCY_ALIGNMENT 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static ResidencyPolicy policy;
+static pthread_once_t policy_once = PTHREAD_ONCE_INIT;
+
+static int
+env_flag(const char *name, int default_value)
+{
+    const char *value = getenv(name);
+    return value != NULL && *value != '\0' ? atoi(value) != 0 : default_value;
+}
+
+static ResidencyMode
+parse_mode_env(void)
+{
+    const char *env = getenv("CALLM_RESIDENCY");
+    if (env == NULL)
+    {
+        return RESIDENCY_PREFAULT;
+    }
+    if (strcmp(env, "lazy") == 0)
+    {
+        return RESIDENCY_LAZY;
+    }
+    if (strcmp(env, "prefetch") == 0)
+    {
+        return RESIDENCY_PREFETCH;
+    }
+    if (strcmp(env, "populate") == 0)
+    {
+        return RESIDENCY_POPULATE;
+    }
+    return RESIDENCY_PREFAULT;
+}
+
+static void
+read_policy_env(void)
+{
+    policy.mode = parse_mode_env();
+    policy.huge_pages = env_flag("CALLM_HUGE_PAGES", 1);
+    policy.lock = env_flag("CALLM_MLOCK", 0);
+}
+
+const ResidencyPolicy *
+residency_policy(void)
+{
+    // The first call may come from several loader threads at once
+    pthread_once(&policy_once, read_policy_env);
+    return &policy;
+}
+
+void
+residency_set_policy(const ResidencyPolicy *new_policy)
+{
+    // Environment read first, so that it can't override the new policy later
+    pthread_once(&policy_once, read_policy_env);
+    policy = *new_policy;
+}
+
+const char *
+residency_mode_name(ResidencyMode mode)
+{
+    switch (mode)
+    {
+    case RESIDENCY_LAZY:
+        return "lazy";
+    case RESIDENCY_PREFETCH:
+        return "prefetch";
+    case RESIDENCY_POPULATE:
+        return "populate";
+    default:
+        return "prefault";
+    }
+}
+
+PageFaults
+page_faults(void)
+{
+    struct rusage usage;
+    PageFaults faults = { 0, 0 };
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        faults.minor = usage.ru_minflt;
+        faults.major = usage.ru_majflt;
+    }
+    return faults;
+}
+
+void *
+residency_alloc(size_t size)
+{
+    int huge = residency_policy()->huge_pages && size >= HUGE_PAGE_SIZE;
+    void *ptr;
+    if (posix_memalign(&ptr, huge ? HUGE_PAGE_SIZE : RESIDENCY_ALIGNMENT, size > 0 ? size : 1) != 0)
+    {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge)
+    {
+        // Only a hint: without THP support the buffer keeps small pages
+        madvise(ptr, size, MADV_HUGEPAGE);
+    }
+#endif
+    return ptr;
+}
+
+void
+residency_prefetch(const void *addr, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) addr / page_size * page_size;
+    uintptr_t end = (uintptr_t) addr + size;
+    madvise((void *) start, end - start, MADV_WILLNEED);
+}
@@ -0,0 +1,60 @@
+#ifndef CALLM_RESIDENCY_H
+#define CALLM_RESIDENCY_H
+
+#include <stddef.h>
+
+/*
+ * How the pages of mapped weights are brought into memory
+ */
+typedef enum
+{
+    RESIDENCY_LAZY = 0,      // on first touch, page by page
+    RESIDENCY_PREFETCH = 1,  // read ahead (MADV_WILLNEED) one decoder layer ahead of its execution, on the first pass
+    RESIDENCY_PREFAULT = 2,  // read entirely at load time, in parallel chunks
+    RESIDENCY_POPULATE = 3   // read entirely by mmap itself (MAP_POPULATE)
+} ResidencyMode;
+
+typedef struct
+{
+    ResidencyMode mode;
+    int huge_pages;  // back large converted weights (and mappings, if the kernel can) with transparent huge pages
+    int lock;        // mlock mapped weights, so they are never paged out
+} ResidencyPolicy;
+
+/*
+ * Returns the residency policy, read once from the environment: CALLM_RESIDENCY ("lazy", "prefetch", "prefault" or
+ * "populate", prefault by default), CALLM_HUGE_PAGES (1 by default) and CALLM_MLOCK (0 by default).
+ */
+const ResidencyPolicy *residency_policy(void);
+
+/*
+ * Replaces the residency policy. Only applies to weights loaded afterwards, and must not be called while weights are
+ * being loaded.
+ */
+void residency_set_policy(const ResidencyPolicy *policy);
+
+const char *residency_mode_name(ResidencyMode mode);
+
+typedef struct
+{
+    long minor;  // resolved without I/O (page cache hit, zero page)
+    long major;  // needed a read from disk
+} PageFaults;
+
+/*
+ * Page faults of the process so far, take the difference of two calls to count the faults of a phase
+ */
+PageFaults page_faults(void);
+
+/*
+ * Allocates a 64 bytes aligned buffer for weights. Large buffers are 2 MB aligned and backed by transparent huge pages
+ * when the policy enables them, to spare TLB misses while streaming multi-GB weights. Released with free().
+ */
+void *residency_alloc(size_t size);
+
+/*
+ * Starts reading [addr, addr + size) of a mapping in the background (MADV_WILLNEED on the pages covering it)
+ */
+void residency_prefetch(const void *addr, size_t size);
+
+#endif  // CALLM_RESIDENCY_H
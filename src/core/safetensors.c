@@ -1,8 +1,14 @@
+#define _GNU_SOURCE  // strdup, madvise, MAP_POPULATE
+
 #include "safetensors.h"
 #include "../shared/logging.h"
 #include "bf16.h"
 #include "json.h"
+#include "pack.h"
+#include "quant.h"
+#include "residency.h"
 #include "safetensors.h"
+#include "threadpool.h"
 #include "uthash.h"
 #include <fcntl.h>
 #include <jansson.h>
@@ -14,138 +20,313 @@
 #include <unistd.h>
 
 #define HEADER_SIZE_PART_SIZE sizeof(uint64_t)
+/* Elements converted per parallel range when loading bf16 tensors */
+#define BF16_CONVERT_GRAIN (64 * 1024)
+
+/* Bytes prefaulted per parallel range */
+#define PREFAULT_CHUNK_SIZE (16 * 1024 * 1024)
 
+/* Tensor descriptor, parsed once from the JSON header */
 struct SafetensorsLayer
 {
+    const char *name;  // in the names buffer of its shard
     enum Dtype dtype;
-    int *shape;
+    int group_size;  // Q4 tensors of packed models only
+    int shape[SAFETENSORS_MAX_DIMS];
     int shape_size;
-    long *data_offset;
-    UT_hash_handle hh;
+    size_t offset;     // absolute position of the data in its shard file
+    const char *data;  // data in the mapping of the shard
+    size_t nb_bytes;
+    UT_hash_handle hh;  // index by name
 };
 
-struct Safetensors
+/* One mapped file of a checkpoint, with the descriptors of the tensors it holds */
+typedef struct
 {
-    char *raw_content;
-    SafetensorsLayer *layer_table;
-    json_t *json_root;
+    char *path;
     void *map;
-    int map_size;
+    size_t map_size;
     uint64_t header_size;
+    SafetensorsLayer *layers;  // nb_layers descriptors, in header order
+    int nb_layers;
+    char *names;  // every tensor name, back to back
+} SafetensorsShard;
+
+struct Safetensors
+{
+    SafetensorsShard *shards;
+    int nb_shards;
+    SafetensorsLayer *layer_table;  // hash index over the layers of every shard
 };
 
+static CallmStatusCode Safetensors_parse(SafetensorsShard *shard, const char *header_content);
+
 static CallmStatusCode
-SafetensorsLayer_parse(json_t *layer, SafetensorsLayer *h)
+SafetensorsLayer_parse(json_t *json_layer, const char *name, size_t data_start, size_t file_size,
+                       SafetensorsLayer *layer)
 {
-    json_t *dtype = GET_JSON_OBJECT(layer, "dtype", dtype);
-    json_t *shape = GET_JSON_OBJECT(layer, "shape", shape);
-    json_t *data_offset = GET_JSON_OBJECT(layer, "data_offsets", data_offset);
-
-    if (!json_is_string(dtype) || !json_is_array(shape) || !json_is_array(data_offset))
+    json_t *dtype = GET_JSON_OBJECT(json_layer, "dtype", dtype);
+    json_t *shape = GET_JSON_OBJECT(json_layer, "shape", shape);
+    json_t *data_offsets = GET_JSON_OBJECT(json_layer, "data_offsets", data_offsets);
+    if (!json_is_string(dtype) || !json_is_array(shape) || !json_is_array(data_offsets)
+        || json_array_size(data_offsets) != 2)
     {
-        printerr("error: invalid JSON data\n");
-        if (json_is_string(dtype))
-        {
-            printerr("dtype: %s\n", json_string_value(dtype));
-        }
-        if (json_is_array(shape))
-        {
-            printerr("shape: %d\n", (int) json_array_size(shape));
-        }
-        if (json_is_array(data_offset))
-        {
-            printerr("data_offsets: %d\n", (int) json_array_size(data_offset));
-        }
+        LOGF_ERROR("Invalid header entry for tensor %s", name);
         return ERROR;
     }
 
-    char *dtype_str;
-    if (json_unpack(dtype, "s", &dtype_str))
-    {
-        printerr("error: invalid JSON data for dtype\n");
-        return ERROR;
-    }
+    // Unsupported types are only an error when such a tensor is loaded
+    const char *dtype_str = json_string_value(dtype);
+    size_t element_size = 0;
     if (strcmp(dtype_str, "F32") == 0)
     {
-        h->dtype = F32;
+        layer->dtype = F32;
+        element_size = sizeof(float);
     }
     else if (strcmp(dtype_str, "BF16") == 0)
     {
-        h->dtype = BF16;
+        layer->dtype = BF16;
+        element_size = sizeof(bf16_t);
+    }
+    else if (strcmp(dtype_str, "U8") == 0)
+    {
+        layer->dtype = U8;
+        element_size = 1;
     }
     else
     {
-        printerr("error: invalid dtype '%s'\n", dtype_str);
-        return ERROR;
+        layer->dtype = UNSUPPORTED_DTYPE;
     }
+    layer->group_size = 0;
 
-    h->shape_size = json_array_size(shape);
-    h->shape = (int *) malloc(h->shape_size * sizeof(int));
-    CHECK_MALLOC(h->shape, "shape");
-    for (int i = 0; i < h->shape_size; i++)
+    layer->shape_size = json_array_size(shape);
+    if (layer->shape_size > SAFETENSORS_MAX_DIMS)
     {
-        if (json_unpack(json_array_get(shape, i), "i", &h->shape[i]))
+        LOGF_ERROR("Tensor %s has %d dimensions, at most %d are supported", name, layer->shape_size,
+                   SAFETENSORS_MAX_DIMS);
+        return ERROR;
+    }
+    size_t nb_elements = 1;
+    for (int i = 0; i < layer->shape_size; i++)
+    {
+        json_t *dim = json_array_get(shape, i);
+        if (!json_is_integer(dim) || json_integer_value(dim) < 0 || json_integer_value(dim) > INT32_MAX)
         {
-            printerr("error: invalid JSON data for shape at index %d\n", i);
+            LOGF_ERROR("Invalid shape for tensor %s at index %d", name, i);
             return ERROR;
         }
+        layer->shape[i] = (int) json_integer_value(dim);
+        nb_elements *= layer->shape[i];
     }
 
-    h->data_offset = (int *) malloc(2 * sizeof(long));
-    CHECK_MALLOC(h->data_offset, "data_offset");
-    if (json_unpack(json_array_get(data_offset, 0), "F", &h->data_offset[0]))
+    json_t *begin = json_array_get(data_offsets, 0);
+    json_t *end = json_array_get(data_offsets, 1);
+    if (!json_is_integer(begin) || !json_is_integer(end) || json_integer_value(begin) < 0
+        || json_integer_value(end) < json_integer_value(begin)
+        || data_start + (size_t) json_integer_value(end) > file_size)
     {
-        printerr("error: invalid JSON data for data_offsets at index 0\n");
+        LOGF_ERROR("Invalid data offsets for tensor %s", name);
         return ERROR;
     }
-    if (json_unpack(json_array_get(data_offset, 1), "F", &h->data_offset[1]))
+    layer->offset = data_start + (size_t) json_integer_value(begin);
+    layer->nb_bytes = (size_t) (json_integer_value(end) - json_integer_value(begin));
+    if (element_size > 0 && layer->nb_bytes != nb_elements * element_size)
     {
-        printerr("error: invalid JSON data for data_offsets at index 1\n");
+        LOGF_ERROR("Tensor %s has %zu bytes of data for %zu elements", name, layer->nb_bytes, nb_elements);
         return ERROR;
     }
 
+    layer->name = name;
+    layer->data = NULL;
     return OK;
 }
 
-Safetensors *
-Safetensors_new(const char *file_path)
+/*
+ * Weights type of the tensors that can be loaded as weights
+ */
+static CallmStatusCode
+weights_dtype(enum Dtype dtype, WeightsDtype *weights_dtype)
+{
+    switch (dtype)
+    {
+    case F32:
+        *weights_dtype = WEIGHTS_F32;
+        return OK;
+    case BF16:
+        *weights_dtype = WEIGHTS_BF16;
+        return OK;
+    case Q8:
+        *weights_dtype = WEIGHTS_Q8;
+        return OK;
+    case Q4:
+        *weights_dtype = WEIGHTS_Q4;
+        return OK;
+    case Q4_MIN:
+        *weights_dtype = WEIGHTS_Q4_MIN;
+        return OK;
+    default:
+        return ERROR;
+    }
+}
+
+/*
+ * Q4 entries need the group size the weights would be built with (see Weights_wrap_grouped): a positive multiple of
+ * Q4_CHUNK dividing the number of columns. The other types ignore it.
+ */
+static int
+valid_group_size(const PackEntry *entry)
+{
+    if (entry->dtype != Q4 && entry->dtype != Q4_MIN)
+    {
+        return 1;
+    }
+    return entry->shape_size == 2 && entry->group_size > 0 && entry->group_size % Q4_CHUNK == 0
+           && entry->shape[1] % entry->group_size == 0;
+}
+
+/*
+ * Reads the binary header of a packed model in place: names point into the mapping
+ */
+static CallmStatusCode
+SafetensorsShard_parse_packed(SafetensorsShard *shard)
 {
+    const PackHeader *header = (const PackHeader *) shard->map;
+    if (header->version != PACK_VERSION)
+    {
+        LOGF_ERROR("%s: unsupported packed model version %u (expected %d)", shard->path, header->version, PACK_VERSION);
+        return ERROR;
+    }
+    size_t entries_end = sizeof(PackHeader) + (size_t) header->nb_entries * sizeof(PackEntry);
+    if (header->file_size != shard->map_size || entries_end > header->names_offset || header->names_size == 0
+        || header->names_offset > shard->map_size || header->names_size > shard->map_size - header->names_offset)
+    {
+        LOGF_ERROR("%s: truncated or corrupted packed model", shard->path);
+        return ERROR;
+    }
+    const char *names = (const char *) shard->map + header->names_offset;
+    if (names[header->names_size - 1] != '\0')
+    {
+        LOGF_ERROR("%s: corrupted tensor names", shard->path);
+        return ERROR;
+    }
+
+    shard->layers = calloc(header->nb_entries > 0 ? header->nb_entries : 1, sizeof(SafetensorsLayer));
+    CHECK_MALLOC_PANIC(shard->layers, "tensor descriptors");
+    const PackEntry *entries = (const PackEntry *) ((const char *) shard->map + sizeof(PackHeader));
+    for (uint32_t e = 0; e < header->nb_entries; e++)
+    {
+        const PackEntry *entry = &entries[e];
+        SafetensorsLayer *layer = &shard->layers[e];
+        if (entry->name_offset >= header->names_size || entry->shape_size < 0
+            || entry->shape_size > SAFETENSORS_MAX_DIMS || entry->offset > shard->map_size
+            || entry->nb_bytes > shard->map_size - entry->offset || !valid_group_size(entry))
+        {
+            LOGF_ERROR("%s: corrupted entry %u", shard->path, e);
+            return ERROR;
+        }
+        layer->name = names + entry->name_offset;
+        layer->dtype = (enum Dtype) entry->dtype;
+        layer->group_size = entry->group_size;
+        layer->shape_size = entry->shape_size;
+        memcpy(layer->shape, entry->shape, entry->shape_size * sizeof(int));
+        layer->offset = entry->offset;
+        layer->nb_bytes = entry->nb_bytes;
+
+        // The data must hold the whole tensor
+        size_t nb_elements = 1;
+        for (int i = 0; i < layer->shape_size; i++)
+        {
+            nb_elements *= layer->shape[i] >= 0 ? (size_t) layer->shape[i] : 0;
+        }
+        size_t expected = layer->nb_bytes;
+        WeightsDtype dtype;
+        if (layer->dtype == F32 || layer->dtype == BF16 || layer->dtype == U8)
+        {
+            expected = nb_elements * (layer->dtype == F32 ? sizeof(float) : layer->dtype == BF16 ? sizeof(bf16_t) : 1);
+        }
+        else if (weights_dtype(layer->dtype, &dtype) == OK)
+        {
+            expected = layer->shape_size == 2 && layer->shape[1] >= 0
+                           ? (size_t) layer->shape[0] * Weights_dtype_nbytes(dtype, layer->group_size, layer->shape[1])
+                           : 0;
+        }
+        if (layer->nb_bytes != expected)
+        {
+            LOGF_ERROR("%s: tensor %s doesn't match its shape", shard->path, layer->name);
+            return ERROR;
+        }
+        shard->nb_layers++;
+    }
+    return OK;
+}
+
+/*
+ * Maps a safetensors file (or a packed model) and parses its header into the descriptors of its tensors
+ */
+static CallmStatusCode
+SafetensorsShard_open(SafetensorsShard *shard, const char *file_path)
+{
+    memset(shard, 0, sizeof(SafetensorsShard));
+    shard->path = strdup(file_path);
+    CHECK_MALLOC_PANIC(shard->path, "shard path");
+
     int fd = open(file_path, O_RDONLY);
     if (fd == -1)
     {
-        perror("Error opening file");
-        exit(1);
+        LOGF_ERROR("Error opening file %s", file_path);
+        return ERROR;
     }
 
     // Get the file size
     struct stat st;
     if (fstat(fd, &st) == -1)
     {
-        perror("fstat");
+        LOGF_ERROR("Error reading the size of %s", file_path);
         close(fd);
-        exit(1);
+        return ERROR;
     }
     size_t filesize = st.st_size;
+    if (filesize < HEADER_SIZE_PART_SIZE)
+    {
+        LOGF_ERROR("%s is too small to be a safetensors file", file_path);
+        close(fd);
+        return ERROR;
+    }
 
-    // read header size
-    void *map = mmap(NULL, filesize, PROT_READ, MAP_SHARED, fd, 0);
+    // Read-only shared mapping: tensors are used in place, and processes mapping the same file share its page cache
+    const ResidencyPolicy *policy = residency_policy();
+    int flags = MAP_SHARED | (policy->mode == RESIDENCY_POPULATE ? MAP_POPULATE : 0);
+    void *map = mmap(NULL, filesize, PROT_READ, flags, fd, 0);
+    close(fd);  // the mapping keeps the file referenced
     if (map == MAP_FAILED)
     {
-        printerr("Error mapping file");
-        close(fd);
-        exit(1);
+        LOGF_ERROR("Error mapping file %s", file_path);
+        return ERROR;
+    }
+    shard->map = map;
+    shard->map_size = filesize;
+#ifdef MADV_HUGEPAGE
+    if (policy->huge_pages)
+    {
+        // Only honoured by kernels supporting huge pages for read-only file mappings
+        madvise(map, filesize, MADV_HUGEPAGE);
+    }
+#endif
+
+    if (filesize >= sizeof(PackHeader) && memcmp(map, PACK_MAGIC, sizeof(((PackHeader *) 0)->magic)) == 0)
+    {
+        return SafetensorsShard_parse_packed(shard);
     }
 
     uint64_t header_size;
     memcpy(&header_size, map, HEADER_SIZE_PART_SIZE);
-    printf("Header size: %lu\n", header_size);
-    if (HEADER_SIZE_PART_SIZE + header_size > filesize)
+    LOGF_DEBUG("%s: header size %lu", file_path, header_size);
+    if (header_size > filesize - HEADER_SIZE_PART_SIZE)
     {
-        fprintf(stderr, "Error: header size is larger than file size\n");
-        munmap(map, filesize);
-        close(fd);
-        exit(1);
+        LOGF_ERROR("%s: header size is larger than file size", file_path);
+        return ERROR;
     }
+    shard->header_size = header_size;
 
     // read header
     char *header_content = (char *) malloc(header_size + 1);
@@ -153,87 +334,396 @@ Safetensors_new(const char *file_path)
     memcpy(header_content, (char *) map + HEADER_SIZE_PART_SIZE, header_size);
     header_content[header_size] = '\0';
 
-    // Initialize header
-    Safetensors *h = (Safetensors *) malloc(sizeof(Safetensors));
-    CHECK_MALLOC_PANIC(h, "new safetensors header");
-    h->map = NULL;
-    h->map_size = filesize;
-    h->header_size = header_size;
-    h->layer_table = NULL;
+    // The JSON tree only lives while the descriptors are built
+    CallmStatusCode status = Safetensors_parse(shard, header_content);
+    free(header_content);
+    if (status != OK)
+    {
+        LOGF_ERROR("Error parsing the header of %s", file_path);
+    }
+    return status;
+}
 
-    h->raw_content = (char *) malloc(strlen(header_content) + 1);
-    CHECK_MALLOC_PANIC(h->raw_content, "safetensors header content");
-    h->raw_content = strcpy(h->raw_content, header_content);
+static void
+SafetensorsShard_close(SafetensorsShard *shard)
+{
+    free(shard->layers);
+    free(shard->names);
+    free(shard->path);
+    if (shard->map != NULL)
+    {
+        munmap(shard->map, shard->map_size);  // TODO: check the return value (causes an error with python extension)
+    }
+}
 
-    h->json_root = NULL;
-    CHECK_STATUS_PANIC(Safetensors_parse(h, header_content), "Error parsing header\n", NULL);
+/*
+ * Indexes the tensors of every shard by name
+ */
+static CallmStatusCode
+Safetensors_index(Safetensors *h)
+{
+    for (int s = 0; s < h->nb_shards; s++)
+    {
+        SafetensorsShard *shard = &h->shards[s];
+        for (int l = 0; l < shard->nb_layers; l++)
+        {
+            SafetensorsLayer *layer = &shard->layers[l];
+            SafetensorsLayer *existing;
+            HASH_FIND_STR(h->layer_table, layer->name, existing);
+            if (existing != NULL)
+            {
+                LOGF_ERROR("Tensor %s is stored in several files", layer->name);
+                return ERROR;
+            }
+            layer->data = (const char *) shard->map + layer->offset;
+            HASH_ADD_KEYPTR(hh, h->layer_table, layer->name, strlen(layer->name), layer);
+        }
+    }
+    return OK;
+}
 
-    h->map = map;
+/* Index files are named like model.safetensors.index.json */
+static int
+is_index_file(const char *file_path)
+{
+    size_t len = strlen(file_path);
+    return len >= 5 && strcmp(file_path + len - 5, ".json") == 0;
+}
 
-    return h;
+/*
+ * Reads the weight map of a sharded checkpoint index and opens each shard it lists once (shard paths are relative to
+ * the index). Every tensor of the map must then be found in the shard it is mapped to.
+ */
+static CallmStatusCode
+Safetensors_open_index(Safetensors *h, const char *index_path)
+{
+    json_error_t error;
+    json_t *root = json_load_file(index_path, 0, &error);
+    if (root == NULL)
+    {
+        LOGF_ERROR("%s: JSON error on line %d: %s", index_path, error.line, error.text);
+        return ERROR;
+    }
+    json_t *weight_map = json_object_get(root, "weight_map");
+    if (!json_is_object(weight_map))
+    {
+        LOGF_ERROR("%s has no weight_map object", index_path);
+        json_decref(root);
+        return ERROR;
+    }
+
+    const char *slash = strrchr(index_path, '/');
+    int dir_len = slash != NULL ? (int) (slash - index_path + 1) : 0;
+
+    // Distinct shard files, in order of first appearance
+    h->shards = calloc(json_object_size(weight_map) > 0 ? json_object_size(weight_map) : 1, sizeof(SafetensorsShard));
+    CHECK_MALLOC_PANIC(h->shards, "safetensors shards");
+    const char **shard_files = calloc(json_object_size(weight_map) + 1, sizeof(char *));
+    CHECK_MALLOC_PANIC(shard_files, "safetensors shard files");
+    int nb_files = 0;
+
+    CallmStatusCode status = OK;
+    const char *key;
+    json_t *value;
+    json_object_foreach(weight_map, key, value)
+    {
+        if (!json_is_string(value))
+        {
+            LOGF_ERROR("%s: invalid shard for tensor %s", index_path, key);
+            status = ERROR;
+            break;
+        }
+        int f = 0;
+        while (f < nb_files && strcmp(shard_files[f], json_string_value(value)) != 0)
+        {
+            f++;
+        }
+        if (f < nb_files)
+        {
+            continue;
+        }
+        shard_files[nb_files++] = json_string_value(value);
+
+        char *shard_path;
+        if (asprintf(&shard_path, "%.*s%s", dir_len, index_path, json_string_value(value)) == -1)
+        {
+            LOG_ERROR("Failed to build a shard path");
+            status = ERROR;
+            break;
+        }
+        status = SafetensorsShard_open(&h->shards[h->nb_shards++], shard_path);
+        free(shard_path);
+        if (status != OK)
+        {
+            break;
+        }
+    }
+
+    if (status == OK)
+    {
+        status = Safetensors_index(h);
+    }
+
+    // The index and the shard headers must agree on where each tensor lives
+    json_object_foreach(weight_map, key, value)
+    {
+        if (status != OK)
+        {
+            break;
+        }
+        SafetensorsLayer *layer;
+        HASH_FIND_STR(h->layer_table, key, layer);
+        int f = 0;
+        while (f < nb_files && strcmp(shard_files[f], json_string_value(value)) != 0)
+        {
+            f++;
+        }
+        if (layer == NULL || layer < h->shards[f].layers || layer >= h->shards[f].layers + h->shards[f].nb_layers)
+        {
+            LOGF_ERROR("%s: tensor %s is not in %s", index_path, key, json_string_value(value));
+            status = ERROR;
+        }
+    }
+
+    free(shard_files);
+    json_decref(root);
+    return status;
+}
+
+typedef struct
+{
+    const Safetensors *h;
+    const size_t *first_chunk;  // index of the first chunk of each shard, then the total number of chunks
+} PrefaultArgs;
+
+static void
+prefault_chunks(void *arg, int start, int end)
+{
+    PrefaultArgs *args = (PrefaultArgs *) arg;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    volatile char sink = 0;
+    for (int c = start; c < end; c++)
+    {
+        int s = 0;
+        while (args->first_chunk[s + 1] <= (size_t) c)
+        {
+            s++;
+        }
+        const SafetensorsShard *shard = &args->h->shards[s];
+        size_t begin = (c - args->first_chunk[s]) * (size_t) PREFAULT_CHUNK_SIZE;
+        size_t end_byte = begin + PREFAULT_CHUNK_SIZE < shard->map_size ? begin + PREFAULT_CHUNK_SIZE : shard->map_size;
+        const char *data = (const char *) shard->map;
+
+        // Read ahead the whole chunk at once, then fault its pages in
+        madvise((void *) (data + begin), end_byte - begin, MADV_WILLNEED);
+        for (size_t i = begin; i < end_byte; i += page_size)
+        {
+            sink += data[i];
+        }
+    }
+    (void) sink;
 }
 
 CallmStatusCode
-Safetensors_print(Safetensors *h)
+Safetensors_prefault(const Safetensors *h)
 {
-    char *key = NULL;
-    void *value = NULL;
-    json_object_foreach(h->json_root, key, value)
+    size_t *first_chunk = malloc((h->nb_shards + 1) * sizeof(size_t));
+    if (first_chunk == NULL)
     {
-        if (strcmp(key, "__metadata__") == 0)
+        LOG_ERROR("Failed to allocate the prefault chunks");
+        return ERROR;
+    }
+    first_chunk[0] = 0;
+    for (int s = 0; s < h->nb_shards; s++)
+    {
+        first_chunk[s + 1] = first_chunk[s] + (h->shards[s].map_size + PREFAULT_CHUNK_SIZE - 1) / PREFAULT_CHUNK_SIZE;
+    }
+
+    // Chunks of every shard are read concurrently, to keep several I/O requests in flight
+    PrefaultArgs args = { h, first_chunk };
+    parallel_for((int) first_chunk[h->nb_shards], 1, prefault_chunks, &args);
+    free(first_chunk);
+    return OK;
+}
+
+Safetensors *
+Safetensors_new(const char *file_path)
+{
+    PageFaults before = page_faults();
+    Safetensors *h = (Safetensors *) calloc(1, sizeof(Safetensors));
+    CHECK_MALLOC_PANIC(h, "new safetensors header");
+
+    CallmStatusCode status;
+    if (is_index_file(file_path))
+    {
+        status = Safetensors_open_index(h, file_path);
+    }
+    else
+    {
+        h->shards = calloc(1, sizeof(SafetensorsShard));
+        CHECK_MALLOC_PANIC(h->shards, "safetensors shards");
+        h->nb_shards = 1;
+        status = SafetensorsShard_open(&h->shards[0], file_path);
+        if (status == OK)
         {
-            continue;
+            status = Safetensors_index(h);
         }
+    }
+    if (status != OK)
+    {
+        Safetensors_free(h);
+        return NULL;
+    }
+    LOGF_DEBUG("Opened %s: %u tensors in %d files", file_path, HASH_COUNT(h->layer_table), h->nb_shards);
 
-        printf("Layer: %s\t\t", key);
-        json_t *json_layer = GET_JSON_OBJECT_PANIC(h->json_root, key, json_layer);
-        SafetensorsLayer *layer = (SafetensorsLayer *) malloc(sizeof(SafetensorsLayer));
-        CHECK_MALLOC_PANIC(layer, key);
-        CHECK_STATUS(SafetensorsLayer_parse(json_layer, layer), "Error parsing tensor header %s\n", key)
+    const ResidencyPolicy *policy = residency_policy();
+    if (policy->mode == RESIDENCY_PREFAULT)
+    {
+        Safetensors_prefault(h);
+    }
+    if (policy->lock)
+    {
+        Safetensors_lock(h);
+    }
+    PageFaults after = page_faults();
+    LOGF_INFO("Opened %s with %s residency: %ld minor, %ld major page faults", file_path,
+              residency_mode_name(policy->mode), after.minor - before.minor, after.major - before.major);
+    return h;
+}
 
-        printf("shape: [");
-        for (int i = 0; i < layer->shape_size; i++)
+CallmStatusCode
+Safetensors_lock(const Safetensors *h)
+{
+    CallmStatusCode status = OK;
+    for (int s = 0; s < h->nb_shards; s++)
+    {
+        if (mlock(h->shards[s].map, h->shards[s].map_size) != 0)
         {
-            printf("%d", layer->shape[i]);
-            if (i < layer->shape_size - 1)
+            // Usually RLIMIT_MEMLOCK: the weights stay pageable
+            LOGF_ERROR("Failed to lock %s in memory", h->shards[s].path);
+            status = ERROR;
+        }
+    }
+    return status;
+}
+
+CallmStatusCode
+Safetensors_print(Safetensors *h)
+{
+    for (int s = 0; s < h->nb_shards; s++)
+    {
+        printf("File: %s\n", h->shards[s].path);
+        for (int l = 0; l < h->shards[s].nb_layers; l++)
+        {
+            const SafetensorsLayer *layer = &h->shards[s].layers[l];
+            printf("Layer: %s\t\t", layer->name);
+            printf("shape: [");
+            for (int i = 0; i < layer->shape_size; i++)
             {
-                printf(", ");
+                printf("%d", layer->shape[i]);
+                if (i < layer->shape_size - 1)
+                {
+                    printf(", ");
+                }
             }
-        }
-        printf("]");
+            printf("]");
 
-        printf("\t\tdata_offset: [%lu, %lu]\n", layer->data_offset[0], layer->data_offset[1]);
-        printf("\n");
-        SafetensorsLayer_free(layer);
+            printf("\t\tdata: [%zu, %zu]\n", layer->offset, layer->offset + layer->nb_bytes);
+            printf("\n");
+        }
     }
 
     return OK;
 }
 
+/*
+ * Builds the tensor descriptors of a shard from its JSON header
+ */
 static CallmStatusCode
-Safetensors_parse(Safetensors *h, const char *header_content)
+Safetensors_parse(SafetensorsShard *shard, const char *header_content)
 {
     json_error_t error;
     json_t *root = json_loads(header_content, 0, &error);
-    if (!root)
+    if (!root || !json_is_object(root))
     {
         printerr("JSON error: on line %d: %s\n", error.line, error.text);
+        json_decref(root);
         return ERROR;
     }
 
-    h->json_root = root;
+    // Names are copied into one buffer
+    const char *key;
+    json_t *value;
+    size_t names_size = 0;
+    int nb_layers = 0;
+    json_object_foreach(root, key, value)
+    {
+        if (strcmp(key, "__metadata__") != 0)
+        {
+            names_size += strlen(key) + 1;
+            nb_layers++;
+        }
+    }
 
+    shard->layers = calloc(nb_layers > 0 ? nb_layers : 1, sizeof(SafetensorsLayer));
+    shard->names = malloc(names_size > 0 ? names_size : 1);
+    if (shard->layers == NULL || shard->names == NULL)
+    {
+        LOG_ERROR("Failed to allocate the tensor descriptors");
+        json_decref(root);
+        return ERROR;
+    }
+
+    size_t data_start = HEADER_SIZE_PART_SIZE + shard->header_size;
+    char *name = shard->names;
+    json_object_foreach(root, key, value)
+    {
+        if (strcmp(key, "__metadata__") == 0)
+        {
+            continue;
+        }
+        size_t len = strlen(key);
+        memcpy(name, key, len + 1);
+
+        SafetensorsLayer *layer = &shard->layers[shard->nb_layers];
+        if (!json_is_object(value) || SafetensorsLayer_parse(value, name, data_start, shard->map_size, layer) != OK)
+        {
+            json_decref(root);
+            return ERROR;
+        }
+        shard->nb_layers++;
+        name += len + 1;
+    }
+
+    json_decref(root);
     return OK;
 }
 
-Matrix *
-Safetensors_load_matrix(const char *tensor_name, const Safetensors *header)
+typedef struct
+{
+    float *dst;
+    const bf16_t *src;
+} Bf16ConvertArgs;
+
+static void
+convert_bf16_range(void *arg, int start, int end)
 {
-    // Get layer metadata
-    json_t *json_layer = GET_JSON_OBJECT_PANIC(header->json_root, tensor_name, json_layer);
-    SafetensorsLayer *layer = (SafetensorsLayer *) malloc(sizeof(SafetensorsLayer));
-    CHECK_MALLOC_PANIC(layer, tensor_name);
-    CHECK_STATUS_PANIC(SafetensorsLayer_parse(json_layer, layer), "Error parsing tensor header %s\n", tensor_name)
+    Bf16ConvertArgs *args = (Bf16ConvertArgs *) arg;
+    bf16_to_f32_n(args->dst + start, args->src + start, end - start);
+}
+
+/*
+ * Find the descriptor of a 1D or 2D tensor, and locate its data in the mapped file
+ */
+static const SafetensorsLayer *
+Safetensors_locate_matrix(const char *tensor_name, const Safetensors *header, size_t *dim1, size_t *dim2,
+                          size_t *start_index)
+{
+    SafetensorsLayer *layer;
+    if (Safetensors_get_layer_by_name(header, tensor_name, &layer) != OK)
+    {
+        exit(1);
+    }
 
     // Check is a matrix
     if (layer->shape_size > 2 || layer->shape_size < 1)
@@ -242,74 +732,192 @@ Safetensors_load_matrix(const char *tensor_name, const Safetensors *header)
         exit(1);
     }
 
-    size_t dim1 = layer->shape[0];
-    size_t dim2;
-
+    *dim1 = layer->shape[0];
     if (layer->shape_size == 1)
     {
-        dim2 = 1;
+        *dim2 = 1;
     }
     else
     {
-        dim2 = layer->shape[1];
+        *dim2 = layer->shape[1];
+    }
+
+    *start_index = layer->offset;
+    return layer;
+}
+
+/*
+ * Address of a tensor in the mapping, or NULL if it isn't aligned on its element size (then it must be copied)
+ */
+static const void *
+mapped_tensor(const SafetensorsLayer *layer, size_t element_size)
+{
+    return (uintptr_t) layer->data % element_size == 0 ? layer->data : NULL;
+}
+
+Matrix *
+Safetensors_load_matrix(const char *tensor_name, const Safetensors *header)
+{
+    size_t dim1, dim2, start_index;
+    const SafetensorsLayer *layer = Safetensors_locate_matrix(tensor_name, header, &dim1, &dim2, &start_index);
+
+    const void *mapped = layer->dtype == F32 ? mapped_tensor(layer, sizeof(float)) : NULL;
+    if (mapped != NULL)
+    {
+        LOGF_DEBUG("Mapping float32 matrix %s (%zux%zu)", tensor_name, dim1, dim2);
+        Matrix *m = Matrix_wrap(dim1, dim2, (float *) mapped);
+        CHECK_MALLOC_PANIC(m, tensor_name);
+        return m;
     }
 
     // Get data from map
     Matrix *m = Matrix_new(dim1, dim2);
+    CHECK_MALLOC_PANIC(m, tensor_name);
 
     int nb_elements = dim1 * dim2;
-    int start_index = HEADER_SIZE_PART_SIZE + header->header_size + layer->data_offset[0];
 
-    LOGF_DEBUG("Loading matrix %s (%zux%zu) with %d elements at start index %d (=%lu+%lu+%lu)", tensor_name, dim1, dim2,
-               nb_elements, start_index, HEADER_SIZE_PART_SIZE, header->header_size, layer->data_offset[0]);
+    LOGF_DEBUG("Loading matrix %s (%zux%zu) with %d elements at start index %zu", tensor_name, dim1, dim2, nb_elements,
+               start_index);
 
     if (layer->dtype == F32)
     {
         LOG_DEBUG("Loading float32 matrix");
 
-        char *buff = (char *) malloc(nb_elements * sizeof(float));
-        CHECK_MALLOC_PANIC(buff, "tmp matrix data buffer");
-        memcpy(buff, (char *) header->map + start_index, nb_elements * sizeof(float));
-
-        float *data = (float *) malloc(nb_elements * sizeof(float));
-        CHECK_MALLOC_PANIC(data, "matrix float data");
-        memcpy(data, buff, nb_elements * sizeof(float));
-        free(buff);
-
-        m->data = data;
+        // Copied straight into the (aligned) matrix buffer
+        memcpy(m->data, layer->data, nb_elements * sizeof(float));
     }
     else if (layer->dtype == BF16)
     {
         LOG_DEBUG("Loading bf16 matrix");
 
-        char *buff = (char *) malloc(nb_elements * sizeof(bf16_t));
-        CHECK_MALLOC_PANIC(buff, "tmp matrix data buffer");
-        memcpy(buff, (char *) header->map + start_index, nb_elements * sizeof(bf16_t));
+        // Converted to float straight from the mapped file into the (aligned) matrix buffer, in parallel chunks
+        Bf16ConvertArgs args = { m->data, (const bf16_t *) (layer->data) };
+        parallel_for(nb_elements, BF16_CONVERT_GRAIN, convert_bf16_range, &args);
+    }
+    else if (layer->dtype == Q8 || layer->dtype == Q4 || layer->dtype == Q4_MIN)
+    {
+        LOG_DEBUG("Dequantising matrix");
 
-        bf16_t *data = (bf16_t *) malloc(nb_elements * sizeof(bf16_t));
-        CHECK_MALLOC_PANIC(data, "matrix bf16 data");
-        memcpy(data, buff, nb_elements * sizeof(bf16_t));
-        free(buff);
+        Matrix_free(m);
+        Weights *w = Safetensors_load_weights(tensor_name, header);
+        m = Weights_to_matrix(w);
+        CHECK_MALLOC_PANIC(m, tensor_name);
+        Weights_free(w);
+    }
+    else
+    {
+        LOGF_ERROR("tensor %s has an unsupported dtype", tensor_name);
+        exit(1);
+    }
 
-        // convert to float
-        float *f_data = (float *) malloc(nb_elements * sizeof(float));
-        CHECK_MALLOC_PANIC(f_data, "matrix float data");
+    return m;
+}
+
+Weights *
+Safetensors_load_weights(const char *tensor_name, const Safetensors *header)
+{
+    size_t dim1, dim2, start_index;
+    const SafetensorsLayer *layer = Safetensors_locate_matrix(tensor_name, header, &dim1, &dim2, &start_index);
 
-        for (int i = 0; i < nb_elements; i++)
+    WeightsDtype dtype;
+    if (weights_dtype(layer->dtype, &dtype) != OK)
+    {
+        LOGF_ERROR("tensor %s has an unsupported dtype", tensor_name);
+        exit(1);
+    }
+
+    // Quantised rows start with f32 scales
+    const void *mapped = mapped_tensor(layer, dtype == WEIGHTS_BF16 ? sizeof(bf16_t) : sizeof(float));
+    if (mapped != NULL)
+    {
+        LOGF_DEBUG("Mapping %s weights %s (%zux%zu) at start index %zu", Weights_dtype_name(dtype), tensor_name, dim1,
+                   dim2, start_index);
+        Weights *w = Weights_wrap_grouped(dim1, dim2, dtype, layer->group_size, mapped);
+        CHECK_MALLOC_PANIC(w, tensor_name);
+        return w;
+    }
+
+    Weights *w = Weights_new_grouped(dim1, dim2, dtype, layer->group_size);
+    CHECK_MALLOC_PANIC(w, tensor_name);
+
+    LOGF_DEBUG("Loading misaligned %s weights %s (%zux%zu) at start index %zu", Weights_dtype_name(dtype), tensor_name,
+               dim1, dim2, start_index);
+
+    // Copied as stored, without any conversion
+    memcpy(w->data, layer->data, Weights_nbytes(w));
+
+    return w;
+}
+
+Weights *
+Safetensors_load_weights_as(const char *tensor_name, const Safetensors *header, WeightsDtype dtype, int group_size)
+{
+    size_t dim1, dim2, start_index;
+    const SafetensorsLayer *layer = Safetensors_locate_matrix(tensor_name, header, &dim1, &dim2, &start_index);
+    WeightsDtype stored_dtype;
+    int stored = weights_dtype(layer->dtype, &stored_dtype) == OK && stored_dtype == dtype
+                 && ((layer->dtype != Q4 && layer->dtype != Q4_MIN) || layer->group_size == group_size);
+    if (stored)
+    {
+        return Safetensors_load_weights(tensor_name, header);
+    }
+
+    // Widened to f32 first, then converted (quantised) row by row
+    Matrix *m = Safetensors_load_matrix(tensor_name, header);
+    LOGF_DEBUG("Converting weights %s to %s", tensor_name, Weights_dtype_name(dtype));
+    Weights *w = Weights_from_matrix_grouped(m, dtype, group_size);
+    CHECK_MALLOC_PANIC(w, tensor_name);
+    Matrix_free(m);
+    return w;
+}
+
+int
+Safetensors_nb_tensors(const Safetensors *h)
+{
+    return HASH_COUNT(h->layer_table);
+}
+
+const char *
+Safetensors_tensor_name(const Safetensors *h, int i)
+{
+    for (int s = 0; s < h->nb_shards; s++)
+    {
+        if (i < h->shards[s].nb_layers)
         {
-            f_data[i] = bf16_to_float(data[i]);
+            return h->shards[s].layers[i].name;
         }
-
-        m->data = f_data;
-        free(data);
+        i -= h->shards[s].nb_layers;
     }
-    else
+    return NULL;
+}
+
+CallmStatusCode
+Safetensors_tensor_info(const Safetensors *h, const char *tensor_name, enum Dtype *dtype, int *group_size, int *shape,
+                        int *shape_size)
+{
+    SafetensorsLayer *layer;
+    if (Safetensors_get_layer_by_name(h, tensor_name, &layer) != OK)
     {
-        LOGF_ERROR("unsupported dtype %zu", layer->dtype);
-        exit(1);
+        return ERROR;
     }
+    *dtype = layer->dtype;
+    *group_size = layer->group_size;
+    memcpy(shape, layer->shape, layer->shape_size * sizeof(int));
+    *shape_size = layer->shape_size;
+    return OK;
+}
 
-    return m;
+const void *
+Safetensors_tensor_data(const Safetensors *h, const char *tensor_name, size_t *nb_bytes)
+{
+    SafetensorsLayer *layer;
+    HASH_FIND_STR(h->layer_table, tensor_name, layer);
+    if (layer == NULL)
+    {
+        return NULL;
+    }
+    *nb_bytes = layer->nb_bytes;
+    return layer->data;
 }
 
 CallmStatusCode
@@ -330,23 +938,12 @@ Safetensors_get_layer_by_name(const Safetensors *h, const char *layer_name, Safe
 CallmStatusCode
 Safetensors_free(Safetensors *h)
 {
-    if (h->layer_table != NULL)
+    HASH_CLEAR(hh, h->layer_table);
+    for (int s = 0; s < h->nb_shards; s++)
     {
-        HASH_CLEAR(hh, h->layer_table);
+        SafetensorsShard_close(&h->shards[s]);
     }
-
-    free(h->raw_content);
-    json_decref(h->json_root);
-    munmap(h->map, h->map_size);  // TODO: check the return value (causes an error with python extension)
+    free(h->shards);
     free(h);
     return OK;
 }
-
-CallmStatusCode
-SafetensorsLayer_free(SafetensorsLayer *layer)
-{
-    free(layer->shape);
-    free(layer->data_offset);
-    free(layer);
-    return OK;
-}
@@ -3,24 +3,68 @@
 
 #include "../shared/errors.h"
 #include "matrix.h"
-#include <jansson.h>
+#include "weights.h"
 
 enum Dtype
 {
+    UNSUPPORTED_DTYPE = 0,  // Tensors of other types can be listed, not loaded
     F32 = 4,
     BF16 = 2,
+    U8 = 1,  // Raw bytes
+    // Quantised weights of packed models (see pack.h), rows laid out as in quant.h
+    Q8 = 8,
+    Q4 = 9,
+    Q4_MIN = 10,
 };
 
+/* Maximal number of dimensions of a tensor */
+#define SAFETENSORS_MAX_DIMS 8
+
 typedef struct SafetensorsLayer SafetensorsLayer;
 
 typedef struct Safetensors Safetensors;
 
+/**
+ * @brief Loads a 1D or 2D tensor as a float matrix, to be treated as read-only. F32 tensors aren't copied: the matrix
+ * points into the read-only mapping of the file (see Matrix_wrap), so writing to it, in place operations included,
+ * faults, and the Safetensors must outlive it. BF16 tensors are widened into a new matrix.
+ */
 Matrix *Safetensors_load_matrix(const char *tensor_name, const Safetensors *header);
 
+/**
+ * @brief Loads a 1D or 2D tensor as weights kept in their stored precision (bf16 tensors stay bf16). The weights point
+ * into the read-only mapping of the file, without any copy: loading is almost free, pages are read on first use, and
+ * processes serving the same file share one copy of it in the page cache. The Safetensors must outlive them.
+ */
+Weights *Safetensors_load_weights(const char *tensor_name, const Safetensors *header);
+
+/**
+ * @brief Loads a 1D or 2D tensor as weights of the given precision, converting (e.g. quantising) them at load time
+ * when it differs from the stored one. group_size is the group size of Q4 weights (ignored by the other types).
+ */
+Weights *Safetensors_load_weights_as(const char *tensor_name, const Safetensors *header, WeightsDtype dtype,
+                                     int group_size);
+
 CallmStatusCode Safetensors_get_layer_by_name(const Safetensors *header, const char *layer_name,
                                               SafetensorsLayer **layer);
 
-static CallmStatusCode Safetensors_parse(Safetensors *h, const char *header_content);
+/**
+ * @brief Number of tensors, and name of the i-th one (files in order, then tensors in header order).
+ */
+int Safetensors_nb_tensors(const Safetensors *h);
+const char *Safetensors_tensor_name(const Safetensors *h, int i);
+
+/**
+ * @brief Type and shape (at most SAFETENSORS_MAX_DIMS dimensions) of a tensor. group_size is the group size of Q4
+ * tensors, 0 for the others.
+ */
+CallmStatusCode Safetensors_tensor_info(const Safetensors *h, const char *tensor_name, enum Dtype *dtype,
+                                        int *group_size, int *shape, int *shape_size);
+
+/**
+ * @brief Raw data of a tensor in the mapping, and its size. NULL if there is no such tensor.
+ */
+const void *Safetensors_tensor_data(const Safetensors *h, const char *tensor_name, size_t *nb_bytes);
 
 /**
  * @brief Prints the content of an st_header object.
@@ -32,19 +76,39 @@ CallmStatusCode Safetensors_print(Safetensors *h);
  * a file.
  *
  * This function opens a file, maps it into memory, reads the header size and
- * content, and initializes an `st_header` object with the parsed header
- * information.
+ * content, and parses the header once into an array of tensor descriptors (dtype, shape, absolute offset) indexed by
+ * name: looking a tensor up doesn't touch the JSON again, and the JSON tree is released right after parsing.
+ *
+ * The path may also be the index of a sharded checkpoint (model.safetensors.index.json): every shard listed in its
+ * weight map is mapped (shard paths are relative to the index) and tensors are looked up across all of them. Or a
+ * packed model (see pack.h), whose binary header is read in place.
+ * The files are then brought into memory as the residency policy says (see residency.h): populated by mmap,
+ * prefaulted (see Safetensors_prefault), or left to the first pass, and locked if asked. The page faults this took
+ * are logged.
  *
- * @param file_path The path to the file to be read.
- * @return A pointer to the newly created `st_header` object.
+ * @param file_path The path to the safetensors file, or to the index of a sharded checkpoint.
+ * @return A pointer to the newly created `st_header` object, NULL on error.
  */
 Safetensors *Safetensors_new(const char *file_path);
 
+/**
+ * @brief Reads every mapped file into the page cache, the chunks of all the shards in parallel on the thread pool so
+ * that several I/O requests are in flight, instead of faulting pages one by one during the first forward pass.
+ */
+CallmStatusCode Safetensors_prefault(const Safetensors *h);
+
+/**
+ * @brief Locks the mapped files in memory (mlock), faulting them in if needed. Fails when it would exceed
+ * RLIMIT_MEMLOCK, the files then stay pageable.
+ */
+CallmStatusCode Safetensors_lock(const Safetensors *h);
+
 /**
  * @brief Frees the memory allocated for an st_header object.
  *
- * This function releases all resources associated with an `st_header` object,
- * including hash tables, raw content, and JSON objects.
+ * This function releases all resources associated with an `st_header` object:
+ * the tensor descriptors, their index and the mappings. It unmaps the files: everything loaded from them (the model)
+ * must be freed first.
  *
  * @param h A pointer to the `st_header` object to be freed.
  * @return CallmStatusCode OK if the header was successfully freed, ERROR
@@ -52,6 +116,4 @@ Safetensors *Safetensors_new(const char *file_path);
  */
 CallmStatusCode Safetensors_free(Safetensors *h);
 
-CallmStatusCode SafetensorsLayer_free(SafetensorsLayer *layer);
-
 #endif
@@ -1,42 +1,72 @@
 #include "tensor.h"
 #include "./memory/block.h"
+#include "gemm.h"
+#include "threadpool.h"
 #include <stdlib.h>
 #include <string.h>
 
 struct tensor
 {
     size_t ndim;
-    size_t *shape;
+    size_t shape[TENSOR_MAX_DIMS];
+    size_t strides[TENSOR_MAX_DIMS];  // in elements
     size_t size;
-    MemBlock *store;
+    float *data;      // first element
+    MemBlock *store;  // NULL for views
+    int in_arena;     // released with its arena, Tensor_free is a no-op
 };
 
-Tensor *
-Tensor_new(size_t ndim, size_t *shape)
+static Tensor *
+Tensor_alloc(Arena *arena, size_t ndim, const size_t *shape)
 {
+    if (ndim > TENSOR_MAX_DIMS)
+    {
+        LOGF_ERROR("Tensors have at most %d dimensions, got %zu", TENSOR_MAX_DIMS, ndim);
+        return NULL;
+    }
     if (ndim != 0 && shape == NULL)
     {
         LOG_ERROR("Shape must not be NULL");
         return NULL;
     }
-    Tensor *t = malloc(sizeof(Tensor));
+    Tensor *t = arena != NULL ? Arena_alloc(arena, sizeof(Tensor)) : malloc(sizeof(Tensor));
     if (t == NULL)
     {
         LOG_ERROR("Could not allocate memory for tensor");
         return NULL;
     }
 
+    t->in_arena = arena != NULL;
     t->ndim = ndim;
-    t->shape = NULL;
-    if (ndim > 0)
-    {
-        t->shape = (size_t *) malloc(ndim * sizeof(size_t));
-        memcpy(t->shape, shape, ndim);
-    }
-
     t->size = 1;
     for (size_t i = 0; i < ndim; i++)
+    {
+        t->shape[i] = shape[i];
         t->size *= shape[i];
+    }
+    t->data = NULL;
+    t->store = NULL;
+    return t;
+}
+
+/* Row-major strides of a contiguous tensor */
+static void
+contiguous_strides(size_t ndim, const size_t *shape, size_t *strides)
+{
+    size_t stride = 1;
+    for (size_t i = ndim; i != 0; i--)
+    {
+        strides[i - 1] = stride;
+        stride *= shape[i - 1];
+    }
+}
+
+Tensor *
+Tensor_new(size_t ndim, size_t *shape)
+{
+    Tensor *t = Tensor_alloc(NULL, ndim, shape);
+    if (t == NULL)
+        return NULL;
 
     Error **err = Error_new_empty_ref();
     t->store = MemBlock_new(ndim, shape, err);
@@ -45,25 +75,93 @@ Tensor_new(size_t ndim, size_t *shape)
         Tensor_free(t);
         return NULL;
     })
+    free(err);
+
+    t->data = MemBlock_data(t->store);
+    contiguous_strides(ndim, shape, t->strides);
+    return t;
+}
+
+Tensor *
+Tensor_wrap(size_t ndim, const size_t *shape, const size_t *strides, float *data)
+{
+    return Tensor_wrap_in(NULL, ndim, shape, strides, data);
+}
+
+Tensor *
+Tensor_wrap_in(Arena *arena, size_t ndim, const size_t *shape, const size_t *strides, float *data)
+{
+    if (data == NULL)
+    {
+        LOG_ERROR("Tensor data must not be NULL");
+        return NULL;
+    }
+    Tensor *t = Tensor_alloc(arena, ndim, shape);
+    if (t == NULL)
+        return NULL;
 
+    t->data = data;
+    if (strides != NULL)
+        memcpy(t->strides, strides, ndim * sizeof(size_t));
+    else
+        contiguous_strides(ndim, shape, t->strides);
     return t;
 }
 
+Tensor *
+Tensor_transpose(Tensor *t, size_t dim0, size_t dim1)
+{
+    if (dim0 >= t->ndim || dim1 >= t->ndim)
+    {
+        LOGF_ERROR("Cannot transpose dimensions %zu and %zu of a %zu-d tensor", dim0, dim1, t->ndim);
+        return NULL;
+    }
+    Tensor *view = Tensor_wrap(t->ndim, t->shape, t->strides, t->data);
+    if (view == NULL)
+        return NULL;
+
+    view->shape[dim0] = t->shape[dim1];
+    view->shape[dim1] = t->shape[dim0];
+    view->strides[dim0] = t->strides[dim1];
+    view->strides[dim1] = t->strides[dim0];
+    return view;
+}
+
+CallmStatusCode
+Tensor_iterate(Tensor *t, const size_t *mask, MemBlockIterator *i)
+{
+    // No heap round trip for the error reference: kernels iterate on every call
+    Error *err = NULL;
+    MemBlockIterator_init(i, t->data, t->ndim, t->shape, t->strides, mask, &err);
+    if (err != NULL)
+    {
+        LOG_ERROR(err->message);
+        Error_free(err);
+        return ERROR;
+    }
+    return OK;
+}
+
 void
 Tensor_free(Tensor *t)
 {
-    if (t == NULL)
+    if (t == NULL || t->in_arena)
         return;
     if (t->store != NULL)
         MemBlock_free(t->store);
-    if (t->shape != NULL)
-        free(t->shape);
+    free(t);
 }
 
 size_t*
 Tensor_shape(Tensor *t)
 {
-    return t->shape;
+    return t->ndim > 0 ? t->shape : NULL;
+}
+
+size_t*
+Tensor_strides(Tensor *t)
+{
+    return t->ndim > 0 ? t->strides : NULL;
 }
 
 size_t
@@ -78,163 +176,261 @@ Tensor_ndim(Tensor *t)
     return t->ndim;
 }
 
-//// TODO: move this in an iterator in the memory block module
-//static void
-//infer_coords(size_t index, size_t ndim, size_t *shape, size_t *coords)
-//{
-//    for (size_t dim = 0; dim < ndim; dim++)
-//    {
-//        size_t dim_size = shape[dim];
-//        coords[dim] = index % dim_size;
-//        index /= dim_size;
-//    }
-//}
+float *
+Tensor_data(Tensor *t)
+{
+    return t->data;
+}
 
-Tensor *
-Tensor_dot(Tensor *t, Tensor *other)
+int
+Tensor_is_contiguous(Tensor *t)
 {
-    // General verifications
-    if (t == NULL || other == NULL)
+    size_t stride = 1;
+    for (size_t i = t->ndim; i != 0; i--)
     {
-        LOG_ERROR("Input tensors must not be NULL");
-        return NULL;
+        // The stride of a dimension of size 1 is never used
+        if (t->shape[i - 1] != 1 && t->strides[i - 1] != stride)
+            return 0;
+        stride *= t->shape[i - 1];
     }
-    if (t->ndim != other->ndim)
+    return 1;
+}
+
+float
+Tensor_get(Tensor *t, const size_t *coords)
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < t->ndim; i++)
+        offset += coords[i] * t->strides[i];
+    return t->data[offset];
+}
+
+typedef struct
+{
+    Tensor *dst;
+    Tensor *a;
+    Tensor *b;
+    size_t nb_batch_dims;
+    int m;
+    int n;
+    int k;
+    int failed;
+} BatchedDotArgs;
+
+/*
+ * Offset of the matrix of t used by the product number batch, the leading dimensions of size 1 being broadcast
+ */
+static size_t
+batch_offset(const Tensor *t, const Tensor *dst, size_t nb_batch_dims, size_t batch)
+{
+    size_t offset = 0;
+    for (size_t d = nb_batch_dims; d != 0; d--)
     {
-        LOG_ERROR("Tensor dimensions do not match");
+        size_t coord = batch % dst->shape[d - 1];
+        batch /= dst->shape[d - 1];
+        if (t->shape[d - 1] != 1)
+            offset += coord * t->strides[d - 1];
+    }
+    return offset;
+}
+
+/* Copies the r x c matrix at src with the given strides into a contiguous buffer */
+static float *
+gather_matrix(const float *src, int r, int c, size_t row_stride, size_t col_stride)
+{
+    float *dst = malloc((size_t) r * c * sizeof(float));
+    if (dst == NULL)
         return NULL;
+    for (int i = 0; i < r; i++)
+        for (int j = 0; j < c; j++)
+            dst[(size_t) i * c + j] = src[i * row_stride + j * col_stride];
+    return dst;
+}
+
+/*
+ * C = A . B for one product of the batch. A dimension of size 1 has a meaningless stride, so it never forces a copy.
+ */
+static CallmStatusCode
+dot_matrices(const BatchedDotArgs *args, const float *a, const float *b, float *c)
+{
+    size_t nd = args->nb_batch_dims + 2;
+    int m = args->m, n = args->n, k = args->k;
+    size_t ldc = m == 1 ? (size_t) n : args->dst->strides[nd - 2];
+
+    if (k == 0)
+    {
+        for (int i = 0; i < m; i++)
+            memset(c + i * ldc, 0, n * sizeof(float));
+        return OK;
     }
 
-    size_t ndim = t->ndim;
-    Error **err = Error_new_empty_ref();
+    size_t a_row = args->a->strides[nd - 2], a_col = args->a->strides[nd - 1];
+    float *a_copy = NULL;
+    if (k != 1 && a_col != 1)
+    {
+        a_copy = gather_matrix(a, m, k, a_row, a_col);
+        if (a_copy == NULL)
+            return ERROR;
+        a = a_copy;
+        a_row = k;
+    }
+    size_t lda = m == 1 ? (size_t) k : a_row;
 
-    // Special case for 0D tensors => scalar
-    if (ndim == 0)
+    size_t b_row = args->b->strides[nd - 2], b_col = args->b->strides[nd - 1];
+    CallmStatusCode status = OK;
+    if (n == 1 || b_col == 1)
     {
-        Tensor *c = Tensor_new(0, NULL);
-        if (c == NULL)
-            return NULL;
-        MemBlock_set_val(
-            t->store,
-            MemBlock_get_val(t->store, NULL, err) * MemBlock_get_val(other->store, NULL, err),
-            NULL,
-            err
-        );
-        CHECK_ERROR(err, {
-            LOG_ERROR((*err)->message);
-            Tensor_free(c);
-            return NULL;
-        })
-        return c;
-    }
-
-    // Special case for 1D tensors => vector
-    if (ndim == 1)
-    {
-        Tensor *c = Tensor_new(1, t->shape);
-        if (c == NULL)
-            return NULL;
-
-        for (size_t i = 0; i < t->shape[0]; i++)
+        gemm_f32(m, n, k, a, (int) lda, b, k == 1 ? n : (int) b_row, c, (int) ldc, 0);
+    }
+    else if (k == 1 || b_row == 1)
+    {
+        // B is the transpose of a row-major n x k matrix
+        gemm_f32_nt(m, n, k, a, (int) lda, b, (int) b_col, c, (int) ldc, 0);
+    }
+    else
+    {
+        float *b_copy = gather_matrix(b, k, n, b_row, b_col);
+        if (b_copy != NULL)
+            gemm_f32(m, n, k, a, (int) lda, b_copy, n, c, (int) ldc, 0);
+        else
+            status = ERROR;
+        free(b_copy);
+    }
+
+    free(a_copy);
+    return status;
+}
+
+static void
+dot_batches(void *arg, int start, int end)
+{
+    BatchedDotArgs *args = (BatchedDotArgs *) arg;
+    for (int batch = start; batch < end; batch++)
+    {
+        const float *a = args->a->data + batch_offset(args->a, args->dst, args->nb_batch_dims, batch);
+        const float *b = args->b->data + batch_offset(args->b, args->dst, args->nb_batch_dims, batch);
+        float *c = args->dst->data + batch_offset(args->dst, args->dst, args->nb_batch_dims, batch);
+        if (dot_matrices(args, a, b, c) != OK)
         {
-            NEW_STATIC_COORDS(coords, i)
-            MemBlock_set_val(
-                t->store,
-                MemBlock_get_val(t->store, coords, err) * MemBlock_get_val(other->store, coords, err),
-                coords,
-                err
-            );
-            CHECK_ERROR(err, {
-                LOG_ERROR((*err)->message);
-                Tensor_free(c);
-                return NULL;
-            })
+            __atomic_store_n(&args->failed, 1, __ATOMIC_RELAXED);
         }
-
-        return c;
     }
+}
 
-    // TODO: special case for 3D tensor => matrix
-    // TODO: special case for 4D tensor
+/* Checks the operands of a product and fills the shape of its result, returns its number of dimensions or -1 */
+static int
+dot_shape(Tensor *t, Tensor *other, size_t *shape)
+{
+    if (t == NULL || other == NULL)
+    {
+        LOG_ERROR("Input tensors must not be NULL");
+        return -1;
+    }
+    if (t->ndim != other->ndim)
+    {
+        LOGF_ERROR("Tensor dimensions do not match, got %zu and %zu", t->ndim, other->ndim);
+        return -1;
+    }
 
-    // If ndim > 1, check shape
-    if (t->shape[ndim - 2] != other->shape[ndim - 1])
+    size_t ndim = t->ndim;
+    if (ndim == 1 && t->shape[0] != other->shape[0])
     {
-        LOGF_ERROR("Tensor dimensions do not match, got t[-2]=%d and other[-1]", t->shape[ndim - 2], other->shape[ndim - 1]);
-        return NULL;
+        LOGF_ERROR("Tensor sizes do not match, got %zu and %zu", t->shape[0], other->shape[0]);
+        return -1;
     }
+    if (ndim < 2)
+        return 0;
 
+    if (t->shape[ndim - 1] != other->shape[ndim - 2])
+    {
+        LOGF_ERROR("Tensor dimensions do not match, got t[-1]=%zu and other[-2]=%zu", t->shape[ndim - 1],
+                   other->shape[ndim - 2]);
+        return -1;
+    }
     for (size_t i = 0; i < ndim - 2; i++)
     {
-        if (t->shape[i] != other->shape[i])
+        if (t->shape[i] != other->shape[i] && t->shape[i] != 1 && other->shape[i] != 1)
         {
-            LOGF_ERROR("Tensor dimensions do not match at index %d", i);
-            return NULL;
+            LOGF_ERROR("Tensor dimensions do not match at index %zu, got %zu and %zu", i, t->shape[i],
+                       other->shape[i]);
+            return -1;
         }
+        shape[i] = t->shape[i] != 1 ? t->shape[i] : other->shape[i];
     }
+    shape[ndim - 2] = t->shape[ndim - 2];
+    shape[ndim - 1] = other->shape[ndim - 1];
+    return (int) ndim;
+}
 
-    // init the new C tensor
-    size_t *c_shape = malloc(ndim * sizeof(size_t));
-    if (c_shape == NULL)
+CallmStatusCode
+Tensor_dot_into(Tensor *dst, Tensor *t, Tensor *other)
+{
+    size_t shape[TENSOR_MAX_DIMS];
+    int ndim = dot_shape(t, other, shape);
+    if (ndim < 0)
+        return ERROR;
+    if (dst == NULL || dst->ndim != (size_t) ndim || memcmp(dst->shape, shape, ndim * sizeof(size_t)) != 0)
     {
-        LOG_ERROR("Could not allocate memory for shape");
-        return NULL;
+        LOG_ERROR("Tensor_dot_into: invalid destination shape");
+        return ERROR;
     }
-    memcpy(c_shape, t->shape, ndim);
-    c_shape[ndim - 1] = other->shape[ndim - 1];
-    Tensor *c = Tensor_new(ndim, c_shape);
-    if (c == NULL)
-        return NULL;
-    free(c_shape);
 
-    float acc;
-    size_t *t_coords = malloc(ndim - 1 * sizeof(size_t));
-    size_t *other_coords = malloc(ndim - 1 * sizeof(size_t));
+    // Scalars and vectors
+    if (ndim == 0)
+    {
+        float acc = 0.0f;
+        size_t len = t->ndim == 1 ? t->shape[0] : 1;
+        size_t t_stride = t->ndim == 1 ? t->strides[0] : 0, other_stride = t->ndim == 1 ? other->strides[0] : 0;
+        for (size_t i = 0; i < len; i++)
+            acc += t->data[i * t_stride] * other->data[i * other_stride];
+        dst->data[0] = acc;
+        return OK;
+    }
 
-    for (size_t i = 0; i < t->shape[ndim - 2]; i++)
+    if (shape[ndim - 1] != 1 && dst->strides[ndim - 1] != 1)
     {
-        for (size_t j = 0; j < other->shape[ndim - 1]; j++)
-        {
-            t_coords[ndim - 1] = i;
-            other_coords[ndim - 2] = j;
-
-            size_t n_common_coords = 1;
-            for (size_t dim_idx = 0; dim_idx < ndim - 2; dim_idx++)
-            {
-                n_common_coords *= t->shape[dim_idx];
-            }
-
-            for (size_t coord_idx = 0; coord_idx < n_common_coords; coord_idx++)
-            {
-                infer_coords(coord_idx, ndim - 2, t->shape, t_coords);
-                for (size_t c = 0; c < ndim - 2; c++)
-                {
-                    acc += t->data[t_coords[c]] * other->data[other_coords[c]];  // TODO: use a memory block here
-                }
-            }
-
-
-//            for (size_t dim_idx = 0; dim_idx < ndim - 2; dim_idx++)
-//            {
-//                // t_coords[dim_idx] = dim_idx;
-//                // other_coords[dim_idx] = dim_idx;
-//
-//                size_t dim_size = t->shape[dim_idx];
-//                for (size_t k = 0; k < dim_size; k++)
-//                {
-//                    t_coords[dim_idx] = k;
-//                    other_coords[dim_idx] = k;
-//
-//                }
-//                // c->data[i * other->shape[other->ndim - 1] + j] += t->data[i * t->shape[t->ndim - 1] + k] * other->data[k * other->shape[other->ndim - 1] + j];
-//            }
-        }
+        LOG_ERROR("Tensor_dot_into: the rows of the destination must be contiguous");
+        return ERROR;
     }
+    if (dst->size == 0)
+        return OK;
 
-    free(t_coords);
-    free(other_coords);
-    if (*err != NULL)
-        Error_free(*err);
+    BatchedDotArgs args = { dst, t, other, ndim - 2, (int) shape[ndim - 2], (int) shape[ndim - 1],
+                            (int) t->shape[ndim - 1], 0 };
+    int nb_batches = (int) (dst->size / (shape[ndim - 2] * shape[ndim - 1]));
 
+    // Enough products for every thread: one product per task, each GEMM then runs on its worker thread only
+    if (nb_batches > 1 && nb_batches >= ThreadPool_size(ThreadPool_default()))
+    {
+        parallel_for(nb_batches, 1, dot_batches, &args);
+    }
+    else
+    {
+        dot_batches(&args, 0, nb_batches);
+    }
+    if (args.failed)
+    {
+        LOG_ERROR("Tensor_dot_into: could not allocate a copy of an operand");
+        return ERROR;
+    }
+    return OK;
+}
+
+Tensor *
+Tensor_dot(Tensor *t, Tensor *other)
+{
+    size_t shape[TENSOR_MAX_DIMS];
+    int ndim = dot_shape(t, other, shape);
+    if (ndim < 0)
+        return NULL;
+
+    Tensor *c = Tensor_new(ndim, shape);
+    if (c == NULL)
+        return NULL;
+    if (Tensor_dot_into(c, t, other) != OK)
+    {
+        Tensor_free(c);
+        return NULL;
+    }
     return c;
-}
\ No newline at end of file
+}
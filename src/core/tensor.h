@@ -2,13 +2,23 @@
 #define CALLM_TENSOR_H
 
 #include "../shared/errors.h"
+#include "memory/arena.h"
+#include "memory/block.h"
+#include <stddef.h>
 
+/*
+ * N-d array of floats: a shape, and per dimension a stride (in elements) into a buffer. Tensors created by Tensor_new
+ * own a contiguous row-major MemBlock, views (Tensor_wrap, Tensor_transpose) only reference memory owned elsewhere,
+ * which must outlive them. A stride of 0 repeats the same values along a dimension.
+ */
 typedef struct tensor Tensor;
 
+#define TENSOR_MAX_DIMS 8
+
 /**
- * Initialize a new empy tensor.
+ * Initialize a new zeroed, contiguous tensor.
  *
- * @param ndim number of dimensions
+ * @param ndim number of dimensions (at most TENSOR_MAX_DIMS)
  * @param shape array containing the size of each dimension (its length MUST be equal to ndim).
  *              The Tensor object doesn't have ownership over this pointer.
  *              Can be NULL for a scalar tensor.
@@ -18,7 +28,58 @@ Tensor *
 Tensor_new(size_t ndim, size_t *shape);
 
 /**
- * Freed the tensor.
+ * Initialize a view over a buffer the tensor doesn't own, e.g. the heads of a [tokens, heads * head_dim] projection
+ * matrix seen as [heads, tokens, head_dim] with strides {head_dim, heads * head_dim, 1}.
+ *
+ * @param ndim number of dimensions (at most TENSOR_MAX_DIMS)
+ * @param shape size of each dimension, copied
+ * @param strides number of elements between two consecutive indices of each dimension, copied.
+ *                NULL for a contiguous row-major layout.
+ * @param data first element
+ * @return new tensor pointer
+ */
+Tensor *
+Tensor_wrap(size_t ndim, const size_t *shape, const size_t *strides, float *data);
+
+/**
+ * Same as Tensor_wrap with the tensor itself allocated from arena (from the heap when NULL): Tensor_free is then a
+ * no-op, the view goes away with the arena.
+ *
+ * @param arena
+ * @param ndim
+ * @param shape
+ * @param strides
+ * @param data
+ * @return new tensor pointer
+ */
+Tensor *
+Tensor_wrap_in(Arena *arena, size_t ndim, const size_t *shape, const size_t *strides, float *data);
+
+/**
+ * Returns a view of t with the dimensions dim0 and dim1 swapped. No data is moved.
+ *
+ * @param t
+ * @param dim0
+ * @param dim1
+ * @return new view or NULL when the dimensions are out of range
+ */
+Tensor *
+Tensor_transpose(Tensor *t, size_t dim0, size_t dim1);
+
+/**
+ * Init an iterator over the contiguous spans of the tensor (see MemBlockIterator), e.g. a single span for a
+ * contiguous tensor, one per row for a padded matrix, one per element for a transposed one.
+ *
+ * @param t
+ * @param mask dimensions to iterate over (1) or to leave to MemBlockIterator_get_val (0), NULL for all of them
+ * @param i iterator to fill
+ * @return OK, or ERROR for an invalid mask
+ */
+CallmStatusCode
+Tensor_iterate(Tensor *t, const size_t *mask, MemBlockIterator *i);
+
+/**
+ * Freed the tensor. The memory of a view is left untouched, tensors allocated from an arena are left to it.
  *
  * @param t Tensor instance
  */
@@ -34,6 +95,15 @@ Tensor_free(Tensor *t);
 size_t*
 Tensor_shape(Tensor *t);
 
+/**
+ * Return the strides of the tensor, in elements. NULL if it is a scalar
+ *
+ * @param t
+ * @return
+ */
+size_t*
+Tensor_strides(Tensor *t);
+
 /**
  * Returns the total number of data contained into the tensor.
  *
@@ -52,16 +122,45 @@ Tensor_size(Tensor *t);
 size_t
 Tensor_ndim(Tensor *t);
 
+/**
+ * Returns the first element of the tensor, the others are found through the strides.
+ *
+ * @param t
+ * @return
+ */
+float *
+Tensor_data(Tensor *t);
+
+/**
+ * Returns 1 when the elements are laid out contiguously in row-major order, 0 else.
+ *
+ * @param t
+ * @return
+ */
+int
+Tensor_is_contiguous(Tensor *t);
+
+/**
+ * Returns the element at the given coordinates (one per dimension, unchecked).
+ *
+ * @param t
+ * @param coords
+ * @return
+ */
+float
+Tensor_get(Tensor *t, const size_t *coords);
+
 /**
  * Perform a dot product between 2 tensors, allocate, create and returns the resulting tensor.
  * The 2 input tensors must have compatible shapes. Given 2 tensors A, B with n dimensions:
- * - shape(A) = (d1, d2, .., m, p)
- * - shape(B) = (d1, d2, .., q, m)
+ * - shape(A) = (d1, d2, .., m, k)
+ * - shape(B) = (d1, d2, .., k, n)
  *
- * The dot product is only performes between the 2 last dimensions. The resulting tensor C have the shape:
- * - shape(C) = (d1, d2, .., q, p)
+ * The dot product is a batch of matrix products over the 2 last dimensions. The resulting tensor C have the shape:
+ * - shape(C) = (d1, d2, .., m, n)
  *
- * Note it also works for ndim=1 and ndim=0 tensors.
+ * A leading dimension of size 1 in one operand is broadcast to the size of the other.
+ * For ndim=1 tensors, it's the inner product (a scalar tensor), for ndim=0 tensors the product of the scalars.
  *
  * @param t current Tensor instance
  * @param other Tensor to multiply with. Must have compatible dimensions
@@ -70,4 +169,20 @@ Tensor_ndim(Tensor *t);
 Tensor *
 Tensor_dot(Tensor *t, Tensor *other);
 
+/**
+ * Same as Tensor_dot, writing the result into dst, which must have the shape of the result and rows of contiguous
+ * elements (stride 1 on its last dimension). dst may be a view, e.g. the columns of one head in a matrix.
+ *
+ * Each 2-D product runs on the optimised GEMM: an operand is read in place when one of its 2 last dimensions is
+ * contiguous (a transposed view of B goes through gemm_f32_nt), and copied otherwise. Batches of at least as many
+ * products as threads are spread over the default thread pool, one product per task.
+ *
+ * @param dst
+ * @param t
+ * @param other
+ * @return OK, or ERROR when the shapes don't match
+ */
+CallmStatusCode
+Tensor_dot_into(Tensor *dst, Tensor *t, Tensor *other);
+
 #endif  // CALLM_TENSOR_H
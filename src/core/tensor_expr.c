@@ -0,0 +1,721 @@
+#include "tensor_expr.h"
+#include "../shared/logging.h"
+#include "threadpool.h"
+#include "vecops.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Elements evaluated per task: rows are grouped until a task has about this many */
+#define TENSOR_EXPR_GRAIN 16384
+
+/* A tensor broadcast to the shape of the destination: strides of the outer dimensions, and stride along the rows */
+typedef struct
+{
+    float *data;
+    size_t strides[TENSOR_MAX_DIMS];
+    size_t step;
+} ExprTensor;
+
+typedef struct
+{
+    const TensorExprStep *program;
+    int nb_steps;
+    int nb_operands;
+    size_t nb_outer;  // dimensions before the last one
+    size_t outer_shape[TENSOR_MAX_DIMS];
+    int n;       // row length
+    int direct;  // rows are stored straight into dst, which is contiguous along them and overlaps no operand
+    int nb_slots;
+    ExprTensor dst;
+    ExprTensor operands[TENSOR_EXPR_MAX_OPERANDS];
+    int failed;
+} ExprEval;
+
+/*
+ * Lazy value of a row. Steps only compute a row when no single kernel covers them with their inputs:
+ *   ROW:     a * s (a read as rotate_half(a) when rotated)
+ *   UNIFORM: s along the whole row
+ *   PRODUCT: a * b * s (a read as rotate_half(a) when rotated)
+ *   SILU:    silu(a) * b * s (silu(a) * s when b is NULL)
+ */
+typedef enum
+{
+    VALUE_ROW = 0,
+    VALUE_UNIFORM,
+    VALUE_PRODUCT,
+    VALUE_SILU,
+} ValueKind;
+
+typedef struct
+{
+    ValueKind kind;
+    const float *a;
+    const float *b;
+    float s;
+    int rotated;
+    int slots[2];  // scratch rows owned by the value, -1 when unused
+} Value;
+
+/* Rows of n floats from the thread arena, the bits of used marking the taken ones */
+typedef struct
+{
+    float *rows;
+    int n;
+    unsigned used;
+} Scratch;
+
+static int
+slot_take(Scratch *sc)
+{
+    // Always available: the scratch is sized after the deepest stack of the program
+    int slot = 0;
+    while (sc->used & (1u << slot))
+        slot++;
+    sc->used |= 1u << slot;
+    return slot;
+}
+
+static float *
+slot_row(const Scratch *sc, int slot)
+{
+    return sc->rows + (size_t) slot * sc->n;
+}
+
+static Value
+value_row(const float *a, float s, int slot)
+{
+    return (Value) { VALUE_ROW, a, NULL, s, 0, { slot, -1 } };
+}
+
+static Value
+value_uniform(float s)
+{
+    return (Value) { VALUE_UNIFORM, NULL, NULL, s, 0, { -1, -1 } };
+}
+
+static void
+value_release(Scratch *sc, Value *v)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (v->slots[i] >= 0)
+            sc->used &= ~(1u << v->slots[i]);
+        v->slots[i] = -1;
+    }
+}
+
+static void
+value_swap(Value *x, Value *y)
+{
+    Value tmp = *x;
+    *x = *y;
+    *y = tmp;
+}
+
+/* Factors of [lo, lo + len) of a ROW or PRODUCT, within a single half of the row when rotated */
+static void
+value_segment(const Value *v, int lo, int half, const float **a, const float **b, float *s)
+{
+    *b = v->kind == VALUE_PRODUCT ? v->b + lo : NULL;
+    *s = v->s;
+    if (!v->rotated)
+    {
+        *a = v->a + lo;
+    }
+    else if (lo < half)
+    {
+        *a = v->a + lo + half;  // rotate_half(a) = [-a2, a1]
+        *s = -v->s;
+    }
+    else
+    {
+        *a = v->a + lo - half;
+    }
+}
+
+/* Writes the row of v into dst, which may only alias the rows of v when v is not rotated */
+static void
+value_store(const Scratch *sc, const Value *v, float *dst)
+{
+    int n = sc->n;
+    switch (v->kind)
+    {
+    case VALUE_UNIFORM:
+        for (int i = 0; i < n; i++)
+            dst[i] = v->s;
+        return;
+    case VALUE_SILU:
+        if (v->b != NULL)
+            vec_silu_mul(dst, v->a, v->b, n);
+        else
+            vec_silu(dst, v->a, n);
+        if (v->s != 1.0f)
+            vec_scale(dst, dst, v->s, n);
+        return;
+    default:
+        break;
+    }
+
+    int nb_segments = v->rotated ? 2 : 1;
+    int len = n / nb_segments;
+    for (int k = 0; k < nb_segments; k++)
+    {
+        const float *a, *b;
+        float s;
+        value_segment(v, k * len, n / 2, &a, &b, &s);
+        if (b != NULL)
+            vec_mul_scale(dst + k * len, a, b, s, len);
+        else if (s != 1.0f)
+            vec_scale(dst + k * len, a, s, len);
+        else if (dst + k * len != a)
+            memcpy(dst + k * len, a, len * sizeof(float));
+    }
+}
+
+/* Computes v into a scratch row of its own unless it already is a plain row (ROW, not rotated, unscaled) */
+static void
+value_materialize(Scratch *sc, Value *v)
+{
+    if (v->kind == VALUE_ROW && !v->rotated && v->s == 1.0f)
+        return;
+    int slot = slot_take(sc);
+    value_store(sc, v, slot_row(sc, slot));
+    value_release(sc, v);
+    *v = value_row(slot_row(sc, slot), 1.0f, slot);
+}
+
+/* x = x * y */
+static void
+value_mul(Scratch *sc, Value *x, Value *y)
+{
+    if (x->kind == VALUE_UNIFORM)
+        value_swap(x, y);
+    if (y->kind == VALUE_UNIFORM)
+    {
+        x->s *= y->s;
+        return;
+    }
+
+    // silu(a) * b in one pass
+    if (y->kind == VALUE_SILU && y->b == NULL)
+        value_swap(x, y);
+    if (x->kind == VALUE_SILU && x->b == NULL && y->kind != VALUE_SILU)
+    {
+        if (y->kind != VALUE_ROW || y->rotated)
+            value_materialize(sc, y);
+        x->b = y->a;
+        x->s *= y->s;
+        x->slots[1] = y->slots[0];
+        return;
+    }
+
+    // a * b with at most one rotated factor
+    if (x->kind != VALUE_ROW || (x->rotated && y->rotated))
+        value_materialize(sc, x);
+    if (y->kind != VALUE_ROW)
+        value_materialize(sc, y);
+    if (y->rotated)
+        value_swap(x, y);
+    x->kind = VALUE_PRODUCT;
+    x->b = y->a;
+    x->s *= y->s;
+    x->slots[1] = y->slots[0];
+}
+
+/* x = x + sign * y */
+static void
+value_add(Scratch *sc, Value *x, Value *y, float sign)
+{
+    int n = sc->n;
+    if (x->kind == VALUE_UNIFORM && y->kind == VALUE_UNIFORM)
+    {
+        x->s += sign * y->s;
+        return;
+    }
+
+    int slot = -1;
+    if (x->kind == VALUE_UNIFORM || y->kind == VALUE_UNIFORM)
+    {
+        // Row * scale + bias
+        Value *row = x->kind == VALUE_UNIFORM ? y : x;
+        float bias = x->kind == VALUE_UNIFORM ? x->s : sign * y->s;
+        float scale = x->kind == VALUE_UNIFORM ? sign : 1.0f;
+        if (row->kind != VALUE_ROW || row->rotated)
+            value_materialize(sc, row);
+        slot = slot_take(sc);
+        vec_scale_add(slot_row(sc, slot), row->a, row->s * scale, bias, n);
+    }
+    else if (x->kind == VALUE_PRODUCT && y->kind == VALUE_PRODUCT)
+    {
+        // a * b * s + c * d * t, by halves when a factor is rotated (x * cos + rotate_half(x) * sin)
+        slot = slot_take(sc);
+        int nb_segments = x->rotated || y->rotated ? 2 : 1;
+        int len = n / nb_segments;
+        for (int k = 0; k < nb_segments; k++)
+        {
+            const float *a, *b, *c, *d;
+            float s, t;
+            value_segment(x, k * len, n / 2, &a, &b, &s);
+            value_segment(y, k * len, n / 2, &c, &d, &t);
+            vec_mul_add_mul(slot_row(sc, slot) + k * len, a, b, s, c, d, sign * t, len);
+        }
+    }
+    else
+    {
+        value_materialize(sc, x);
+        value_materialize(sc, y);
+        slot = slot_take(sc);
+        if (sign > 0.0f)
+            vec_add(slot_row(sc, slot), x->a, y->a, n);
+        else
+            vec_sub(slot_row(sc, slot), x->a, y->a, n);
+    }
+    value_release(sc, x);
+    value_release(sc, y);
+    *x = value_row(slot_row(sc, slot), 1.0f, slot);
+}
+
+static void
+value_mean(Scratch *sc, Value *x)
+{
+    if (x->kind == VALUE_UNIFORM)
+        return;
+    float sum;
+    if (x->kind == VALUE_PRODUCT && !x->rotated && x->a == x->b)
+    {
+        sum = x->s * vec_square_sum(x->a, sc->n);
+    }
+    else
+    {
+        if (x->kind != VALUE_ROW || x->rotated)
+            value_materialize(sc, x);
+        sum = x->s * vec_sum(x->a, sc->n);
+    }
+    value_release(sc, x);
+    *x = value_uniform(sum / (float) sc->n);
+}
+
+static void
+value_rsqrt(Scratch *sc, Value *x)
+{
+    if (x->kind == VALUE_UNIFORM)
+    {
+        x->s = 1.0f / sqrtf(x->s);
+        return;
+    }
+    int slot = slot_take(sc);
+    float *row = slot_row(sc, slot);
+    value_store(sc, x, row);
+    for (int i = 0; i < sc->n; i++)
+        row[i] = 1.0f / sqrtf(row[i]);
+    value_release(sc, x);
+    *x = value_row(row, 1.0f, slot);
+}
+
+static void
+value_rotate_half(Scratch *sc, Value *x)
+{
+    if (x->kind == VALUE_ROW && x->rotated)
+    {
+        // rotate_half(rotate_half(a)) = -a
+        x->rotated = 0;
+        x->s = -x->s;
+        return;
+    }
+    if (x->kind != VALUE_ROW)
+        value_materialize(sc, x);
+    x->rotated = 1;
+}
+
+/* Evaluates the program on the row of the given offsets into dst_row (n floats, not overlapping any operand) */
+static void
+eval_row(const ExprEval *e, Scratch *sc, const size_t *offsets, const float *const *gathered, float *dst_row)
+{
+    Value stack[TENSOR_EXPR_MAX_STACK];
+    int top = 0;
+    for (int k = 0; k < e->nb_steps; k++)
+    {
+        const TensorExprStep *step = &e->program[k];
+        Value *x = top >= 2 ? &stack[top - 2] : NULL;
+        Value *y = top >= 1 ? &stack[top - 1] : NULL;
+        switch (step->op)
+        {
+        case TENSOR_EXPR_LOAD:
+        {
+            const ExprTensor *op = &e->operands[step->arg];
+            const float *row = op->data + offsets[step->arg];
+            if (op->step == 0)
+                stack[top++] = value_uniform(row[0]);
+            else
+                stack[top++] = value_row(op->step == 1 ? row : gathered[step->arg], 1.0f, -1);
+            break;
+        }
+        case TENSOR_EXPR_CONST:
+            stack[top++] = value_uniform(step->value);
+            break;
+        case TENSOR_EXPR_ADD:
+            value_add(sc, x, y, 1.0f);
+            top--;
+            break;
+        case TENSOR_EXPR_SUB:
+            value_add(sc, x, y, -1.0f);
+            top--;
+            break;
+        case TENSOR_EXPR_MUL:
+            value_mul(sc, x, y);
+            top--;
+            break;
+        case TENSOR_EXPR_SILU:
+            if (y->kind == VALUE_UNIFORM)
+            {
+                y->s = y->s / (1.0f + expf(-y->s));
+                break;
+            }
+            value_materialize(sc, y);
+            y->kind = VALUE_SILU;
+            break;
+        case TENSOR_EXPR_RSQRT:
+            value_rsqrt(sc, y);
+            break;
+        case TENSOR_EXPR_MEAN:
+            value_mean(sc, y);
+            break;
+        case TENSOR_EXPR_ROTATE_HALF:
+            value_rotate_half(sc, y);
+            break;
+        }
+    }
+    value_store(sc, &stack[0], dst_row);
+    value_release(sc, &stack[0]);
+}
+
+static void
+eval_range(void *arg, int start, int end)
+{
+    ExprEval *e = (ExprEval *) arg;
+    int n = e->n;
+
+    // Scratch rows from the arena of the worker, released when done: the first ones hold the strided operands
+    Arena *arena = Arena_thread_local();
+    ArenaMark mark = arena != NULL ? Arena_mark(arena) : (ArenaMark) { 0, 0, 0 };
+    Scratch sc = { NULL, n, 0 };
+    sc.rows = arena != NULL ? Arena_alloc(arena, (size_t) e->nb_slots * n * sizeof(float)) : NULL;
+    if (sc.rows == NULL)
+    {
+        __atomic_store_n(&e->failed, 1, __ATOMIC_RELAXED);
+        if (arena != NULL)
+            Arena_release(arena, mark);
+        return;
+    }
+    float *gathered[TENSOR_EXPR_MAX_OPERANDS] = { 0 };
+    for (int k = 0; k < e->nb_operands; k++)
+    {
+        if (e->operands[k].step > 1)
+            gathered[k] = slot_row(&sc, slot_take(&sc));
+    }
+
+    size_t coords[TENSOR_MAX_DIMS];
+    size_t offsets[TENSOR_EXPR_MAX_OPERANDS];
+    size_t dst_offset = 0;
+    size_t rest = (size_t) start;
+    for (int k = 0; k < e->nb_operands; k++)
+        offsets[k] = 0;
+    for (size_t d = e->nb_outer; d-- > 0;)
+    {
+        coords[d] = rest % e->outer_shape[d];
+        rest /= e->outer_shape[d];
+        dst_offset += coords[d] * e->dst.strides[d];
+        for (int k = 0; k < e->nb_operands; k++)
+            offsets[k] += coords[d] * e->operands[k].strides[d];
+    }
+
+    for (int r = start; r < end; r++)
+    {
+        for (int k = 0; k < e->nb_operands; k++)
+        {
+            const ExprTensor *op = &e->operands[k];
+            if (gathered[k] != NULL)
+            {
+                for (int i = 0; i < n; i++)
+                    gathered[k][i] = op->data[offsets[k] + i * op->step];
+            }
+        }
+
+        float *dst_row = e->dst.data + dst_offset;
+        if (e->direct)
+        {
+            eval_row(e, &sc, offsets, (const float *const *) gathered, dst_row);
+        }
+        else
+        {
+            int slot = slot_take(&sc);
+            float *row = slot_row(&sc, slot);
+            eval_row(e, &sc, offsets, (const float *const *) gathered, row);
+            for (int i = 0; i < n; i++)
+                dst_row[i * e->dst.step] = row[i];
+            sc.used &= ~(1u << slot);
+        }
+
+        // Next row
+        for (size_t d = e->nb_outer; d-- > 0;)
+        {
+            dst_offset += e->dst.strides[d];
+            for (int k = 0; k < e->nb_operands; k++)
+                offsets[k] += e->operands[k].strides[d];
+            if (++coords[d] < e->outer_shape[d])
+                break;
+            coords[d] = 0;
+            dst_offset -= e->outer_shape[d] * e->dst.strides[d];
+            for (int k = 0; k < e->nb_operands; k++)
+                offsets[k] -= e->outer_shape[d] * e->operands[k].strides[d];
+        }
+    }
+    Arena_release(arena, mark);
+}
+
+/* Returns the deepest stack of a valid program, -1 otherwise */
+static int
+program_depth(const TensorExprStep *program, int nb_steps, int nb_operands, int *rotates)
+{
+    int depth = 0, max_depth = 0;
+    *rotates = 0;
+    for (int k = 0; k < nb_steps; k++)
+    {
+        switch (program[k].op)
+        {
+        case TENSOR_EXPR_LOAD:
+            if (program[k].arg < 0 || program[k].arg >= nb_operands)
+            {
+                LOGF_ERROR("Tensor_eval_into: step %d loads operand %d of %d", k, program[k].arg, nb_operands);
+                return -1;
+            }
+            depth++;
+            break;
+        case TENSOR_EXPR_CONST:
+            depth++;
+            break;
+        case TENSOR_EXPR_ADD:
+        case TENSOR_EXPR_SUB:
+        case TENSOR_EXPR_MUL:
+            if (depth < 2)
+            {
+                LOGF_ERROR("Tensor_eval_into: step %d needs 2 values, got %d", k, depth);
+                return -1;
+            }
+            depth--;
+            break;
+        case TENSOR_EXPR_ROTATE_HALF:
+            *rotates = 1;
+            // fallthrough
+        case TENSOR_EXPR_SILU:
+        case TENSOR_EXPR_RSQRT:
+        case TENSOR_EXPR_MEAN:
+            if (depth < 1)
+            {
+                LOGF_ERROR("Tensor_eval_into: step %d needs a value", k);
+                return -1;
+            }
+            break;
+        default:
+            LOGF_ERROR("Tensor_eval_into: unknown operation %d at step %d", (int) program[k].op, k);
+            return -1;
+        }
+        if (depth > TENSOR_EXPR_MAX_STACK)
+        {
+            LOGF_ERROR("Tensor_eval_into: more than %d values on the stack", TENSOR_EXPR_MAX_STACK);
+            return -1;
+        }
+        if (depth > max_depth)
+            max_depth = depth;
+    }
+    if (depth != 1)
+    {
+        LOGF_ERROR("Tensor_eval_into: the program leaves %d values instead of 1", depth);
+        return -1;
+    }
+    return max_depth;
+}
+
+/* Strides of t broadcast to the shape of dst, -1 when it can't be */
+static int
+broadcast_to(Tensor *dst, Tensor *t, ExprTensor *out)
+{
+    size_t ndim = Tensor_ndim(dst), t_ndim = Tensor_ndim(t);
+    if (t_ndim > ndim)
+        return -1;
+    const size_t *shape = Tensor_shape(dst);
+    size_t strides[TENSOR_MAX_DIMS];
+    for (size_t d = 0; d < ndim; d++)
+    {
+        strides[d] = 0;
+        if (d + t_ndim < ndim)
+            continue;
+        size_t td = d + t_ndim - ndim;
+        if (Tensor_shape(t)[td] == shape[d])
+            strides[d] = Tensor_strides(t)[td];
+        else if (Tensor_shape(t)[td] != 1)
+            return -1;
+    }
+    out->data = Tensor_data(t);
+    out->step = ndim > 0 ? strides[ndim - 1] : 0;
+    for (size_t d = 0; d + 1 < ndim; d++)
+        out->strides[d] = strides[d];
+    return 0;
+}
+
+/* Last element of t in memory */
+static const float *
+tensor_end(Tensor *t)
+{
+    const float *end = Tensor_data(t);
+    for (size_t d = 0; d < Tensor_ndim(t); d++)
+        end += (Tensor_shape(t)[d] - 1) * Tensor_strides(t)[d];
+    return end;
+}
+
+int
+Tensor_broadcast_shape(Tensor **tensors, int nb_tensors, size_t *shape)
+{
+    size_t ndim = 0;
+    for (int k = 0; k < nb_tensors; k++)
+    {
+        if (Tensor_ndim(tensors[k]) > ndim)
+            ndim = Tensor_ndim(tensors[k]);
+    }
+    for (size_t d = 0; d < ndim; d++)
+        shape[d] = 1;
+    for (int k = 0; k < nb_tensors; k++)
+    {
+        size_t t_ndim = Tensor_ndim(tensors[k]);
+        for (size_t td = 0; td < t_ndim; td++)
+        {
+            size_t d = td + ndim - t_ndim, size = Tensor_shape(tensors[k])[td];
+            if (size == shape[d] || size == 1)
+                continue;
+            if (shape[d] != 1)
+            {
+                LOGF_ERROR("Cannot broadcast dimension %zu of size %zu to %zu", d, size, shape[d]);
+                return -1;
+            }
+            shape[d] = size;
+        }
+    }
+    return (int) ndim;
+}
+
+CallmStatusCode
+Tensor_eval_into(Tensor *dst, const TensorExprStep *program, int nb_steps, Tensor **operands, int nb_operands)
+{
+    if (dst == NULL || program == NULL || (nb_operands > 0 && operands == NULL))
+    {
+        LOG_ERROR("Tensor_eval_into: NULL destination, program or operands");
+        return ERROR;
+    }
+    if (nb_operands < 0 || nb_operands > TENSOR_EXPR_MAX_OPERANDS)
+    {
+        LOGF_ERROR("Tensor_eval_into: at most %d operands, got %d", TENSOR_EXPR_MAX_OPERANDS, nb_operands);
+        return ERROR;
+    }
+    int rotates;
+    int depth = program_depth(program, nb_steps, nb_operands, &rotates);
+    if (depth < 0)
+        return ERROR;
+
+    size_t ndim = Tensor_ndim(dst);
+    ExprEval e = { .program = program, .nb_steps = nb_steps, .nb_operands = nb_operands };
+    e.nb_outer = ndim > 0 ? ndim - 1 : 0;
+    memcpy(e.outer_shape, Tensor_shape(dst), e.nb_outer * sizeof(size_t));
+    e.n = ndim > 0 ? (int) Tensor_shape(dst)[ndim - 1] : 1;
+    if (rotates && e.n % 2 != 0)
+    {
+        LOGF_ERROR("Tensor_eval_into: cannot rotate the halves of rows of %d elements", e.n);
+        return ERROR;
+    }
+    broadcast_to(dst, dst, &e.dst);
+
+    // Rows go straight to dst unless it is strided or shared with an operand
+    e.direct = ndim == 0 || e.dst.step == 1;
+    int nb_gathered = 0;
+    for (int k = 0; k < nb_operands; k++)
+    {
+        if (operands[k] == NULL || broadcast_to(dst, operands[k], &e.operands[k]) != 0)
+        {
+            LOGF_ERROR("Tensor_eval_into: operand %d cannot be broadcast to the destination", k);
+            return ERROR;
+        }
+        if (e.operands[k].step > 1)
+            nb_gathered++;
+    }
+    if (Tensor_size(dst) == 0)
+        return OK;
+    for (int k = 0; k < nb_operands; k++)
+    {
+        if (Tensor_data(operands[k]) <= tensor_end(dst) && Tensor_data(dst) <= tensor_end(operands[k]))
+            e.direct = 0;
+    }
+
+    // Every value on the stack owns at most 2 scratch rows, plus the one being computed and the row of dst
+    e.nb_slots = nb_gathered + 2 * depth + 2;
+    int nb_rows = (int) (Tensor_size(dst) / (size_t) e.n);
+    int grain = e.n < TENSOR_EXPR_GRAIN ? TENSOR_EXPR_GRAIN / e.n : 1;
+    parallel_for(nb_rows, grain, eval_range, &e);
+    if (e.failed)
+    {
+        LOG_ERROR("Tensor_eval_into: could not allocate the scratch rows");
+        return ERROR;
+    }
+    return OK;
+}
+
+CallmStatusCode
+Tensor_rms_norm_into(Tensor *dst, Tensor *x, Tensor *w, float eps)
+{
+    // x * rsqrt(mean(x * x) + eps) * w
+    const TensorExprStep program[] = {
+        TENSOR_EXPR_LOAD(0),
+        TENSOR_EXPR_LOAD(0),
+        TENSOR_EXPR_LOAD(0),
+        TENSOR_EXPR_OP(TENSOR_EXPR_MUL),
+        TENSOR_EXPR_OP(TENSOR_EXPR_MEAN),
+        TENSOR_EXPR_CONST(eps),
+        TENSOR_EXPR_OP(TENSOR_EXPR_ADD),
+        TENSOR_EXPR_OP(TENSOR_EXPR_RSQRT),
+        TENSOR_EXPR_OP(TENSOR_EXPR_MUL),
+        TENSOR_EXPR_LOAD(1),
+        TENSOR_EXPR_OP(TENSOR_EXPR_MUL),
+    };
+    Tensor *operands[] = { x, w };
+    return Tensor_eval_into(dst, program, sizeof(program) / sizeof(program[0]), operands, 2);
+}
+
+CallmStatusCode
+Tensor_silu_mul_into(Tensor *dst, Tensor *gate, Tensor *up)
+{
+    const TensorExprStep program[] = {
+        TENSOR_EXPR_LOAD(0),
+        TENSOR_EXPR_OP(TENSOR_EXPR_SILU),
+        TENSOR_EXPR_LOAD(1),
+        TENSOR_EXPR_OP(TENSOR_EXPR_MUL),
+    };
+    Tensor *operands[] = { gate, up };
+    return Tensor_eval_into(dst, program, sizeof(program) / sizeof(program[0]), operands, 2);
+}
+
+CallmStatusCode
+Tensor_rotary_into(Tensor *dst, Tensor *x, Tensor *cos, Tensor *sin)
+{
+    // x * cos + rotate_half(x) * sin
+    const TensorExprStep program[] = {
+        TENSOR_EXPR_LOAD(0),
+        TENSOR_EXPR_LOAD(1),
+        TENSOR_EXPR_OP(TENSOR_EXPR_MUL),
+        TENSOR_EXPR_LOAD(0),
+        TENSOR_EXPR_OP(TENSOR_EXPR_ROTATE_HALF),
+        TENSOR_EXPR_LOAD(2),
+        TENSOR_EXPR_OP(TENSOR_EXPR_MUL),
+        TENSOR_EXPR_OP(TENSOR_EXPR_ADD),
+    };
+    Tensor *operands[] = { x, cos, sin };
+    return Tensor_eval_into(dst, program, sizeof(program) / sizeof(program[0]), operands, 3);
+}
@@ -0,0 +1,85 @@
+#ifndef CALLM_TENSOR_EXPR_H
+#define CALLM_TENSOR_EXPR_H
+
+#include "../shared/errors.h"
+#include "tensor.h"
+
+/*
+ * Fused element-wise expressions over broadcast tensors.
+ *
+ * An expression is a small postfix program over its operands, e.g. x * rsqrt(mean(x^2) + eps) * w:
+ *
+ *   LOAD(0) LOAD(0) LOAD(0) MUL MEAN CONST(eps) ADD RSQRT MUL LOAD(1) MUL
+ *
+ * Operands are broadcast to the shape of the destination numpy-style: shapes are aligned on their last dimension,
+ * and a missing dimension or one of size 1 is repeated (e.g. RMSNorm weights of shape [hidden] against [N, hidden]).
+ *
+ * The destination is evaluated one row (last dimension) at a time, every intermediate of a row staying in L1 in
+ * scratch rows of the thread arena: the operands are read once and the destination written once, with no full size
+ * temporary. Steps are evaluated lazily, so that the usual patterns map onto a single SIMD kernel of vecops.h:
+ * x * s * w (vec_mul_scale), mean(x * x) (vec_square_sum), silu(g) * u (vec_silu_mul),
+ * x * cos + rotate_half(x) * sin (vec_mul_add_mul on each half).
+ *
+ * Rows are spread over the default thread pool.
+ */
+
+/* Most values on the stack of an expression, and most operands */
+#define TENSOR_EXPR_MAX_STACK 8
+#define TENSOR_EXPR_MAX_OPERANDS 8
+
+typedef enum
+{
+    TENSOR_EXPR_LOAD = 0,     // push operands[arg]
+    TENSOR_EXPR_CONST,        // push value
+    TENSOR_EXPR_ADD,          // pop b, pop a, push a + b
+    TENSOR_EXPR_SUB,          // pop b, pop a, push a - b
+    TENSOR_EXPR_MUL,          // pop b, pop a, push a * b
+    TENSOR_EXPR_SILU,         // pop a, push a / (1 + exp(-a))
+    TENSOR_EXPR_RSQRT,        // pop a, push 1 / sqrt(a)
+    TENSOR_EXPR_MEAN,         // pop a, push the mean of its row, repeated along the row
+    TENSOR_EXPR_ROTATE_HALF,  // pop a, push [-a2, a1] with a1, a2 the 2 halves of its row
+} TensorExprOp;
+
+typedef struct
+{
+    TensorExprOp op;
+    int arg;      // operand index of TENSOR_EXPR_LOAD
+    float value;  // constant of TENSOR_EXPR_CONST
+} TensorExprStep;
+
+#define TENSOR_EXPR_LOAD(i) ((TensorExprStep) { TENSOR_EXPR_LOAD, (i), 0.0f })
+#define TENSOR_EXPR_CONST(v) ((TensorExprStep) { TENSOR_EXPR_CONST, 0, (v) })
+#define TENSOR_EXPR_OP(op) ((TensorExprStep) { (op), 0, 0.0f })
+
+/*
+ * Computes the broadcast shape of tensors into shape (TENSOR_MAX_DIMS long) and returns its number of dimensions, or
+ * -1 when the shapes are not compatible
+ */
+int Tensor_broadcast_shape(Tensor **tensors, int nb_tensors, size_t *shape);
+
+/*
+ * Evaluates the program over the operands, broadcast to the shape of dst, into dst. dst may be one of the operands
+ * (same view, in place), otherwise it must not overlap them.
+ * Returns ERROR for an invalid program (unknown operand, stack under/overflow, more than one value left), operands
+ * that can't be broadcast to dst, or ROTATE_HALF on rows of odd length.
+ */
+CallmStatusCode Tensor_eval_into(Tensor *dst, const TensorExprStep *program, int nb_steps, Tensor **operands,
+                                 int nb_operands);
+
+/*
+ * Usual fused expressions, through Tensor_eval_into
+ */
+
+/* dst = x * rsqrt(mean(x^2) + eps) * w, w broadcast along the rows of x (RMSNorm) */
+CallmStatusCode Tensor_rms_norm_into(Tensor *dst, Tensor *x, Tensor *w, float eps);
+
+/* dst = silu(gate) * up (gated activation of the MLP) */
+CallmStatusCode Tensor_silu_mul_into(Tensor *dst, Tensor *gate, Tensor *up);
+
+/*
+ * dst = x * cos + rotate_half(x) * sin (rotary embedding), e.g. x of shape [N, heads, head_dim] with cos and sin of
+ * shape [N, 1, head_dim] broadcast over the heads
+ */
+CallmStatusCode Tensor_rotary_into(Tensor *dst, Tensor *x, Tensor *cos, Tensor *sin);
+
+#endif  // CALLM_TENSOR_EXPR_H
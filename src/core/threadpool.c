@@ -0,0 +1,367 @@
+#define _GNU_SOURCE  // pthread_setaffinity_np
+
+#include "threadpool.h"
+#include "../shared/errors.h"
+#include "memory/arena.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define THREADPOOL_MAX_THREADS 256
+/* Each thread gets a few ranges on average so a late thread (preempted, busy core) doesn't delay the whole loop */
+#define THREADPOOL_RANGES_PER_THREAD 4
+/* Spin iterations before a waiting thread goes to sleep, i.e. a few tens of microseconds */
+#define THREADPOOL_SPIN_ITERATIONS 20000
+
+struct thread_pool_t
+{
+    int nb_threads;
+    int nb_workers;
+    pthread_t *workers;
+    int *started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    pthread_mutex_t submit_lock;
+
+    // Current loop, published to the workers by bumping the generation
+    parallel_for_fn_t fn;
+    void *arg;
+    int n;
+    int chunk;
+    int next;
+    int pending;
+    unsigned int generation;
+    int stop;
+};
+
+typedef struct
+{
+    ThreadPool *pool;
+    int cpu;
+} WorkerStart;
+
+/* Non zero in the workers, and in a submitting thread while it runs its share of a loop: nested loops run serially */
+static __thread int in_parallel_loop = 0;
+
+static ThreadPool *default_pool = NULL;
+static pthread_mutex_t default_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static int
+nb_online_cpus(void)
+{
+    long nb = sysconf(_SC_NPROCESSORS_ONLN);
+    return nb > 0 ? (int) nb : 1;
+}
+
+static void
+run_ranges(ThreadPool *pool)
+{
+    int n = pool->n;
+    int chunk = pool->chunk;
+    for (;;)
+    {
+        int start = __atomic_fetch_add(&pool->next, chunk, __ATOMIC_RELAXED);
+        if (start >= n)
+        {
+            break;
+        }
+        int end = n - start < chunk ? n : start + chunk;
+        pool->fn(pool->arg, start, end);
+    }
+}
+
+/*
+ * Waits for a loop newer than the given generation (or for the pool shutdown) and returns its generation
+ */
+static unsigned int
+wait_for_work(ThreadPool *pool, unsigned int seen)
+{
+    for (int i = 0; i < THREADPOOL_SPIN_ITERATIONS; i++)
+    {
+        unsigned int generation = __atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE);
+        if (generation != seen)
+        {
+            return generation;
+        }
+        cpu_relax();
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE) == seen && !pool->stop)
+    {
+        pthread_cond_wait(&pool->work_cond, &pool->lock);
+    }
+    unsigned int generation = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+    return generation;
+}
+
+static void *
+worker_main(void *ptr)
+{
+    WorkerStart *start = (WorkerStart *) ptr;
+    ThreadPool *pool = start->pool;
+    if (start->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(start->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        {
+            LOGF_ERROR("Failed to pin worker thread to CPU %d", start->cpu);
+        }
+    }
+    free(start);
+
+    // The arena of the worker and its first block are taken up front, not by whichever loop first hands it work: a
+    // steady workload doesn't touch the heap whatever ranges the workers happen to pick
+    Arena *arena = Arena_thread_local();
+    if (arena != NULL)
+    {
+        ArenaMark mark = Arena_mark(arena);
+        Arena_alloc(arena, 1);
+        Arena_release(arena, mark);
+    }
+
+    in_parallel_loop = 1;
+    unsigned int seen = 0;
+    for (;;)
+    {
+        seen = wait_for_work(pool, seen);
+        if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+
+        run_ranges(pool);
+
+        if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0)
+        {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_signal(&pool->done_cond);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+    return NULL;
+}
+
+ThreadPool *
+ThreadPool_new(int nb_threads, int pin)
+{
+    if (nb_threads <= 0)
+    {
+        nb_threads = nb_online_cpus();
+    }
+    if (nb_threads > THREADPOOL_MAX_THREADS)
+    {
+        nb_threads = THREADPOOL_MAX_THREADS;
+    }
+
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    RETURN_WHEN_NULL(pool, "Failed to allocate thread pool");
+    pool->nb_threads = 1;
+    pool->workers = calloc(nb_threads, sizeof(pthread_t));
+    pool->started = calloc(nb_threads, sizeof(int));
+    if (pool->workers == NULL || pool->started == NULL)
+    {
+        LOG_ERROR("Failed to allocate thread pool workers");
+        free(pool->workers);
+        free(pool->started);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pthread_mutex_init(&pool->submit_lock, NULL);
+
+    int nb_cpus = nb_online_cpus();
+    for (int t = 0; t < nb_threads - 1; t++)
+    {
+        WorkerStart *start = malloc(sizeof(WorkerStart));
+        if (start == NULL)
+        {
+            break;
+        }
+        start->pool = pool;
+        // The submitting thread isn't pinned: worker t goes to CPU t + 1
+        start->cpu = pin ? (t + 1) % nb_cpus : -1;
+        if (pthread_create(&pool->workers[t], NULL, worker_main, start) != 0)
+        {
+            // Not fatal: the pool just runs with fewer threads
+            LOGF_ERROR("Failed to start thread pool worker %d", t);
+            free(start);
+            break;
+        }
+        pool->started[t] = 1;
+        pool->nb_workers++;
+    }
+    pool->nb_threads = pool->nb_workers + 1;
+
+    return pool;
+}
+
+void
+ThreadPool_free(ThreadPool *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int t = 0; t < pool->nb_workers; t++)
+    {
+        if (pool->started[t])
+        {
+            pthread_join(pool->workers[t], NULL);
+        }
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_mutex_destroy(&pool->submit_lock);
+    free(pool->workers);
+    free(pool->started);
+    free(pool);
+}
+
+int
+ThreadPool_size(const ThreadPool *pool)
+{
+    return pool == NULL ? 1 : pool->nb_threads;
+}
+
+void
+ThreadPool_parallel_for(ThreadPool *pool, int n, int grain, parallel_for_fn_t fn, void *arg)
+{
+    if (n <= 0)
+    {
+        return;
+    }
+    if (grain < 1)
+    {
+        grain = 1;
+    }
+
+    int nb_threads = ThreadPool_size(pool);
+    int chunk = (n + nb_threads * THREADPOOL_RANGES_PER_THREAD - 1) / (nb_threads * THREADPOOL_RANGES_PER_THREAD);
+    chunk = (chunk + grain - 1) / grain * grain;
+
+    // Single range, nested loop, or another thread already using the pool: no need (or no way) to dispatch
+    if (nb_threads <= 1 || chunk >= n || in_parallel_loop || pthread_mutex_trylock(&pool->submit_lock) != 0)
+    {
+        fn(arg, 0, n);
+        return;
+    }
+
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->n = n;
+    pool->chunk = chunk;
+    pool->next = 0;
+    pool->pending = pool->nb_workers;
+
+    pthread_mutex_lock(&pool->lock);
+    __atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    in_parallel_loop = 1;
+    run_ranges(pool);
+    in_parallel_loop = 0;
+
+    int done = 0;
+    for (int i = 0; i < THREADPOOL_SPIN_ITERATIONS && !done; i++)
+    {
+        done = __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0;
+        cpu_relax();
+    }
+    if (!done)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) != 0)
+        {
+            pthread_cond_wait(&pool->done_cond, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->submit_lock);
+}
+
+static int
+env_int(const char *name, int default_value)
+{
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0')
+    {
+        return default_value;
+    }
+    return atoi(value);
+}
+
+ThreadPool *
+ThreadPool_default(void)
+{
+    ThreadPool *pool = __atomic_load_n(&default_pool, __ATOMIC_ACQUIRE);
+    if (pool != NULL)
+    {
+        return pool;
+    }
+
+    pthread_mutex_lock(&default_pool_lock);
+    if (default_pool == NULL)
+    {
+        pool = ThreadPool_new(env_int("CALLM_NUM_THREADS", 0), env_int("CALLM_PIN_THREADS", 0) == 1);
+        __atomic_store_n(&default_pool, pool, __ATOMIC_RELEASE);
+        if (pool != NULL)
+        {
+            LOGF_DEBUG("Thread pool started with %d threads", pool->nb_threads);
+        }
+    }
+    pool = default_pool;
+    pthread_mutex_unlock(&default_pool_lock);
+    return pool;
+}
+
+void
+ThreadPool_set_default_threads(int nb_threads)
+{
+    pthread_mutex_lock(&default_pool_lock);
+    ThreadPool *old_pool = default_pool;
+    ThreadPool *pool = ThreadPool_new(nb_threads, env_int("CALLM_PIN_THREADS", 0) == 1);
+    __atomic_store_n(&default_pool, pool, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&default_pool_lock);
+
+    ThreadPool_free(old_pool);
+}
+
+void
+parallel_for(int n, int grain, parallel_for_fn_t fn, void *arg)
+{
+    ThreadPool *pool = ThreadPool_default();
+    if (pool == NULL)
+    {
+        fn(arg, 0, n);
+        return;
+    }
+    ThreadPool_parallel_for(pool, n, grain, fn, arg);
+}
@@ -0,0 +1,60 @@
+#ifndef CALLM_THREADPOOL_H
+#define CALLM_THREADPOOL_H
+
+/*
+ * Persistent pool of worker threads running parallel loops for the numerical kernels.
+ *
+ * Workers are created once and wait for work between loops: they first spin for a short while (consecutive kernels of
+ * a forward pass follow each other within microseconds) and then sleep on a condition variable, so an idle pool
+ * doesn't burn any CPU. The thread submitting a loop takes its share of the work and returns once every range is done.
+ *
+ * A parallel loop started from inside another one (e.g. a GEMM run on a single attention head while the heads are
+ * processed in parallel) runs serially on the calling thread.
+ */
+
+typedef struct thread_pool_t ThreadPool;
+
+/*
+ * Body of a parallel loop: processes the indices [start, end). arg is the pointer given to parallel_for.
+ */
+typedef void (*parallel_for_fn_t)(void *arg, int start, int end);
+
+/*
+ * Creates a pool running loops on nb_threads threads (the submitting thread included, so nb_threads - 1 workers are
+ * spawned). nb_threads <= 0 means one thread per online CPU. When pin is non zero, each worker is bound to a CPU.
+ */
+ThreadPool *ThreadPool_new(int nb_threads, int pin);
+
+void ThreadPool_free(ThreadPool *pool);
+
+/*
+ * Number of threads running a loop, the submitting thread included.
+ */
+int ThreadPool_size(const ThreadPool *pool);
+
+/*
+ * Calls fn over [0, n) split in ranges. Every range but the last is a multiple of grain elements, so grain is both
+ * the minimal amount of work worth a thread and an alignment (e.g. to keep threads from writing the same cache line).
+ * Returns once all the ranges have been processed.
+ */
+void ThreadPool_parallel_for(ThreadPool *pool, int n, int grain, parallel_for_fn_t fn, void *arg);
+
+/*
+ * Returns the process wide pool used by the kernels, created on first use.
+ * Its size is taken from the CALLM_NUM_THREADS environment variable (one thread per online CPU by default), and the
+ * workers are pinned when CALLM_PIN_THREADS is set to 1.
+ */
+ThreadPool *ThreadPool_default(void);
+
+/*
+ * Replaces the default pool with one of nb_threads threads (<= 0 for one per online CPU).
+ * Must not be called while a kernel is running.
+ */
+void ThreadPool_set_default_threads(int nb_threads);
+
+/*
+ * ThreadPool_parallel_for on the default pool.
+ */
+void parallel_for(int n, int grain, parallel_for_fn_t fn, void *arg);
+
+#endif  // CALLM_THREADPOOL_H
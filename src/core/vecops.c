@@ -0,0 +1,318 @@
+#include "vecops.h"
+#include "cpu.h"
+#include <immintrin.h>
+#include <math.h>
+
+#define VEC_CONCAT_(name, isa) isa##_##name
+#define VEC_CONCAT(name, isa) VEC_CONCAT_(name, isa)
+#define VEC_FN(name) VEC_CONCAT(name, VEC_ISA)
+#define SCALAR_FN(name) scalar_##name
+
+/*
+ * exp(x) = 2^n * exp(r) with n = round(x / ln 2) and |r| <= ln(2) / 2, exp(r) being approximated by a degree 6
+ * polynomial (Cephes expf coefficients). Inputs are clamped to the range where the result is a normal float, so
+ * -INFINITY (masked scores) gives 0.
+ */
+#define EXP_HI 88.3762626647949f
+#define EXP_LO -88.3762626647949f
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_C1 0.693359375f
+#define EXP_C2 -2.12194440e-4f
+#define EXP_P0 1.9875691500e-4f
+#define EXP_P1 1.3981999507e-3f
+#define EXP_P2 8.3334519073e-3f
+#define EXP_P3 4.1665795894e-2f
+#define EXP_P4 1.6666665459e-1f
+#define EXP_P5 5.0000001201e-1f
+
+/* ---- Scalar ---- */
+
+#define VEC_ISA scalar
+#define VEC_TARGET
+#define VEC_WIDTH 1
+#define VF float
+#define VLOAD(p) (*(p))
+#define VSTORE(p, v) (*(p) = (v))
+#define VSET1(x) (x)
+#define VADD(a, b) ((a) + (b))
+#define VSUB(a, b) ((a) - (b))
+#define VMUL(a, b) ((a) * (b))
+#define VDIV(a, b) ((a) / (b))
+#define VMAX(a, b) ((a) > (b) ? (a) : (b))
+#define VFMA(a, b, c) ((a) * (b) + (c))
+#define VFNMA(a, b, c) ((c) - (a) * (b))
+#define VEXP(v) expf(v)
+#define VHSUM(v) (v)
+#define VHMAX(v) (v)
+
+#include "vecops_impl.h"
+
+#undef VEC_ISA
+#undef VEC_TARGET
+#undef VEC_WIDTH
+#undef VF
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+#undef VMAX
+#undef VFMA
+#undef VFNMA
+#undef VEXP
+#undef VHSUM
+#undef VHMAX
+
+/* ---- AVX2 + FMA ---- */
+
+__attribute__((target("avx2,fma"))) static inline __m256
+exp_avx2(__m256 x)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_LO)), _mm256_set1_ps(EXP_HI));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(EXP_LOG2E)),
+                               _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_C1), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_C2), r);
+
+    __m256 p = _mm256_set1_ps(EXP_P0);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P5));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+__attribute__((target("avx2,fma"))) static inline float
+hsum_avx2(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma"))) static inline float
+hmax_avx2(__m256 v)
+{
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_movehdup_ps(m));
+    return _mm_cvtss_f32(m);
+}
+
+#define VEC_ISA avx2
+#define VEC_TARGET __attribute__((target("avx2,fma")))
+#define VEC_WIDTH 8
+#define VF __m256
+#define VLOAD(p) _mm256_loadu_ps(p)
+#define VSTORE(p, v) _mm256_storeu_ps(p, v)
+#define VSET1(x) _mm256_set1_ps(x)
+#define VADD(a, b) _mm256_add_ps(a, b)
+#define VSUB(a, b) _mm256_sub_ps(a, b)
+#define VMUL(a, b) _mm256_mul_ps(a, b)
+#define VDIV(a, b) _mm256_div_ps(a, b)
+#define VMAX(a, b) _mm256_max_ps(a, b)
+#define VFMA(a, b, c) _mm256_fmadd_ps(a, b, c)
+#define VFNMA(a, b, c) _mm256_fnmadd_ps(a, b, c)
+#define VEXP(v) exp_avx2(v)
+#define VHSUM(v) hsum_avx2(v)
+#define VHMAX(v) hmax_avx2(v)
+
+#include "vecops_impl.h"
+
+#undef VEC_ISA
+#undef VEC_TARGET
+#undef VEC_WIDTH
+#undef VF
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+#undef VMAX
+#undef VFMA
+#undef VFNMA
+#undef VEXP
+#undef VHSUM
+#undef VHMAX
+
+/* ---- AVX-512 ---- */
+
+__attribute__((target("avx512f"))) static inline __m512
+exp_avx512(__m512 x)
+{
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_LO)), _mm512_set1_ps(EXP_HI));
+    __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(EXP_LOG2E)),
+                                    _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(EXP_C1), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(EXP_C2), r);
+
+    __m512 p = _mm512_set1_ps(EXP_P0);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P1));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P2));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P3));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P4));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P5));
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+    // scalef computes p * 2^n directly, without building the exponent bits
+    return _mm512_scalef_ps(p, n);
+}
+
+#define VEC_ISA avx512
+#define VEC_TARGET __attribute__((target("avx512f")))
+#define VEC_WIDTH 16
+#define VF __m512
+#define VLOAD(p) _mm512_loadu_ps(p)
+#define VSTORE(p, v) _mm512_storeu_ps(p, v)
+#define VSET1(x) _mm512_set1_ps(x)
+#define VADD(a, b) _mm512_add_ps(a, b)
+#define VSUB(a, b) _mm512_sub_ps(a, b)
+#define VMUL(a, b) _mm512_mul_ps(a, b)
+#define VDIV(a, b) _mm512_div_ps(a, b)
+#define VMAX(a, b) _mm512_max_ps(a, b)
+#define VFMA(a, b, c) _mm512_fmadd_ps(a, b, c)
+#define VFNMA(a, b, c) _mm512_fnmadd_ps(a, b, c)
+#define VEXP(v) exp_avx512(v)
+#define VHSUM(v) _mm512_reduce_add_ps(v)
+#define VHMAX(v) _mm512_reduce_max_ps(v)
+
+#include "vecops_impl.h"
+
+/* ---- Dispatch ---- */
+
+/* Runs the widest instantiation allowed by cpu_best_isa() */
+#define VEC_DISPATCH(name, ...)                                                                                        \
+    switch (cpu_best_isa())                                                                                            \
+    {                                                                                                                  \
+    case CPU_ISA_AVX512:                                                                                               \
+        return avx512_##name(__VA_ARGS__);                                                                             \
+    case CPU_ISA_AVX2:                                                                                                 \
+        return avx2_##name(__VA_ARGS__);                                                                               \
+    default:                                                                                                           \
+        return scalar_##name(__VA_ARGS__);                                                                             \
+    }
+
+#define VEC_DISPATCH_VOID(name, ...)                                                                                   \
+    switch (cpu_best_isa())                                                                                            \
+    {                                                                                                                  \
+    case CPU_ISA_AVX512:                                                                                               \
+        avx512_##name(__VA_ARGS__);                                                                                    \
+        break;                                                                                                         \
+    case CPU_ISA_AVX2:                                                                                                 \
+        avx2_##name(__VA_ARGS__);                                                                                      \
+        break;                                                                                                         \
+    default:                                                                                                           \
+        scalar_##name(__VA_ARGS__);                                                                                    \
+        break;                                                                                                         \
+    }
+
+void
+vec_add(float *dst, const float *a, const float *b, int n)
+{
+    VEC_DISPATCH_VOID(add, dst, a, b, n)
+}
+
+void
+vec_mul(float *dst, const float *a, const float *b, int n)
+{
+    VEC_DISPATCH_VOID(mul, dst, a, b, n)
+}
+
+void
+vec_sub(float *dst, const float *a, const float *b, int n)
+{
+    VEC_DISPATCH_VOID(sub, dst, a, b, n)
+}
+
+void
+vec_mul_add_mul(float *dst, const float *a, const float *b, float s, const float *c, const float *d, float t, int n)
+{
+    VEC_DISPATCH_VOID(mul_add_mul, dst, a, b, s, c, d, t, n)
+}
+
+void
+vec_scale(float *dst, const float *x, float s, int n)
+{
+    VEC_DISPATCH_VOID(scale_add, dst, x, s, 0.0f, n)
+}
+
+void
+vec_add_scalar(float *dst, const float *x, float s, int n)
+{
+    VEC_DISPATCH_VOID(scale_add, dst, x, 1.0f, s, n)
+}
+
+void
+vec_scale_add(float *dst, const float *x, float scale, float bias, int n)
+{
+    VEC_DISPATCH_VOID(scale_add, dst, x, scale, bias, n)
+}
+
+void
+vec_mul_scale(float *dst, const float *a, const float *b, float s, int n)
+{
+    VEC_DISPATCH_VOID(mul_scale, dst, a, b, s, n)
+}
+
+void
+vec_exp(float *dst, const float *x, int n)
+{
+    VEC_DISPATCH_VOID(exp, dst, x, n)
+}
+
+float
+vec_exp_sum(float *dst, const float *x, float scale, float bias, int n)
+{
+    VEC_DISPATCH(exp_sum, dst, x, scale, bias, n)
+}
+
+void
+vec_silu(float *dst, const float *x, int n)
+{
+    VEC_DISPATCH_VOID(silu, dst, x, n)
+}
+
+void
+vec_silu_mul(float *dst, const float *gate, const float *up, int n)
+{
+    VEC_DISPATCH_VOID(silu_mul, dst, gate, up, n)
+}
+
+void
+vec_rotate(float *x1, float *x2, const float *cos, const float *sin, int n)
+{
+    VEC_DISPATCH_VOID(rotate, x1, x2, cos, sin, n)
+}
+
+float
+vec_sum(const float *x, int n)
+{
+    VEC_DISPATCH(sum, x, n)
+}
+
+float
+vec_square_sum(const float *x, int n)
+{
+    VEC_DISPATCH(square_sum, x, n)
+}
+
+float
+vec_add_square_sum(float *dst, const float *a, const float *b, int n)
+{
+    VEC_DISPATCH(add_square_sum, dst, a, b, n)
+}
+
+float
+vec_max(const float *x, int n)
+{
+    VEC_DISPATCH(max, x, n)
+}
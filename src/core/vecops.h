@@ -0,0 +1,70 @@
+#ifndef CALLM_VECOPS_H
+#define CALLM_VECOPS_H
+
+/*
+ * Element-wise and reduction kernels on float arrays, with the operation fixed at compile time (as opposed to the
+ * function pointer based Matrix_apply_each / Matrix_reduce_along).
+ *
+ * Every kernel is written once (vecops_impl.h) and instantiated for each instruction set level (scalar, AVX2/FMA,
+ * AVX-512); the widest one allowed by cpu_best_isa() is picked at runtime. Unless stated otherwise, dst may be one of
+ * the inputs (in-place operation). Arrays don't need any particular alignment.
+ */
+
+/* dst = a + b */
+void vec_add(float *dst, const float *a, const float *b, int n);
+
+/* dst = a - b */
+void vec_sub(float *dst, const float *a, const float *b, int n);
+
+/* dst = a * b */
+void vec_mul(float *dst, const float *a, const float *b, int n);
+
+/* dst = x * s */
+void vec_scale(float *dst, const float *x, float s, int n);
+
+/* dst = x + s */
+void vec_add_scalar(float *dst, const float *x, float s, int n);
+
+/* dst = x * scale + bias */
+void vec_scale_add(float *dst, const float *x, float scale, float bias, int n);
+
+/* dst = a * b * s (e.g. normalised input times the RMSNorm weights) */
+void vec_mul_scale(float *dst, const float *a, const float *b, float s, int n);
+
+/* dst = a * b * s + c * d * t (e.g. x * cos + rotate_half(x) * sin, one half of the vector at a time) */
+void vec_mul_add_mul(float *dst, const float *a, const float *b, float s, const float *c, const float *d, float t,
+                     int n);
+
+/* dst = exp(x), with a polynomial approximation (relative error below 2e-7) on the vector paths */
+void vec_exp(float *dst, const float *x, int n);
+
+/* dst = exp(x * scale + bias) and returns the sum of dst, in a single pass (the exponentiation step of a softmax) */
+float vec_exp_sum(float *dst, const float *x, float scale, float bias, int n);
+
+/* dst = silu(x) = x / (1 + exp(-x)) */
+void vec_silu(float *dst, const float *x, int n);
+
+/* dst = silu(gate) * up, the gated activation of the MLP */
+void vec_silu_mul(float *dst, const float *gate, const float *up, int n);
+
+/*
+ * Rotates the n pairs (x1[i], x2[i]) by the angles given by their cos/sin, in place:
+ *   x1 = x1 * cos - x2 * sin
+ *   x2 = x2 * cos + x1 * sin
+ * i.e. x * cos + rotate_half(x) * sin for the two halves of a rotary embedded vector.
+ */
+void vec_rotate(float *x1, float *x2, const float *cos, const float *sin, int n);
+
+/* Returns the sum of the elements of x */
+float vec_sum(const float *x, int n);
+
+/* Returns the sum of the squares of the elements of x */
+float vec_square_sum(const float *x, int n);
+
+/* dst = a + b and returns the sum of the squares of dst, in a single pass (e.g. residual add before a RMSNorm) */
+float vec_add_square_sum(float *dst, const float *a, const float *b, int n);
+
+/* Returns the largest element of x (-INFINITY when n == 0) */
+float vec_max(const float *x, int n);
+
+#endif  // CALLM_VECOPS_H
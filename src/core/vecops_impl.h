@@ -0,0 +1,273 @@
+/*
+ * Body of the vecops kernels, included once per instruction set level by vecops.c.
+ *
+ * The including file defines the vector primitives below, and VEC_FN(name) gives the name of the instantiated
+ * function. Remainders shorter than a vector are handled by the scalar instantiation (SCALAR_FN(name)).
+ *
+ *   VEC_TARGET           function attribute enabling the instruction set
+ *   VEC_WIDTH            number of floats per vector
+ *   VF                   vector type
+ *   VLOAD(p) / VSTORE(p, v) / VSET1(x)
+ *   VADD / VSUB / VMUL / VDIV / VMAX (a, b), VFMA(a, b, c) = a * b + c, VFNMA(a, b, c) = c - a * b
+ *   VEXP(v)
+ *   VHSUM(v) / VHMAX(v)  horizontal sum / max
+ */
+
+#if VEC_WIDTH > 1
+#define VEC_TAIL(name, ...)                                                                                            \
+    if (i < n)                                                                                                         \
+    {                                                                                                                  \
+        SCALAR_FN(name)(__VA_ARGS__, n - i);                                                                           \
+    }
+#else
+#define VEC_TAIL(name, ...)
+#endif
+
+VEC_TARGET static void
+VEC_FN(add)(float *dst, const float *a, const float *b, int n)
+{
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VSTORE(dst + i, VADD(VLOAD(a + i), VLOAD(b + i)));
+    }
+    VEC_TAIL(add, dst + i, a + i, b + i)
+}
+
+VEC_TARGET static void
+VEC_FN(mul)(float *dst, const float *a, const float *b, int n)
+{
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VSTORE(dst + i, VMUL(VLOAD(a + i), VLOAD(b + i)));
+    }
+    VEC_TAIL(mul, dst + i, a + i, b + i)
+}
+
+VEC_TARGET static void
+VEC_FN(scale_add)(float *dst, const float *x, float scale, float bias, int n)
+{
+    VF vscale = VSET1(scale);
+    VF vbias = VSET1(bias);
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VSTORE(dst + i, VFMA(VLOAD(x + i), vscale, vbias));
+    }
+    VEC_TAIL(scale_add, dst + i, x + i, scale, bias)
+}
+
+VEC_TARGET static void
+VEC_FN(mul_scale)(float *dst, const float *a, const float *b, float s, int n)
+{
+    VF vs = VSET1(s);
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VSTORE(dst + i, VMUL(VMUL(VLOAD(a + i), vs), VLOAD(b + i)));
+    }
+    VEC_TAIL(mul_scale, dst + i, a + i, b + i, s)
+}
+
+VEC_TARGET static void
+VEC_FN(sub)(float *dst, const float *a, const float *b, int n)
+{
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VSTORE(dst + i, VSUB(VLOAD(a + i), VLOAD(b + i)));
+    }
+    VEC_TAIL(sub, dst + i, a + i, b + i)
+}
+
+VEC_TARGET static void
+VEC_FN(mul_add_mul)(float *dst, const float *a, const float *b, float s, const float *c, const float *d, float t,
+                    int n)
+{
+    VF vs = VSET1(s);
+    VF vt = VSET1(t);
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VF ab = VMUL(VMUL(VLOAD(a + i), VLOAD(b + i)), vs);
+        VF cd = VMUL(VLOAD(c + i), VLOAD(d + i));
+        VSTORE(dst + i, VFMA(cd, vt, ab));
+    }
+    VEC_TAIL(mul_add_mul, dst + i, a + i, b + i, s, c + i, d + i, t)
+}
+
+VEC_TARGET static void
+VEC_FN(exp)(float *dst, const float *x, int n)
+{
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VSTORE(dst + i, VEXP(VLOAD(x + i)));
+    }
+    VEC_TAIL(exp, dst + i, x + i)
+}
+
+VEC_TARGET static float
+VEC_FN(exp_sum)(float *dst, const float *x, float scale, float bias, int n)
+{
+    VF vscale = VSET1(scale);
+    VF vbias = VSET1(bias);
+    VF acc = VSET1(0.0f);
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VF e = VEXP(VFMA(VLOAD(x + i), vscale, vbias));
+        VSTORE(dst + i, e);
+        acc = VADD(acc, e);
+    }
+    float total = VHSUM(acc);
+#if VEC_WIDTH > 1
+    if (i < n)
+    {
+        total += SCALAR_FN(exp_sum)(dst + i, x + i, scale, bias, n - i);
+    }
+#endif
+    return total;
+}
+
+VEC_TARGET static void
+VEC_FN(silu)(float *dst, const float *x, int n)
+{
+    VF one = VSET1(1.0f);
+    VF zero = VSET1(0.0f);
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VF v = VLOAD(x + i);
+        VSTORE(dst + i, VDIV(v, VADD(one, VEXP(VSUB(zero, v)))));
+    }
+    VEC_TAIL(silu, dst + i, x + i)
+}
+
+VEC_TARGET static void
+VEC_FN(silu_mul)(float *dst, const float *gate, const float *up, int n)
+{
+    VF one = VSET1(1.0f);
+    VF zero = VSET1(0.0f);
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VF g = VLOAD(gate + i);
+        VF silu = VDIV(g, VADD(one, VEXP(VSUB(zero, g))));
+        VSTORE(dst + i, VMUL(silu, VLOAD(up + i)));
+    }
+    VEC_TAIL(silu_mul, dst + i, gate + i, up + i)
+}
+
+VEC_TARGET static void
+VEC_FN(rotate)(float *x1, float *x2, const float *cos, const float *sin, int n)
+{
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VF a = VLOAD(x1 + i);
+        VF b = VLOAD(x2 + i);
+        VF c = VLOAD(cos + i);
+        VF s = VLOAD(sin + i);
+        VSTORE(x1 + i, VFNMA(b, s, VMUL(a, c)));
+        VSTORE(x2 + i, VFMA(a, s, VMUL(b, c)));
+    }
+    VEC_TAIL(rotate, x1 + i, x2 + i, cos + i, sin + i)
+}
+
+VEC_TARGET static float
+VEC_FN(sum)(const float *x, int n)
+{
+    VF acc0 = VSET1(0.0f);
+    VF acc1 = VSET1(0.0f);
+    int i = 0;
+    for (; i + 2 * VEC_WIDTH <= n; i += 2 * VEC_WIDTH)
+    {
+        acc0 = VADD(acc0, VLOAD(x + i));
+        acc1 = VADD(acc1, VLOAD(x + i + VEC_WIDTH));
+    }
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        acc0 = VADD(acc0, VLOAD(x + i));
+    }
+    float total = VHSUM(VADD(acc0, acc1));
+#if VEC_WIDTH > 1
+    if (i < n)
+    {
+        total += SCALAR_FN(sum)(x + i, n - i);
+    }
+#endif
+    return total;
+}
+
+VEC_TARGET static float
+VEC_FN(square_sum)(const float *x, int n)
+{
+    VF acc0 = VSET1(0.0f);
+    VF acc1 = VSET1(0.0f);
+    int i = 0;
+    for (; i + 2 * VEC_WIDTH <= n; i += 2 * VEC_WIDTH)
+    {
+        VF a = VLOAD(x + i);
+        VF b = VLOAD(x + i + VEC_WIDTH);
+        acc0 = VFMA(a, a, acc0);
+        acc1 = VFMA(b, b, acc1);
+    }
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VF a = VLOAD(x + i);
+        acc0 = VFMA(a, a, acc0);
+    }
+    float total = VHSUM(VADD(acc0, acc1));
+#if VEC_WIDTH > 1
+    if (i < n)
+    {
+        total += SCALAR_FN(square_sum)(x + i, n - i);
+    }
+#endif
+    return total;
+}
+
+VEC_TARGET static float
+VEC_FN(add_square_sum)(float *dst, const float *a, const float *b, int n)
+{
+    VF acc = VSET1(0.0f);
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        VF v = VADD(VLOAD(a + i), VLOAD(b + i));
+        VSTORE(dst + i, v);
+        acc = VFMA(v, v, acc);
+    }
+    float total = VHSUM(acc);
+#if VEC_WIDTH > 1
+    if (i < n)
+    {
+        total += SCALAR_FN(add_square_sum)(dst + i, a + i, b + i, n - i);
+    }
+#endif
+    return total;
+}
+
+VEC_TARGET static float
+VEC_FN(max)(const float *x, int n)
+{
+    VF acc = VSET1(-INFINITY);
+    int i = 0;
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+    {
+        acc = VMAX(acc, VLOAD(x + i));
+    }
+    float best = VHMAX(acc);
+#if VEC_WIDTH > 1
+    if (i < n)
+    {
+        float tail = SCALAR_FN(max)(x + i, n - i);
+        best = tail > best ? tail : best;
+    }
+#endif
+    return best;
+}
+
+#undef VEC_TAIL
@@ -0,0 +1,360 @@
+#include "weights.h"
+#include "../shared/logging.h"
+#include "bf16.h"
+#include "gemm.h"
+#include "gemv.h"
+#include "quant.h"
+#include "residency.h"
+#include "threadpool.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Rows converted per parallel range when building weights from a matrix */
+#define WEIGHTS_CONVERT_GRAIN 64
+
+Weights *
+Weights_new(int r, int c, WeightsDtype dtype)
+{
+    return Weights_new_grouped(r, c, dtype, WEIGHTS_Q4_DEFAULT_GROUP_SIZE);
+}
+
+/*
+ * Group size actually used by weights of the given type (the block size for Q8, 0 for unquantised types), or -1 when
+ * it doesn't fit c columns
+ */
+static int
+effective_group_size(int c, WeightsDtype dtype, int group_size)
+{
+    int q4 = dtype == WEIGHTS_Q4 || dtype == WEIGHTS_Q4_MIN;
+    group_size = q4 ? group_size : (dtype == WEIGHTS_Q8 ? QK8 : 0);
+    if (q4 && (group_size <= 0 || group_size % Q4_CHUNK != 0))
+    {
+        LOGF_ERROR("Q4 group size must be a multiple of %d, got %d", Q4_CHUNK, group_size);
+        return -1;
+    }
+    if (group_size > 0 && c % group_size != 0)
+    {
+        LOGF_ERROR("%s weights need a multiple of %d columns, got %d", Weights_dtype_name(dtype), group_size, c);
+        return -1;
+    }
+    return group_size;
+}
+
+Weights *
+Weights_new_grouped(int r, int c, WeightsDtype dtype, int group_size)
+{
+    group_size = effective_group_size(c, dtype, group_size);
+    if (group_size < 0)
+    {
+        return NULL;
+    }
+
+    Weights *W = malloc(sizeof(Weights));
+    RETURN_WHEN_NULL(W, "Failed to allocate weights");
+    W->r = r;
+    W->c = c;
+    W->dtype = dtype;
+    W->stride = c;
+    W->group_size = group_size;
+    W->owns_data = 1;
+
+    // Large buffers get huge pages (see residency.h)
+    size_t nb_bytes = (size_t) r * Weights_dtype_nbytes(dtype, group_size, c);
+    W->data = residency_alloc(nb_bytes);
+    if (W->data == NULL)
+    {
+        LOGF_ERROR("Failed to allocate %zu bytes of weights data", nb_bytes);
+        free(W);
+        return NULL;
+    }
+    return W;
+}
+
+Weights *
+Weights_wrap(int r, int c, WeightsDtype dtype, const void *data)
+{
+    return Weights_wrap_grouped(r, c, dtype, WEIGHTS_Q4_DEFAULT_GROUP_SIZE, data);
+}
+
+Weights *
+Weights_wrap_grouped(int r, int c, WeightsDtype dtype, int group_size, const void *data)
+{
+    group_size = effective_group_size(c, dtype, group_size);
+    if (group_size < 0)
+    {
+        return NULL;
+    }
+    Weights *W = malloc(sizeof(Weights));
+    RETURN_WHEN_NULL(W, "Failed to allocate weights");
+    W->r = r;
+    W->c = c;
+    W->dtype = dtype;
+    W->data = (void *) data;  // Weights are never written through
+    W->stride = c;
+    W->group_size = group_size;
+    W->owns_data = 0;
+    return W;
+}
+
+typedef struct
+{
+    Weights *W;
+    const Matrix *M;
+} ConvertRowsArgs;
+
+static void
+convert_rows(void *arg, int start, int end)
+{
+    ConvertRowsArgs *args = (ConvertRowsArgs *) arg;
+    Weights *W = args->W;
+    for (int i = start; i < end; i++)
+    {
+        void *dst = (void *) Weights_row(W, i);
+        const float *src = Matrix_row(args->M, i);
+        switch (W->dtype)
+        {
+        case WEIGHTS_BF16:
+            f32_to_bf16_n((bf16_t *) dst, src, W->c);
+            break;
+        case WEIGHTS_Q8:
+            quantize_row_q8((BlockQ8 *) dst, src, W->c);
+            break;
+        case WEIGHTS_Q4:
+        case WEIGHTS_Q4_MIN:
+            quantize_row_q4(dst, src, W->c, W->group_size, W->dtype == WEIGHTS_Q4_MIN);
+            break;
+        default:
+            memcpy(dst, src, W->c * sizeof(float));
+            break;
+        }
+    }
+}
+
+Weights *
+Weights_from_matrix(const Matrix *M, WeightsDtype dtype)
+{
+    return Weights_from_matrix_grouped(M, dtype, WEIGHTS_Q4_DEFAULT_GROUP_SIZE);
+}
+
+Weights *
+Weights_from_matrix_grouped(const Matrix *M, WeightsDtype dtype, int group_size)
+{
+    Weights *W = Weights_new_grouped(M->r, M->c, dtype, group_size);
+    RETURN_WHEN_NULL(W, "Failed to allocate weights");
+    ConvertRowsArgs args = { W, M };
+    parallel_for(M->r, WEIGHTS_CONVERT_GRAIN, convert_rows, &args);
+    return W;
+}
+
+/* dst = row i of W in f32 */
+static void
+widen_row(float *dst, const Weights *W, int i)
+{
+    const void *row = Weights_row(W, i);
+    switch (W->dtype)
+    {
+    case WEIGHTS_BF16:
+        bf16_to_f32_n(dst, (const bf16_t *) row, W->c);
+        break;
+    case WEIGHTS_Q8:
+        dequantize_row_q8(dst, (const BlockQ8 *) row, W->c);
+        break;
+    case WEIGHTS_Q4:
+    case WEIGHTS_Q4_MIN:
+        dequantize_row_q4(dst, row, W->c, W->group_size, W->dtype == WEIGHTS_Q4_MIN);
+        break;
+    default:
+        memcpy(dst, row, W->c * sizeof(float));
+        break;
+    }
+}
+
+typedef struct
+{
+    Matrix *M;
+    const Weights *W;
+} WidenRowsArgs;
+
+static void
+widen_rows(void *arg, int start, int end)
+{
+    WidenRowsArgs *args = (WidenRowsArgs *) arg;
+    for (int i = start; i < end; i++)
+    {
+        widen_row(Matrix_row(args->M, i), args->W, i);
+    }
+}
+
+Matrix *
+Weights_to_matrix(const Weights *W)
+{
+    Matrix *M = Matrix_new(W->r, W->c);
+    RETURN_WHEN_NULL(M, "Failed to allocate matrix");
+    WidenRowsArgs args = { M, W };
+    parallel_for(W->r, WEIGHTS_CONVERT_GRAIN, widen_rows, &args);
+    return M;
+}
+
+void
+Weights_prefetch(const Weights *W)
+{
+    // Buffers of their own are resident already
+    if (W != NULL && !W->owns_data)
+    {
+        residency_prefetch(W->data, Weights_nbytes(W));
+    }
+}
+
+CallmStatusCode
+Weights_free(Weights *W)
+{
+    if (W == NULL)
+    {
+        return OK;
+    }
+    if (W->owns_data)
+    {
+        free(W->data);
+    }
+    free(W);
+    return OK;
+}
+
+size_t
+Weights_dtype_nbytes(WeightsDtype dtype, int group_size, int nb)
+{
+    switch (dtype)
+    {
+    case WEIGHTS_BF16:
+        return (size_t) nb * sizeof(bf16_t);
+    case WEIGHTS_Q8:
+        return (size_t) (nb / QK8) * sizeof(BlockQ8);
+    case WEIGHTS_Q4:
+    case WEIGHTS_Q4_MIN:
+        return q4_row_nbytes(nb, group_size, dtype == WEIGHTS_Q4_MIN);
+    default:
+        return (size_t) nb * sizeof(float);
+    }
+}
+
+const char *
+Weights_dtype_name(WeightsDtype dtype)
+{
+    switch (dtype)
+    {
+    case WEIGHTS_BF16:
+        return "bf16";
+    case WEIGHTS_Q8:
+        return "q8";
+    case WEIGHTS_Q4:
+        return "q4";
+    case WEIGHTS_Q4_MIN:
+        return "q4_min";
+    default:
+        return "f32";
+    }
+}
+
+size_t
+Weights_nbytes(const Weights *W)
+{
+    return (size_t) W->r * Weights_dtype_nbytes(W->dtype, W->group_size, W->c);
+}
+
+const void *
+Weights_row(const Weights *W, int i)
+{
+    return (const char *) W->data + (size_t) i * Weights_dtype_nbytes(W->dtype, W->group_size, W->stride);
+}
+
+CallmStatusCode
+Weights_select_rows_into(Matrix *dst, const Weights *W, const int *idx, int nb)
+{
+    if (dst == NULL || dst->r != nb || dst->c != W->c)
+    {
+        LOGF_ERROR("Weights_select_rows_into: invalid destination shape, expected (%d, %d)", nb, W->c);
+        return ERROR;
+    }
+    for (int i = 0; i < nb; i++)
+    {
+        if (idx[i] < 0 || idx[i] >= W->r)
+        {
+            LOGF_ERROR("Weights_select_rows_into: row %d out of bounds (%d rows)", idx[i], W->r);
+            return ERROR;
+        }
+        widen_row(Matrix_row(dst, i), W, idx[i]);
+    }
+    return OK;
+}
+
+CallmStatusCode
+Weights_dot_transposed_into(Matrix *dst, const Matrix *A, const Weights *W)
+{
+    if (A->c != W->c)
+    {
+        LOGF_ERROR("Weights_dot_transposed_into: dimensions do not match: (%d, %d) . (%d, %d)^T", A->r, A->c, W->r,
+                   W->c);
+        return ERROR;
+    }
+    if (dst == NULL || dst->r != A->r || dst->c != W->r)
+    {
+        LOGF_ERROR("Weights_dot_transposed_into: invalid destination shape, expected (%d, %d)", A->r, W->r);
+        return ERROR;
+    }
+    if (Matrix_overlaps(dst, A))
+    {
+        LOG_ERROR("Weights_dot_transposed_into: destination must not overlap an operand");
+        return ERROR;
+    }
+
+    switch (W->dtype)
+    {
+    case WEIGHTS_BF16:
+        if (A->r == 1)
+        {
+            // Single token (decoding): bound by the weights bandwidth, halved by reading bf16
+            gemv_bf16_t(W->r, A->c, (const bf16_t *) W->data, W->stride, A->data, dst->data, 0);
+        }
+        else
+        {
+            gemm_bf16_nt(A->r, W->r, A->c, A->data, A->stride, (const bf16_t *) W->data, W->stride, dst->data,
+                         dst->stride, 0);
+        }
+        return OK;
+    case WEIGHTS_Q8:
+        gemm_q8_nt(A->r, W->r, A->c, A->data, A->stride, (const BlockQ8 *) W->data, W->stride / QK8, dst->data,
+                   dst->stride);
+        return OK;
+    case WEIGHTS_Q4:
+    case WEIGHTS_Q4_MIN:
+        // Rows are packed back to back: the stride of Q4 weights is always their width
+        gemm_q4_nt(A->r, W->r, A->c, A->data, A->stride, W->data, W->group_size, W->dtype == WEIGHTS_Q4_MIN, dst->data,
+                   dst->stride);
+        return OK;
+    default:
+    {
+        Matrix w = { .r = W->r, .c = W->c, .size = (size_t) W->r * W->c, .data = (float *) W->data,
+                     .stride = W->stride, .owns_data = 0 };
+        return Matrix_dot_transposed_into(dst, A, &w);
+    }
+    }
+}
+
+Matrix *
+Weights_dot_transposed(const Matrix *A, const Weights *W)
+{
+    return Weights_dot_transposed_in(NULL, A, W);
+}
+
+Matrix *
+Weights_dot_transposed_in(Arena *arena, const Matrix *A, const Weights *W)
+{
+    Matrix *dst = Matrix_new_in(arena, A->r, W->r);
+    RETURN_WHEN_NULL(dst, "Failed to allocate result matrix");
+    if (Weights_dot_transposed_into(dst, A, W) != OK)
+    {
+        Matrix_free(dst);
+        return NULL;
+    }
+    return dst;
+}
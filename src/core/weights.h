@@ -0,0 +1,112 @@
+#ifndef CALLM_WEIGHTS_H
+#define CALLM_WEIGHTS_H
+
+#include "../shared/errors.h"
+#include "matrix.h"
+#include <stddef.h>
+
+/*
+ * Storage precision of a weight matrix
+ */
+typedef enum
+{
+    WEIGHTS_F32 = 0,
+    WEIGHTS_BF16 = 1,
+    WEIGHTS_Q8 = 2,      // blocks of QK8 int8 with one f32 scale (see quant.h), c must be a multiple of QK8
+    WEIGHTS_Q4 = 3,      // groups of 4 bits values with one f32 scale, c must be a multiple of the group size
+    WEIGHTS_Q4_MIN = 4,  // same as WEIGHTS_Q4 with an f32 minimum per group too
+} WeightsDtype;
+
+/* Group size of the Q4 weights when none is given */
+#define WEIGHTS_Q4_DEFAULT_GROUP_SIZE 32
+
+/*
+ * Read-only weight matrix kept in the precision it was stored with (e.g. bf16 in safetensors), in the [out, in] layout
+ * of linear layers: W is r x c, with r outputs and c inputs.
+ * Products against activations (always f32) widen the weights inside the kernels and accumulate in f32: a bf16 matrix
+ * takes half the memory of its f32 copy, and half the bandwidth of a decoding step, which is bound by the weights.
+ *
+ * Quantised weights (Q8, Q4) are produced at load time from f32/bf16 ones, to trade some accuracy for memory. Q8
+ * products quantise the activations too and run integer dot products, Q4 ones unpack the weights to f32 in registers.
+ *
+ * stride is the distance between rows in elements (a whole number of blocks for quantised weights). Weights allocated
+ * here have 64 bytes aligned data (on huge pages when large, see residency.h) and own it, weights wrapping a buffer
+ * (e.g. a tensor of a mapped safetensors file) don't: only weights owning their data release it in Weights_free.
+ */
+typedef struct
+{
+    int r;
+    int c;
+    WeightsDtype dtype;
+    void *data;
+    int stride;
+    int group_size;  // values sharing a scale in quantised weights, 0 otherwise
+    int owns_data;
+} Weights;
+
+/*
+ * Allocate an uninitialised r x c weight matrix
+ */
+Weights *Weights_new(int r, int c, WeightsDtype dtype);
+
+/*
+ * Same as Weights_new with the group size of Q4 weights (32, 64 or 128), ignored by the other types
+ */
+Weights *Weights_new_grouped(int r, int c, WeightsDtype dtype, int group_size);
+
+/*
+ * Create r x c weights on an existing buffer of rows stored back to back, without copying it (the buffer must outlive
+ * the weights), e.g. a tensor of a mapped file. Quantised rows are laid out as in quant.h.
+ */
+Weights *Weights_wrap(int r, int c, WeightsDtype dtype, const void *data);
+Weights *Weights_wrap_grouped(int r, int c, WeightsDtype dtype, int group_size, const void *data);
+
+/*
+ * Copy a matrix into new weights of the given precision (rounded to the nearest when narrowing, quantised for Q8)
+ */
+Weights *Weights_from_matrix(const Matrix *M, WeightsDtype dtype);
+Weights *Weights_from_matrix_grouped(const Matrix *M, WeightsDtype dtype, int group_size);
+
+/*
+ * Widen (dequantise) weights into a new f32 matrix
+ */
+Matrix *Weights_to_matrix(const Weights *W);
+
+CallmStatusCode Weights_free(Weights *W);
+
+/*
+ * Starts reading mapped weights from disk in the background (nothing to do for weights owning their buffer)
+ */
+void Weights_prefetch(const Weights *W);
+
+/*
+ * Number of bytes taken by a row of nb elements (a multiple of the block or group size for quantised weights)
+ */
+size_t Weights_dtype_nbytes(WeightsDtype dtype, int group_size, int nb);
+
+const char *Weights_dtype_name(WeightsDtype dtype);
+
+/*
+ * Number of bytes of weight data (rows excluding their padding)
+ */
+size_t Weights_nbytes(const Weights *W);
+
+/*
+ * Start of row i of W
+ */
+const void *Weights_row(const Weights *W, int i);
+
+/*
+ * Widen the rows of W given by their index into the rows of dst (nb x c), e.g. an embeddings lookup
+ */
+CallmStatusCode Weights_select_rows_into(Matrix *dst, const Weights *W, const int *idx, int nb);
+
+/*
+ * dst = A . W^T, with A of shape N x c (activations) and dst of shape N x r.
+ * A single row goes through the matrix-vector kernels, larger products through the blocked GEMM.
+ */
+Matrix *Weights_dot_transposed(const Matrix *A, const Weights *W);
+Matrix *Weights_dot_transposed_in(Arena *arena, const Matrix *A, const Weights *W);  // result allocated from arena
+CallmStatusCode Weights_dot_transposed_into(Matrix *dst, const Matrix *A, const Weights *W);  // dst must not overlap A
+
+#endif  // CALLM_WEIGHTS_H
@@ -1,15 +1,22 @@
 #include "attention.h"
+#include "../core/maths.h"
 #include "../core/matrix.h"
-#include "../monitor/probe.h"
+#include "../core/memory/arena.h"
+#include "../core/tensor.h"
+#include "../core/threadpool.h"
+#include "../core/weights.h"
 #include "../shared/errors.h"
 #include "../shared/logging.h"
+#include "rotary_embedding.h"
+#include <math.h>
 
 struct attention
 {
-    Matrix *query;
-    Matrix *key;
-    Matrix *value;
-    Matrix *out_proj;
+    Weights *query;
+    Weights *key;
+    Weights *value;
+    Weights *out_proj;
+    int head_dim;
     unsigned int layer_idx;
 };
 
@@ -20,6 +27,17 @@ Layer: model.layers.0.self_attn.v_proj.weight           shape: [512, 2048]
 Layer: model.layers.0.self_attn.o_proj.weight           shape: [2048, 2048]
 */
 
+/* Projections keep their stored precision unless the config quantises the attention layers */
+static Weights *
+load_projection(Safetensors *st, const Config *config, const char *name)
+{
+    if (config->quantize_attention)
+    {
+        return Safetensors_load_weights_as(name, st, config->quantization_dtype, config->quantization_group_size);
+    }
+    return Safetensors_load_weights(name, st);
+}
+
 Attention *
 Attention_new(Safetensors *st, const Config *config, unsigned int layer_idx)
 {
@@ -27,233 +45,223 @@ Attention_new(Safetensors *st, const Config *config, unsigned int layer_idx)
     Attention *at = (Attention *) malloc(sizeof(Attention));
 
     at->layer_idx = layer_idx;
+    at->head_dim = config->head_dim;
 
     char layer_name[256];
 
     sprintf(layer_name, "model.layers.%d.self_attn.q_proj.weight", layer_idx);
-    at->query = Safetensors_load_matrix(layer_name, st);
-    ENSURE_SHAPE(at->query, 2048, 2048);
+    at->query = load_projection(st, config, layer_name);
+    ENSURE_SHAPE(at->query, at->query->r, at->query->c);
 
     sprintf(layer_name, "model.layers.%d.self_attn.k_proj.weight", layer_idx);
-    at->key = Safetensors_load_matrix(layer_name, st);
-    ENSURE_SHAPE(at->key, 512, 2048);
+    at->key = load_projection(st, config, layer_name);
+    ENSURE_SHAPE(at->key, at->key->r, at->query->c);
 
     sprintf(layer_name, "model.layers.%d.self_attn.v_proj.weight", layer_idx);
-    at->value = Safetensors_load_matrix(layer_name, st);
-    ENSURE_SHAPE(at->value, 512, 2048);
+    at->value = load_projection(st, config, layer_name);
+    ENSURE_SHAPE(at->value, at->key->r, at->query->c);
 
     sprintf(layer_name, "model.layers.%d.self_attn.o_proj.weight", layer_idx);
-    at->out_proj = Safetensors_load_matrix(layer_name, st);
-    ENSURE_SHAPE(at->out_proj, 2048, 2048);
+    at->out_proj = load_projection(st, config, layer_name);
+    ENSURE_SHAPE(at->out_proj, at->query->c, at->query->r);
 
     LOGF_DEBUG("Attention layer %d loaded", layer_idx);
 
     return at;
 }
 
+void
+Attention_prefetch(const Attention *at)
+{
+    Weights_prefetch(at->query);
+    Weights_prefetch(at->key);
+    Weights_prefetch(at->value);
+    Weights_prefetch(at->out_proj);
+}
+
+void
+Attention_shape(const Attention *at, int *hidden_size, int *nb_heads, int *nb_kv_heads, int *head_dim)
+{
+    *hidden_size = at->query->c;
+    *nb_heads = at->query->r / at->head_dim;
+    *nb_kv_heads = at->key->r / at->head_dim;
+    *head_dim = at->head_dim;
+}
+
 void
 Attention_free(Attention *at)
 {
     if (at != NULL)
     {
         if (at->query != NULL)
-            Matrix_free(at->query);
+            Weights_free(at->query);
         if (at->key != NULL)
-            Matrix_free(at->key);
+            Weights_free(at->key);
         if (at->value != NULL)
-            Matrix_free(at->value);
+            Weights_free(at->value);
         if (at->out_proj != NULL)
-            Matrix_free(at->out_proj);
+            Weights_free(at->out_proj);
         free(at);
     }
 }
 
+typedef struct
+{
+    Matrix *query_proj;
+    Matrix *key_proj;
+    const Matrix *cos;
+    const Matrix *sin;
+    int nb_heads;
+    int head_dim;
+    int failed;
+} HeadsArgs;
+
 /*
- * Apply projection heads to the hidden state
+ * Applies the rotary embedding on the query heads [0, nb_heads) and on the key heads [nb_heads, nb_heads + nb_kv_heads)
  */
-static Matrix **
-apply_projection_heads(const Matrix *hidden_state, const Matrix *weights_T, size_t nb_heads, size_t head_dim,
-                       const char *probe_label)
+static void
+rotate_heads(void *arg, int start, int end)
 {
-    int nb_tokens = hidden_state->r;
-
-    Matrix *proj = Matrix_dot(hidden_state, weights_T);
-    RETURN_WHEN_NULL(proj, "Failed to compute projection");
-
-    // Probe_send_matrix(proj, probe_label);
-    // ENSURE_SHAPE(proj, nb_tokens, 2048);
-
-    Matrix **per_token_mat = malloc(nb_tokens * sizeof(Matrix *));
-    for (int i = 0; i < nb_tokens; i++)
+    HeadsArgs *heads = (HeadsArgs *) arg;
+    for (int i = start; i < end; i++)
     {
-        Matrix *tmp = Matrix_slice_line(proj, i, 1);
-        Matrix *per_token = Matrix_new(nb_heads, head_dim);  // Equivalent to reshape
-        Matrix_fill(per_token, tmp->data);
-        per_token_mat[i] = per_token;
-        Matrix_free(tmp);
-    }
-    Matrix_free(proj);
-
-    Matrix **heads = malloc(nb_heads * sizeof(Matrix *));
-    for (int i = 0; i < nb_heads; i++)
-    {
-        Matrix *head = Matrix_new(nb_tokens, head_dim);
-        float *head_data = malloc(nb_tokens * head_dim * sizeof(float));
-        for (int j = 0; j < nb_tokens; j++)
+        CallmStatusCode status = i < heads->nb_heads
+                                     ? RotaryEmbedding_apply_head(heads->query_proj, i, heads->cos, heads->sin)
+                                     : RotaryEmbedding_apply_head(heads->key_proj, i - heads->nb_heads, heads->cos,
+                                                                  heads->sin);
+        if (status != OK)
         {
-            Matrix *current_line = Matrix_slice_line(per_token_mat[j], i, 1);
-            for (int k = 0; k < head_dim; k++)
-                head_data[j * head_dim + k] = current_line->data[k];
-            Matrix_free(current_line);
+            __atomic_store_n(&heads->failed, 1, __ATOMIC_RELAXED);
         }
-        Matrix_fill(head, head_data);
-        free(head_data);
-        Matrix_print(head, 0);
-        heads[i] = head;
     }
-
-    // cleanup per token temp matrices
-    for (int i = 0; i < nb_tokens; i++)
-        Matrix_free(per_token_mat[i]);
-    free(per_token_mat);
-
-    return heads;
 }
 
-void
-free_projection_heads(Matrix **heads, size_t nb_heads)
+/*
+ * Sees the heads of a N x (nb_kv_heads * group * head_dim) projection as a [nb_kv_heads, group, N, head_dim] tensor:
+ * query heads are grouped by the key/value head they share. Key and value projections have a group of 1, broadcast
+ * by the products. With transpose, the 2 last dimensions are swapped.
+ */
+static Tensor *
+heads_tensor(Arena *arena, Matrix *proj, int nb_kv_heads, int group, int head_dim, int transpose)
 {
-    for (int i = 0; i < nb_heads; i++)
-        Matrix_free(heads[i]);
-    free(heads);
+    size_t shape[] = { nb_kv_heads, group, proj->r, head_dim };
+    size_t strides[] = { (size_t) group * head_dim, head_dim, proj->stride, 1 };
+    if (transpose)
+    {
+        shape[2] = head_dim;
+        shape[3] = proj->r;
+        strides[2] = 1;
+        strides[3] = proj->stride;
+    }
+    return Tensor_wrap_in(arena, 4, shape, strides, proj->data);
 }
 
-void
-send_projection_heads(Matrix **heads, size_t nb_heads, const char *label)
+typedef struct
 {
-    char message_label[256];
-    for (int i = 0; i < nb_heads; i++)
+    Matrix *scores;
+    int nb_tokens;
+    float scale;
+} SoftmaxArgs;
+
+static void
+softmax_rows(void *arg, int start, int end)
+{
+    SoftmaxArgs *args = (SoftmaxArgs *) arg;
+    for (int row = start; row < end; row++)
     {
-        sprintf(message_label, "%s_%d", label, i);
-        Probe_send_matrix(heads[i], message_label);
+        // Causal mask: token i only attends to the tokens [0, i], the scaling is folded into the softmax
+        int token = row % args->nb_tokens;
+        softmax_masked(Matrix_row(args->scores, row), args->nb_tokens, token + 1, args->scale);
     }
 }
 
-void
-rotate_half(Matrix **xs, size_t nb)
+/*
+ * context_h = softmax(mask(q_h . k_h^T / sqrt(head_dim))) . v_h for every head h, as 2 batched products over views on
+ * the projections: the result is written in place into the columns of each head in the context matrix. The views are
+ * allocated from the arena of the calling thread.
+ */
+static CallmStatusCode
+attend_heads(Matrix *query_proj, Matrix *key_proj, Matrix *value_proj, Matrix *scores, Matrix *context,
+             int nb_kv_heads, int head_dim)
 {
-    int n;
-    int m;
-    int x1len;
-    int x2len;
-    Matrix *x;
-    for (int i = 0; i < nb; i++)
+    int nb_tokens = query_proj->r;
+    int group = query_proj->c / (nb_kv_heads * head_dim);
+    // One N x N block of rows per head
+    size_t scores_shape[] = { nb_kv_heads, group, nb_tokens, nb_tokens };
+    size_t scores_strides[] = { (size_t) group * nb_tokens * scores->stride, (size_t) nb_tokens * scores->stride,
+                                scores->stride, 1 };
+
+    Arena *arena = Arena_thread_local();
+    ArenaMark mark = arena != NULL ? Arena_mark(arena) : (ArenaMark) { 0, 0, 0 };
+    Tensor *query = heads_tensor(arena, query_proj, nb_kv_heads, group, head_dim, 0);
+    Tensor *key_t = heads_tensor(arena, key_proj, nb_kv_heads, 1, head_dim, 1);
+    Tensor *value = heads_tensor(arena, value_proj, nb_kv_heads, 1, head_dim, 0);
+    Tensor *context_heads = heads_tensor(arena, context, nb_kv_heads, group, head_dim, 0);
+    Tensor *scores_heads = Tensor_wrap_in(arena, 4, scores_shape, scores_strides, scores->data);
+
+    CallmStatusCode status = ERROR;
+    if (query != NULL && key_t != NULL && value != NULL && context_heads != NULL && scores_heads != NULL
+        && Tensor_dot_into(scores_heads, query, key_t) == OK)
     {
-        x = xs[i];
-        n = x->r;
-        m = x->c;
-        x1len = m / 2;
-        x2len = m - x1len;
-        for (int j = 0; j < n; j++)
-        {
-            float *x1 = malloc(x1len * sizeof(float));
-            float *x2 = malloc(x2len * sizeof(float));
-            for (int k = 0; k < m; k++)
-                if (k < x1len)
-                    x1[k] = x->data[j * m + k];
-                else
-                    x2[k - x1len] = -(x->data[j * m + k]);
-            for (int k = 0; k < m; k++)
-                if (k < x1len)
-                    x->data[j * m + k] = x2[k];
-                else
-                    x->data[j * m + k] = x1[k - x1len];
-            free(x1);
-            free(x2);
-        }
+        SoftmaxArgs args = { scores, nb_tokens, 1.0f / sqrtf((float) head_dim) };
+        parallel_for(scores->r, 1, softmax_rows, &args);
+        status = Tensor_dot_into(context_heads, scores_heads, value);
     }
+
+    Tensor_free(query);
+    Tensor_free(key_t);
+    Tensor_free(value);
+    Tensor_free(context_heads);
+    Tensor_free(scores_heads);
+    if (arena != NULL)
+    {
+        Arena_release(arena, mark);
+    }
+    return status;
 }
 
 Matrix *
-Attention_forward(Attention *at, Matrix *input)
+Attention_forward(Attention *at, const Matrix *input, const Matrix *cos, const Matrix *sin, DecoderBuffers *buffers)
 {
-    Matrix *query_weights_T = Matrix_transpose(at->query);
-    Matrix *key_weights_T = Matrix_transpose(at->key);
-    Matrix *value_weights_T = Matrix_transpose(at->value);
-
-    const char label[64];
-
-    LOG_INFO("Compute query heads projections");
-    Matrix **query_heads = apply_projection_heads(input, query_weights_T, 32, 64, "query_heads");
-    // send_projection_heads(query_heads, 32, "query_heads projected");
-
-    LOG_INFO("Compute key heads projections");
-    Matrix **key_heads = apply_projection_heads(input, key_weights_T, 32, 64, "key_heads");
-    // send_projection_heads(key_heads, 32, "key_heads projected");
-
-    LOG_INFO("Compute value heads projections");
-    Matrix **value_heads = apply_projection_heads(input, value_weights_T, 32, 64, "value_heads");
-    // send_projection_heads(value_heads, 32, "value_heads projected");
-
-    Matrix_free(query_weights_T);
-    Matrix_free(value_weights_T);
-
-    Matrix **qk_proj = malloc(32 * sizeof(Matrix *));
-    char message_label[256];
-    for (int i = 0; i < 32; i++)
+    // Weights are kept in their [out, in] layout and stored precision, consumed through Weights_dot_transposed: no
+    // per-call transpose nor widened copy
+    int head_dim = at->head_dim;
+    int nb_heads = at->query->r / head_dim;
+    int nb_kv_heads = at->key->r / head_dim;
+
+    Matrix *query_proj = &buffers->matrices[DECODER_QUERY];
+    Matrix *key_proj = &buffers->matrices[DECODER_KEY];
+    Matrix *value_proj = &buffers->matrices[DECODER_VALUE];
+    Matrix *scores = &buffers->matrices[DECODER_SCORES];
+    Matrix *context = &buffers->matrices[DECODER_CONTEXT];
+    Matrix *output = &buffers->matrices[DECODER_ATTN_OUT];
+
+    if (Weights_dot_transposed_into(query_proj, input, at->query) != OK
+        || Weights_dot_transposed_into(key_proj, input, at->key) != OK
+        || Weights_dot_transposed_into(value_proj, input, at->value) != OK)
     {
-        Matrix *q_T = Matrix_transpose(query_heads[i]);
-        Matrix *kq = Matrix_dot(key_heads[i], q_T);
-        RETURN_WHEN_NULL(kq, "Failed to compute query-key projection");
-        Matrix_free(q_T);
-        qk_proj[i] = kq;
-        // Matrix_print(kq, -1);
-
-        sprintf(message_label, "qk_proj_%d", i);
-        // Probe_send_matrix(kq, message_label);
+        LOG_ERROR("Failed to compute attention projections");
+        return NULL;
     }
 
-    Matrix *key_proj = Matrix_dot(input, key_weights_T);
-    RETURN_WHEN_NULL(key_proj, "Failed to compute key projection");
-    ENSURE_SHAPE(key_proj, input->r, 512);
-
-    Matrix_free(key_weights_T);
-
-    free_projection_heads(query_heads, 32);
-    free_projection_heads(key_heads, 32);
-    free_projection_heads(value_heads, 32);
-
-    free_projection_heads(qk_proj, 32);
-
-    Matrix_free(key_proj);
-
-    return NULL;  // TODO: Implement the rest of the forward pass
-
-    // Matrix *attn_mask = Matrix_dot()
+    // Heads are independent: one head per task
+    HeadsArgs heads = { query_proj, key_proj, cos, sin, nb_heads, head_dim, 0 };
+    parallel_for(nb_heads + nb_kv_heads, 1, rotate_heads, &heads);
+    if (heads.failed)
+    {
+        LOG_ERROR("Failed to apply rotary embeddings");
+        return NULL;
+    }
+    if (attend_heads(query_proj, key_proj, value_proj, scores, context, nb_kv_heads, head_dim) != OK)
+    {
+        LOG_ERROR("Failed to compute attention heads");
+        return NULL;
+    }
 
-    // Matrix *value_proj = Matrix_dot(at->value, hidden_state_T);
-    // RETURN_WHEN_NULL(value_proj, "Failed to compute value projection");
-    //
-    // Matrix *key_proj_T = Matrix_transpose(key_proj);
-    // RETURN_WHEN_NULL(key_proj_T, "Failed to transpose key projection");
-    //
-    // Matrix *scores = Matrix_dot(query_proj, key_proj_T);
-    // RETURN_WHEN_NULL(scores, "Failed to compute attention scores");
-    //
-    // Matrix_apply_along(scores, MAT_APPLY_COL, softmax);
-    //
-    // Matrix *context = Matrix_dot(scores, value_proj);
-    // RETURN_WHEN_NULL(context, "Failed to compute context");
-    //
-    // Matrix *output = Matrix_dot(at->out_proj, context);
-    // RETURN_WHEN_NULL(output, "Failed to compute output");
-    //
-    //
-    //
-    // Matrix_free(value_proj);
-    // Matrix_free(scores);
-    // Matrix_free(context);
-    // Matrix_free(key_proj_T);
-    //
-    // return output;
+    if (Weights_dot_transposed_into(output, context, at->out_proj) != OK)
+    {
+        LOG_ERROR("Failed to compute attention output projection");
+        return NULL;
+    }
+    return output;
 }
@@ -4,6 +4,7 @@
 #include "../core/config.h"
 #include "../core/matrix.h"
 #include "../core/safetensors.h"
+#include "decoder_plan.h"
 
 typedef struct attention Attention;
 
@@ -11,6 +12,23 @@ Attention *Attention_new(Safetensors *st, const Config *config, unsigned int lay
 
 void Attention_free(Attention *at);
 
-Matrix *Attention_forward(Attention *at, Matrix *input);
+/*
+ * Dimensions of the layer, read from the shapes of its projections
+ */
+void Attention_shape(const Attention *at, int *hidden_size, int *nb_heads, int *nb_kv_heads, int *head_dim);
+
+/*
+ * Starts reading the mapped weights of the attention layer in the background
+ */
+void Attention_prefetch(const Attention *at);
+
+/*
+ * Causal multi-head self-attention (with grouped key/value heads) of a N x hidden_size input.
+ * cos and sin are the N x head_dim tables of the rotary embedding of the input positions.
+ * The projections, scores and result are written into their planned buffers (see decoder_plan.h), the input being
+ * the normed hidden state: returns the DECODER_ATTN_OUT matrix, or NULL on error.
+ */
+Matrix *Attention_forward(Attention *at, const Matrix *input, const Matrix *cos, const Matrix *sin,
+                          DecoderBuffers *buffers);
 
 #endif  // !#ifndef ATTENTION_H
@@ -13,10 +13,7 @@ struct decoder_t
     RMSNorm *input_layernorm;
     Attention *attn;
     MLP *mlp;
-    size_t norm_hidden_size;
-    float norm_eps;
-    Matrix *input_layer_norm;
-    Matrix *post_attention_layer_norm;
+    RMSNorm *post_attention_layernorm;
 };
 
 Decoder *
@@ -37,14 +34,21 @@ Decoder_new(Safetensors *st, const Config *config, unsigned int layer_idx)
     decoder->input_layernorm = RMSNorm_new(config->rms_norm_eps, st, layer_name);
 
     sprintf(layer_name, "model.layers.%d.post_attention_layernorm.weight", layer_idx);
-    decoder->post_attention_layer_norm = Safetensors_load_matrix(layer_name, st);
-    RETURN_WHEN_NULL(decoder->post_attention_layer_norm, "post attention layer norm");
-    ENSURE_SHAPE(decoder->post_attention_layer_norm, 2048, 1);
+    decoder->post_attention_layernorm = RMSNorm_new(config->rms_norm_eps, st, layer_name);
+    RETURN_WHEN_NULL(decoder->post_attention_layernorm, "post attention layer norm");
 
     LOG_DEBUG("Decoder loaded");
     return decoder;
 }
 
+void
+Decoder_prefetch(const Decoder *decoder)
+{
+    // The norms weigh a few KB, their pages are faulted in on use
+    Attention_prefetch(decoder->attn);
+    MLP_prefetch(decoder->mlp);
+}
+
 CallmStatusCode
 Decoder_free(Decoder *decoder)
 {
@@ -57,36 +61,46 @@ Decoder_free(Decoder *decoder)
     Attention_free(decoder->attn);
     MLP_free(decoder->mlp);
 
-    if (decoder->input_layer_norm != NULL)
-    {
-        Matrix_free(decoder->input_layer_norm);
-    }
-
-    if (decoder->post_attention_layer_norm != NULL)
-    {
-        Matrix_free(decoder->post_attention_layer_norm);
-    }
+    RMSNorm_free(decoder->input_layernorm);
+    RMSNorm_free(decoder->post_attention_layernorm);
 
     free(decoder);
     return OK;
 }
 
+void
+Decoder_shape(const Decoder *decoder, DecoderShape *shape)
+{
+    Attention_shape(decoder->attn, &shape->hidden_size, &shape->nb_heads, &shape->nb_kv_heads, &shape->head_dim);
+    shape->intermediate_size = MLP_intermediate_size(decoder->mlp);
+}
+
 Matrix *
-Decoder_forward(Decoder *decoder, Matrix *hidden_state)
+Decoder_forward(Decoder *decoder, Matrix *hidden_state, const Matrix *cos, const Matrix *sin, DecoderBuffers *buffers)
 {
-    Matrix *normed_hidden_state = RMSNorm_forward(decoder->input_layernorm, hidden_state);
-    ENSURE_SHAPE(normed_hidden_state, hidden_state->r, 2048);
-    Matrix_print(normed_hidden_state, 10);
+    // hidden_state is the residual stream:
+    //   h = x + attn(input_norm(x))
+    //   out = h + mlp(post_attention_norm(h))
+    Matrix *normed_hidden_state = &buffers->matrices[DECODER_NORMED];
+    if (RMSNorm_forward_into(decoder->input_layernorm, normed_hidden_state, hidden_state) != OK)
+    {
+        LOG_ERROR("Error when running input norm");
+        return NULL;
+    }
 
-    Matrix *attn_out = Attention_forward(decoder->attn, normed_hidden_state);
+    Matrix *attn_out = Attention_forward(decoder->attn, normed_hidden_state, cos, sin, buffers);
     RETURN_WHEN_NULL(attn_out, "Error when running attention");
-    Matrix_free(normed_hidden_state);
 
-    Matrix *mlp_out = MLP_forward(decoder->mlp, attn_out);
-    RETURN_WHEN_NULL(mlp_out, "Error when running mlp");
-    Matrix_free(attn_out);
+    // Residual add and norm in one sweep, the normalised state overwrites the attention output
+    if (RMSNorm_residual_forward_into(decoder->post_attention_layernorm, attn_out, hidden_state, attn_out) != OK)
+    {
+        LOG_ERROR("Error when running post attention norm");
+        return NULL;
+    }
 
-    // Normaliszation
+    Matrix *mlp_out = MLP_forward(decoder->mlp, attn_out, buffers);
+    RETURN_WHEN_NULL(mlp_out, "Error when running mlp");
 
-    return mlp_out;
+    Matrix_add_into(hidden_state, hidden_state, mlp_out);
+    return hidden_state;
 }
@@ -5,6 +5,7 @@
 #include "../core/matrix.h"
 #include "../core/safetensors.h"
 #include "../shared/errors.h"
+#include "decoder_plan.h"
 
 typedef struct decoder_t Decoder;
 
@@ -12,6 +13,24 @@ Decoder *Decoder_new(Safetensors *st, const Config *config, unsigned int loayer_
 
 CallmStatusCode Decoder_free(Decoder *decoder);
 
-Matrix *Decoder_forward(Decoder *decoder, Matrix *hidden_state);
+/*
+ * Starts reading the mapped weights of the decoder block in the background, e.g. while the previous block runs
+ */
+void Decoder_prefetch(const Decoder *decoder);
+
+/*
+ * Dimensions of the layers of the decoder, to plan its intermediates
+ */
+void Decoder_shape(const Decoder *decoder, DecoderShape *shape);
+
+/*
+ * Runs the decoder block on hidden_state (N x hidden_size), updated in place with both residual connections, and
+ * returns it (NULL on error).
+ * cos and sin are the rotary embedding tables of the tokens positions (see RotaryEmbedding_forward).
+ * Intermediates are written into buffers, planned for the shape of the decoder and the number of tokens (see
+ * DecoderPlan_buffers): nothing is allocated, they are dead once it returns.
+ */
+Matrix *Decoder_forward(Decoder *decoder, Matrix *hidden_state, const Matrix *cos, const Matrix *sin,
+                        DecoderBuffers *buffers);
 
 #endif  // !#ifndef DECODER_H
@@ -0,0 +1,141 @@
+#include "decoder_plan.h"
+#include "../shared/logging.h"
+#include <string.h>
+
+/* First and last step of Decoder_forward each buffer is alive in, see DecoderBufferId */
+static const int liveness[DECODER_NB_BUFFERS][2] = {
+    [DECODER_NORMED] = { 0, 1 },   [DECODER_QUERY] = { 1, 3 },    [DECODER_KEY] = { 1, 3 },
+    [DECODER_VALUE] = { 1, 5 },    [DECODER_SCORES] = { 3, 5 },   [DECODER_CONTEXT] = { 5, 6 },
+    [DECODER_ATTN_OUT] = { 6, 8 }, [DECODER_GATE] = { 8, 10 },    [DECODER_UP] = { 8, 9 },
+    [DECODER_MLP_OUT] = { 10, 11 },
+};
+
+void
+DecoderPlan_liveness(DecoderBufferId id, int *first_step, int *last_step)
+{
+    *first_step = liveness[id][0];
+    *last_step = liveness[id][1];
+}
+
+/* Shape of a buffer for nb_tokens tokens */
+static void
+buffer_shape(const DecoderShape *shape, DecoderBufferId id, int nb_tokens, int *r, int *c)
+{
+    *r = nb_tokens;
+    switch (id)
+    {
+    case DECODER_QUERY:
+    case DECODER_CONTEXT:
+        *c = shape->nb_heads * shape->head_dim;
+        break;
+    case DECODER_KEY:
+    case DECODER_VALUE:
+        *c = shape->nb_kv_heads * shape->head_dim;
+        break;
+    case DECODER_SCORES:
+        *r = shape->nb_heads * nb_tokens;
+        *c = nb_tokens;
+        break;
+    case DECODER_GATE:
+    case DECODER_UP:
+        *c = shape->intermediate_size;
+        break;
+    default:
+        *c = shape->hidden_size;
+        break;
+    }
+}
+
+static size_t
+align_up(size_t n)
+{
+    return (n + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+static int
+alive_together(DecoderBufferId a, DecoderBufferId b)
+{
+    return liveness[a][0] <= liveness[b][1] && liveness[b][0] <= liveness[a][1];
+}
+
+CallmStatusCode
+DecoderPlan_init(DecoderPlan *plan, const DecoderShape *shape, int max_tokens)
+{
+    if (max_tokens <= 0 || shape->nb_heads <= 0 || shape->nb_kv_heads <= 0 || shape->nb_heads % shape->nb_kv_heads != 0)
+    {
+        LOGF_ERROR("Cannot plan a decoder of %d heads, %d key/value heads for %d tokens", shape->nb_heads,
+                   shape->nb_kv_heads, max_tokens);
+        return ERROR;
+    }
+    memset(plan, 0, sizeof(DecoderPlan));
+    plan->shape = *shape;
+    plan->max_tokens = max_tokens;
+
+    int order[DECODER_NB_BUFFERS];
+    for (int i = 0; i < DECODER_NB_BUFFERS; i++)
+    {
+        int r, c;
+        buffer_shape(shape, (DecoderBufferId) i, max_tokens, &r, &c);
+        plan->sizes[i] = align_up((size_t) r * c * sizeof(float));
+
+        // Insertion by decreasing size
+        int j = i;
+        while (j > 0 && plan->sizes[order[j - 1]] < plan->sizes[i])
+        {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    for (int i = 0; i < DECODER_NB_BUFFERS; i++)
+    {
+        int id = order[i];
+        size_t offset = 0;
+
+        // Lowest offset clear of every placed buffer alive at the same time: any overlap pushes the candidate past the
+        // buffer it hits, until none is hit
+        int moved = 1;
+        while (moved)
+        {
+            moved = 0;
+            for (int j = 0; j < i; j++)
+            {
+                int other = order[j];
+                if (alive_together(id, other) && offset < plan->offsets[other] + plan->sizes[other]
+                    && plan->offsets[other] < offset + plan->sizes[id])
+                {
+                    offset = plan->offsets[other] + plan->sizes[other];
+                    moved = 1;
+                }
+            }
+        }
+        plan->offsets[id] = offset;
+        if (offset + plan->sizes[id] > plan->workspace_size)
+        {
+            plan->workspace_size = offset + plan->sizes[id];
+        }
+    }
+    return OK;
+}
+
+CallmStatusCode
+DecoderPlan_buffers(const DecoderPlan *plan, void *workspace, int nb_tokens, DecoderBuffers *buffers)
+{
+    if (nb_tokens <= 0 || nb_tokens > plan->max_tokens)
+    {
+        LOGF_ERROR("The decoder plan is for up to %d tokens, got %d", plan->max_tokens, nb_tokens);
+        return ERROR;
+    }
+    for (int i = 0; i < DECODER_NB_BUFFERS; i++)
+    {
+        Matrix *M = &buffers->matrices[i];
+        buffer_shape(&plan->shape, (DecoderBufferId) i, nb_tokens, &M->r, &M->c);
+        M->size = (size_t) M->r * M->c;
+        M->stride = M->c;
+        M->data = (float *) ((char *) workspace + plan->offsets[i]);
+        M->owns_data = 0;
+        M->in_arena = 1;  // never released on its own
+    }
+    return OK;
+}
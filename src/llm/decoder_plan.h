@@ -0,0 +1,74 @@
+#ifndef DECODER_PLAN_H
+#define DECODER_PLAN_H
+
+#include "../core/matrix.h"
+#include "../shared/errors.h"
+#include <stddef.h>
+
+/*
+ * Static memory plan of the intermediates of Decoder_forward. Their shapes only depend on the dimensions of the layers
+ * and on the number of tokens, so the whole forward graph is planned once: each intermediate gets an offset in a
+ * single workspace, intermediates that are never alive at the same time sharing memory. The layers then run on these
+ * preassigned buffers without any allocation.
+ */
+
+/* Intermediates of a decoder, with the steps of Decoder_forward they are alive in (first write to last read) */
+typedef enum
+{
+    DECODER_NORMED = 0,  // N x hidden_size,              [0, 1]: input norm, projections
+    DECODER_QUERY,       // N x (nb_heads * head_dim),    [1, 3]: projections, rotary embedding, scores
+    DECODER_KEY,         // N x (nb_kv_heads * head_dim), [1, 3]
+    DECODER_VALUE,       // N x (nb_kv_heads * head_dim), [1, 5]: up to the context product
+    DECODER_SCORES,      // (nb_heads * N) x N,           [3, 5]: scores, softmax, context product
+    DECODER_CONTEXT,     // N x (nb_heads * head_dim),    [5, 6]: context product, output projection
+    DECODER_ATTN_OUT,    // N x hidden_size,              [6, 8]: output projection, post attention norm (in place)
+    DECODER_GATE,        // N x intermediate_size,        [8, 10]: gate projection, silu(gate) * up (in place), down
+    DECODER_UP,          // N x intermediate_size,        [8, 9]
+    DECODER_MLP_OUT,     // N x hidden_size,              [10, 11]: down projection, residual add
+    DECODER_NB_BUFFERS
+} DecoderBufferId;
+
+/* Dimensions of the layers of a decoder */
+typedef struct
+{
+    int hidden_size;
+    int nb_heads;
+    int nb_kv_heads;
+    int head_dim;
+    int intermediate_size;
+} DecoderShape;
+
+typedef struct
+{
+    DecoderShape shape;
+    int max_tokens;
+    size_t offsets[DECODER_NB_BUFFERS];  // in bytes from the start of the workspace, MATRIX_ALIGNMENT aligned
+    size_t sizes[DECODER_NB_BUFFERS];    // in bytes, for max_tokens tokens
+    size_t workspace_size;
+} DecoderPlan;
+
+/* The intermediates of one forward pass, as matrices on a workspace (indexed by DecoderBufferId) */
+typedef struct
+{
+    Matrix matrices[DECODER_NB_BUFFERS];
+} DecoderBuffers;
+
+/*
+ * Plans the intermediates of a decoder of the given shape for up to max_tokens tokens: offsets are assigned by
+ * decreasing size, each buffer at the lowest offset that doesn't overlap a buffer alive at the same time.
+ */
+CallmStatusCode DecoderPlan_init(DecoderPlan *plan, const DecoderShape *shape, int max_tokens);
+
+/*
+ * Steps of Decoder_forward during which the buffer is alive
+ */
+void DecoderPlan_liveness(DecoderBufferId id, int *first_step, int *last_step);
+
+/*
+ * Fills buffers with the matrices of a pass on nb_tokens (<= max_tokens) tokens, on a workspace of at least
+ * plan->workspace_size bytes aligned on MATRIX_ALIGNMENT. Nothing is allocated, the matrices are released with the
+ * workspace.
+ */
+CallmStatusCode DecoderPlan_buffers(const DecoderPlan *plan, void *workspace, int nb_tokens, DecoderBuffers *buffers);
+
+#endif  // !#ifndef DECODER_PLAN_H
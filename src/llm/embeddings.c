@@ -1,22 +1,33 @@
 #include "embeddings.h"
 #include "matrix.h"
+#include "weights.h"
 
 #define EMBEDDINGS_LAYER_NAME "model.embed_tokens.weight"
 
 struct embeddings_lookup
 {
-    Matrix *embeddings;
+    Weights *embeddings;  // Kept in the stored precision, only the looked up rows are widened
 };
 
 /**
 Layer: model.embed_tokens.weight                shape: [128256, 2048]
 */
 EmbeddingsLookup *
-EmbeddingsLookup_new(Safetensors *st)
+EmbeddingsLookup_new(Safetensors *st, const Config *config)
 {
     LOG_DEBUG("Loading embeddings lookup table...");
     EmbeddingsLookup *el = (EmbeddingsLookup *) malloc(sizeof(EmbeddingsLookup));
-    Matrix *emb_mat = Safetensors_load_matrix(EMBEDDINGS_LAYER_NAME, st);
+    // The table is also the (tied) output head: quantising the head quantises the lookup too
+    Weights *emb_mat;
+    if (config->quantize_lm_head)
+    {
+        emb_mat = Safetensors_load_weights_as(EMBEDDINGS_LAYER_NAME, st, config->quantization_dtype,
+                                              config->quantization_group_size);
+    }
+    else
+    {
+        emb_mat = Safetensors_load_weights(EMBEDDINGS_LAYER_NAME, st);
+    }
     ENSURE_SHAPE(emb_mat, 128256, 2048);
 
     el->embeddings = emb_mat;
@@ -32,7 +43,7 @@ EmbeddingsLookup_free(EmbeddingsLookup *el)
     {
         if (el->embeddings != NULL)
         {
-            Matrix_free(el->embeddings);
+            Weights_free(el->embeddings);
         }
         free(el);
     }
@@ -41,8 +52,38 @@ EmbeddingsLookup_free(EmbeddingsLookup *el)
 Matrix *
 EmbeddingsLookup_forward(EmbeddingsLookup *el, int *token_ids, int token_count)
 {
-    Matrix *embeddings = Matrix_select_rows(el->embeddings, token_ids, token_count);
-    ENSURE_SHAPE(embeddings, token_count, 2048);
-
+    Matrix *embeddings = Matrix_new(token_count, el->embeddings->c);
+    RETURN_WHEN_NULL(embeddings, "Failed to allocate embeddings");
+    if (EmbeddingsLookup_forward_into(embeddings, el, token_ids, token_count) != OK)
+    {
+        Matrix_free(embeddings);
+        return NULL;
+    }
     return embeddings;
 }
+
+CallmStatusCode
+EmbeddingsLookup_forward_into(Matrix *dst, EmbeddingsLookup *el, int *token_ids, int token_count)
+{
+    if (Weights_select_rows_into(dst, el->embeddings, token_ids, token_count) != OK)
+    {
+        return ERROR;
+    }
+    ENSURE_SHAPE(dst, token_count, 2048);
+
+    return OK;
+}
+
+int
+EmbeddingsLookup_hidden_size(const EmbeddingsLookup *el)
+{
+    return el->embeddings->c;
+}
+
+Matrix *
+EmbeddingsLookup_logits(EmbeddingsLookup *el, const Matrix *hidden_state)
+{
+    Matrix *logits = Weights_dot_transposed(hidden_state, el->embeddings);
+    RETURN_WHEN_NULL(logits, "Failed to compute the logits");
+    return logits;
+}
@@ -1,14 +1,25 @@
 #ifndef EMBEDDINGS_H
 #define EMBEDDINGS_H
 
+#include "../core/config.h"
 #include "../core/safetensors.h"
 
 typedef struct embeddings_lookup EmbeddingsLookup;
 
-EmbeddingsLookup *EmbeddingsLookup_new(Safetensors *st);
+EmbeddingsLookup *EmbeddingsLookup_new(Safetensors *st, const Config *config);
 
 void EmbeddingsLookup_free(EmbeddingsLookup *el);
 
 Matrix *EmbeddingsLookup_forward(EmbeddingsLookup *el, int *token_ids, int token_count);
+CallmStatusCode EmbeddingsLookup_forward_into(Matrix *dst, EmbeddingsLookup *el, int *token_ids, int token_count);
+
+/* Width of an embedding: the hidden size of the model */
+int EmbeddingsLookup_hidden_size(const EmbeddingsLookup *el);
+
+/*
+ * Output head tied to the embeddings table (as in Llama 3.2): logits = hidden_state . E^T, one row of vocabulary scores
+ * per token
+ */
+Matrix *EmbeddingsLookup_logits(EmbeddingsLookup *el, const Matrix *hidden_state);
 
 #endif  // !#ifndef EMBEDDINGS_H
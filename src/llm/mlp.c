@@ -1,5 +1,6 @@
 #include "mlp.h"
 #include "../core/matrix.h"
+#include "../core/weights.h"
 #include "../shared/errors.h"
 #include "../shared/logging.h"
 #include <stdio.h>
@@ -7,9 +8,9 @@
 
 struct mlp_t
 {
-    Matrix *down_weights;
-    Matrix *gate_weights;
-    Matrix *up_weights;
+    Weights *down_weights;
+    Weights *gate_weights;
+    Weights *up_weights;
 };
 
 /**
@@ -17,6 +18,17 @@ Layer: model.layers.0.mlp.down_proj.weight              shape: [2048, 8192]
 Layer: model.layers.0.mlp.gate_proj.weight              shape: [8192, 2048]
 Layer: model.layers.0.mlp.up_proj.weight                shape: [8192, 2048]
 */
+/* Weights keep their stored precision unless the config quantises the MLP layers */
+static Weights *
+load_weights(Safetensors *st, const Config *config, const char *name)
+{
+    if (config->quantize_mlp)
+    {
+        return Safetensors_load_weights_as(name, st, config->quantization_dtype, config->quantization_group_size);
+    }
+    return Safetensors_load_weights(name, st);
+}
+
 MLP *
 MLP_new(Safetensors *st, const Config *config, unsigned int layer_idx)
 {
@@ -28,20 +40,29 @@ MLP_new(Safetensors *st, const Config *config, unsigned int layer_idx)
     char layer_name[256];
 
     sprintf(layer_name, "model.layers.%d.mlp.down_proj.weight", layer_idx);
-    mlp->down_weights = Safetensors_load_matrix(layer_name, st);
+    mlp->down_weights = load_weights(st, config, layer_name);
     RETURN_WHEN_NULL(mlp->down_weights, "Failed to load down weights");
 
     sprintf(layer_name, "model.layers.%d.mlp.gate_proj.weight", layer_idx);
-    mlp->gate_weights = Safetensors_load_matrix(layer_name, st);
+    mlp->gate_weights = load_weights(st, config, layer_name);
     RETURN_WHEN_NULL(mlp->gate_weights, "Failed to load gate weights");
 
     sprintf(layer_name, "model.layers.%d.mlp.up_proj.weight", layer_idx);
-    mlp->up_weights = Safetensors_load_matrix(layer_name, st);
+    mlp->up_weights = load_weights(st, config, layer_name);
     RETURN_WHEN_NULL(mlp->up_weights, "Failed to load up weights");
 
     return mlp;
 }
 
+void
+MLP_prefetch(const MLP *mlp)
+{
+    // In their order of use
+    Weights_prefetch(mlp->gate_weights);
+    Weights_prefetch(mlp->up_weights);
+    Weights_prefetch(mlp->down_weights);
+}
+
 CallmStatusCode
 MLP_free(MLP *mlp)
 {
@@ -50,24 +71,46 @@ MLP_free(MLP *mlp)
         return ERROR;
     }
 
-    Matrix_free(mlp->down_weights);
-    Matrix_free(mlp->gate_weights);
-    Matrix_free(mlp->up_weights);
+    Weights_free(mlp->down_weights);
+    Weights_free(mlp->gate_weights);
+    Weights_free(mlp->up_weights);
     free(mlp);
 
     return OK;
 }
 
+int
+MLP_intermediate_size(const MLP *mlp)
+{
+    return mlp->gate_weights->r;
+}
+
 Matrix *
-MLP_forward(MLP *mlp, Matrix *input)
+MLP_forward(MLP *mlp, const Matrix *input, DecoderBuffers *buffers)
 {
-    Matrix *hidden = Matrix_dot(mlp->down_weights, input);
-    RETURN_WHEN_NULL(hidden, "Failed to compute hidden layer");
+    // out = down(silu(gate(x)) * up(x)), with every weight consumed in its [out, in] layout
+    Matrix *gate = &buffers->matrices[DECODER_GATE];
+    Matrix *up = &buffers->matrices[DECODER_UP];
+    Matrix *output = &buffers->matrices[DECODER_MLP_OUT];
 
-    // Matrix_apply_activation(hidden, RELU);
-    Matrix *output = Matrix_dot(mlp->gate_weights, hidden);
-    RETURN_WHEN_NULL(output, "Failed to compute output layer");
+    if (Weights_dot_transposed_into(gate, input, mlp->gate_weights) != OK)
+    {
+        LOG_ERROR("Failed to compute gate projection");
+        return NULL;
+    }
+    if (Weights_dot_transposed_into(up, input, mlp->up_weights) != OK)
+    {
+        LOG_ERROR("Failed to compute up projection");
+        return NULL;
+    }
+
+    // The hidden layer overwrites the gate activations in place, silu and product fused in one pass
+    Matrix_silu_multiply_into(gate, gate, up);
 
-    Matrix_free(hidden);
+    if (Weights_dot_transposed_into(output, gate, mlp->down_weights) != OK)
+    {
+        LOG_ERROR("Failed to compute output layer");
+        return NULL;
+    }
     return output;
 }
@@ -4,6 +4,7 @@
 #include "../core/config.h"
 #include "../core/matrix.h"
 #include "../core/safetensors.h"
+#include "decoder_plan.h"
 
 typedef struct mlp_t MLP;
 
@@ -11,6 +12,20 @@ MLP *MLP_new(Safetensors *st, const Config *config, unsigned int layer_idx);
 
 CallmStatusCode MLP_free(MLP *mlp);
 
-Matrix *MLP_forward(MLP *mlp, Matrix *input);
+/*
+ * Starts reading the mapped weights of the MLP in the background
+ */
+void MLP_prefetch(const MLP *mlp);
+
+/*
+ * Number of hidden units, the width of the gate and up projections
+ */
+int MLP_intermediate_size(const MLP *mlp);
+
+/*
+ * down(silu(gate(input)) * up(input)), the projections and the result being written into their planned buffers (see
+ * decoder_plan.h): returns the DECODER_MLP_OUT matrix, or NULL on error
+ */
+Matrix *MLP_forward(MLP *mlp, const Matrix *input, DecoderBuffers *buffers);
 
 #endif  // !#ifndef MLP_H
@@ -1,48 +1,162 @@
+#define _POSIX_C_SOURCE 200112L  // clock_gettime
+
 #include "model.h"
+#include "../core/threadpool.h"
 #include "../shared/errors.h"
 #include "../shared/logging.h"
 #include "decoder.h"
+#include "decoder_plan.h"
 #include "embeddings.h"
 #include "rms_norm.h"
 #include "rotary_embedding.h"
 #include <stddef.h>
+#include <time.h>
 
 struct model_t
 {
     EmbeddingsLookup *embedding;
     Decoder **decoder_layers;
     size_t decoders_count;
+    DecoderShape decoder_shape;  // shared by every decoder
     RotaryEmbedding *rotary;
     RMSNorm *norm;
+    ModelLoadTimings load_timings;
+    int forwarded;  // FORWARD_*, accessed atomically
+    PageFaults first_forward_faults;  // written by the pass that claimed the first one, read once it is published
 };
 
+/* First pass state: the first pass to start claims it, prefetches the weights and publishes its page faults */
+enum
+{
+    FORWARD_NONE = 0,
+    FORWARD_CLAIMED,
+    FORWARD_PUBLISHED,
+};
+
+static double
+elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+typedef struct
+{
+    Safetensors *st;
+    const Config *config;
+    Decoder **decoders;
+} LoadDecodersArgs;
+
+static void
+load_decoders(void *arg, int start, int end)
+{
+    LoadDecodersArgs *args = (LoadDecodersArgs *) arg;
+    for (int i = start; i < end; i++)
+    {
+        args->decoders[i] = Decoder_new(args->st, args->config, i);
+    }
+}
+
+/*
+ * Builds every decoder layer into its slot of decoders.
+ * With at least as many layers as threads, whole layers are built in parallel (their conversions then run serially
+ * on the thread building them). With fewer layers, they are built one after the other and their tensors are converted
+ * in parallel instead, so no thread is left idle. Either way each layer is built from its own tensors only, the result
+ * doesn't depend on the number of threads.
+ */
+static void
+Model_load_decoders(Safetensors *st, const Config *config, Decoder **decoders, int count)
+{
+    LoadDecodersArgs args = { st, config, decoders };
+    if (count >= ThreadPool_size(ThreadPool_default()))
+    {
+        parallel_for(count, 1, load_decoders, &args);
+    }
+    else
+    {
+        load_decoders(&args, 0, count);
+    }
+}
+
 Model *
 Model_new(Safetensors *st, const Config *config)
 {
     LOG_DEBUG("Loading model...");
-    Model *model = (Model *) malloc(sizeof(Model));
-    model->embedding = NULL;
-    model->decoder_layers = NULL;
-    model->rotary = NULL;
-    model->norm = NULL;
+    struct timespec model_start, phase_start;
+    clock_gettime(CLOCK_MONOTONIC, &model_start);
+    PageFaults faults_start = page_faults();
+
+    Model *model = (Model *) calloc(1, sizeof(Model));
+    RETURN_WHEN_NULL(model, "Failed to allocate the model");
 
-    model->embedding = EmbeddingsLookup_new(st);
+    clock_gettime(CLOCK_MONOTONIC, &phase_start);
+    model->embedding = EmbeddingsLookup_new(st, config);
+    model->load_timings.embeddings_ms = elapsed_ms(&phase_start);
 
+    clock_gettime(CLOCK_MONOTONIC, &phase_start);
     model->rotary = RotaryEmbedding_new(config);
+    model->load_timings.rotary_ms = elapsed_ms(&phase_start);
 
+    clock_gettime(CLOCK_MONOTONIC, &phase_start);
     model->decoders_count = config->transformers_bloc_count;
-    model->decoder_layers = (Decoder **) malloc(config->transformers_bloc_count * sizeof(Decoder *));
-    for (size_t i = 0; i < config->transformers_bloc_count; i++)
+    model->decoder_layers = (Decoder **) calloc(model->decoders_count, sizeof(Decoder *));
+    if (model->decoder_layers == NULL)
+    {
+        LOG_ERROR("Failed to allocate the decoder layers");
+        Model_free(model);
+        return NULL;
+    }
+    Model_load_decoders(st, config, model->decoder_layers, (int) model->decoders_count);
+    for (size_t i = 0; i < model->decoders_count; i++)
+    {
+        if (model->decoder_layers[i] == NULL)
+        {
+            LOGF_ERROR("Failed to load decoder layer %zu", i);
+            Model_free(model);
+            return NULL;
+        }
+    }
+    if (model->decoders_count > 0)
     {
-        model->decoder_layers[i] = Decoder_new(st, config, i);
+        Decoder_shape(model->decoder_layers[0], &model->decoder_shape);
     }
+    model->load_timings.decoders_ms = elapsed_ms(&phase_start);
 
     // model->norm = RMSNorm_new(config->rms_norm_eps, st, "");
 
-    LOG_DEBUG("Model loaded");
+    model->load_timings.total_ms = elapsed_ms(&model_start);
+    PageFaults faults_end = page_faults();
+    model->load_timings.faults.minor = faults_end.minor - faults_start.minor;
+    model->load_timings.faults.major = faults_end.major - faults_start.major;
+    LOGF_INFO("Model loaded in %.1f ms (embeddings %.1f ms, rotary %.1f ms, %zu decoders %.1f ms), "
+              "%ld minor, %ld major page faults",
+              model->load_timings.total_ms, model->load_timings.embeddings_ms, model->load_timings.rotary_ms,
+              model->decoders_count, model->load_timings.decoders_ms, model->load_timings.faults.minor,
+              model->load_timings.faults.major);
     return model;
 }
 
+const ModelLoadTimings *
+Model_load_timings(const Model *model)
+{
+    return &model->load_timings;
+}
+
+int
+Model_hidden_size(const Model *model)
+{
+    return EmbeddingsLookup_hidden_size(model->embedding);
+}
+
+const PageFaults *
+Model_first_forward_faults(const Model *model)
+{
+    static const PageFaults none = { 0, 0 };
+    return __atomic_load_n(&model->forwarded, __ATOMIC_ACQUIRE) == FORWARD_PUBLISHED ? &model->first_forward_faults
+                                                                                      : &none;
+}
+
 CallmStatusCode
 Model_free(Model *model)
 {
@@ -53,9 +167,12 @@ Model_free(Model *model)
     }
     EmbeddingsLookup_free(model->embedding);
 
-    for (size_t i = 0; i < model->decoders_count; i++)
+    for (size_t i = 0; model->decoder_layers != NULL && i < model->decoders_count; i++)
     {
-        Decoder_free(model->decoder_layers[i]);
+        if (model->decoder_layers[i] != NULL)
+        {
+            Decoder_free(model->decoder_layers[i]);
+        }
     }
     free(model->decoder_layers);
 
@@ -80,35 +197,155 @@ Model_embed_inputs(Model *model, int *token_ids, int token_count, Matrix **cos,
     RETURN_WHEN_NULL(hidden_state, "Error when embedding input tokens");
 
     Matrix *position_ids = Matrix_arange(0, token_count, 1, MAT_APPLY_ROW);
-
-    // LOGF_DEBUG("Running model with %d tokens position_ids rows=%d, cols=%d", token_count, position_ids->r,
-    //            position_ids->c);
-
-    if (RotaryEmbedding_forward(model->rotary, position_ids, cos, sin) != OK)
+    CallmStatusCode status = position_ids != NULL ? RotaryEmbedding_forward(model->rotary, position_ids, cos, sin)
+                                                  : ERROR;
+    Matrix_free(position_ids);
+    if (status != OK)
     {
         LOG_ERROR("Error when applying rotary embeddings");
+        Matrix_free(hidden_state);
         return NULL;
     }
     return hidden_state;
 }
 
+/*
+ * Rotary embedding tables of the positions [0, token_count), allocated from arena
+ */
+static CallmStatusCode
+Model_rotary_tables(Model *model, Arena *arena, int token_count, Matrix **cos, Matrix **sin)
+{
+    Matrix *position_ids = Matrix_new_in(arena, 1, token_count);
+    *cos = Matrix_new_in(arena, token_count, model->decoder_shape.head_dim);
+    *sin = Matrix_new_in(arena, token_count, model->decoder_shape.head_dim);
+    if (position_ids == NULL || *cos == NULL || *sin == NULL)
+    {
+        LOG_ERROR("Failed to allocate rotary embeddings");
+        return ERROR;
+    }
+    for (int i = 0; i < token_count; i++)
+    {
+        position_ids->data[i] = (float) i;
+    }
+    return RotaryEmbedding_forward_into(model->rotary, position_ids, *cos, *sin);
+}
+
+/*
+ * Smallest power of two >= n: token counts up to the same power of two get the same workspace size, so a growing
+ * sequence only grows the arena O(log n) times
+ */
+static int
+plan_capacity(int n)
+{
+    int capacity = 1;
+    while (capacity < n)
+    {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
 Matrix *
 Model_forward(Model *model, int *token_ids, int token_count)
 {
+    Matrix *hidden_state = Matrix_new(token_count, Model_hidden_size(model));
+    RETURN_WHEN_NULL(hidden_state, "Failed to allocate the hidden state");
+    if (Model_forward_into(hidden_state, model, token_ids, token_count) != OK)
+    {
+        Matrix_free(hidden_state);
+        return NULL;
+    }
+    return hidden_state;
+}
+
+CallmStatusCode
+Model_forward_into(Matrix *hidden_state, Model *model, int *token_ids, int token_count)
+{
+    PageFaults faults_start = page_faults();
+
+    // The whole pass lives in the arena of the calling thread, each sequence run on its own thread gets its own: no
+    // allocator contention, and once the arena has grown to the largest pass it never touches the heap again
+    Arena *scratch = Arena_thread_local();
+    if (scratch == NULL)
+    {
+        LOG_ERROR("Failed to get the scratch arena");
+        return ERROR;
+    }
+    ArenaMark scratch_start = Arena_mark(scratch);
+
+    // Passes may run concurrently: only the one claiming the first pass prefetches and publishes its page faults
+    int none = FORWARD_NONE;
+    int first = __atomic_compare_exchange_n(&model->forwarded, &none, FORWARD_CLAIMED, 0, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE);
+    int prefetch = first && residency_policy()->mode == RESIDENCY_PREFETCH;
+
     Matrix *cos = NULL;
     Matrix *sin = NULL;
-    Matrix *hidden_state = Model_embed_inputs(model, token_ids, token_count, &cos, &sin);
-    if (hidden_state == NULL)
+    if (EmbeddingsLookup_forward_into(hidden_state, model->embedding, token_ids, token_count) != OK
+        || Model_rotary_tables(model, scratch, token_count, &cos, &sin) != OK)
     {
         LOG_ERROR("Error when embedding input tokens");
-        return NULL;
+        goto error;
     }
 
+    // The intermediates are planned into a single workspace (a few comparisons over 10 buffers) shared by the decoders
+    DecoderPlan plan;
+    DecoderBuffers buffers;
+    void *workspace = NULL;
+    if (DecoderPlan_init(&plan, &model->decoder_shape, plan_capacity(token_count)) != OK
+        || (workspace = Arena_alloc(scratch, plan.workspace_size)) == NULL
+        || DecoderPlan_buffers(&plan, workspace, token_count, &buffers) != OK)
+    {
+        LOG_ERROR("Failed to plan the decoders intermediates");
+        goto error;
+    }
+
+    // With a single token (decoding), every projection of the decoders goes through the matrix-vector kernels
     for (size_t i = 0; i < model->decoders_count; i++)
     {
-        hidden_state = Decoder_forward(model->decoder_layers[i], hidden_state);
-        RETURN_WHEN_NULL(hidden_state, "Error when running decoder");
+        if (prefetch)
+        {
+            // The next decoder is read from disk while this one computes
+            if (i == 0)
+            {
+                Decoder_prefetch(model->decoder_layers[0]);
+            }
+            if (i + 1 < model->decoders_count)
+            {
+                Decoder_prefetch(model->decoder_layers[i + 1]);
+            }
+        }
+        if (Decoder_forward(model->decoder_layers[i], hidden_state, cos, sin, &buffers) == NULL)
+        {
+            LOG_ERROR("Error when running decoder");
+            goto error;
+        }
     }
 
-    return hidden_state;
+    if (first)
+    {
+        PageFaults faults_end = page_faults();
+        model->first_forward_faults.minor = faults_end.minor - faults_start.minor;
+        model->first_forward_faults.major = faults_end.major - faults_start.major;
+        __atomic_store_n(&model->forwarded, FORWARD_PUBLISHED, __ATOMIC_RELEASE);
+        LOGF_INFO("First forward pass: %ld minor, %ld major page faults", model->first_forward_faults.minor,
+                  model->first_forward_faults.major);
+        ArenaStats stats;
+        Arena_stats(scratch, &stats);
+        LOGF_INFO("Forward pass scratch memory: %zu bytes high-water mark (decoders workspace %zu bytes), "
+                  "%zu bytes held",
+                  stats.high_water, plan.workspace_size, stats.capacity);
+    }
+
+    Arena_release(scratch, scratch_start);
+    return OK;
+
+error:
+    if (first)
+    {
+        // The next pass measures the first faults instead
+        __atomic_store_n(&model->forwarded, FORWARD_NONE, __ATOMIC_RELEASE);
+    }
+    Arena_release(scratch, scratch_start);
+    return ERROR;
 }
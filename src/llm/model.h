@@ -3,17 +3,57 @@
 
 #include "../core/config.h"
 #include "../core/matrix.h"
+#include "../core/residency.h"
 #include "../core/safetensors.h"
 #include "../shared/errors.h"
 
 typedef struct model_t Model;
 
+/*
+ * Wall clock time spent in each phase of Model_new, and the page faults it took
+ */
+typedef struct
+{
+    double embeddings_ms;
+    double rotary_ms;
+    double decoders_ms;
+    double total_ms;
+    PageFaults faults;
+} ModelLoadTimings;
+
+/*
+ * Loads the model weights from st. The decoder layers are built on the thread pool: their tensors are widened,
+ * quantised or mapped concurrently, with the same result whatever the number of threads. Returns NULL on error.
+ */
 Model *Model_new(Safetensors *st, const Config *config);
 
+const ModelLoadTimings *Model_load_timings(const Model *model);
+
+/*
+ * Page faults taken by the first Model_forward (zero before it runs): the weights that were not resident yet when it
+ * started, to tune the residency policy (see residency.h) against the first token latency
+ */
+const PageFaults *Model_first_forward_faults(const Model *model);
+
 CallmStatusCode Model_free(Model *model);
 
+/*
+ * Runs the decoders on the embedded tokens. With the prefetch residency policy, the first pass reads the weights of
+ * each decoder ahead while the previous one runs.
+ * The intermediates of the decoders are planned into a single workspace (see decoder_plan.h) for token_count rounded
+ * up to a power of two, allocated with the rotary tables from the arena of the calling thread (see Arena_thread_local)
+ * and released on return: its high-water mark is the scratch memory a sequence needs.
+ */
 Matrix *Model_forward(Model *model, int *token_ids, int token_count);
 
+/*
+ * Same as Model_forward, into hidden_state (token_count x Model_hidden_size): a caller reusing it across passes, e.g.
+ * one token at a time while decoding, runs them without any heap allocation once the arenas have grown
+ */
+CallmStatusCode Model_forward_into(Matrix *hidden_state, Model *model, int *token_ids, int token_count);
+
+int Model_hidden_size(const Model *model);
+
 Matrix *Model_embed_inputs(Model *model, int *token_ids, int token_count, Matrix **cos, Matrix **sin);
 
 #endif  // !#ifndef MODEL_H
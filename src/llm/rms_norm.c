@@ -1,14 +1,20 @@
 #include "rms_norm.h"
+#include <math.h>
 #include <stdlib.h>
 
 #include "../core/safetensors.h"
-#include "maths.h"
+#include "../core/threadpool.h"
+#include "../shared/logging.h"
 #include "matrix.h"
+#include "vecops.h"
+
+/* Minimum number of elements per parallel range of rows */
+#define RMS_NORM_PARALLEL_GRAIN (16 * 1024)
 
 struct rms_norm_t
 {
     float epsilon;
-    Matrix *weights;
+    Matrix *weights;  // read-only: may point into the mapping of the safetensors file
 };
 
 RMSNorm *
@@ -18,12 +24,11 @@ RMSNorm_new(float epsilon, const Safetensors *st, const char *layer_name)
 
     rms_norm->epsilon = epsilon;
 
-    Matrix *tmp = Safetensors_load_matrix(layer_name, st);
-    rms_norm->weights = Matrix_transpose(tmp);
+    // 1D weights are loaded as a column vector: turn it into a row vector without any copy
+    rms_norm->weights = Safetensors_load_matrix(layer_name, st);
     RETURN_WHEN_NULL(rms_norm->weights, "rms norm weights");
-    ENSURE_SHAPE(rms_norm->weights, 1, 2048);
-
-    Matrix_free(tmp);
+    Matrix_reshape(rms_norm->weights, 1, rms_norm->weights->r);
+    ENSURE_SHAPE(rms_norm->weights, 1, rms_norm->weights->c);
 
     return rms_norm;
 }
@@ -43,40 +48,90 @@ RMSNorm_free(RMSNorm *rms_norm)
     return OK;
 }
 
-float
-mean_square(float *vals, int size)
+typedef struct
 {
-    float mean = 0;
-    for (int i = 0; i < size; i++)
+    const RMSNorm *rms_norm;
+    Matrix *dst;
+    const Matrix *input;  // NULL for the residual variant
+    Matrix *residual;
+    const Matrix *delta;
+} RMSNormArgs;
+
+/*
+ * Normalises the rows [start, end): sum of squares (fused with the residual add when there is one), exact rsqrt, then
+ * a single sweep scaling by 1 / rms and the weights. A row stays in L1 between the two passes.
+ */
+static void
+rms_norm_rows(void *arg, int start, int end)
+{
+    RMSNormArgs *args = (RMSNormArgs *) arg;
+    int n = args->dst->c;
+    const float *weights = args->rms_norm->weights->data;
+    for (int i = start; i < end; i++)
     {
-        mean += (vals[i] * vals[i]);
+        const float *x;
+        float square_sum;
+        if (args->input == NULL)
+        {
+            float *residual = Matrix_row(args->residual, i);
+            square_sum = vec_add_square_sum(residual, residual, Matrix_row(args->delta, i), n);
+            x = residual;
+        }
+        else
+        {
+            x = Matrix_row(args->input, i);
+            square_sum = vec_square_sum(x, n);
+        }
+        float inv_rms = 1.0f / sqrtf(square_sum / n + args->rms_norm->epsilon);
+        vec_mul_scale(Matrix_row(args->dst, i), x, weights, inv_rms, n);
     }
-    mean /= size;
-
-    return mean;
 }
 
-Matrix *
-RMSNorm_forward(RMSNorm *rms_norm, Matrix *input)
+static CallmStatusCode
+rms_norm_run(RMSNormArgs *args, const Matrix *input)
 {
-    Matrix *variances = Matrix_reduce_along(input, MAT_APPLY_ROW, mean_square);
-    ENSURE_SHAPE(variances, input->r, 1);
-
-    Matrix *variances_eps = Matrix_add_scalar(variances, rms_norm->epsilon);
-    ENSURE_SHAPE(variances_eps, input->r, 1);
+    if (input->c != args->rms_norm->weights->c || args->dst->r != input->r || args->dst->c != input->c)
+    {
+        LOGF_ERROR("RMSNorm: invalid shapes: input (%d, %d), destination (%d, %d), %d weights", input->r, input->c,
+                   args->dst->r, args->dst->c, args->rms_norm->weights->c);
+        return ERROR;
+    }
+    int grain = RMS_NORM_PARALLEL_GRAIN / (input->c > 0 ? input->c : 1);
+    parallel_for(input->r, grain > 0 ? grain : 1, rms_norm_rows, args);
+    return OK;
+}
 
-    Matrix_apply_each(variances_eps, Q_rsqrt);
-    ENSURE_SHAPE(variances_eps, input->r, 1);
+CallmStatusCode
+RMSNorm_forward_into(RMSNorm *rms_norm, Matrix *dst, const Matrix *input)
+{
+    RMSNormArgs args = { .rms_norm = rms_norm, .dst = dst, .input = input };
+    return rms_norm_run(&args, input);
+}
 
-    Matrix *hidden_state = Matrix_multiply_broadcast(variances_eps, input, MAT_APPLY_ROW);
-    ENSURE_SHAPE(hidden_state, input->r, 2048);
+CallmStatusCode
+RMSNorm_residual_forward_into(RMSNorm *rms_norm, Matrix *dst, Matrix *residual, const Matrix *delta)
+{
+    if (delta->r != residual->r || delta->c != residual->c)
+    {
+        LOG_ERROR("RMSNorm_residual_forward_into: residual and delta must have the same shape");
+        return ERROR;
+    }
+    RMSNormArgs args = { .rms_norm = rms_norm, .dst = dst, .residual = residual, .delta = delta };
+    return rms_norm_run(&args, residual);
+}
 
-    Matrix *result = Matrix_multiply_broadcast(rms_norm->weights, hidden_state, MAT_APPLY_COL);
-    ENSURE_SHAPE(result, input->r, 2048);
+Matrix *
+RMSNorm_forward(RMSNorm *rms_norm, Matrix *input)
+{
+    Matrix *result = Matrix_new(input->r, input->c);
+    RETURN_WHEN_NULL(result, "Failed to allocate rms norm output");
 
-    Matrix_free(variances);
-    Matrix_free(variances_eps);
-    Matrix_free(hidden_state);
+    if (RMSNorm_forward_into(rms_norm, result, input) != OK)
+    {
+        Matrix_free(result);
+        return NULL;
+    }
+    ENSURE_SHAPE(result, input->r, input->c);
 
     return result;
 }
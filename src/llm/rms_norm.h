@@ -13,4 +13,19 @@ CallmStatusCode RMSNorm_free(RMSNorm *rms_norm);
 
 Matrix *RMSNorm_forward(RMSNorm *rms_norm, Matrix *input);
 
+/*
+ * Same as RMSNorm_forward but writes into dst (same shape as input, may be input itself) without any allocation.
+ * Each row is normalised in a single fused sweep (sum of squares, exact rsqrt, weight scaling), rows in parallel.
+ */
+CallmStatusCode RMSNorm_forward_into(RMSNorm *rms_norm, Matrix *dst, const Matrix *input);
+
+/*
+ * Residual connection followed by the norm, fused in one sweep per row:
+ *   residual += delta
+ *   dst = RMSNorm(residual)
+ * e.g. the post-attention norm of a decoder, residual being the hidden state and delta the attention output.
+ * dst may be delta, not residual.
+ */
+CallmStatusCode RMSNorm_residual_forward_into(RMSNorm *rms_norm, Matrix *dst, Matrix *residual, const Matrix *delta);
+
 #endif  // !#ifndef RMS_NORM_H
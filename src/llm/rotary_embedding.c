@@ -1,5 +1,7 @@
 #include "rotary_embedding.h"
+#include "../shared/logging.h"
 #include "matrix.h"
+#include "vecops.h"
 #include <math.h>
 #include <stdlib.h>
 
@@ -91,45 +93,115 @@ RotaryEmbedding_free(RotaryEmbedding *re)
     {
         return OK;
     }
+    Matrix_free(re->inv_freg);
     free(re);
     return OK;
 }
 
-static float
-cos_f_and_scale(float x, void *arg)
+CallmStatusCode
+RotaryEmbedding_forward(RotaryEmbedding *re, Matrix *position_ids, Matrix **out_cos, Matrix **out_sin)
 {
-    return cos(x) * (*(float *) arg);
-}
+    int nb_tokens = position_ids->c;
+    int dim = 2 * re->inv_freg->r;
 
-static float
-sin_f_and_scale(float x, void *arg)
-{
-    return sin(x) * (*(float *) arg);
+    *out_cos = Matrix_new(nb_tokens, dim);
+    *out_sin = Matrix_new(nb_tokens, dim);
+    if (*out_cos == NULL || *out_sin == NULL
+        || RotaryEmbedding_forward_into(re, position_ids, *out_cos, *out_sin) != OK)
+    {
+        LOG_ERROR("Failed to compute rotary embeddings");
+        Matrix_free(*out_cos);
+        Matrix_free(*out_sin);
+        *out_cos = NULL;
+        *out_sin = NULL;
+        return ERROR;
+    }
+    return OK;
 }
 
 CallmStatusCode
-RotaryEmbedding_forward(RotaryEmbedding *re, Matrix *position_ids, Matrix **out_cos, Matrix **out_sin)
+RotaryEmbedding_forward_into(RotaryEmbedding *re, const Matrix *position_ids, Matrix *cos, Matrix *sin)
 {
-    Matrix *inv_freq_expanded = re->inv_freg;
-    ENSURE_SHAPE(inv_freq_expanded, 32, 1);
-
-    Matrix *position_ids_expanded = position_ids;
-    ENSURE_SHAPE(position_ids_expanded, 1, position_ids->c);
-
-    Matrix *freqs = Matrix_dot(inv_freq_expanded, position_ids_expanded);
-    ENSURE_SHAPE(freqs, 32, position_ids->c);
+    // freqs = position_ids^T . inv_freq^T (N x head_dim / 2), duplicated along the columns: emb = [freqs, freqs]
+    Matrix *inv_freq = re->inv_freg;
+    int nb_tokens = position_ids->c;
+    int half_dim = inv_freq->r;
+    if (position_ids->r != 1 || cos->r != nb_tokens || cos->c != 2 * half_dim || sin->r != nb_tokens
+        || sin->c != 2 * half_dim)
+    {
+        LOGF_ERROR("RotaryEmbedding_forward_into: (%d, %d) positions don't match cos/sin tables of shape (%d, %d)",
+                   position_ids->r, position_ids->c, cos->r, cos->c);
+        return ERROR;
+    }
 
-    // Matrix_free(inv_freq_expanded);
-    // Matrix_free(position_ids_expanded);
+    for (int i = 0; i < nb_tokens; i++)
+    {
+        float *cos_row = Matrix_row(cos, i);
+        float *sin_row = Matrix_row(sin, i);
+        for (int j = 0; j < half_dim; j++)
+        {
+            float freq = position_ids->data[i] * Matrix_row(inv_freq, j)[0];
+            cos_row[j] = cos_row[j + half_dim] = cosf(freq) * re->attn_scaling;
+            sin_row[j] = sin_row[j + half_dim] = sinf(freq) * re->attn_scaling;
+        }
+    }
 
-    Matrix *embs = Matrix_concat(freqs, freqs, MAT_APPLY_COL);
-    Matrix_free(freqs);
+    return OK;
+}
 
-    *out_cos = Matrix_new(embs->r, embs->c);
-    Matrix_apply_each_arg(*out_cos, cos_f_and_scale, &re->attn_scaling);
+CallmStatusCode
+RotaryEmbedding_apply(MatrixView *x, const Matrix *cos, const Matrix *sin)
+{
+    int nb_tokens = MatrixView_rows(x);
+    int dim = MatrixView_cols(x);
+    int half_dim = dim / 2;
+    if (cos->r < nb_tokens || cos->c != dim || sin->r < nb_tokens || sin->c != dim)
+    {
+        LOGF_ERROR("RotaryEmbedding_apply: cos/sin of shape (%d, %d) don't match a (%d, %d) input", cos->r, cos->c,
+                   nb_tokens, dim);
+        return ERROR;
+    }
 
-    *out_sin = Matrix_new(embs->r, embs->c);
-    Matrix_apply_each_arg(*out_sin, sin_f_and_scale, &re->attn_scaling);
+    // x * cos + rotate_half(x) * sin, with rotate_half(x) = [-x2, x1]. The two halves of cos/sin are equal, so each
+    // pair (x1[j], x2[j]) is rotated by the angle of column j. Non contiguous rows go through a temporary buffer.
+    float tmp[dim];
+    for (int i = 0; i < nb_tokens; i++)
+    {
+        float *row = MatrixView_row(x, i);
+        float *out = row != NULL ? row : tmp;
+        if (row == NULL)
+        {
+            for (int j = 0; j < dim; j++)
+            {
+                tmp[j] = MatrixView_get(x, i, j);
+            }
+        }
+        vec_rotate(out, out + half_dim, Matrix_row(cos, i), Matrix_row(sin, i), half_dim);
+        if (row == NULL)
+        {
+            for (int j = 0; j < dim; j++)
+            {
+                MatrixView_set(x, i, j, tmp[j]);
+            }
+        }
+    }
+    return OK;
+}
 
+CallmStatusCode
+RotaryEmbedding_apply_head(Matrix *x, int head, const Matrix *cos, const Matrix *sin)
+{
+    int dim = cos->c;
+    if (cos->r < x->r || sin->r < x->r || sin->c != dim || (head + 1) * dim > x->c)
+    {
+        LOGF_ERROR("RotaryEmbedding_apply_head: cos/sin of shape (%d, %d) don't match head %d of a (%d, %d) input",
+                   cos->r, cos->c, head, x->r, x->c);
+        return ERROR;
+    }
+    for (int i = 0; i < x->r; i++)
+    {
+        float *row = Matrix_row(x, i) + head * dim;
+        vec_rotate(row, row + dim / 2, Matrix_row(cos, i), Matrix_row(sin, i), dim / 2);
+    }
     return OK;
 }
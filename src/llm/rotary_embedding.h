@@ -3,6 +3,7 @@
 
 #include "../core/config.h"
 #include "../core/matrix.h"
+#include "../core/matrix_view.h"
 #include "../shared/errors.h"
 
 typedef struct rotary_embedding_t RotaryEmbedding;
@@ -11,6 +12,25 @@ RotaryEmbedding *RotaryEmbedding_new(const Config *config);
 
 CallmStatusCode RotaryEmbedding_free(RotaryEmbedding *re);
 
+/*
+ * Given a 1 x N matrix of token positions, computes the N x head_dim cos and sin tables of the rotary embedding
+ */
 CallmStatusCode RotaryEmbedding_forward(RotaryEmbedding *re, Matrix *position_ids, Matrix **out_cos, Matrix **out_sin);
 
+/*
+ * Same as RotaryEmbedding_forward into N x head_dim tables allocated by the caller
+ */
+CallmStatusCode RotaryEmbedding_forward_into(RotaryEmbedding *re, const Matrix *position_ids, Matrix *cos, Matrix *sin);
+
+/*
+ * Rotates in place the N x head_dim rows of x (e.g. the view of one attention head in the query projection) with the
+ * cos/sin tables returned by RotaryEmbedding_forward
+ */
+CallmStatusCode RotaryEmbedding_apply(MatrixView *x, const Matrix *cos, const Matrix *sin);
+
+/*
+ * Same as RotaryEmbedding_apply on the columns of one head of a N x (nb_heads * head_dim) projection, without a view
+ */
+CallmStatusCode RotaryEmbedding_apply_head(Matrix *x, int head, const Matrix *cos, const Matrix *sin);
+
 #endif  // !#ifndef ROTARY_EMBEDDING_H
@@ -4,6 +4,7 @@
 #include "../tokenizer/tokenizer.h"
 #include "matrix.h"
 #include "model.h"
+#include "pack.h"
 #include <fcntl.h>
 #include <pcre.h>
 #include <stdint.h>
@@ -34,20 +35,77 @@
 //                               "communauté, à faire le don, le don de soi…";
 
 static char *monologue_otis = "aujourd’hui qui m’ont";
-static const char *st_file_path = "model2.safetensors";
+static const char *default_st_file_path = "model2.safetensors";
 static const char *tok_file_path = "resources/tokenizer.model";
-static const char *config_file = "config.json";
+static const char *default_config_file = "config.json";
 
+/*
+ * callm pack <weights> <config> <tokenizer> <output>
+ * Writes a packed model: weights quantised as the config asks, config and tokenizer embedded
+ */
+static int
+pack_main(int argc, char **argv)
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "Usage: callm pack <weights> <config> <tokenizer> <output>\n");
+        return 1;
+    }
+    Safetensors *st = Safetensors_new(argv[0]);
+    Config *config = Config_new(argv[1]);
+    if (st == NULL || config == NULL)
+    {
+        LOG_ERROR("Error loading the model to pack");
+        return 1;
+    }
+    CallmStatusCode status = Pack_write(argv[3], st, config, argv[1], argv[2]);
+    Config_free(config);
+    Safetensors_free(st);
+    return status == OK ? 0 : 1;
+}
+
+/*
+ * Usage: callm [weights] [config]
+ * weights is a safetensors file, the index of a sharded checkpoint (model.safetensors.index.json) or a packed model
+ * (then the config and tokenizer embedded in it are used)
+ */
 int
-main()
+main(int argc, char **argv)
 {
-    Tokenizer *tokenizer = Tokenizer_new(tok_file_path);
+    if (argc > 1 && strcmp(argv[1], "pack") == 0)
+    {
+        return pack_main(argc - 2, argv + 2);
+    }
+    const char *st_file_path = argc > 1 ? argv[1] : default_st_file_path;
+    const char *config_file = argc > 2 ? argv[2] : default_config_file;
 
     Safetensors *st = Safetensors_new(st_file_path);
+    if (st == NULL)
+    {
+        LOGF_ERROR("Error loading the weights from %s", st_file_path);
+        return 1;
+    }
     // Safetensors_print(st);
 
-    Config *config = Config_new(config_file);
+    size_t embedded_size;
+    const char *embedded = Safetensors_tensor_data(st, PACK_TOKENIZER_TENSOR, &embedded_size);
+    Tokenizer *tokenizer = embedded != NULL ? Tokenizer_new_from_buffer(embedded, embedded_size)
+                                            : Tokenizer_new(tok_file_path);
+
+    embedded = Safetensors_tensor_data(st, PACK_CONFIG_TENSOR, &embedded_size);
+    Config *config = embedded != NULL && argc <= 2 ? Config_new_from_buffer(embedded, embedded_size)
+                                                   : Config_new(config_file);
+    if (config == NULL)
+    {
+        LOG_ERROR("Error loading the config");
+        return 1;
+    }
     Model *model = Model_new(st, config);
+    if (model == NULL)
+    {
+        LOG_ERROR("Error loading the model");
+        return 1;
+    }
 
     LOG_INFO("Encoding Otis monologue...");
     int *token_ids;
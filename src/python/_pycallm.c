@@ -237,17 +237,18 @@ finally1:
 static void
 LLamaModelObject_free(LLamaModelObject *self)
 {
-    if (self->safetensors)
+    // The model's weights point into the mapping of the safetensors file: it must be unmapped last
+    if (self->model)
     {
-        Safetensors_free(self->safetensors);
+        Model_free(self->model);
     }
     if (self->config)
     {
         Config_free(self->config);
     }
-    if (self->model)
+    if (self->safetensors)
     {
-        Model_free(self->model);
+        Safetensors_free(self->safetensors);
     }
     Py_TYPE(self)->tp_free((PyObject *) self);
 }
@@ -344,7 +345,7 @@ LLamaModelObject_embed(LLamaModelObject *self, PyObject *args)
 
         for (int j = 0; j < vector_size; j++)
         {
-            PyObject *value = PyLong_FromLong(embeds_in->data[i * vector_size + j]);
+            PyObject *value = PyLong_FromLong(Matrix_row(embeds_in, i)[j]);
             HANDLE_RUNTIME_ERR(value, "Failed to convert embedding value to Python integer", finally3);
             PyList_SetItem(vector, j, value);
         }
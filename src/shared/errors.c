@@ -1,5 +1,7 @@
 #include "errors.h"
 #include "logging.h"
+#include <stdlib.h>
+#include <string.h>
 
 char *
 CallmStatusCode_string(CallmStatusCode code)
@@ -23,3 +25,36 @@ CallmStatusCode_string(CallmStatusCode code)
 
     return NULL;
 }
+
+Error **
+Error_new_empty_ref()
+{
+    Error **err = malloc(sizeof(Error *));
+    CHECK_MALLOC_PANIC(err, "error reference");
+    *err = NULL;
+    return err;
+}
+
+void
+Error_free(Error *err)
+{
+    if (err == NULL)
+    {
+        return;
+    }
+    free(err->message);
+    free(err);
+}
+
+void
+Error_with_message(Error **err, const char *message)
+{
+    Error *e = malloc(sizeof(Error));
+    CHECK_MALLOC_PANIC(e, "error");
+    size_t len = strlen(message);
+    e->message = malloc(len + 1);
+    CHECK_MALLOC_PANIC(e->message, "error message");
+    memcpy(e->message, message, len + 1);
+    Error_free(*err);
+    *err = e;
+}
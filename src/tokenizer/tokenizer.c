@@ -91,16 +91,12 @@ load_json_file_content(char *file_path)
     return content;
 }
 
+/*
+ * Parses the lines "<base64 token> <rank>" of a tokenizer model, content is split in place
+ */
 static CallmStatusCode
-make_encoder_from_model_file(char *file_path, Token **encoder)
+make_encoder_from_model_content(char *content, Token **encoder)
 {
-    char *content;
-    if (load_file_content(file_path, &content) != OK)
-    {
-        LOG_ERROR("Failed to load model file content");
-        return ERROR;
-    }
-
     char *line = content;
     char *next_line;
 
@@ -138,11 +134,24 @@ make_encoder_from_model_file(char *file_path, Token **encoder)
         }
     }
 
-    free(content);
-
     return OK;
 }
 
+static CallmStatusCode
+make_encoder_from_model_file(char *file_path, Token **encoder)
+{
+    char *content;
+    if (load_file_content(file_path, &content) != OK)
+    {
+        LOG_ERROR("Failed to load model file content");
+        return ERROR;
+    }
+
+    CallmStatusCode status = make_encoder_from_model_content(content, encoder);
+    free(content);
+    return status;
+}
+
 static CallmStatusCode
 make_encoder_from_json(char *file_path, Token **encoder)
 {
@@ -227,6 +236,8 @@ get_regex()
     return (struct get_regexp_res){ re, OK };
 }
 
+static Tokenizer *Tokenizer_init(Tokenizer *tokenizer);
+
 Tokenizer *
 Tokenizer_new(const char *file_path)
 {
@@ -244,7 +255,41 @@ Tokenizer_new(const char *file_path)
         LOGF_ERROR("Fail to build encoder from file %s", file_path);
         exit(1);
     }
+    return Tokenizer_init(tokenizer);
+}
+
+Tokenizer *
+Tokenizer_new_from_buffer(const char *buffer, size_t size)
+{
+    LOG_INFO("Creating encoder from buffer");
+
+    Tokenizer *tokenizer = (Tokenizer *) malloc(sizeof(struct Tokenizer));
+    CHECK_MALLOC_PANIC(tokenizer, "init tokenizer")
+
+    tokenizer->decoder = NULL;
+    tokenizer->encoder = NULL;
+
+    // Parsed in place, on a copy
+    char *content = (char *) malloc(size + 1);
+    CHECK_MALLOC_PANIC(content, "tokenizer content buffer");
+    memcpy(content, buffer, size);
+    content[size] = '\0';
+    CallmStatusCode status = make_encoder_from_model_content(content, &tokenizer->encoder);
+    free(content);
+    if (status != OK)
+    {
+        LOG_ERROR("Fail to build encoder from buffer");
+        exit(1);
+    }
+    return Tokenizer_init(tokenizer);
+}
 
+/*
+ * Builds the decoder and the regex of a tokenizer whose encoder is loaded
+ */
+static Tokenizer *
+Tokenizer_init(Tokenizer *tokenizer)
+{
     LOG_INFO("Encoder created. Creating decoder");
     Token *t;
     for (t = tokenizer->encoder; t != NULL; t = t->hh.next)
@@ -4,11 +4,17 @@
 
 #include "../shared/errors.h"
 #include <pcre2.h>
+#include <stddef.h>
 
 typedef struct Tokenizer Tokenizer;
 
 Tokenizer *Tokenizer_new(const char *filepath);
 
+/*
+ * Same as Tokenizer_new with the content of a tokenizer model file (e.g. embedded in a packed model)
+ */
+Tokenizer *Tokenizer_new_from_buffer(const char *buffer, size_t size);
+
 CallmStatusCode Tokenizer_encode(Tokenizer *tokenizer, const char *input_str, int **token_ids, int *token_count);
 
 char *Tokenizer_decode_single(Tokenizer *tokenizer, int out_token_id);
@@ -0,0 +1,151 @@
+#include "unity.h"
+
+#include "../../src/core/matrix.h"
+#include "../../src/core/memory/arena.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+}
+
+void
+test_allocations_should_be_aligned_and_disjoint()
+{
+    // Given
+    Arena *a = Arena_new(1024);
+
+    // When
+    char *first = Arena_alloc(a, 10);
+    char *second = Arena_alloc(a, 100);
+    memset(first, 1, 10);
+    memset(second, 2, 100);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) first % ARENA_ALIGNMENT);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) second % ARENA_ALIGNMENT);
+    TEST_ASSERT_TRUE(second >= first + 10);
+    TEST_ASSERT_EQUAL(1, first[9]);
+    Arena_free(a);
+}
+
+void
+test_release_should_reuse_memory_after_the_mark()
+{
+    // Given
+    Arena *a = Arena_new(1024);
+    Arena_alloc(a, 64);
+    ArenaMark mark = Arena_mark(a);
+    void *before = Arena_alloc(a, 128);
+
+    // When
+    Arena_release(a, mark);
+    void *after = Arena_alloc(a, 128);
+
+    // Then
+    TEST_ASSERT_EQUAL_PTR(before, after);
+    ArenaStats stats;
+    Arena_stats(a, &stats);
+    TEST_ASSERT_EQUAL(192, stats.used);
+    TEST_ASSERT_EQUAL(192, stats.high_water);
+    Arena_free(a);
+}
+
+void
+test_reset_should_merge_blocks_to_the_high_water_mark()
+{
+    // Given: a pass larger than a block
+    Arena *a = Arena_new(256);
+    for (int i = 0; i < 10; i++)
+    {
+        TEST_ASSERT_NOT_NULL(Arena_alloc(a, 200));
+    }
+    ArenaStats stats;
+    Arena_stats(a, &stats);
+    TEST_ASSERT_TRUE(stats.nb_blocks > 1);
+
+    // When
+    Arena_reset(a);
+    Arena_stats(a, &stats);
+    size_t block_allocs = stats.nb_block_allocs;
+    for (int i = 0; i < 10; i++)
+    {
+        TEST_ASSERT_NOT_NULL(Arena_alloc(a, 200));
+    }
+
+    // Then: the same pass again fits in the merged block
+    Arena_stats(a, &stats);
+    TEST_ASSERT_EQUAL(1, stats.nb_blocks);
+    TEST_ASSERT_EQUAL(block_allocs, stats.nb_block_allocs);
+    TEST_ASSERT_EQUAL(10 * 256, stats.high_water);
+    Arena_free(a);
+}
+
+void
+test_matrix_in_arena_should_be_released_with_it()
+{
+    // Given
+    Arena *a = Arena_new(4096);
+
+    // When
+    Matrix *M = Matrix_new_in(a, 3, 5);
+    Matrix_row(M, 2)[4] = 7.0f;
+
+    // Then
+    TEST_ASSERT_NOT_NULL(M);
+    TEST_ASSERT_EQUAL(5, M->stride);
+    TEST_ASSERT_EQUAL(1, M->in_arena);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) M->data % MATRIX_ALIGNMENT);
+    TEST_ASSERT_EQUAL(OK, Matrix_free(M));  // no-op
+    TEST_ASSERT_EQUAL_FLOAT(7.0f, Matrix_row(M, 2)[4]);
+    Arena_free(a);
+}
+
+static void *
+thread_arena(void *arg)
+{
+    (void) arg;
+    Arena *a = Arena_thread_local();
+    Arena_alloc(a, 16);
+    return a;
+}
+
+void
+test_thread_local_arenas_should_be_distinct()
+{
+    // Given
+    Arena *mine = Arena_thread_local();
+    pthread_t thread;
+    void *theirs = NULL;
+
+    // When
+    pthread_create(&thread, NULL, thread_arena, NULL);
+    pthread_join(thread, &theirs);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(mine);
+    TEST_ASSERT_NOT_NULL(theirs);
+    TEST_ASSERT_TRUE(mine != theirs);
+    TEST_ASSERT_EQUAL_PTR(mine, Arena_thread_local());
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_allocations_should_be_aligned_and_disjoint);
+    RUN_TEST(test_release_should_reuse_memory_after_the_mark);
+    RUN_TEST(test_reset_should_merge_blocks_to_the_high_water_mark);
+    RUN_TEST(test_matrix_in_arena_should_be_released_with_it);
+    RUN_TEST(test_thread_local_arenas_should_be_distinct);
+    return UNITY_END();
+}
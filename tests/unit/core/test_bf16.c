@@ -0,0 +1,113 @@
+#include "unity.h"
+
+#include "../../src/core/bf16.h"
+#include "test_isa.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_BF16 65536
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+    cpu_limit_isa(CPU_ISA_AVX512);
+}
+
+static uint32_t
+float_bits(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+static float
+bits_float(uint32_t bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+void
+test_bf16_to_float_should_keep_special_values()
+{
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, bf16_to_float(0x3F80));
+    TEST_ASSERT_EQUAL_FLOAT(-2.0f, bf16_to_float(0xC000));
+    TEST_ASSERT_EQUAL_HEX32(0x80000000, float_bits(bf16_to_float(0x8000)));  // -0
+    TEST_ASSERT_EQUAL_HEX32(0x00010000, float_bits(bf16_to_float(0x0001)));  // smallest denormal, not flushed
+    TEST_ASSERT_TRUE(isinf(bf16_to_float(0x7F80)) && bf16_to_float(0x7F80) > 0);
+    TEST_ASSERT_TRUE(isinf(bf16_to_float(0xFF80)) && bf16_to_float(0xFF80) < 0);
+    TEST_ASSERT_TRUE(isnan(bf16_to_float(0x7FC1)));
+    // Exponent 0x1F is an ordinary bf16 exponent (it was mistaken for the fp16 special one)
+    TEST_ASSERT_EQUAL_FLOAT(ldexpf(1.0f, 0x1F - 127), bf16_to_float(0x1F << 7));
+}
+
+void
+test_float_to_bf16_should_round_to_nearest_even()
+{
+    // 1 + 2^-8 is exactly halfway between two bf16: ties go to the even mantissa (1.0)
+    TEST_ASSERT_EQUAL_HEX16(0x3F80, float_to_bf16(bits_float(0x3F808000)));
+    // 1 + 3 * 2^-8 is halfway too, the even neighbour is above
+    TEST_ASSERT_EQUAL_HEX16(0x3F82, float_to_bf16(bits_float(0x3F818000)));
+    // Just above half way rounds up
+    TEST_ASSERT_EQUAL_HEX16(0x3F81, float_to_bf16(bits_float(0x3F808001)));
+    // The largest float overflows to infinity
+    TEST_ASSERT_EQUAL_HEX16(0x7F80, float_to_bf16(bits_float(0x7F7FFFFF)));
+    // A NaN whose payload sits in the dropped bits stays a NaN
+    TEST_ASSERT_EQUAL_HEX16(0x7FC0, float_to_bf16(bits_float(0x7F800001)));
+    TEST_ASSERT_EQUAL_HEX16(0x8000, float_to_bf16(-0.0f));
+}
+
+void
+test_bulk_conversions_should_be_bit_exact_with_every_isa()
+{
+    // Given: every bf16 value, and floats covering every exponent with various low bits (ties included)
+    bf16_t *all_bf16 = malloc(NB_BF16 * sizeof(bf16_t));
+    float *floats = malloc(NB_BF16 * sizeof(float));
+    float *converted = malloc(NB_BF16 * sizeof(float));
+    bf16_t *rounded = malloc(NB_BF16 * sizeof(bf16_t));
+    uint32_t seed = 42;
+    for (int i = 0; i < NB_BF16; i++)
+    {
+        all_bf16[i] = (bf16_t) i;
+        seed = seed * 1103515245u + 12345u;
+        uint32_t low = (i % 4 == 0) ? 0x8000 : (seed >> 8) & 0xFFFF;
+        floats[i] = bits_float(((uint32_t) i << 16) | low);
+    }
+
+    FOR_EACH_ISA(isa)
+    {
+        // When: an odd length, so that the tail path runs too
+        bf16_to_f32_n(converted, all_bf16, NB_BF16 - 3);
+        f32_to_bf16_n(rounded, floats, NB_BF16 - 3);
+
+        // Then
+        for (int i = 0; i < NB_BF16 - 3; i++)
+        {
+            TEST_ASSERT_EQUAL_HEX32((uint32_t) i << 16, float_bits(converted[i]));
+            TEST_ASSERT_EQUAL_HEX16(float_to_bf16(floats[i]), rounded[i]);
+        }
+    }
+
+    free(all_bf16);
+    free(floats);
+    free(converted);
+    free(rounded);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_bf16_to_float_should_keep_special_values);
+    RUN_TEST(test_float_to_bf16_should_round_to_nearest_even);
+    RUN_TEST(test_bulk_conversions_should_be_bit_exact_with_every_isa);
+    return UNITY_END();
+}
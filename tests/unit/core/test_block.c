@@ -0,0 +1,222 @@
+#include "unity.h"
+
+#include "../../src/core/memory/block.h"
+#include "../../src/core/tensor.h"
+#include "../../src/core/threadpool.h"
+#include <stdlib.h>
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+}
+
+static MemBlock *
+new_sequence_block(size_t ndim, size_t *shape)
+{
+    Error *err = NULL;
+    MemBlock *b = MemBlock_new(ndim, shape, &err);
+    TEST_ASSERT_NULL(err);
+    for (size_t i = 0; i < MemBlock_size(b); i++)
+    {
+        MemBlock_data(b)[i] = (float) i;
+    }
+    return b;
+}
+
+void
+test_block_should_keep_its_whole_shape()
+{
+    // Given / When: sizes above 255 don't fit in the first byte of each dimension
+    size_t shape[] = { 2, 300, 3 };
+    MemBlock *b = new_sequence_block(3, shape);
+
+    // Then
+    TEST_ASSERT_EQUAL(300, MemBlock_shape(b)[1]);
+    TEST_ASSERT_EQUAL(3, MemBlock_shape(b)[2]);
+    TEST_ASSERT_EQUAL(1800, MemBlock_size(b));
+    MemBlock_free(b);
+}
+
+void
+test_contiguous_block_should_be_a_single_span()
+{
+    // Given
+    size_t shape[] = { 2, 3, 4 };
+    MemBlock *b = new_sequence_block(3, shape);
+    Error *err = NULL;
+
+    // When
+    MemBlockIterator *i = MemBlock_iterate(b, NULL, &err);
+    MemBlockSpan span;
+
+    // Then
+    TEST_ASSERT_NULL(err);
+    TEST_ASSERT_EQUAL(1, i->nb_spans);
+    TEST_ASSERT_EQUAL(0, MemBlockIterator_next_span(i, &span));
+    TEST_ASSERT_EQUAL_PTR(MemBlock_data(b), span.data);
+    TEST_ASSERT_EQUAL(24, span.length);
+    TEST_ASSERT_EQUAL(-1, MemBlockIterator_next_span(i, &span));
+    MemBlock_free(b);  // frees the iterator
+}
+
+void
+test_masked_dimensions_should_be_addressed_from_each_span()
+{
+    // Given: iterate over the 2 x 3 matrices of a [2, 3, 2, 5] block
+    size_t shape[] = { 2, 3, 2, 5 };
+    size_t mask[] = { 1, 1, 0, 0 };
+    MemBlock *b = new_sequence_block(4, shape);
+    Error *err = NULL;
+    MemBlockIterator *i = MemBlock_iterate(b, mask, &err);
+    TEST_ASSERT_NULL(err);
+
+    // When / Then
+    size_t coords[] = { 1, 4 };
+    size_t nb = 0;
+    do
+    {
+        TEST_ASSERT_EQUAL_FLOAT((float) (nb * 10 + 9), MemBlockIterator_get_val(i, coords, &err));
+        TEST_ASSERT_NULL(err);
+        nb++;
+    } while (MemBlockIterator_next(i) == 0);
+    TEST_ASSERT_EQUAL(6, nb);
+    TEST_ASSERT_EQUAL(6, i->nb_spans);
+    TEST_ASSERT_EQUAL(1, i->span_length);
+
+    MemBlock_iterator_free(b, i);
+    MemBlock_free(b);
+}
+
+void
+test_out_of_bounds_coordinates_should_fail()
+{
+    // Given
+    size_t shape[] = { 2, 3, 4 };
+    size_t mask[] = { 1, 0, 0 };
+    size_t bad_mask[] = { 1, 2, 0 };
+    MemBlock *b = new_sequence_block(3, shape);
+    Error *err = NULL;
+    MemBlockIterator *i = MemBlock_iterate(b, mask, &err);
+
+    // When
+    size_t coords[] = { 3, 0 };
+    MemBlockIterator_get_val(i, coords, &err);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(err);
+    Error_free(err);
+    err = NULL;
+    TEST_ASSERT_NULL(MemBlock_iterate(b, bad_mask, &err));
+    TEST_ASSERT_NOT_NULL(err);
+    Error_free(err);
+    MemBlock_free(b);
+}
+
+void
+test_strided_view_should_be_walked_in_row_major_order()
+{
+    // Given: the transpose of a 3 x 4 matrix, and the first 3 columns of each row of a 2 x 4 x 4 block
+    float data[32];
+    for (int k = 0; k < 32; k++)
+    {
+        data[k] = (float) k;
+    }
+    size_t t_shape[] = { 4, 3 };
+    size_t t_strides[] = { 1, 4 };
+    size_t p_shape[] = { 2, 4, 3 };
+    size_t p_strides[] = { 16, 4, 1 };
+    MemBlockIterator transposed, padded;
+    Error *err = NULL;
+
+    // When
+    MemBlockIterator_init(&transposed, data, 2, t_shape, t_strides, NULL, &err);
+    MemBlockIterator_init(&padded, data, 3, p_shape, p_strides, NULL, &err);
+
+    // Then
+    TEST_ASSERT_NULL(err);
+    TEST_ASSERT_EQUAL(12, transposed.nb_spans);
+    MemBlockSpan span;
+    for (int r = 0; r < 4; r++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            TEST_ASSERT_EQUAL(0, MemBlockIterator_next_span(&transposed, &span));
+            TEST_ASSERT_EQUAL(1, span.length);
+            TEST_ASSERT_EQUAL_FLOAT((float) (c * 4 + r), span.data[0]);
+        }
+    }
+    TEST_ASSERT_EQUAL(8, padded.nb_spans);
+    TEST_ASSERT_EQUAL(3, padded.span_length);
+    for (int row = 0; MemBlockIterator_next_span(&padded, &span) == 0; row++)
+    {
+        TEST_ASSERT_EQUAL_PTR(data + row * 4, span.data);
+    }
+}
+
+typedef struct
+{
+    MemBlockIterator iterator;
+    int visits[64];
+} RangesArgs;
+
+static void
+visit_range(void *arg, int start, int end)
+{
+    RangesArgs *args = (RangesArgs *) arg;
+    MemBlockIterator i = args->iterator;
+    MemBlockIterator_range(&i, start, end);
+    MemBlockSpan span;
+    while (MemBlockIterator_next_span(&i, &span) == 0)
+    {
+        for (size_t k = 0; k < span.length; k++)
+        {
+            __atomic_add_fetch(&args->visits[(int) span.data[k]], 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void
+test_ranges_should_cover_every_span_once()
+{
+    // Given: the [4, 2, 3] transpose of a contiguous [3, 2, 4] tensor, spans of 1 element
+    size_t shape[] = { 3, 2, 4 };
+    Tensor *t = Tensor_new(3, shape);
+    float *data = Tensor_data(t);
+    for (int k = 0; k < 24; k++)
+    {
+        data[k] = (float) k;
+    }
+    Tensor *view = Tensor_transpose(t, 0, 2);
+    RangesArgs args = { 0 };
+    TEST_ASSERT_EQUAL(OK, Tensor_iterate(view, NULL, &args.iterator));
+
+    // When
+    parallel_for((int) args.iterator.nb_spans, 5, visit_range, &args);
+
+    // Then
+    TEST_ASSERT_EQUAL(24, args.iterator.nb_spans);
+    for (int k = 0; k < 24; k++)
+    {
+        TEST_ASSERT_EQUAL(1, args.visits[k]);
+    }
+    Tensor_free(view);
+    Tensor_free(t);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_block_should_keep_its_whole_shape);
+    RUN_TEST(test_contiguous_block_should_be_a_single_span);
+    RUN_TEST(test_masked_dimensions_should_be_addressed_from_each_span);
+    RUN_TEST(test_out_of_bounds_coordinates_should_fail);
+    RUN_TEST(test_strided_view_should_be_walked_in_row_major_order);
+    RUN_TEST(test_ranges_should_cover_every_span_once);
+    return UNITY_END();
+}
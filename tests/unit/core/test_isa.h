@@ -0,0 +1,19 @@
+#ifndef CALLM_TEST_ISA_H
+#define CALLM_TEST_ISA_H
+
+#include "../../src/core/cpu.h"
+
+/*
+ * Runs the body once per instruction set level the CPU supports, scalar first, with the kernels capped to it.
+ * The best level is read before the first cap (which would hide the wider ones) and restored after the last run.
+ *
+ *   FOR_EACH_ISA(isa)
+ *   {
+ *       ...
+ *   }
+ */
+#define FOR_EACH_ISA(isa)                                                                                              \
+    for (CpuIsa isa = CPU_ISA_SCALAR, isa##_best = cpu_best_isa();                                                     \
+         isa <= isa##_best ? (cpu_limit_isa(isa), 1) : (cpu_limit_isa(isa##_best), 0); isa++)
+
+#endif  // CALLM_TEST_ISA_H
@@ -0,0 +1,131 @@
+#include "unity.h"
+
+#include "../../src/core/maths.h"
+#include "test_isa.h"
+#include <math.h>
+
+#define ROW_LEN 37
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+    cpu_limit_isa(CPU_ISA_AVX512);
+}
+
+static void
+reference_softmax(const float *x, double *out, int n, float scale)
+{
+    double max = -INFINITY;
+    for (int i = 0; i < n; i++)
+    {
+        max = x[i] > max ? x[i] : max;
+    }
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = exp(scale * (x[i] - max));
+        sum += out[i];
+    }
+    for (int i = 0; i < n; i++)
+    {
+        out[i] /= sum;
+    }
+}
+
+void
+test_softmax_should_match_reference_with_every_isa()
+{
+    // Given: an all negative row (the max must not start at 0) and a row that overflows a naive exp
+    float rows[2][ROW_LEN];
+    for (int i = 0; i < ROW_LEN; i++)
+    {
+        rows[0][i] = -50.0f - (float) ((i * 7) % 11);
+        rows[1][i] = 1000.0f + (float) ((i * 5) % 13) / 4.0f;
+    }
+
+    FOR_EACH_ISA(isa)
+    {
+        for (int r = 0; r < 2; r++)
+        {
+            float x[ROW_LEN];
+            double expected[ROW_LEN];
+            for (int i = 0; i < ROW_LEN; i++)
+            {
+                x[i] = rows[r][i];
+            }
+            reference_softmax(x, expected, ROW_LEN, 1.0f);
+
+            // When
+            softmax(x, ROW_LEN);
+
+            // Then
+            float sum = 0;
+            for (int i = 0; i < ROW_LEN; i++)
+            {
+                TEST_ASSERT_FLOAT_WITHIN(1e-6f, (float) expected[i], x[i]);
+                sum += x[i];
+            }
+            TEST_ASSERT_FLOAT_WITHIN(1e-5f, 1.0f, sum);
+        }
+    }
+}
+
+void
+test_softmax_masked_should_ignore_masked_entries()
+{
+    FOR_EACH_ISA(isa)
+    {
+        // Given: the masked entries hold garbage that must never be read
+        float x[ROW_LEN];
+        double expected[ROW_LEN];
+        int nb_valid = 21;
+        for (int i = 0; i < ROW_LEN; i++)
+        {
+            x[i] = i < nb_valid ? (float) ((i * 3) % 7) - 2.0f : NAN;
+        }
+        reference_softmax(x, expected, nb_valid, 0.125f);
+
+        // When
+        softmax_masked(x, ROW_LEN, nb_valid, 0.125f);
+
+        // Then
+        for (int i = 0; i < ROW_LEN; i++)
+        {
+            TEST_ASSERT_FLOAT_WITHIN(1e-6f, i < nb_valid ? (float) expected[i] : 0.0f, x[i]);
+        }
+    }
+}
+
+void
+test_softmax_of_fully_masked_row_should_be_zero()
+{
+    // Given
+    float x[] = { -INFINITY, -INFINITY, -INFINITY };
+    float y[] = { 1.0f, 2.0f, 3.0f };
+
+    // When
+    softmax(x, 3);
+    softmax_masked(y, 3, 0, 1.0f);
+
+    // Then
+    for (int i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_EQUAL_FLOAT(0.0f, x[i]);
+        TEST_ASSERT_EQUAL_FLOAT(0.0f, y[i]);
+    }
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_softmax_should_match_reference_with_every_isa);
+    RUN_TEST(test_softmax_masked_should_ignore_masked_entries);
+    RUN_TEST(test_softmax_of_fully_masked_row_should_be_zero);
+    return UNITY_END();
+}
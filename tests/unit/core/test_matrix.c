@@ -2,6 +2,7 @@
 #include <math.h>
 
 #include "../../src/core/matrix.h"
+#include "test_isa.h"
 
 float
 mock_times_tow_func(float x)
@@ -191,6 +192,32 @@ test_matrix_should_reduce_along_rows()
     Matrix_free(expected);
 }
 
+void
+test_matrix_should_apply_and_reduce_along_the_columns_of_a_tall_matrix()
+{
+    // Given: columns of 16 MB, more than a default stack
+    int r = 4 * 1024 * 1024;
+    Matrix *m = Matrix_new(r, 2);
+    for (int i = 0; i < r; i++)
+    {
+        Matrix_row(m, i)[0] = (float) (i % 2);
+        Matrix_row(m, i)[1] = (float) (i % 2) * 2;
+    }
+
+    // When
+    Matrix *sums = Matrix_reduce_along(m, MAT_APPLY_COL, mock_sum_func);
+    Matrix_apply_along(m, MAT_APPLY_COL, mock_add_max_func);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(sums);
+    TEST_ASSERT_EQUAL_FLOAT((float) (r / 2), sums->data[0]);
+    TEST_ASSERT_EQUAL_FLOAT((float) r, sums->data[1]);
+    TEST_ASSERT_EQUAL_FLOAT(1, Matrix_row(m, 0)[0]);
+    TEST_ASSERT_EQUAL_FLOAT(4, Matrix_row(m, r - 1)[1]);
+    Matrix_free(m);
+    Matrix_free(sums);
+}
+
 void
 test_should_slice_by_columns()
 {
@@ -429,6 +456,366 @@ test_matrix_to_json(void)
     TEST_ASSERT_EQUAL_STRING(expected, json_str);
 }
 
+static void
+fill_pseudo_random(Matrix *M, unsigned int seed)
+{
+    for (int i = 0; i < M->r; i++)
+    {
+        for (int j = 0; j < M->c; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            Matrix_row(M, i)[j] = (float) ((seed >> 16) % 2001) / 1000.0f - 1.0f;
+        }
+    }
+}
+
+static void
+assert_dot_matches_naive(const Matrix *A, const Matrix *B, const Matrix *C)
+{
+    for (int i = 0; i < A->r; i++)
+    {
+        for (int j = 0; j < B->c; j++)
+        {
+            double expected = 0;
+            for (int k = 0; k < A->c; k++)
+            {
+                expected += (double) Matrix_row(A, i)[k] * Matrix_row(B, k)[j];
+            }
+            TEST_ASSERT_FLOAT_WITHIN(1e-3, (float) expected, Matrix_row(C, i)[j]);
+        }
+    }
+}
+
+void
+test_matrix_dot()
+{
+    // Given
+    Matrix *A = Matrix_new(2, 3);
+    float data_a[] = { 1, 2, 3,  //
+                       4, 5, 6 };
+    Matrix_fill(A, data_a);
+
+    Matrix *B = Matrix_new(3, 2);
+    float data_b[] = { 7,  8,   //
+                       9,  10,  //
+                       11, 12 };
+    Matrix_fill(B, data_b);
+
+    Matrix *expected = Matrix_new(2, 2);
+    float expected_data[] = { 58,  64,  //
+                              139, 154 };
+    Matrix_fill(expected, expected_data);
+
+    // When
+    Matrix *result = Matrix_dot(A, B);
+
+    // Then
+    TEST_ASSERT_EQUAL(1, Matrix_equals(result, expected));
+    Matrix_free(A);
+    Matrix_free(B);
+    Matrix_free(result);
+    Matrix_free(expected);
+}
+
+void
+test_matrix_dot_transposed()
+{
+    // Given
+    Matrix *A = Matrix_new(2, 3);
+    float data_a[] = { 1, 2, 3,  //
+                       4, 5, 6 };
+    Matrix_fill(A, data_a);
+
+    Matrix *W = Matrix_new(2, 3);  // [out, in] layout
+    float data_w[] = { 7, 9,  11,  //
+                       8, 10, 12 };
+    Matrix_fill(W, data_w);
+
+    Matrix *expected = Matrix_new(2, 2);
+    float expected_data[] = { 58,  64,  //
+                              139, 154 };
+    Matrix_fill(expected, expected_data);
+
+    // When
+    Matrix *result = Matrix_dot_transposed(A, W);
+
+    // Then
+    TEST_ASSERT_EQUAL(1, Matrix_equals(result, expected));
+    Matrix_free(A);
+    Matrix_free(W);
+    Matrix_free(result);
+    Matrix_free(expected);
+}
+
+void
+test_matrix_dot_should_match_naive_product_with_every_kernel()
+{
+    // Given: shapes that are not multiples of any micro-tile and cross the K and M cache blocks
+    // (the single row shapes go through the matrix-vector kernels, the last one being split across threads)
+    int shapes[][3] = { { 1, 1, 1 }, { 7, 13, 5 }, { 37, 53, 29 }, { 200, 300, 70 }, { 1, 67, 45 }, { 1, 1030, 1100 } };
+
+    for (int s = 0; s < 6; s++)
+    {
+        Matrix *A = Matrix_new(shapes[s][0], shapes[s][1]);
+        Matrix *B = Matrix_new(shapes[s][1], shapes[s][2]);
+        fill_pseudo_random(A, 42 + s);
+        fill_pseudo_random(B, 1337 + s);
+        Matrix *B_T = Matrix_transpose(B);
+
+        FOR_EACH_ISA(isa)
+        {
+            // When
+            Matrix *C = Matrix_dot(A, B);
+            Matrix *C_nt = Matrix_dot_transposed(A, B_T);
+
+            // Then
+            assert_dot_matches_naive(A, B, C);
+            assert_dot_matches_naive(A, B, C_nt);
+            Matrix_free(C);
+            Matrix_free(C_nt);
+        }
+
+        Matrix_free(A);
+        Matrix_free(B);
+        Matrix_free(B_T);
+    }
+}
+
+void
+test_matrix_multiply_into_should_work_in_place()
+{
+    // Given
+    Matrix *A = Matrix_new(2, 3);
+    float data[] = { 1, 2, 3,  //
+                     4, 5, 6 };
+    Matrix_fill(A, data);
+
+    Matrix *B = Matrix_new(2, 3);
+    float data2[] = { 2, 4, 2,  //
+                      4, 2, 4 };
+    Matrix_fill(B, data2);
+
+    Matrix *expected = Matrix_new(2, 3);
+    float expected_data[] = { 12, 20, 16,  //
+                              28, 20, 36 };
+    Matrix_fill(expected, expected_data);
+
+    // When
+    TEST_ASSERT_EQUAL(OK, Matrix_multiply_into(A, A, B));
+    TEST_ASSERT_EQUAL(OK, Matrix_add_into(A, A, B));
+    TEST_ASSERT_EQUAL(OK, Matrix_add_scalar_into(A, A, 8));
+
+    // Then
+    TEST_ASSERT_EQUAL(1, Matrix_equals(A, expected));
+    Matrix_free(A);
+    Matrix_free(B);
+    Matrix_free(expected);
+}
+
+void
+test_matrix_into_should_reject_invalid_destination()
+{
+    // Given
+    Matrix *A = Matrix_new(2, 3);
+    float data[] = { 1, 2, 3,  //
+                     4, 5, 6 };
+    Matrix_fill(A, data);
+    Matrix *dst = Matrix_new(3, 3);
+    Matrix *square = Matrix_new(3, 3);
+    Matrix_fill(square, (float[]){ 0, 1, 2, 3, 4, 5, 6, 7, 8 });
+
+    // When / Then
+    TEST_ASSERT_EQUAL(ERROR, Matrix_multiply_scalar_into(dst, A, 2));
+    TEST_ASSERT_EQUAL(ERROR, Matrix_dot_transposed_into(dst, A, A));
+    TEST_ASSERT_EQUAL(ERROR, Matrix_transpose_into(square, square));
+    TEST_ASSERT_EQUAL(ERROR, Matrix_dot_into(square, square, square));
+    TEST_ASSERT_EQUAL(OK, Matrix_dot_into(dst, square, square));
+    TEST_ASSERT_EQUAL_FLOAT(15, Matrix_get(dst, 0, 0, NULL));
+
+    Matrix_free(A);
+    Matrix_free(dst);
+    Matrix_free(square);
+}
+
+void
+test_padded_matrix_should_have_aligned_rows()
+{
+    // Given
+    Matrix *A = Matrix_new_padded(37, 45);
+    Matrix *B = Matrix_new_padded(45, 67);
+    fill_pseudo_random(A, 11);
+    fill_pseudo_random(B, 12);
+
+    // Then
+    TEST_ASSERT_EQUAL_INT(48, A->stride);
+    for (int i = 0; i < A->r; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, (int) ((size_t) Matrix_row(A, i) % MATRIX_ALIGNMENT));
+        TEST_ASSERT_EQUAL_FLOAT(0, Matrix_row(A, i)[45]);
+    }
+
+    // When
+    Matrix *C = Matrix_new_padded(37, 67);
+    TEST_ASSERT_EQUAL(OK, Matrix_dot_into(C, A, B));
+    Matrix *D = Matrix_add_scalar(A, 1);
+
+    // Then
+    assert_dot_matches_naive(A, B, C);
+    TEST_ASSERT_EQUAL_INT(45, D->stride);
+    TEST_ASSERT_EQUAL_FLOAT(Matrix_get(A, 36, 44, NULL) + 1, Matrix_get(D, 36, 44, NULL));
+
+    Matrix_free(A);
+    Matrix_free(B);
+    Matrix_free(C);
+    Matrix_free(D);
+}
+
+void
+test_submatrix_should_share_storage()
+{
+    // Given
+    Matrix *M = Matrix_new(3, 4);
+    float data[] = { 1, 2,  3,  4,  //
+                     5, 6,  7,  8,  //
+                     9, 10, 11, 12 };
+    Matrix_fill(M, data);
+
+    Matrix *expected = Matrix_new(3, 4);
+    float expected_data[] = { 1, 2,  3,  4,  //
+                              5, 60, 70, 8,  //
+                              9, 100, 110, 12 };
+    Matrix_fill(expected, expected_data);
+
+    // When
+    Matrix *sub = Matrix_submatrix(M, 1, 1, 2, 2);
+    Matrix_multiply_scalar_into(sub, sub, 10);
+
+    // Then
+    TEST_ASSERT_EQUAL_INT(4, sub->stride);
+    TEST_ASSERT_EQUAL_FLOAT(60, Matrix_get(sub, 0, 0, NULL));
+    TEST_ASSERT_EQUAL(1, Matrix_equals(M, expected));
+    TEST_ASSERT_NULL(Matrix_submatrix(M, 2, 0, 2, 1));
+
+    Matrix_free(sub);
+    Matrix_free(M);
+    Matrix_free(expected);
+}
+
+void
+test_concat_into_should_reject_overlapping_destinations()
+{
+    // Given: the destination starts one row below the first operand, on the same buffer
+    Matrix *M = Matrix_new(4, 4);
+    Matrix *A = Matrix_submatrix(M, 0, 0, 2, 2);
+    Matrix *B = Matrix_new(2, 2);
+    Matrix *overlapping = Matrix_submatrix(M, 1, 0, 2, 4);
+    Matrix *dst = Matrix_new(2, 4);
+
+    // When / Then
+    TEST_ASSERT_EQUAL(ERROR, Matrix_concat_into(overlapping, A, B, MAT_APPLY_COL));
+    TEST_ASSERT_EQUAL(ERROR, Matrix_concat_into(NULL, A, B, MAT_APPLY_COL));
+    TEST_ASSERT_EQUAL(OK, Matrix_concat_into(dst, A, B, MAT_APPLY_COL));
+
+    Matrix_free(overlapping);
+    Matrix_free(A);
+    Matrix_free(B);
+    Matrix_free(dst);
+    Matrix_free(M);
+}
+
+void
+test_into_functions_should_reject_destinations_overlapping_at_an_offset()
+{
+    // Given: views of the same buffer, the destination sharing a single element with A
+    Matrix *M = Matrix_new(4, 4);
+    Matrix *A = Matrix_submatrix(M, 0, 0, 2, 2);
+    Matrix *overlapping = Matrix_submatrix(M, 1, 1, 2, 2);
+    Matrix *disjoint = Matrix_submatrix(M, 2, 0, 2, 2);
+    Matrix *B = Matrix_new(2, 2);
+    int idx[] = { 1, 0 };
+
+    // When / Then
+    TEST_ASSERT_TRUE(Matrix_overlaps(overlapping, A));
+    TEST_ASSERT_FALSE(Matrix_overlaps(disjoint, A));
+    TEST_ASSERT_EQUAL(ERROR, Matrix_dot_into(overlapping, A, B));
+    TEST_ASSERT_EQUAL(ERROR, Matrix_dot_into(overlapping, B, A));
+    TEST_ASSERT_EQUAL(ERROR, Matrix_dot_transposed_into(overlapping, A, B));
+    TEST_ASSERT_EQUAL(ERROR, Matrix_transpose_into(overlapping, A));
+    TEST_ASSERT_EQUAL(ERROR, Matrix_select_rows_into(overlapping, A, idx, 2));
+    TEST_ASSERT_EQUAL(ERROR, Matrix_select_columns_into(overlapping, A, idx, 2));
+    TEST_ASSERT_EQUAL(OK, Matrix_dot_into(disjoint, A, B));
+    TEST_ASSERT_EQUAL(OK, Matrix_transpose_into(disjoint, A));
+    TEST_ASSERT_EQUAL(OK, Matrix_select_rows_into(disjoint, A, idx, 2));
+
+    Matrix_free(overlapping);
+    Matrix_free(disjoint);
+    Matrix_free(A);
+    Matrix_free(B);
+    Matrix_free(M);
+}
+
+void
+test_wrap_should_use_the_buffer_without_owning_it()
+{
+    // Given
+    float data[] = { 1, 2, 3,  //
+                     4, 5, 6 };
+
+    // When
+    Matrix *M = Matrix_wrap(2, 3, data);
+    Matrix *T = Matrix_transpose(M);
+
+    // Then
+    TEST_ASSERT_EQUAL_PTR(data, M->data);
+    TEST_ASSERT_EQUAL_INT(0, M->owns_data);
+    TEST_ASSERT_EQUAL_INT(3, M->stride);
+    TEST_ASSERT_EQUAL_FLOAT(4, Matrix_get(T, 0, 1, NULL));
+
+    // Freeing the matrix leaves the (stack) buffer alone
+    Matrix_free(M);
+    Matrix_free(T);
+    TEST_ASSERT_EQUAL_FLOAT(6, data[5]);
+}
+
+void
+test_matrix_silu_multiply_should_match_elementwise_formula()
+{
+    // Given: a padded (strided) gate, so that rows are processed one segment at a time
+    Matrix *gate = Matrix_new_padded(3, 21);
+    Matrix *up = Matrix_new(3, 21);
+    fill_pseudo_random(gate, 7);
+    fill_pseudo_random(up, 11);
+    Matrix *expected_silu = Matrix_new(3, 21);
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 21; j++)
+        {
+            float x = Matrix_row(gate, i)[j];
+            Matrix_row(expected_silu, i)[j] = x / (1.0f + expf(-x));
+        }
+    }
+    Matrix *fused = Matrix_new(3, 21);
+
+    // When
+    TEST_ASSERT_EQUAL(OK, Matrix_silu_multiply_into(fused, gate, up));
+    TEST_ASSERT_EQUAL(OK, Matrix_silu_into(gate, gate));
+
+    // Then
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 21; j++)
+        {
+            float expected = Matrix_row(expected_silu, i)[j];
+            TEST_ASSERT_FLOAT_WITHIN(1e-6f, expected, Matrix_row(gate, i)[j]);
+            TEST_ASSERT_FLOAT_WITHIN(1e-6f, expected * Matrix_row(up, i)[j], Matrix_row(fused, i)[j]);
+        }
+    }
+    Matrix_free(gate);
+    Matrix_free(up);
+    Matrix_free(expected_silu);
+    Matrix_free(fused);
+}
+
 int
 main()
 {
@@ -442,11 +829,23 @@ main()
     RUN_TEST(test_matrix_apply_along_row);
     RUN_TEST(test_matrix_apply_along_col);
     RUN_TEST(test_matrix_should_reduce_along_rows);
+    RUN_TEST(test_matrix_should_apply_and_reduce_along_the_columns_of_a_tall_matrix);
     RUN_TEST(test_matrix_multiply_each_element);
     RUN_TEST(test_matrix_multiply_scalar);
     RUN_TEST(test_matrix_add_scalar);
     RUN_TEST(test_matrix_multiply_broadcast_row);
     RUN_TEST(test_matrix_multiply_broadcast_col);
     RUN_TEST(test_matrix_to_json);
+    RUN_TEST(test_matrix_dot);
+    RUN_TEST(test_matrix_dot_transposed);
+    RUN_TEST(test_matrix_dot_should_match_naive_product_with_every_kernel);
+    RUN_TEST(test_matrix_multiply_into_should_work_in_place);
+    RUN_TEST(test_matrix_into_should_reject_invalid_destination);
+    RUN_TEST(test_padded_matrix_should_have_aligned_rows);
+    RUN_TEST(test_submatrix_should_share_storage);
+    RUN_TEST(test_concat_into_should_reject_overlapping_destinations);
+    RUN_TEST(test_into_functions_should_reject_destinations_overlapping_at_an_offset);
+    RUN_TEST(test_wrap_should_use_the_buffer_without_owning_it);
+    RUN_TEST(test_matrix_silu_multiply_should_match_elementwise_formula);
     return UNITY_END();
 }
@@ -1,5 +1,6 @@
 #include "unity.h"
 
+#include "../../src/core/maths.h"
 #include "../../src/core/matrix_view.h"
 #include <string.h>
 
@@ -13,9 +14,148 @@ tearDown(void)
 {
 }
 
+static Matrix *
+new_3x4(void)
+{
+    Matrix *M = Matrix_new(3, 4);
+    float data[] = { 1, 2,  3,  4,  //
+                     5, 6,  7,  8,  //
+                     9, 10, 11, 12 };
+    Matrix_fill(M, data);
+    return M;
+}
+
+void
+test_view_should_select_row_and_column_ranges_without_copy()
+{
+    // Given
+    Matrix *M = new_3x4();
+    MatrixView *V = MatrixView_new(M);
+
+    // When
+    TEST_ASSERT_EQUAL(OK, MatrixView_select_rows_by_nb(V, 1, 2));
+    TEST_ASSERT_EQUAL(OK, MatrixView_select_columns_by_nb(V, 2, 2));
+    MatrixView_set(V, 0, 0, 70);
+
+    // Then
+    TEST_ASSERT_EQUAL_INT(2, MatrixView_rows(V));
+    TEST_ASSERT_EQUAL_INT(2, MatrixView_cols(V));
+    TEST_ASSERT_EQUAL_FLOAT(8, MatrixView_get(V, 0, 1));
+    TEST_ASSERT_EQUAL_FLOAT(12, MatrixView_get(V, 1, 1));
+    TEST_ASSERT_EQUAL_FLOAT(70, Matrix_get(M, 1, 2, NULL));
+    TEST_ASSERT_EQUAL_PTR(Matrix_row(M, 2) + 2, MatrixView_row(V, 1));
+    TEST_ASSERT_EQUAL(ERROR, MatrixView_select_rows_by_nb(V, 1, 2));
+
+    MatrixView_free(V);
+    Matrix_free(M);
+}
+
+void
+test_view_should_compose_index_selections_and_transpose()
+{
+    // Given
+    Matrix *M = new_3x4();
+    MatrixView *V = MatrixView_new(M);
+
+    // When
+    TEST_ASSERT_EQUAL(OK, MatrixView_select_columns_by_indexes(V, (int[]){ 3, 0, 2 }, 3));
+    TEST_ASSERT_EQUAL(OK, MatrixView_select_columns_by_indexes(V, (int[]){ 2, 0 }, 2));
+    TEST_ASSERT_EQUAL(OK, MatrixView_select_rows_by_indexes(V, (int[]){ 2, 2, 0 }, 3));
+    TEST_ASSERT_EQUAL(OK, MatrixView_transpose(V));
+    Matrix *copy = MatrixView_to_matrix(V);
+
+    // Then
+    Matrix *expected = Matrix_new(2, 3);
+    float expected_data[] = { 11, 11, 3,  //
+                              12, 12, 4 };
+    Matrix_fill(expected, expected_data);
+    TEST_ASSERT_EQUAL(1, Matrix_equals(copy, expected));
+    TEST_ASSERT_NULL(MatrixView_row(V, 0));
+    TEST_ASSERT_EQUAL(ERROR, MatrixView_select_rows_by_indexes(V, (int[]){ 2 }, 1));
+
+    Matrix_free(copy);
+    Matrix_free(expected);
+    MatrixView_free(V);
+    Matrix_free(M);
+}
+
+void
+test_view_dot_should_use_strided_and_transposed_views()
+{
+    // Given: two "heads" of 2 columns in a 3 x 4 projection
+    Matrix *M = new_3x4();
+    MatrixView *q = MatrixView_new(M);
+    MatrixView *k = MatrixView_new(M);
+    MatrixView_select_columns_by_nb(q, 0, 2);
+    MatrixView_select_columns_by_nb(k, 2, 2);
+    MatrixView_transpose(k);
+    Matrix *scores = Matrix_new(3, 3);
+
+    // When
+    TEST_ASSERT_EQUAL(OK, MatrixView_dot_into(scores, q, k));
+
+    // Then
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            float expected = Matrix_get(M, i, 0, NULL) * Matrix_get(M, j, 2, NULL)
+                             + Matrix_get(M, i, 1, NULL) * Matrix_get(M, j, 3, NULL);
+            TEST_ASSERT_EQUAL_FLOAT(expected, Matrix_get(scores, i, j, NULL));
+        }
+    }
+
+    // When: gathered operands give the same result
+    MatrixView *q_idx = MatrixView_new(M);
+    MatrixView_select_columns_by_indexes(q_idx, (int[]){ 0, 1 }, 2);
+    Matrix *scores2 = Matrix_new(3, 3);
+    TEST_ASSERT_EQUAL(OK, MatrixView_dot_into(scores2, q_idx, k));
+    TEST_ASSERT_EQUAL(1, Matrix_equals(scores, scores2));
+
+    MatrixView_free(q);
+    MatrixView_free(k);
+    MatrixView_free(q_idx);
+    Matrix_free(scores);
+    Matrix_free(scores2);
+    Matrix_free(M);
+}
+
+void
+test_view_should_apply_softmax_along_rows()
+{
+    // Given
+    Matrix *M = new_3x4();
+    MatrixView *V = MatrixView_new(M);
+    MatrixView_select_columns_by_nb(V, 1, 2);
+    MatrixView_transpose(V);
+
+    // When
+    MatrixView_apply_along_rows(V, softmax);
+
+    // Then: columns 1 and 2 of M are softmaxed, the others are untouched
+    for (int j = 1; j <= 2; j++)
+    {
+        float sum = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            sum += Matrix_get(M, i, j, NULL);
+        }
+        TEST_ASSERT_FLOAT_WITHIN(1e-6, 1.0f, sum);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(1, Matrix_get(M, 0, 0, NULL));
+    TEST_ASSERT_EQUAL_FLOAT(12, Matrix_get(M, 2, 3, NULL));
+
+    MatrixView_free(V);
+    Matrix_free(M);
+}
+
 int
 main(void)
 {
     UNITY_BEGIN();
+    RUN_TEST(test_view_should_select_row_and_column_ranges_without_copy);
+    RUN_TEST(test_view_should_compose_index_selections_and_transpose);
+    RUN_TEST(test_view_dot_should_use_strided_and_transposed_views);
+    RUN_TEST(test_view_should_apply_softmax_along_rows);
     return UNITY_END();
 }
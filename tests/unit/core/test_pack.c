@@ -0,0 +1,266 @@
+#include "unity.h"
+
+#include "../../src/core/bf16.h"
+#include "../../src/core/config.h"
+#include "../../src/core/matrix.h"
+#include "../../src/core/pack.h"
+#include "../../src/core/safetensors.h"
+#include "../../src/core/weights.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *st_path = "callm_test_pack.safetensors";
+static const char *config_path = "callm_test_pack_config.json";
+static const char *tokenizer_path = "callm_test_pack_tokenizer.model";
+static const char *pack_path = "callm_test.callm";
+
+static const char *config_text = "{\"head_dim\": 64}";
+static const char *tokenizer_text = "IQ== 0\nIg== 1\n";
+
+#define MLP_ROWS 4
+#define MLP_COLS 64
+
+static float mlp[MLP_ROWS * MLP_COLS];
+static float norm[MLP_COLS];
+
+/*
+ * A checkpoint with an MLP matrix (quantised when packed), an attention one (kept in bf16) and a norm vector
+ */
+static void
+write_checkpoint(void)
+{
+    unsigned int seed = 7;
+    for (int i = 0; i < MLP_ROWS * MLP_COLS; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        mlp[i] = (float) ((seed >> 8) & 0xFFFF) / 32768.0f - 1.0f;
+    }
+    for (int i = 0; i < MLP_COLS; i++)
+    {
+        norm[i] = 1.0f + i / 64.0f;
+    }
+    bf16_t attn[2 * 32];
+    for (int i = 0; i < 2 * 32; i++)
+    {
+        attn[i] = float_to_bf16(i / 8.0f);
+    }
+
+    char json[512];
+    int len = snprintf(json, sizeof(json),
+                       "{\"model.layers.0.mlp.up_proj.weight\": {\"dtype\": \"F32\", \"shape\": [%d, %d], "
+                       "\"data_offsets\": [0, %zu]}, "
+                       "\"model.norm.weight\": {\"dtype\": \"F32\", \"shape\": [%d], \"data_offsets\": [%zu, %zu]}, "
+                       "\"model.layers.0.self_attn.q_proj.weight\": {\"dtype\": \"BF16\", \"shape\": [2, 32], "
+                       "\"data_offsets\": [%zu, %zu]}}",
+                       MLP_ROWS, MLP_COLS, sizeof(mlp), MLP_COLS, sizeof(mlp), sizeof(mlp) + sizeof(norm),
+                       sizeof(mlp) + sizeof(norm), sizeof(mlp) + sizeof(norm) + sizeof(attn));
+    while (len % 8 != 0)
+    {
+        json[len++] = ' ';
+    }
+    uint64_t header_size = len;
+
+    FILE *f = fopen(st_path, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    fwrite(&header_size, sizeof(header_size), 1, f);
+    fwrite(json, 1, len, f);
+    fwrite(mlp, sizeof(mlp), 1, f);
+    fwrite(norm, sizeof(norm), 1, f);
+    fwrite(attn, sizeof(attn), 1, f);
+    fclose(f);
+
+    f = fopen(config_path, "w");
+    fputs(config_text, f);
+    fclose(f);
+    f = fopen(tokenizer_path, "w");
+    fputs(tokenizer_text, f);
+    fclose(f);
+}
+
+void
+setUp(void)
+{
+    write_checkpoint();
+}
+
+void
+tearDown(void)
+{
+    remove(st_path);
+    remove(config_path);
+    remove(tokenizer_path);
+    remove(pack_path);
+}
+
+static Config
+q4_mlp_config(void)
+{
+    Config config;
+    memset(&config, 0, sizeof(Config));
+    config.quantization_dtype = WEIGHTS_Q4;
+    config.quantization_group_size = 32;
+    config.quantize_mlp = 1;
+    return config;
+}
+
+void
+test_packed_model_should_map_quantised_weights(void)
+{
+    // Given
+    Config config = q4_mlp_config();
+    Safetensors *st = Safetensors_new(st_path);
+    TEST_ASSERT_EQUAL(OK, Pack_write(pack_path, st, &config, config_path, tokenizer_path));
+    Safetensors_free(st);
+
+    Matrix *M = Matrix_new(MLP_ROWS, MLP_COLS);
+    Matrix_fill(M, mlp);
+    Weights *expected = Weights_from_matrix_grouped(M, WEIGHTS_Q4, 32);
+
+    // When
+    Safetensors *packed = Safetensors_new(pack_path);
+    TEST_ASSERT_NOT_NULL(packed);
+    Weights *w = Safetensors_load_weights_as("model.layers.0.mlp.up_proj.weight", packed, WEIGHTS_Q4, 32);
+
+    // Then
+    TEST_ASSERT_EQUAL(WEIGHTS_Q4, w->dtype);
+    TEST_ASSERT_EQUAL(0, w->owns_data);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) w->data % PACK_ALIGNMENT);
+    TEST_ASSERT_EQUAL(Weights_nbytes(expected), Weights_nbytes(w));
+    TEST_ASSERT_EQUAL(0, memcmp(expected->data, w->data, Weights_nbytes(w)));
+
+    Weights_free(w);
+    Weights_free(expected);
+    Matrix_free(M);
+    Safetensors_free(packed);
+}
+
+void
+test_packed_model_should_keep_other_tensors_and_embed_files(void)
+{
+    // Given
+    Config config = q4_mlp_config();
+    Safetensors *st = Safetensors_new(st_path);
+    TEST_ASSERT_EQUAL(OK, Pack_write(pack_path, st, &config, config_path, tokenizer_path));
+    Safetensors_free(st);
+
+    // When
+    Safetensors *packed = Safetensors_new(pack_path);
+    Matrix *n = Safetensors_load_matrix("model.norm.weight", packed);
+    Weights *attn = Safetensors_load_weights("model.layers.0.self_attn.q_proj.weight", packed);
+    size_t config_size, tokenizer_size;
+    const char *config_data = Safetensors_tensor_data(packed, PACK_CONFIG_TENSOR, &config_size);
+    const char *tokenizer_data = Safetensors_tensor_data(packed, PACK_TOKENIZER_TENSOR, &tokenizer_size);
+
+    // Then
+    TEST_ASSERT_EQUAL(0, n->owns_data);
+    TEST_ASSERT_EQUAL_FLOAT_ARRAY(norm, n->data, MLP_COLS);
+    TEST_ASSERT_EQUAL(WEIGHTS_BF16, attn->dtype);
+    TEST_ASSERT_EQUAL_FLOAT(7.875f, bf16_to_float(((const bf16_t *) attn->data)[63]));
+    TEST_ASSERT_EQUAL(strlen(config_text), config_size);
+    TEST_ASSERT_EQUAL(0, memcmp(config_text, config_data, config_size));
+    TEST_ASSERT_EQUAL(strlen(tokenizer_text), tokenizer_size);
+    TEST_ASSERT_EQUAL(0, memcmp(tokenizer_text, tokenizer_data, tokenizer_size));
+
+    Matrix_free(n);
+    Weights_free(attn);
+    Safetensors_free(packed);
+}
+
+void
+test_truncated_packed_model_should_be_rejected(void)
+{
+    // Given
+    Safetensors *st = Safetensors_new(st_path);
+    TEST_ASSERT_EQUAL(OK, Pack_write(pack_path, st, NULL, NULL, NULL));
+    Safetensors_free(st);
+
+    FILE *f = fopen(pack_path, "rb");
+    char head[256];
+    size_t nb = fread(head, 1, sizeof(head), f);
+    fclose(f);
+    f = fopen(pack_path, "wb");
+    fwrite(head, 1, nb, f);
+    fclose(f);
+
+    // When
+    Safetensors *packed = Safetensors_new(pack_path);
+
+    // Then
+    TEST_ASSERT_NULL(packed);
+}
+
+/*
+ * Reads the packed model back, lets patch corrupt it in memory and rewrites it
+ */
+static void
+rewrite_packed_model(void (*patch)(char *data))
+{
+    FILE *f = fopen(pack_path, "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = malloc(size);
+    TEST_ASSERT_EQUAL(size, fread(data, 1, size, f));
+    fclose(f);
+    patch(data);
+    f = fopen(pack_path, "wb");
+    fwrite(data, 1, size, f);
+    fclose(f);
+    free(data);
+}
+
+static void
+overflow_names_size(char *data)
+{
+    ((PackHeader *) data)->names_size = UINT64_MAX;
+}
+
+static void
+break_q4_group_size(char *data)
+{
+    PackEntry *entries = (PackEntry *) (data + sizeof(PackHeader));
+    for (uint32_t e = 0; e < ((PackHeader *) data)->nb_entries; e++)
+    {
+        if (entries[e].dtype == Q4)
+        {
+            entries[e].group_size = 48;
+        }
+    }
+}
+
+void
+test_corrupted_packed_model_headers_should_be_rejected(void)
+{
+    // Given: names running past the end of the file once added to their offset, and a Q4 group size that isn't a
+    // multiple of Q4_CHUNK
+    Config config = q4_mlp_config();
+    Safetensors *st = Safetensors_new(st_path);
+    void (*patches[])(char *) = { overflow_names_size, break_q4_group_size };
+
+    for (int i = 0; i < 2; i++)
+    {
+        TEST_ASSERT_EQUAL(OK, Pack_write(pack_path, st, &config, config_path, tokenizer_path));
+        rewrite_packed_model(patches[i]);
+
+        // When
+        Safetensors *packed = Safetensors_new(pack_path);
+
+        // Then
+        TEST_ASSERT_NULL(packed);
+    }
+    Safetensors_free(st);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_packed_model_should_map_quantised_weights);
+    RUN_TEST(test_packed_model_should_keep_other_tensors_and_embed_files);
+    RUN_TEST(test_truncated_packed_model_should_be_rejected);
+    RUN_TEST(test_corrupted_packed_model_headers_should_be_rejected);
+    return UNITY_END();
+}
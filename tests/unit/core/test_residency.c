@@ -0,0 +1,146 @@
+#include "unity.h"
+
+#include "../../src/core/residency.h"
+#include "../../src/core/safetensors.h"
+#include "../../src/core/weights.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HUGE_ALIGNMENT (2 * 1024 * 1024)
+
+static const char *st_path = "callm_test_residency.safetensors";
+
+static float values[8] = { 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f };
+
+static ResidencyPolicy default_policy;
+
+static void
+write_checkpoint(void)
+{
+    char json[128];
+    int len = snprintf(json, sizeof(json),
+                       "{\"w\": {\"dtype\": \"F32\", \"shape\": [2, 4], \"data_offsets\": [0, %zu]}}", sizeof(values));
+    while (len % 8 != 0)
+    {
+        json[len++] = ' ';
+    }
+    uint64_t header_size = len;
+
+    FILE *f = fopen(st_path, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    fwrite(&header_size, sizeof(header_size), 1, f);
+    fwrite(json, 1, len, f);
+    fwrite(values, sizeof(values), 1, f);
+    fclose(f);
+}
+
+void
+setUp(void)
+{
+    default_policy = *residency_policy();
+    write_checkpoint();
+}
+
+void
+tearDown(void)
+{
+    residency_set_policy(&default_policy);
+    remove(st_path);
+}
+
+static void
+set_policy(ResidencyMode mode, int huge_pages)
+{
+    ResidencyPolicy policy = { mode, huge_pages, 0 };
+    residency_set_policy(&policy);
+}
+
+void
+test_page_faults_should_count_first_touches(void)
+{
+    // Given
+    size_t size = 4 * 1024 * 1024;
+    PageFaults before = page_faults();
+
+    // When
+    volatile char *buffer = malloc(size);
+    for (size_t i = 0; i < size; i += 4096)
+    {
+        buffer[i] = 1;
+    }
+    PageFaults after = page_faults();
+
+    // Then
+    TEST_ASSERT_TRUE(after.minor + after.major > before.minor + before.major);
+    free((char *) buffer);
+}
+
+void
+test_large_weights_should_be_huge_page_aligned(void)
+{
+    // Given
+    set_policy(RESIDENCY_PREFAULT, 1);
+
+    // When
+    Weights *large = Weights_new(1024, 1024, WEIGHTS_F32);
+    Weights *small = Weights_new(4, 64, WEIGHTS_F32);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(large);
+    TEST_ASSERT_NOT_NULL(small);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) large->data % HUGE_ALIGNMENT);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) small->data % 64);
+    Weights_free(large);
+    Weights_free(small);
+}
+
+void
+test_buffers_should_keep_small_alignment_without_huge_pages(void)
+{
+    // Given
+    set_policy(RESIDENCY_PREFAULT, 0);
+
+    // When
+    float *buffer = residency_alloc(4 * 1024 * 1024);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(buffer);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) buffer % 64);
+    free(buffer);
+}
+
+void
+test_every_mode_should_load_the_same_weights(void)
+{
+    ResidencyMode modes[] = { RESIDENCY_LAZY, RESIDENCY_PREFETCH, RESIDENCY_PREFAULT, RESIDENCY_POPULATE };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+    {
+        // Given
+        set_policy(modes[i], 1);
+
+        // When
+        Safetensors *st = Safetensors_new(st_path);
+        TEST_ASSERT_NOT_NULL(st);
+        Weights *w = Safetensors_load_weights("w", st);
+        Weights_prefetch(w);
+
+        // Then
+        TEST_ASSERT_NOT_NULL(w);
+        TEST_ASSERT_EQUAL(0, memcmp(values, w->data, sizeof(values)));
+        Weights_free(w);
+        Safetensors_free(st);
+    }
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_page_faults_should_count_first_touches);
+    RUN_TEST(test_large_weights_should_be_huge_page_aligned);
+    RUN_TEST(test_buffers_should_keep_small_alignment_without_huge_pages);
+    RUN_TEST(test_every_mode_should_load_the_same_weights);
+    return UNITY_END();
+}
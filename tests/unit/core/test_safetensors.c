@@ -0,0 +1,196 @@
+#include "unity.h"
+
+#include "../../src/core/bf16.h"
+#include "../../src/core/matrix.h"
+#include "../../src/core/safetensors.h"
+#include "../../src/core/weights.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *path = "callm_test.safetensors";
+static const char *shard_paths[] = { "callm_test-00001-of-00002.safetensors", "callm_test-00002-of-00002.safetensors" };
+static const char *index_path = "callm_test.safetensors.index.json";
+
+static const float a[] = { 1, 2, 3, 4, 5, 6 };
+static const float b[] = { 0.5f, -1.0f, 2.0f, 8.0f };
+
+/*
+ * Writes a safetensors file, the header padded so that the data is aligned on 8 bytes like the files written by the
+ * safetensors library
+ */
+static void
+write_safetensors(const char *file_path, const char *json, const void *data, size_t size)
+{
+    char header[512];
+    size_t len = strlen(json);
+    memcpy(header, json, len);
+    while (len % 8 != 0)
+    {
+        header[len++] = ' ';
+    }
+    uint64_t header_size = len;
+
+    FILE *f = fopen(file_path, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    fwrite(&header_size, sizeof(header_size), 1, f);
+    fwrite(header, 1, len, f);
+    fwrite(data, 1, size, f);
+    fclose(f);
+}
+
+static void
+write_text(const char *file_path, const char *text)
+{
+    FILE *f = fopen(file_path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fputs(text, f);
+    fclose(f);
+}
+
+/*
+ * A file holding a 2x3 f32 tensor a, a 4 elements bf16 vector b and an int64 tensor c (listed, not loadable), and the
+ * same a and b split across two shards
+ */
+void
+setUp(void)
+{
+    char data[40];
+    bf16_t b_bf16[4];
+    int64_t c = 42;
+    f32_to_bf16_n(b_bf16, b, 4);
+    memcpy(data, a, sizeof(a));
+    memcpy(data + 24, b_bf16, sizeof(b_bf16));
+    memcpy(data + 32, &c, sizeof(c));
+
+    write_safetensors(path,
+                      "{\"__metadata__\": {\"format\": \"pt\"},"
+                      " \"a\": {\"dtype\": \"F32\", \"shape\": [2, 3], \"data_offsets\": [0, 24]},"
+                      " \"b\": {\"dtype\": \"BF16\", \"shape\": [4], \"data_offsets\": [24, 32]},"
+                      " \"c\": {\"dtype\": \"I64\", \"shape\": [1], \"data_offsets\": [32, 40]}}",
+                      data, sizeof(data));
+    write_safetensors(shard_paths[0], "{\"a\": {\"dtype\": \"F32\", \"shape\": [2, 3], \"data_offsets\": [0, 24]}}", a,
+                      sizeof(a));
+    write_safetensors(shard_paths[1], "{\"b\": {\"dtype\": \"BF16\", \"shape\": [4], \"data_offsets\": [0, 8]}}",
+                      b_bf16, sizeof(b_bf16));
+}
+
+void
+tearDown(void)
+{
+    remove(path);
+    remove(shard_paths[0]);
+    remove(shard_paths[1]);
+    remove(index_path);
+}
+
+void
+test_tensors_should_be_found_by_name(void)
+{
+    // Given
+    Safetensors *st = Safetensors_new(path);
+    SafetensorsLayer *layer = NULL;
+
+    // When / Then
+    TEST_ASSERT_EQUAL(OK, Safetensors_get_layer_by_name(st, "a", &layer));
+    TEST_ASSERT_NOT_NULL(layer);
+    TEST_ASSERT_EQUAL(OK, Safetensors_get_layer_by_name(st, "b", &layer));
+    TEST_ASSERT_EQUAL(OK, Safetensors_get_layer_by_name(st, "c", &layer));
+    TEST_ASSERT_EQUAL(ERROR, Safetensors_get_layer_by_name(st, "__metadata__", &layer));
+    TEST_ASSERT_EQUAL(ERROR, Safetensors_get_layer_by_name(st, "d", &layer));
+
+    Safetensors_free(st);
+}
+
+void
+test_f32_matrix_should_map_the_file(void)
+{
+    // Given
+    Safetensors *st = Safetensors_new(path);
+
+    // When
+    Matrix *m = Safetensors_load_matrix("a", st);
+
+    // Then
+    TEST_ASSERT_EQUAL(2, m->r);
+    TEST_ASSERT_EQUAL(3, m->c);
+    TEST_ASSERT_EQUAL(0, m->owns_data);
+    TEST_ASSERT_EQUAL_FLOAT_ARRAY(a, m->data, 6);
+
+    Matrix_free(m);
+    Safetensors_free(st);
+}
+
+void
+test_bf16_tensor_should_load_as_weights_and_matrix(void)
+{
+    // Given
+    Safetensors *st = Safetensors_new(path);
+
+    // When
+    Matrix *m = Safetensors_load_matrix("b", st);
+    Weights *w = Safetensors_load_weights("b", st);
+
+    // Then
+    TEST_ASSERT_EQUAL(4, m->r);
+    TEST_ASSERT_EQUAL(1, m->c);
+    TEST_ASSERT_EQUAL_FLOAT_ARRAY(b, m->data, 4);
+    TEST_ASSERT_EQUAL(WEIGHTS_BF16, w->dtype);
+    TEST_ASSERT_EQUAL(0, w->owns_data);
+    TEST_ASSERT_EQUAL_FLOAT(8.0f, bf16_to_float(((const bf16_t *) w->data)[3]));
+
+    Weights_free(w);
+    Matrix_free(m);
+    Safetensors_free(st);
+}
+
+void
+test_sharded_checkpoint_should_resolve_tensors_across_shards(void)
+{
+    // Given
+    write_text(index_path, "{\"metadata\": {\"total_size\": 32}, \"weight_map\": {"
+                           "\"a\": \"callm_test-00001-of-00002.safetensors\","
+                           " \"b\": \"callm_test-00002-of-00002.safetensors\"}}");
+
+    // When
+    Safetensors *st = Safetensors_new(index_path);
+    TEST_ASSERT_NOT_NULL(st);
+    Matrix *ma = Safetensors_load_matrix("a", st);
+    Matrix *mb = Safetensors_load_matrix("b", st);
+
+    // Then
+    TEST_ASSERT_EQUAL_FLOAT_ARRAY(a, ma->data, 6);
+    TEST_ASSERT_EQUAL_FLOAT_ARRAY(b, mb->data, 4);
+
+    Matrix_free(ma);
+    Matrix_free(mb);
+    Safetensors_free(st);
+}
+
+void
+test_sharded_checkpoint_should_reject_an_index_not_matching_the_shards(void)
+{
+    // Given
+    write_text(index_path, "{\"weight_map\": {"
+                           "\"a\": \"callm_test-00002-of-00002.safetensors\","
+                           " \"b\": \"callm_test-00001-of-00002.safetensors\"}}");
+
+    // When
+    Safetensors *st = Safetensors_new(index_path);
+
+    // Then
+    TEST_ASSERT_NULL(st);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_tensors_should_be_found_by_name);
+    RUN_TEST(test_f32_matrix_should_map_the_file);
+    RUN_TEST(test_bf16_tensor_should_load_as_weights_and_matrix);
+    RUN_TEST(test_sharded_checkpoint_should_resolve_tensors_across_shards);
+    RUN_TEST(test_sharded_checkpoint_should_reject_an_index_not_matching_the_shards);
+    return UNITY_END();
+}
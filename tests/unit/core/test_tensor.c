@@ -0,0 +1,285 @@
+#include "unity.h"
+
+#include "../../src/core/tensor.h"
+#include "../../src/core/threadpool.h"
+#include <math.h>
+#include <string.h>
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+}
+
+static void
+fill_sequence(Tensor *t, float scale)
+{
+    float *data = Tensor_data(t);
+    for (size_t i = 0; i < Tensor_size(t); i++)
+    {
+        data[i] = (float) ((i * 7) % 13) * scale - 1.0f;
+    }
+}
+
+/* c[batch][i][j] = sum_k a[batch][i][k] * b[batch][k][j] through Tensor_get, broadcasting dimensions of size 1 */
+static float
+naive_dot(Tensor *a, Tensor *b, const size_t *batch, size_t nb_batch_dims, size_t i, size_t j)
+{
+    size_t a_coords[TENSOR_MAX_DIMS], b_coords[TENSOR_MAX_DIMS];
+    for (size_t d = 0; d < nb_batch_dims; d++)
+    {
+        a_coords[d] = Tensor_shape(a)[d] == 1 ? 0 : batch[d];
+        b_coords[d] = Tensor_shape(b)[d] == 1 ? 0 : batch[d];
+    }
+    float acc = 0.0f;
+    for (size_t k = 0; k < Tensor_shape(a)[nb_batch_dims + 1]; k++)
+    {
+        a_coords[nb_batch_dims] = i;
+        a_coords[nb_batch_dims + 1] = k;
+        b_coords[nb_batch_dims] = k;
+        b_coords[nb_batch_dims + 1] = j;
+        acc += Tensor_get(a, a_coords) * Tensor_get(b, b_coords);
+    }
+    return acc;
+}
+
+static void
+assert_batched_dot(Tensor *c, Tensor *a, Tensor *b)
+{
+    size_t *shape = Tensor_shape(c);
+    size_t nb_batch_dims = Tensor_ndim(c) - 2;
+    size_t coords[TENSOR_MAX_DIMS];
+    for (size_t index = 0; index < Tensor_size(c); index++)
+    {
+        size_t rest = index;
+        for (size_t d = Tensor_ndim(c); d != 0; d--)
+        {
+            coords[d - 1] = rest % shape[d - 1];
+            rest /= shape[d - 1];
+        }
+        float expected = naive_dot(a, b, coords, nb_batch_dims, coords[nb_batch_dims], coords[nb_batch_dims + 1]);
+        TEST_ASSERT_FLOAT_WITHIN(1e-3f, expected, Tensor_get(c, coords));
+    }
+}
+
+void
+test_new_tensor_should_be_contiguous_and_zeroed()
+{
+    // Given
+    size_t shape[] = { 2, 3, 4 };
+
+    // When
+    Tensor *t = Tensor_new(3, shape);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(t);
+    TEST_ASSERT_EQUAL(24, Tensor_size(t));
+    TEST_ASSERT_EQUAL(12, Tensor_strides(t)[0]);
+    TEST_ASSERT_EQUAL(4, Tensor_strides(t)[1]);
+    TEST_ASSERT_EQUAL(1, Tensor_strides(t)[2]);
+    TEST_ASSERT_TRUE(Tensor_is_contiguous(t));
+    for (size_t i = 0; i < Tensor_size(t); i++)
+    {
+        TEST_ASSERT_EQUAL_FLOAT(0.0f, Tensor_data(t)[i]);
+    }
+    Tensor_free(t);
+}
+
+void
+test_transpose_should_swap_strides_without_copy()
+{
+    // Given
+    size_t shape[] = { 2, 3 };
+    Tensor *t = Tensor_new(2, shape);
+    fill_sequence(t, 1.0f);
+
+    // When
+    Tensor *tt = Tensor_transpose(t, 0, 1);
+
+    // Then
+    TEST_ASSERT_EQUAL(Tensor_data(t), Tensor_data(tt));
+    TEST_ASSERT_EQUAL(3, Tensor_shape(tt)[0]);
+    TEST_ASSERT_FALSE(Tensor_is_contiguous(tt));
+    size_t coords[] = { 2, 1 };
+    size_t swapped[] = { 1, 2 };
+    TEST_ASSERT_EQUAL_FLOAT(Tensor_get(t, swapped), Tensor_get(tt, coords));
+    Tensor_free(tt);
+    Tensor_free(t);
+}
+
+void
+test_dot_should_multiply_every_matrix_of_the_batch()
+{
+    // Given
+    size_t a_shape[] = { 2, 3, 5, 7 };
+    size_t b_shape[] = { 2, 3, 7, 4 };
+    Tensor *a = Tensor_new(4, a_shape);
+    Tensor *b = Tensor_new(4, b_shape);
+    fill_sequence(a, 0.5f);
+    fill_sequence(b, 0.25f);
+
+    // When
+    Tensor *c = Tensor_dot(a, b);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(c);
+    TEST_ASSERT_EQUAL(4, Tensor_ndim(c));
+    TEST_ASSERT_EQUAL(5, Tensor_shape(c)[2]);
+    TEST_ASSERT_EQUAL(4, Tensor_shape(c)[3]);
+    assert_batched_dot(c, a, b);
+    Tensor_free(a);
+    Tensor_free(b);
+    Tensor_free(c);
+}
+
+void
+test_dot_should_match_on_multiple_threads()
+{
+    // Given
+    ThreadPool_set_default_threads(4);
+    size_t a_shape[] = { 6, 9, 16 };
+    size_t b_shape[] = { 6, 16, 10 };
+    Tensor *a = Tensor_new(3, a_shape);
+    Tensor *b = Tensor_new(3, b_shape);
+    fill_sequence(a, 0.5f);
+    fill_sequence(b, 0.125f);
+
+    // When
+    Tensor *c = Tensor_dot(a, b);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(c);
+    assert_batched_dot(c, a, b);
+    Tensor_free(a);
+    Tensor_free(b);
+    Tensor_free(c);
+    ThreadPool_set_default_threads(0);
+}
+
+/*
+ * Grouped query attention scores: 4 query heads share 2 key heads, every operand being a view on a
+ * [tokens, heads * head_dim] projection
+ */
+void
+test_dot_should_compute_attention_scores_on_projection_views()
+{
+    // Given
+    size_t nb_tokens = 5, head_dim = 8, nb_kv_heads = 2, group = 2;
+    size_t q_shape[] = { nb_tokens, nb_kv_heads * group * head_dim };
+    size_t k_shape[] = { nb_tokens, nb_kv_heads * head_dim };
+    Tensor *q_proj = Tensor_new(2, q_shape);
+    Tensor *k_proj = Tensor_new(2, k_shape);
+    fill_sequence(q_proj, 0.5f);
+    fill_sequence(k_proj, 0.25f);
+
+    size_t query_shape[] = { nb_kv_heads, group, nb_tokens, head_dim };
+    size_t query_strides[] = { group * head_dim, head_dim, q_shape[1], 1 };
+    size_t key_t_shape[] = { nb_kv_heads, 1, head_dim, nb_tokens };
+    size_t key_t_strides[] = { head_dim, 0, 1, k_shape[1] };
+    Tensor *query = Tensor_wrap(4, query_shape, query_strides, Tensor_data(q_proj));
+    Tensor *key_t = Tensor_wrap(4, key_t_shape, key_t_strides, Tensor_data(k_proj));
+
+    // When
+    Tensor *scores = Tensor_dot(query, key_t);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(scores);
+    TEST_ASSERT_EQUAL(group, Tensor_shape(scores)[1]);
+    assert_batched_dot(scores, query, key_t);
+    Tensor_free(scores);
+    Tensor_free(query);
+    Tensor_free(key_t);
+    Tensor_free(q_proj);
+    Tensor_free(k_proj);
+}
+
+void
+test_dot_into_should_write_into_a_strided_destination()
+{
+    // Given
+    size_t a_shape[] = { 3, 4, 6 };
+    size_t b_shape[] = { 3, 4, 6 };
+    Tensor *a = Tensor_new(3, a_shape);
+    Tensor *b = Tensor_new(3, b_shape);
+    fill_sequence(a, 0.5f);
+    fill_sequence(b, 0.25f);
+    Tensor *b_t = Tensor_transpose(b, 1, 2);
+
+    // Heads side by side in the columns of a 4 x 12 matrix
+    float out[4 * 12];
+    size_t dst_shape[] = { 3, 4, 4 };
+    size_t dst_strides[] = { 4, 12, 1 };
+    Tensor *dst = Tensor_wrap(3, dst_shape, dst_strides, out);
+
+    // When
+    CallmStatusCode status = Tensor_dot_into(dst, a, b_t);
+
+    // Then
+    TEST_ASSERT_EQUAL(OK, status);
+    assert_batched_dot(dst, a, b_t);
+    Tensor_free(dst);
+    Tensor_free(b_t);
+    Tensor_free(a);
+    Tensor_free(b);
+}
+
+void
+test_dot_should_reduce_vectors_to_a_scalar()
+{
+    // Given
+    size_t shape[] = { 3 };
+    Tensor *a = Tensor_new(1, shape);
+    Tensor *b = Tensor_new(1, shape);
+    float a_data[] = { 1, 2, 3 };
+    float b_data[] = { 4, 5, 6 };
+    memcpy(Tensor_data(a), a_data, sizeof(a_data));
+    memcpy(Tensor_data(b), b_data, sizeof(b_data));
+
+    // When
+    Tensor *c = Tensor_dot(a, b);
+
+    // Then
+    TEST_ASSERT_NOT_NULL(c);
+    TEST_ASSERT_EQUAL(0, Tensor_ndim(c));
+    TEST_ASSERT_EQUAL_FLOAT(32.0f, Tensor_data(c)[0]);
+    Tensor_free(a);
+    Tensor_free(b);
+    Tensor_free(c);
+}
+
+void
+test_dot_should_reject_mismatching_shapes()
+{
+    // Given
+    size_t a_shape[] = { 2, 3, 4 };
+    size_t b_shape[] = { 3, 4, 5 };
+    Tensor *a = Tensor_new(3, a_shape);
+    Tensor *b = Tensor_new(3, b_shape);
+
+    // When
+    Tensor *c = Tensor_dot(a, b);
+
+    // Then
+    TEST_ASSERT_NULL(c);
+    Tensor_free(a);
+    Tensor_free(b);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_new_tensor_should_be_contiguous_and_zeroed);
+    RUN_TEST(test_transpose_should_swap_strides_without_copy);
+    RUN_TEST(test_dot_should_multiply_every_matrix_of_the_batch);
+    RUN_TEST(test_dot_should_match_on_multiple_threads);
+    RUN_TEST(test_dot_should_compute_attention_scores_on_projection_views);
+    RUN_TEST(test_dot_into_should_write_into_a_strided_destination);
+    RUN_TEST(test_dot_should_reduce_vectors_to_a_scalar);
+    RUN_TEST(test_dot_should_reject_mismatching_shapes);
+    return UNITY_END();
+}
@@ -0,0 +1,261 @@
+#include "unity.h"
+
+#include "../../src/core/tensor_expr.h"
+#include "../../src/core/threadpool.h"
+#include "../../src/core/vecops.h"
+#include <math.h>
+#include <string.h>
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+}
+
+static void
+fill_sequence(Tensor *t, float scale)
+{
+    float *data = Tensor_data(t);
+    for (size_t i = 0; i < Tensor_size(t); i++)
+    {
+        data[i] = (float) ((i * 7) % 13) * scale - 1.0f;
+    }
+}
+
+/* Coordinates of the element of index i of a row-major shape, and the same coordinates broadcast to t */
+static void
+coords_of(size_t i, const size_t *shape, size_t ndim, Tensor *t, size_t *coords, size_t *t_coords)
+{
+    for (size_t d = ndim; d-- > 0;)
+    {
+        coords[d] = i % shape[d];
+        i /= shape[d];
+    }
+    size_t offset = ndim - Tensor_ndim(t);
+    for (size_t d = 0; d < Tensor_ndim(t); d++)
+    {
+        t_coords[d] = Tensor_shape(t)[d] == 1 ? 0 : coords[d + offset];
+    }
+}
+
+void
+test_broadcast_shape_should_align_trailing_dimensions()
+{
+    // Given
+    size_t a_shape[] = { 2, 3, 4 }, b_shape[] = { 3, 1 }, c_shape[] = { 4 }, d_shape[] = { 2, 3 };
+    Tensor *a = Tensor_new(3, a_shape), *b = Tensor_new(2, b_shape), *c = Tensor_new(1, c_shape);
+    Tensor *d = Tensor_new(2, d_shape);
+    Tensor *compatible[] = { b, a, c }, *incompatible[] = { a, d };
+    size_t shape[TENSOR_MAX_DIMS];
+
+    // When
+    int ndim = Tensor_broadcast_shape(compatible, 3, shape);
+
+    // Then
+    TEST_ASSERT_EQUAL(3, ndim);
+    for (int d = 0; d < 3; d++)
+    {
+        TEST_ASSERT_EQUAL(a_shape[d], shape[d]);
+    }
+    TEST_ASSERT_EQUAL(-1, Tensor_broadcast_shape(incompatible, 2, shape));
+    Tensor_free(a);
+    Tensor_free(b);
+    Tensor_free(c);
+    Tensor_free(d);
+}
+
+void
+test_eval_should_broadcast_operands()
+{
+    // Given: x * y + z - mean(x) with x [2, 3, 9], y [2, 1, 9] and z [9]
+    size_t x_shape[] = { 2, 3, 9 }, y_shape[] = { 2, 1, 9 }, z_shape[] = { 9 };
+    Tensor *x = Tensor_new(3, x_shape), *y = Tensor_new(3, y_shape), *z = Tensor_new(1, z_shape);
+    Tensor *dst = Tensor_new(3, x_shape);
+    fill_sequence(x, 0.5f);
+    fill_sequence(y, 0.25f);
+    fill_sequence(z, 2.0f);
+    const TensorExprStep program[] = {
+        TENSOR_EXPR_LOAD(0),
+        TENSOR_EXPR_LOAD(1),
+        TENSOR_EXPR_OP(TENSOR_EXPR_MUL),
+        TENSOR_EXPR_LOAD(2),
+        TENSOR_EXPR_OP(TENSOR_EXPR_ADD),
+        TENSOR_EXPR_LOAD(0),
+        TENSOR_EXPR_OP(TENSOR_EXPR_MEAN),
+        TENSOR_EXPR_OP(TENSOR_EXPR_SUB),
+    };
+    Tensor *operands[] = { x, y, z };
+
+    // When
+    CallmStatusCode status = Tensor_eval_into(dst, program, 8, operands, 3);
+
+    // Then
+    TEST_ASSERT_EQUAL(OK, status);
+    size_t coords[3], y_coords[3], z_coords[1];
+    for (size_t i = 0; i < Tensor_size(dst); i++)
+    {
+        coords_of(i, x_shape, 3, y, coords, y_coords);
+        coords_of(i, x_shape, 3, z, coords, z_coords);
+        size_t row[3] = { coords[0], coords[1], 0 };
+        float mean = 0.0f;
+        for (row[2] = 0; row[2] < 9; row[2]++)
+        {
+            mean += Tensor_get(x, row) / 9.0f;
+        }
+        float expected = Tensor_get(x, coords) * Tensor_get(y, y_coords) + Tensor_get(z, z_coords) - mean;
+        TEST_ASSERT_FLOAT_WITHIN(1e-5f, expected, Tensor_get(dst, coords));
+    }
+    Tensor_free(x);
+    Tensor_free(y);
+    Tensor_free(z);
+    Tensor_free(dst);
+}
+
+void
+test_rms_norm_should_match_a_naive_one()
+{
+    // Given: enough rows to be spread over the pool, and rows with a vector tail
+    ThreadPool_set_default_threads(4);
+    size_t x_shape[] = { 300, 37 }, w_shape[] = { 37 };
+    Tensor *x = Tensor_new(2, x_shape), *w = Tensor_new(1, w_shape), *dst = Tensor_new(2, x_shape);
+    fill_sequence(x, 0.3f);
+    fill_sequence(w, 0.1f);
+
+    // When
+    CallmStatusCode status = Tensor_rms_norm_into(dst, x, w, 1e-6f);
+
+    // Then
+    TEST_ASSERT_EQUAL(OK, status);
+    float *xs = Tensor_data(x), *ws = Tensor_data(w), *out = Tensor_data(dst);
+    for (size_t r = 0; r < 300; r++)
+    {
+        float square_sum = 0.0f;
+        for (size_t c = 0; c < 37; c++)
+        {
+            square_sum += xs[r * 37 + c] * xs[r * 37 + c];
+        }
+        float scale = 1.0f / sqrtf(square_sum / 37.0f + 1e-6f);
+        for (size_t c = 0; c < 37; c++)
+        {
+            TEST_ASSERT_FLOAT_WITHIN(1e-5f, xs[r * 37 + c] * scale * ws[c], out[r * 37 + c]);
+        }
+    }
+    Tensor_free(x);
+    Tensor_free(w);
+    Tensor_free(dst);
+    ThreadPool_set_default_threads(0);
+}
+
+void
+test_silu_mul_should_read_strided_operands()
+{
+    // Given: up is the transpose of a contiguous [19, 4] tensor
+    size_t shape[] = { 4, 19 }, t_shape[] = { 19, 4 };
+    Tensor *gate = Tensor_new(2, shape), *up_data = Tensor_new(2, t_shape), *dst = Tensor_new(2, shape);
+    fill_sequence(gate, 0.4f);
+    fill_sequence(up_data, 0.2f);
+    Tensor *up = Tensor_transpose(up_data, 0, 1);
+
+    // When
+    CallmStatusCode status = Tensor_silu_mul_into(dst, gate, up);
+
+    // Then
+    TEST_ASSERT_EQUAL(OK, status);
+    size_t coords[2];
+    for (coords[0] = 0; coords[0] < 4; coords[0]++)
+    {
+        for (coords[1] = 0; coords[1] < 19; coords[1]++)
+        {
+            float g = Tensor_get(gate, coords);
+            float expected = g / (1.0f + expf(-g)) * Tensor_get(up, coords);
+            TEST_ASSERT_FLOAT_WITHIN(1e-5f, expected, Tensor_get(dst, coords));
+        }
+    }
+    Tensor_free(up);
+    Tensor_free(up_data);
+    Tensor_free(gate);
+    Tensor_free(dst);
+}
+
+void
+test_rotary_should_broadcast_over_heads_in_place()
+{
+    // Given: 3 tokens of 4 heads of 20 dimensions, the angles of each token shared by its heads
+    size_t x_shape[] = { 3, 4, 20 }, angles_shape[] = { 3, 1, 20 };
+    Tensor *x = Tensor_new(3, x_shape), *cos = Tensor_new(3, angles_shape), *sin = Tensor_new(3, angles_shape);
+    fill_sequence(x, 0.5f);
+    float *cs = Tensor_data(cos), *sn = Tensor_data(sin);
+    for (int t = 0; t < 3; t++)
+    {
+        for (int i = 0; i < 10; i++)
+        {
+            float angle = (float) (t + 1) / powf(100.0f, (float) i / 10.0f);
+            cs[t * 20 + i] = cs[t * 20 + i + 10] = cosf(angle);
+            sn[t * 20 + i] = sn[t * 20 + i + 10] = sinf(angle);
+        }
+    }
+    float expected[240];
+    memcpy(expected, Tensor_data(x), sizeof(expected));
+    for (int t = 0; t < 3; t++)
+    {
+        for (int h = 0; h < 4; h++)
+        {
+            float *head = expected + (t * 4 + h) * 20;
+            vec_rotate(head, head + 10, cs + t * 20, sn + t * 20, 10);
+        }
+    }
+
+    // When
+    CallmStatusCode status = Tensor_rotary_into(x, x, cos, sin);
+
+    // Then
+    TEST_ASSERT_EQUAL(OK, status);
+    for (int i = 0; i < 240; i++)
+    {
+        TEST_ASSERT_FLOAT_WITHIN(1e-5f, expected[i], Tensor_data(x)[i]);
+    }
+    Tensor_free(x);
+    Tensor_free(cos);
+    Tensor_free(sin);
+}
+
+void
+test_invalid_programs_and_shapes_should_fail()
+{
+    // Given
+    size_t shape[] = { 2, 5 }, other_shape[] = { 3 };
+    Tensor *x = Tensor_new(2, shape), *other = Tensor_new(1, other_shape), *dst = Tensor_new(2, shape);
+    Tensor *operands[] = { x, other };
+    const TensorExprStep underflow[] = { TENSOR_EXPR_LOAD(0), TENSOR_EXPR_OP(TENSOR_EXPR_ADD) };
+    const TensorExprStep leftover[] = { TENSOR_EXPR_LOAD(0), TENSOR_EXPR_CONST(1.0f) };
+    const TensorExprStep unknown[] = { TENSOR_EXPR_LOAD(2) };
+    const TensorExprStep rotate[] = { TENSOR_EXPR_LOAD(0), TENSOR_EXPR_OP(TENSOR_EXPR_ROTATE_HALF) };
+    const TensorExprStep load_other[] = { TENSOR_EXPR_LOAD(1) };
+
+    // When / Then
+    TEST_ASSERT_EQUAL(ERROR, Tensor_eval_into(dst, underflow, 2, operands, 1));
+    TEST_ASSERT_EQUAL(ERROR, Tensor_eval_into(dst, leftover, 2, operands, 1));
+    TEST_ASSERT_EQUAL(ERROR, Tensor_eval_into(dst, unknown, 1, operands, 2));
+    TEST_ASSERT_EQUAL(ERROR, Tensor_eval_into(dst, rotate, 2, operands, 1));
+    TEST_ASSERT_EQUAL(ERROR, Tensor_eval_into(dst, load_other, 1, operands, 2));
+    Tensor_free(x);
+    Tensor_free(other);
+    Tensor_free(dst);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_broadcast_shape_should_align_trailing_dimensions);
+    RUN_TEST(test_eval_should_broadcast_operands);
+    RUN_TEST(test_rms_norm_should_match_a_naive_one);
+    RUN_TEST(test_silu_mul_should_read_strided_operands);
+    RUN_TEST(test_rotary_should_broadcast_over_heads_in_place);
+    RUN_TEST(test_invalid_programs_and_shapes_should_fail);
+    return UNITY_END();
+}
@@ -0,0 +1,161 @@
+#include "unity.h"
+
+#include "../../src/core/threadpool.h"
+#include <stdlib.h>
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+}
+
+typedef struct
+{
+    int *hits;
+    int grain;
+    int n;
+    int misaligned;
+} CoverageArgs;
+
+static void
+count_hits(void *arg, int start, int end)
+{
+    CoverageArgs *cov = (CoverageArgs *) arg;
+    if (start % cov->grain != 0 || (end != cov->n && (end - start) % cov->grain != 0))
+    {
+        __atomic_add_fetch(&cov->misaligned, 1, __ATOMIC_RELAXED);
+    }
+    for (int i = start; i < end; i++)
+    {
+        __atomic_add_fetch(&cov->hits[i], 1, __ATOMIC_RELAXED);
+    }
+}
+
+void
+test_parallel_for_should_visit_every_index_once()
+{
+    // Given
+    ThreadPool *pool = ThreadPool_new(4, 0);
+    TEST_ASSERT_NOT_NULL(pool);
+    int sizes[][2] = { { 1, 1 }, { 7, 1 }, { 1000, 1 }, { 1000, 16 }, { 4097, 64 }, { 100000, 3 } };
+
+    for (int s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        CoverageArgs cov = { calloc(sizes[s][0], sizeof(int)), sizes[s][1], sizes[s][0], 0 };
+
+        // When
+        ThreadPool_parallel_for(pool, cov.n, cov.grain, count_hits, &cov);
+
+        // Then
+        for (int i = 0; i < cov.n; i++)
+        {
+            TEST_ASSERT_EQUAL_INT(1, cov.hits[i]);
+        }
+        TEST_ASSERT_EQUAL_INT(0, cov.misaligned);
+        free(cov.hits);
+    }
+
+    ThreadPool_free(pool);
+}
+
+typedef struct
+{
+    ThreadPool *pool;
+    int *hits;
+    int inner;
+} NestedArgs;
+
+static void
+nested_inner(void *arg, int start, int end)
+{
+    int *hits = (int *) arg;
+    for (int i = start; i < end; i++)
+    {
+        __atomic_add_fetch(&hits[i], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void
+nested_outer(void *arg, int start, int end)
+{
+    NestedArgs *nested = (NestedArgs *) arg;
+    for (int i = start; i < end; i++)
+    {
+        ThreadPool_parallel_for(nested->pool, nested->inner, 1, nested_inner, nested->hits + i * nested->inner);
+    }
+}
+
+void
+test_nested_parallel_for_should_run_serially()
+{
+    // Given
+    ThreadPool *pool = ThreadPool_new(4, 0);
+    NestedArgs nested = { pool, calloc(64 * 100, sizeof(int)), 100 };
+
+    // When
+    ThreadPool_parallel_for(pool, 64, 1, nested_outer, &nested);
+
+    // Then
+    for (int i = 0; i < 64 * 100; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(1, nested.hits[i]);
+    }
+    free(nested.hits);
+    ThreadPool_free(pool);
+}
+
+void
+test_pool_should_be_reusable_many_times()
+{
+    // Given
+    ThreadPool *pool = ThreadPool_new(3, 0);
+    TEST_ASSERT_EQUAL_INT(3, ThreadPool_size(pool));
+    int hits[256] = { 0 };
+    CoverageArgs cov = { hits, 1, 256, 0 };
+
+    // When
+    for (int it = 0; it < 2000; it++)
+    {
+        ThreadPool_parallel_for(pool, cov.n, cov.grain, count_hits, &cov);
+    }
+
+    // Then
+    for (int i = 0; i < 256; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(2000, hits[i]);
+    }
+    ThreadPool_free(pool);
+}
+
+void
+test_default_pool_should_follow_requested_size()
+{
+    ThreadPool_set_default_threads(2);
+    TEST_ASSERT_EQUAL_INT(2, ThreadPool_size(ThreadPool_default()));
+
+    int hits[100] = { 0 };
+    CoverageArgs cov = { hits, 1, 100, 0 };
+    parallel_for(cov.n, cov.grain, count_hits, &cov);
+    for (int i = 0; i < 100; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(1, hits[i]);
+    }
+
+    ThreadPool_set_default_threads(1);
+    TEST_ASSERT_EQUAL_INT(1, ThreadPool_size(ThreadPool_default()));
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_parallel_for_should_visit_every_index_once);
+    RUN_TEST(test_nested_parallel_for_should_run_serially);
+    RUN_TEST(test_pool_should_be_reusable_many_times);
+    RUN_TEST(test_default_pool_should_follow_requested_size);
+    return UNITY_END();
+}
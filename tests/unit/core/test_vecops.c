@@ -0,0 +1,222 @@
+#include "unity.h"
+
+#include "../../src/core/vecops.h"
+#include "test_isa.h"
+#include <math.h>
+
+#define MAX_LEN 100
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+    cpu_limit_isa(CPU_ISA_AVX512);
+}
+
+// Lengths below, equal to and above the vector widths, so that both the vector loops and their tails run
+static const int lengths[] = { 1, 7, 8, 16, 33, MAX_LEN };
+
+static void
+fill_pseudo_random(float *x, int n, unsigned int seed, float amplitude)
+{
+    for (int i = 0; i < n; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        x[i] = amplitude * ((float) ((seed >> 8) & 0xFFFF) / 32768.0f - 1.0f);
+    }
+}
+
+static void
+assert_close(const float *expected, const float *actual, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        TEST_ASSERT_FLOAT_WITHIN(1e-5f * (1.0f + fabsf(expected[i])), expected[i], actual[i]);
+    }
+}
+
+void
+test_elementwise_kernels_should_match_reference_with_every_isa()
+{
+    float a[MAX_LEN], b[MAX_LEN], out[MAX_LEN], expected[MAX_LEN];
+    fill_pseudo_random(a, MAX_LEN, 42, 10.0f);
+    fill_pseudo_random(b, MAX_LEN, 1337, 10.0f);
+
+    FOR_EACH_ISA(isa)
+    {
+        for (int l = 0; l < 6; l++)
+        {
+            int n = lengths[l];
+
+            vec_add(out, a, b, n);
+            for (int i = 0; i < n; i++)
+            {
+                expected[i] = a[i] + b[i];
+            }
+            assert_close(expected, out, n);
+
+            vec_sub(out, a, b, n);
+            for (int i = 0; i < n; i++)
+            {
+                expected[i] = a[i] - b[i];
+            }
+            assert_close(expected, out, n);
+
+            vec_mul_add_mul(out, a, b, 0.5f, b, b, -2.0f, n);
+            for (int i = 0; i < n; i++)
+            {
+                expected[i] = a[i] * b[i] * 0.5f - 2.0f * b[i] * b[i];
+            }
+            assert_close(expected, out, n);
+
+            vec_mul_scale(out, a, b, 0.5f, n);
+            for (int i = 0; i < n; i++)
+            {
+                expected[i] = a[i] * b[i] * 0.5f;
+            }
+            assert_close(expected, out, n);
+
+            vec_scale_add(out, a, 3.0f, -2.0f, n);
+            for (int i = 0; i < n; i++)
+            {
+                expected[i] = a[i] * 3.0f - 2.0f;
+            }
+            assert_close(expected, out, n);
+
+            vec_exp(out, a, n);
+            for (int i = 0; i < n; i++)
+            {
+                expected[i] = expf(a[i]);
+            }
+            assert_close(expected, out, n);
+
+            float sum = vec_exp_sum(out, a, 0.5f, -3.0f, n);
+            double expected_sum = 0;
+            for (int i = 0; i < n; i++)
+            {
+                expected[i] = expf(a[i] * 0.5f - 3.0f);
+                expected_sum += expected[i];
+            }
+            assert_close(expected, out, n);
+            TEST_ASSERT_FLOAT_WITHIN(1e-5f * (float) expected_sum, (float) expected_sum, sum);
+
+            vec_silu_mul(out, a, b, n);
+            for (int i = 0; i < n; i++)
+            {
+                expected[i] = a[i] / (1.0f + expf(-a[i])) * b[i];
+            }
+            assert_close(expected, out, n);
+        }
+    }
+}
+
+void
+test_reductions_should_match_reference_with_every_isa()
+{
+    float x[MAX_LEN];
+    fill_pseudo_random(x, MAX_LEN, 7, 4.0f);
+
+    FOR_EACH_ISA(isa)
+    {
+        for (int l = 0; l < 6; l++)
+        {
+            int n = lengths[l];
+            double sum = 0, square_sum = 0;
+            float max = -INFINITY;
+            for (int i = 0; i < n; i++)
+            {
+                sum += x[i];
+                square_sum += (double) x[i] * x[i];
+                max = x[i] > max ? x[i] : max;
+            }
+
+            TEST_ASSERT_FLOAT_WITHIN(1e-4f, (float) sum, vec_sum(x, n));
+            TEST_ASSERT_FLOAT_WITHIN(1e-4f * (float) square_sum, (float) square_sum, vec_square_sum(x, n));
+            TEST_ASSERT_EQUAL_FLOAT(max, vec_max(x, n));
+
+            // Adding x to a zero vector gives back x and its square sum
+            float zeros[MAX_LEN] = { 0 };
+            float copy[MAX_LEN];
+            TEST_ASSERT_FLOAT_WITHIN(1e-4f * (float) square_sum, (float) square_sum,
+                                     vec_add_square_sum(copy, x, zeros, n));
+            TEST_ASSERT_EQUAL_FLOAT_ARRAY(x, copy, n);
+        }
+    }
+}
+
+void
+test_exp_should_handle_extreme_inputs()
+{
+    // Given: masked scores (-inf) and values out of the float range
+    float x[] = { -INFINITY, -1000.0f, 0.0f, 1.0f, -1.0f, 80.0f, -80.0f, 20.0f, -INFINITY, 0.5f, -0.5f, 10.0f,
+                  -10.0f,    3.0f,     -3.0f, 40.0f, -40.0f };
+    int n = sizeof(x) / sizeof(x[0]);
+    float out[sizeof(x) / sizeof(x[0])];
+
+    FOR_EACH_ISA(isa)
+    {
+        // When
+        vec_exp(out, x, n);
+
+        // Then
+        TEST_ASSERT_EQUAL_FLOAT(0.0f, out[0]);
+        TEST_ASSERT_EQUAL_FLOAT(0.0f, out[1]);
+        TEST_ASSERT_EQUAL_FLOAT(0.0f, out[8]);
+        for (int i = 2; i < n; i++)
+        {
+            if (i == 8)
+            {
+                continue;
+            }
+            TEST_ASSERT_FLOAT_WITHIN(2e-6f * expf(x[i]), expf(x[i]), out[i]);
+        }
+    }
+}
+
+void
+test_rotate_should_rotate_pairs_in_place()
+{
+    // Given: pairs rotated by a quarter turn, only on the first 33 of them
+    float x1[MAX_LEN], x2[MAX_LEN], orig1[MAX_LEN], orig2[MAX_LEN], c[MAX_LEN], s[MAX_LEN];
+    fill_pseudo_random(orig1, MAX_LEN, 3, 1.0f);
+    fill_pseudo_random(orig2, MAX_LEN, 5, 1.0f);
+    for (int i = 0; i < MAX_LEN; i++)
+    {
+        c[i] = 0.0f;
+        s[i] = 1.0f;
+    }
+
+    FOR_EACH_ISA(isa)
+    {
+        for (int i = 0; i < MAX_LEN; i++)
+        {
+            x1[i] = orig1[i];
+            x2[i] = orig2[i];
+        }
+
+        // When
+        vec_rotate(x1, x2, c, s, 33);
+
+        // Then: (x1, x2) -> (-x2, x1), the rest untouched
+        for (int i = 0; i < MAX_LEN; i++)
+        {
+            TEST_ASSERT_EQUAL_FLOAT(i < 33 ? -orig2[i] : orig1[i], x1[i]);
+            TEST_ASSERT_EQUAL_FLOAT(i < 33 ? orig1[i] : orig2[i], x2[i]);
+        }
+    }
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_elementwise_kernels_should_match_reference_with_every_isa);
+    RUN_TEST(test_reductions_should_match_reference_with_every_isa);
+    RUN_TEST(test_exp_should_handle_extreme_inputs);
+    RUN_TEST(test_rotate_should_rotate_pairs_in_place);
+    return UNITY_END();
+}
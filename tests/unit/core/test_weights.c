@@ -0,0 +1,268 @@
+#include "unity.h"
+
+#include "../../src/core/bf16.h"
+#include "../../src/core/matrix.h"
+#include "../../src/core/quant.h"
+#include "../../src/core/weights.h"
+#include "test_isa.h"
+#include <math.h>
+#include <stdlib.h>
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+    cpu_limit_isa(CPU_ISA_AVX512);
+}
+
+static Matrix *
+random_matrix(int r, int c, unsigned int *seed)
+{
+    Matrix *M = Matrix_new(r, c);
+    for (int i = 0; i < r; i++)
+    {
+        for (int j = 0; j < c; j++)
+        {
+            *seed = *seed * 1103515245u + 12345u;
+            Matrix_row(M, i)[j] = (float) ((*seed >> 8) & 0xFFFF) / 32768.0f - 1.0f;
+        }
+    }
+    return M;
+}
+
+/* The f32 matrix holding exactly the values of bf16 weights */
+static Matrix *
+widened(const Weights *W)
+{
+    Matrix *M = Matrix_new(W->r, W->c);
+    for (int i = 0; i < W->r; i++)
+    {
+        bf16_to_f32_n(Matrix_row(M, i), (const bf16_t *) W->data + (size_t) i * W->stride, W->c);
+    }
+    return M;
+}
+
+void
+test_bf16_dot_transposed_should_match_f32_product_with_every_isa()
+{
+    // Given: odd shapes, so that every kernel runs its tails, for a single token (gemv) and a batch (gemm)
+    unsigned int seed = 7;
+    const int nb_rows[] = { 1, 5, 37 };
+    Matrix *M = random_matrix(67, 131, &seed);
+    Weights *W = Weights_from_matrix(M, WEIGHTS_BF16);
+    Matrix *M_bf16 = widened(W);
+    TEST_ASSERT_EQUAL_INT(WEIGHTS_BF16, W->dtype);
+    TEST_ASSERT_EQUAL_size_t(67 * 131 * sizeof(bf16_t), Weights_nbytes(W));
+
+    for (int r = 0; r < 3; r++)
+    {
+        Matrix *A = random_matrix(nb_rows[r], 131, &seed);
+        Matrix *expected = Matrix_dot_transposed(A, M_bf16);
+
+        FOR_EACH_ISA(isa)
+        {
+            // When
+            Matrix *result = Weights_dot_transposed(A, W);
+
+            // Then: same values up to the f32 summation order
+            TEST_ASSERT_NOT_NULL(result);
+            TEST_ASSERT_EQUAL_INT(nb_rows[r], result->r);
+            TEST_ASSERT_EQUAL_INT(67, result->c);
+            for (int i = 0; i < result->r; i++)
+            {
+                for (int j = 0; j < result->c; j++)
+                {
+                    TEST_ASSERT_FLOAT_WITHIN(1e-4f, Matrix_row(expected, i)[j], Matrix_row(result, i)[j]);
+                }
+            }
+            Matrix_free(result);
+        }
+        Matrix_free(A);
+        Matrix_free(expected);
+    }
+
+    Matrix_free(M);
+    Matrix_free(M_bf16);
+    Weights_free(W);
+}
+
+void
+test_select_rows_should_widen_the_selected_rows()
+{
+    // Given
+    unsigned int seed = 11;
+    Matrix *M = random_matrix(9, 21, &seed);
+    Weights *W_bf16 = Weights_from_matrix(M, WEIGHTS_BF16);
+    Weights *W_f32 = Weights_from_matrix(M, WEIGHTS_F32);
+    int idx[] = { 8, 0, 3, 3 };
+    Matrix *rows_bf16 = Matrix_new(4, 21);
+    Matrix *rows_f32 = Matrix_new(4, 21);
+    Matrix *row = Matrix_new(1, 21);
+
+    // When
+    CallmStatusCode status_bf16 = Weights_select_rows_into(rows_bf16, W_bf16, idx, 4);
+    CallmStatusCode status_f32 = Weights_select_rows_into(rows_f32, W_f32, idx, 4);
+    int out_of_bounds[] = { 9 };
+    CallmStatusCode status_invalid = Weights_select_rows_into(row, W_f32, out_of_bounds, 1);
+
+    // Then
+    TEST_ASSERT_EQUAL_INT(OK, status_bf16);
+    TEST_ASSERT_EQUAL_INT(OK, status_f32);
+    TEST_ASSERT_EQUAL_INT(ERROR, status_invalid);
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = 0; j < 21; j++)
+        {
+            float value = Matrix_row(M, idx[i])[j];
+            TEST_ASSERT_EQUAL_FLOAT(value, Matrix_row(rows_f32, i)[j]);
+            TEST_ASSERT_EQUAL_FLOAT(bf16_to_float(float_to_bf16(value)), Matrix_row(rows_bf16, i)[j]);
+        }
+    }
+
+    Matrix_free(M);
+    Matrix_free(rows_bf16);
+    Matrix_free(rows_f32);
+    Matrix_free(row);
+    Weights_free(W_bf16);
+    Weights_free(W_f32);
+}
+
+void
+test_q8_dot_transposed_should_stay_close_to_f32_product()
+{
+    // Given: weights quantised from f32, for a single token and a batch
+    unsigned int seed = 3;
+    const int nb_rows[] = { 1, 7 };
+    Matrix *M = random_matrix(45, 8 * QK8, &seed);
+    Weights *W = Weights_from_matrix(M, WEIGHTS_Q8);
+    TEST_ASSERT_NOT_NULL(W);
+    TEST_ASSERT_EQUAL_size_t(45 * 8 * sizeof(BlockQ8), Weights_nbytes(W));
+
+    for (int r = 0; r < 2; r++)
+    {
+        Matrix *A = random_matrix(nb_rows[r], 8 * QK8, &seed);
+        Matrix *expected = Matrix_dot_transposed(A, M);
+        Matrix *reference = NULL;
+
+        FOR_EACH_ISA(isa)
+        {
+            // When
+            Matrix *result = Weights_dot_transposed(A, W);
+
+            // Then: within 1% (relative, over the whole product) of the f32 product, weights and activations both
+            // being quantised on 8 bits
+            TEST_ASSERT_NOT_NULL(result);
+            double err = 0.0, norm = 0.0;
+            for (int i = 0; i < result->r; i++)
+            {
+                for (int j = 0; j < result->c; j++)
+                {
+                    double diff = Matrix_row(result, i)[j] - Matrix_row(expected, i)[j];
+                    err += diff * diff;
+                    norm += (double) Matrix_row(expected, i)[j] * Matrix_row(expected, i)[j];
+                }
+            }
+            TEST_ASSERT_TRUE(sqrt(err / norm) < 0.01);
+
+            // And every instruction set computes the same integer products
+            if (reference == NULL)
+            {
+                reference = result;
+                continue;
+            }
+            for (int i = 0; i < result->r; i++)
+            {
+                for (int j = 0; j < result->c; j++)
+                {
+                    TEST_ASSERT_FLOAT_WITHIN(1e-4f, Matrix_row(reference, i)[j], Matrix_row(result, i)[j]);
+                }
+            }
+            Matrix_free(result);
+        }
+        Matrix_free(A);
+        Matrix_free(expected);
+        Matrix_free(reference);
+    }
+
+    Matrix_free(M);
+    Weights_free(W);
+}
+
+void
+test_q4_dot_transposed_should_match_dequantised_product()
+{
+    // Given: every group size, with and without minimums, for a single token (gemv) and a batch (gemm)
+    unsigned int seed = 5;
+    const int group_sizes[] = { 32, 64, 128 };
+    const WeightsDtype dtypes[] = { WEIGHTS_Q4, WEIGHTS_Q4_MIN };
+    const int nb_rows[] = { 1, 5 };
+    Matrix *M = random_matrix(53, 384, &seed);
+
+    for (int t = 0; t < 2; t++)
+    {
+        for (int g = 0; g < 3; g++)
+        {
+            Weights *W = Weights_from_matrix_grouped(M, dtypes[t], group_sizes[g]);
+            TEST_ASSERT_NOT_NULL(W);
+            TEST_ASSERT_EQUAL_INT(group_sizes[g], W->group_size);
+            int *idx = malloc(W->r * sizeof(int));
+            for (int i = 0; i < W->r; i++)
+            {
+                idx[i] = i;
+            }
+            Matrix *M_q4 = Matrix_new(W->r, W->c);
+            TEST_ASSERT_EQUAL_INT(OK, Weights_select_rows_into(M_q4, W, idx, W->r));
+
+            for (int r = 0; r < 2; r++)
+            {
+                Matrix *A = random_matrix(nb_rows[r], 384, &seed);
+                Matrix *expected = Matrix_dot_transposed(A, M_q4);
+                Matrix *exact = Matrix_dot_transposed(A, M);
+
+                FOR_EACH_ISA(isa)
+                {
+                    // When
+                    Matrix *result = Weights_dot_transposed(A, W);
+
+                    // Then: the product of the dequantised weights, which is within 10% of the f32 product
+                    TEST_ASSERT_NOT_NULL(result);
+                    double err = 0.0, norm = 0.0;
+                    for (int i = 0; i < result->r; i++)
+                    {
+                        for (int j = 0; j < result->c; j++)
+                        {
+                            TEST_ASSERT_FLOAT_WITHIN(1e-3f, Matrix_row(expected, i)[j], Matrix_row(result, i)[j]);
+                            double diff = Matrix_row(result, i)[j] - Matrix_row(exact, i)[j];
+                            err += diff * diff;
+                            norm += (double) Matrix_row(exact, i)[j] * Matrix_row(exact, i)[j];
+                        }
+                    }
+                    TEST_ASSERT_TRUE(sqrt(err / norm) < 0.1);
+                    Matrix_free(result);
+                }
+                Matrix_free(A);
+                Matrix_free(expected);
+                Matrix_free(exact);
+            }
+            free(idx);
+            Matrix_free(M_q4);
+            Weights_free(W);
+        }
+    }
+    Matrix_free(M);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_bf16_dot_transposed_should_match_f32_product_with_every_isa);
+    RUN_TEST(test_select_rows_should_widen_the_selected_rows);
+    RUN_TEST(test_q8_dot_transposed_should_stay_close_to_f32_product);
+    RUN_TEST(test_q4_dot_transposed_should_match_dequantised_product);
+    return UNITY_END();
+}
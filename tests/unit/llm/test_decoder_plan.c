@@ -0,0 +1,424 @@
+#include "unity.h"
+
+#include "../../src/core/matrix.h"
+#include "../../src/core/residency.h"
+#include "../../src/core/safetensors.h"
+#include "../../src/core/threadpool.h"
+#include "../../src/llm/decoder.h"
+#include "../../src/llm/decoder_plan.h"
+#include "../../src/llm/model.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Heap allocations of the test, counted through the linker wrappers (see CMakeLists.txt) */
+static size_t nb_heap_allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+    __atomic_add_fetch(&nb_heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nb, size_t size)
+{
+    __atomic_add_fetch(&nb_heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(nb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+    __atomic_add_fetch(&nb_heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+int
+__wrap_posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    __atomic_add_fetch(&nb_heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+/* A tiny decoder: 4 query heads sharing 2 key/value heads of 8 dimensions */
+#define HIDDEN 32
+#define NB_HEADS 4
+#define NB_KV_HEADS 2
+#define HEAD_DIM 8
+#define INTERMEDIATE 64
+
+/* The embeddings table of a whole model has the shape of Llama 3.2 1B, left as a hole of the file but a few rows */
+#define VOCAB 128256
+#define MODEL_HIDDEN 2048
+
+static const char *path = "callm_test_decoder.safetensors";
+static const char *model_path = "callm_test_model.safetensors";
+static const DecoderShape shape = { HIDDEN, NB_HEADS, NB_KV_HEADS, HEAD_DIM, INTERMEDIATE };
+
+typedef struct
+{
+    const char *name;
+    int r;
+    int c;  // 0 for a vector
+} TensorSpec;
+
+#define NB_TENSORS 9
+
+static float
+next_value(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return ((float) (*state >> 8) / (float) (1 << 24) - 0.5f) * 0.5f;
+}
+
+/*
+ * Writes the f32 weights of decoder 0 of the given hidden size with small pseudo-random values, the header padded to
+ * 8 bytes. With embedded_tokens > 0, a VOCAB x hidden embeddings table follows, only its first embedded_tokens rows
+ * written.
+ */
+static void
+write_checkpoint(const char *file, int hidden, int embedded_tokens)
+{
+    const TensorSpec tensors[NB_TENSORS] = {
+        { "model.layers.0.self_attn.q_proj.weight", NB_HEADS * HEAD_DIM, hidden },
+        { "model.layers.0.self_attn.k_proj.weight", NB_KV_HEADS * HEAD_DIM, hidden },
+        { "model.layers.0.self_attn.v_proj.weight", NB_KV_HEADS * HEAD_DIM, hidden },
+        { "model.layers.0.self_attn.o_proj.weight", hidden, NB_HEADS * HEAD_DIM },
+        { "model.layers.0.mlp.gate_proj.weight", INTERMEDIATE, hidden },
+        { "model.layers.0.mlp.up_proj.weight", INTERMEDIATE, hidden },
+        { "model.layers.0.mlp.down_proj.weight", hidden, INTERMEDIATE },
+        { "model.layers.0.input_layernorm.weight", hidden, 0 },
+        { "model.layers.0.post_attention_layernorm.weight", hidden, 0 },
+    };
+    char header[4096];
+    size_t len = (size_t) sprintf(header, "{");
+    size_t offset = 0;
+    for (size_t i = 0; i < NB_TENSORS; i++)
+    {
+        size_t nb = (size_t) tensors[i].r * (tensors[i].c > 0 ? tensors[i].c : 1);
+        char dims[32];
+        if (tensors[i].c > 0)
+            sprintf(dims, "%d, %d", tensors[i].r, tensors[i].c);
+        else
+            sprintf(dims, "%d", tensors[i].r);
+        len += sprintf(header + len, "%s\"%s\": {\"dtype\": \"F32\", \"shape\": [%s], \"data_offsets\": [%zu, %zu]}",
+                       i > 0 ? ", " : "", tensors[i].name, dims, offset, offset + nb * sizeof(float));
+        offset += nb * sizeof(float);
+    }
+    size_t embeddings_size = embedded_tokens > 0 ? (size_t) VOCAB * hidden * sizeof(float) : 0;
+    if (embedded_tokens > 0)
+    {
+        len += sprintf(header + len, ", \"model.embed_tokens.weight\": {\"dtype\": \"F32\", \"shape\": [%d, %d], "
+                                     "\"data_offsets\": [%zu, %zu]}",
+                       VOCAB, hidden, offset, offset + embeddings_size);
+    }
+    len += sprintf(header + len, "}");
+    while (len % 8 != 0)
+    {
+        header[len++] = ' ';
+    }
+    uint64_t header_size = len;
+
+    FILE *f = fopen(file, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    fwrite(&header_size, sizeof(header_size), 1, f);
+    fwrite(header, 1, len, f);
+    uint32_t state = 42;
+    size_t nb_values = (offset / sizeof(float)) + (size_t) embedded_tokens * hidden;
+    for (size_t i = 0; i < nb_values; i++)
+    {
+        float value = next_value(&state);
+        fwrite(&value, sizeof(value), 1, f);
+    }
+    if (embedded_tokens > 0)
+    {
+        // The rest of the table is a hole: the file is sparse, and only the looked up rows are ever read
+        float zero = 0.0f;
+        fseek(f, (long) (sizeof(header_size) + len + offset + embeddings_size - sizeof(zero)), SEEK_SET);
+        fwrite(&zero, sizeof(zero), 1, f);
+    }
+    fclose(f);
+}
+
+void
+setUp(void)
+{
+    write_checkpoint(path, HIDDEN, 0);
+}
+
+void
+tearDown(void)
+{
+    remove(path);
+    remove(model_path);
+}
+
+static int
+overlap(const DecoderPlan *plan, int a, int b)
+{
+    return plan->offsets[a] < plan->offsets[b] + plan->sizes[b] && plan->offsets[b] < plan->offsets[a] + plan->sizes[a];
+}
+
+void
+test_buffers_alive_together_should_not_overlap()
+{
+    int max_tokens[] = { 1, 7, 64, 1000 };
+    for (size_t n = 0; n < sizeof(max_tokens) / sizeof(max_tokens[0]); n++)
+    {
+        // Given
+        DecoderPlan plan;
+
+        // When
+        TEST_ASSERT_EQUAL(OK, DecoderPlan_init(&plan, &shape, max_tokens[n]));
+
+        // Then: every pair of buffers alive during a common step is disjoint, and dead ones share memory
+        size_t total = 0;
+        for (int a = 0; a < DECODER_NB_BUFFERS; a++)
+        {
+            int a_first, a_last;
+            DecoderPlan_liveness(a, &a_first, &a_last);
+            TEST_ASSERT_EQUAL(0, plan.offsets[a] % MATRIX_ALIGNMENT);
+            TEST_ASSERT_TRUE(plan.offsets[a] + plan.sizes[a] <= plan.workspace_size);
+            for (int b = a + 1; b < DECODER_NB_BUFFERS; b++)
+            {
+                int b_first, b_last;
+                DecoderPlan_liveness(b, &b_first, &b_last);
+                if (a_first <= b_last && b_first <= a_last)
+                {
+                    TEST_ASSERT_FALSE(overlap(&plan, a, b));
+                }
+            }
+            total += plan.sizes[a];
+        }
+        TEST_ASSERT_TRUE(plan.workspace_size < total);
+    }
+}
+
+void
+test_buffers_should_have_the_shapes_of_the_pass()
+{
+    // Given
+    DecoderPlan plan;
+    DecoderBuffers buffers;
+    TEST_ASSERT_EQUAL(OK, DecoderPlan_init(&plan, &shape, 8));
+    void *workspace = NULL;
+    TEST_ASSERT_EQUAL(0, posix_memalign(&workspace, MATRIX_ALIGNMENT, plan.workspace_size));
+
+    // When
+    TEST_ASSERT_EQUAL(OK, DecoderPlan_buffers(&plan, workspace, 3, &buffers));
+
+    // Then
+    TEST_ASSERT_EQUAL(3, buffers.matrices[DECODER_NORMED].r);
+    TEST_ASSERT_EQUAL(HIDDEN, buffers.matrices[DECODER_NORMED].c);
+    TEST_ASSERT_EQUAL(NB_KV_HEADS * HEAD_DIM, buffers.matrices[DECODER_KEY].c);
+    TEST_ASSERT_EQUAL(NB_HEADS * 3, buffers.matrices[DECODER_SCORES].r);
+    TEST_ASSERT_EQUAL(3, buffers.matrices[DECODER_SCORES].c);
+    TEST_ASSERT_EQUAL(INTERMEDIATE, buffers.matrices[DECODER_GATE].c);
+    TEST_ASSERT_EQUAL(OK, Matrix_free(&buffers.matrices[DECODER_UP]));  // no-op
+    TEST_ASSERT_EQUAL(ERROR, DecoderPlan_buffers(&plan, workspace, 9, &buffers));
+    free(workspace);
+}
+
+static Config
+tiny_config(void)
+{
+    Config config;
+    memset(&config, 0, sizeof(config));
+    config.transformers_bloc_count = 1;
+    config.rms_norm_eps = 1e-5f;
+    config.head_dim = HEAD_DIM;
+    return config;
+}
+
+/* Rotary tables of the positions [0, cos->r) */
+static void
+fill_rotary_tables(Matrix *cos, Matrix *sin)
+{
+    for (int i = 0; i < cos->r; i++)
+    {
+        for (int j = 0; j < HEAD_DIM; j++)
+        {
+            Matrix_row(cos, i)[j] = cosf(0.1f * i * (j % (HEAD_DIM / 2) + 1));
+            Matrix_row(sin, i)[j] = sinf(0.1f * i * (j % (HEAD_DIM / 2) + 1));
+        }
+    }
+}
+
+/* Runs the decoder in place on the tokens of hidden, with buffers planned for max_tokens */
+static void
+run_decoder(Decoder *decoder, int max_tokens, Matrix *hidden, void **workspace)
+{
+    DecoderPlan plan;
+    DecoderBuffers buffers;
+    TEST_ASSERT_EQUAL(OK, DecoderPlan_init(&plan, &shape, max_tokens));
+    if (*workspace == NULL)
+    {
+        TEST_ASSERT_EQUAL(0, posix_memalign(workspace, MATRIX_ALIGNMENT, plan.workspace_size));
+    }
+    TEST_ASSERT_EQUAL(OK, DecoderPlan_buffers(&plan, *workspace, hidden->r, &buffers));
+
+    Matrix *cos = Matrix_new(hidden->r, HEAD_DIM);
+    Matrix *sin = Matrix_new(hidden->r, HEAD_DIM);
+    fill_rotary_tables(cos, sin);
+    TEST_ASSERT_EQUAL_PTR(hidden, Decoder_forward(decoder, hidden, cos, sin, &buffers));
+    Matrix_free(cos);
+    Matrix_free(sin);
+}
+
+static Matrix *
+tiny_hidden_state(int nb_tokens)
+{
+    Matrix *hidden = Matrix_new(nb_tokens, HIDDEN);
+    uint32_t state = 7;
+    for (size_t i = 0; i < hidden->size; i++)
+    {
+        hidden->data[i] = next_value(&state);
+    }
+    return hidden;
+}
+
+void
+test_decoder_result_should_not_depend_on_the_plan()
+{
+    // Given
+    Config config = tiny_config();
+    Safetensors *st = Safetensors_new(path);
+    TEST_ASSERT_NOT_NULL(st);
+    Decoder *decoder = Decoder_new(st, &config, 0);
+    Matrix *exact = tiny_hidden_state(5);
+    Matrix *larger = tiny_hidden_state(5);
+    void *exact_workspace = NULL;
+    void *larger_workspace = NULL;
+
+    // When: the buffers land at other offsets of a larger workspace
+    run_decoder(decoder, 5, exact, &exact_workspace);
+    run_decoder(decoder, 64, larger, &larger_workspace);
+
+    // Then
+    for (size_t i = 0; i < exact->size; i++)
+    {
+        TEST_ASSERT_FALSE(isnan(exact->data[i]));
+    }
+    TEST_ASSERT_EQUAL_FLOAT_ARRAY(exact->data, larger->data, exact->size);
+
+    free(exact_workspace);
+    free(larger_workspace);
+    Matrix_free(exact);
+    Matrix_free(larger);
+    Decoder_free(decoder);
+    Safetensors_free(st);
+}
+
+void
+test_steady_state_decoding_should_not_allocate()
+{
+    // Given: one pass warms up the thread arena (GEMM panels, tensor views); on a single thread, no worker creates its
+    // own arena later on
+    ThreadPool_set_default_threads(1);
+    Config config = tiny_config();
+    Safetensors *st = Safetensors_new(path);
+    TEST_ASSERT_NOT_NULL(st);
+    Decoder *decoder = Decoder_new(st, &config, 0);
+    Matrix *hidden = tiny_hidden_state(1);
+    void *workspace = NULL;
+    run_decoder(decoder, 8, hidden, &workspace);
+
+    // When
+    DecoderPlan plan;
+    DecoderBuffers buffers;
+    TEST_ASSERT_EQUAL(OK, DecoderPlan_init(&plan, &shape, 8));
+    TEST_ASSERT_EQUAL(OK, DecoderPlan_buffers(&plan, workspace, 1, &buffers));
+    Matrix *cos = Matrix_new(1, HEAD_DIM);
+    Matrix *sin = Matrix_new(1, HEAD_DIM);
+    fill_rotary_tables(cos, sin);
+    size_t allocs_before = __atomic_load_n(&nb_heap_allocs, __ATOMIC_RELAXED);
+    for (int step = 0; step < 10; step++)
+    {
+        TEST_ASSERT_NOT_NULL(Decoder_forward(decoder, hidden, cos, sin, &buffers));
+    }
+    size_t allocs_after = __atomic_load_n(&nb_heap_allocs, __ATOMIC_RELAXED);
+
+    // Then
+    TEST_ASSERT_EQUAL(0, allocs_after - allocs_before);
+
+    Matrix_free(cos);
+    Matrix_free(sin);
+    free(workspace);
+    Matrix_free(hidden);
+    Decoder_free(decoder);
+    Safetensors_free(st);
+    ThreadPool_set_default_threads(0);
+}
+
+void
+test_steady_state_model_passes_should_not_allocate()
+{
+    // Given: a one decoder model on a pool of several threads, mapped lazily so that only the looked up embeddings are
+    // read. The first passes warm up the arenas of the calling thread and of the workers.
+    ThreadPool_set_default_threads(4);
+    const ResidencyPolicy previous = *residency_policy();
+    const ResidencyPolicy lazy = { RESIDENCY_LAZY, 0, 0 };
+    residency_set_policy(&lazy);
+    write_checkpoint(model_path, MODEL_HIDDEN, 4);
+    Config config = tiny_config();
+    config.rope_theta = 500000.0f;
+    config.rope_scaling_factor = 32.0f;
+    config.rope_scaling_low_freq_factor = 1.0f;
+    config.rope_scaling_high_freq_factor = 4.0f;
+    config.rope_scaling_original_max_position_embeddings = 8192;
+    Safetensors *st = Safetensors_new(model_path);
+    TEST_ASSERT_NOT_NULL(st);
+    Model *model = Model_new(st, &config);
+    TEST_ASSERT_NOT_NULL(model);
+    TEST_ASSERT_EQUAL(MODEL_HIDDEN, Model_hidden_size(model));
+    Matrix *hidden = Matrix_new(1, MODEL_HIDDEN);
+    int token = 0;
+    for (int pass = 0; pass < 4; pass++)
+    {
+        token = pass;
+        TEST_ASSERT_EQUAL(OK, Model_forward_into(hidden, model, &token, 1));
+    }
+
+    // When
+    size_t allocs_before = __atomic_load_n(&nb_heap_allocs, __ATOMIC_RELAXED);
+    for (int step = 0; step < 10; step++)
+    {
+        token = step % 4;
+        TEST_ASSERT_EQUAL(OK, Model_forward_into(hidden, model, &token, 1));
+    }
+    size_t allocs_after = __atomic_load_n(&nb_heap_allocs, __ATOMIC_RELAXED);
+
+    // Then
+    TEST_ASSERT_EQUAL(0, allocs_after - allocs_before);
+    for (int j = 0; j < MODEL_HIDDEN; j++)
+    {
+        TEST_ASSERT_FALSE(isnan(hidden->data[j]));
+    }
+
+    Matrix_free(hidden);
+    Model_free(model);
+    Safetensors_free(st);
+    residency_set_policy(&previous);
+    ThreadPool_set_default_threads(0);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_buffers_alive_together_should_not_overlap);
+    RUN_TEST(test_buffers_should_have_the_shapes_of_the_pass);
+    RUN_TEST(test_decoder_result_should_not_depend_on_the_plan);
+    RUN_TEST(test_steady_state_decoding_should_not_allocate);
+    RUN_TEST(test_steady_state_model_passes_should_not_allocate);
+    return UNITY_END();
+}